@@ -35,9 +35,14 @@ INCLUDE := \
     $(CONFIG_SRCDIR) \
 
 SOURCES := \
+    fs/epoll.cpp \
+    fs/eventfd.cpp \
     fs/mount.cpp \
     fs/pipe.cpp \
+    fs/poll.cpp \
+    fs/splice.cpp \
     fs/syscalls.cpp \
+    fs/timerfd.cpp \
     fs/util/dirbuf_add.cpp \
     fs/vfs.cpp \
     fs/vnode.cpp \
@@ -75,6 +80,11 @@ SOURCES := \
     sync/semaphore.cpp \
     sync/spinlock.cpp \
 
+# Interrupt latency tracing
+ifneq ($(origin CONFIG_IRQ_TRACE),undefined)
+SOURCES += kern/irq_trace.cpp
+endif
+
 # Generic memory translation support
 ifneq ($(origin CONFIG_MMU),undefined)
 SOURCES += mem/translated.cpp
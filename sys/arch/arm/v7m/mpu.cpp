@@ -6,6 +6,8 @@
 #include <debug.h>
 #include <irq.h>
 #include <kernel.h>
+#include <lib/region_cache.h>
+#include <lib/time_page.h>
 #include <sections.h>
 #include <seg.h>
 #include <sig.h>
@@ -13,30 +15,118 @@
 #include <sys/param.h>
 #include <task.h>
 #include <thread.h>
+#include <timer.h>
 
 /* Tell gcc not to use FPU registers */
 #if defined(__arm__) && defined(__GNUC__) && !defined(__clang__)
 #pragma GCC target("general-regs-only")
 #endif
 
+namespace {
+
+/*
+ * Dynamic region
+ */
+struct region {
+	uintptr_t base;		/* base address */
+	mpu::rasr rasr;		/* attributes & size */
+
+	bool overlaps(const void *addr, size_t len) const
+	{
+		const uintptr_t a = (uintptr_t)addr;
+		return base < a + len && a < base + (2UL << rasr.SIZE);
+	}
+};
+
+/*
+ * Number of address spaces with saved working sets
+ */
+constexpr size_t cached_spaces = 8;
+
+__fast_bss const void *stack_begin;	    /* mapped stack segment */
+__fast_bss const void *stack_end;
+__fast_bss const as *mapped_as;		    /* currently mapped as */
+__fast_bss bool restore_pending;	    /* working set not yet restored */
+__fast_bss mpu_stats stats;
+/* RBAR.REGION supports 0 to 15 */
+__fast_bss region_cache<region, 16, cached_spaces> cache;
+
+}
+
 __fast_bss size_t fixed;		    /* number of fixed regions */
 __fast_bss size_t stack;		    /* number of stack regions */
-__fast_bss size_t victim;		    /* next victim to evict */
 __fast_bss const void *fault_addr;	    /* last fault address */
 __fast_bss const thread *mapped_thread;	    /* currently mapped thread */
 
+__fast_text static void
+disable_region(size_t i)
+{
+	write32(&MPU->RNR, i);
+	write32(&MPU->RASR, {});
+}
+
+__fast_text static void
+load_region(size_t i, const region &r)
+{
+	write32(&MPU->RNR, i);
+	write32(&MPU->RASR, {});
+	write32(&MPU->RBAR, {.ADDR = r.base >> 5});
+	write32(&MPU->RASR, r.rasr);
+}
+
 static void
 clear_dynamic()
 {
 	stack = 0;
 	mapped_thread = nullptr;
 	fault_addr = 0;
+	cache.unload_all();
 
 	const size_t regions = read32(&MPU->TYPE).DREGION;
-	for (size_t i = fixed; i < regions; ++i) {
-		write32(&MPU->RNR, i);
-		write32(&MPU->RASR, {});
+	for (size_t i = fixed; i < regions; ++i)
+		disable_region(i);
+}
+
+/*
+ * switch_as - save working set of mapped address space and switch to a
+ */
+__fast_text static void
+switch_as(const as *a)
+{
+	if (mapped_as && !restore_pending)
+		cache.save(mapped_as, fixed + stack);
+	clear_dynamic();
+	mapped_as = a;
+	restore_pending = true;
+	++stats.switches;
+}
+
+/*
+ * invalidate - remove regions overlapping address range in address space a
+ */
+static void
+invalidate(const as *a, const void *addr, size_t len)
+{
+	auto overlaps = [&](const region &r) {
+		return r.overlaps(addr, len);
+	};
+
+	const int s = irq_disable();
+	/* the address space may have been saved before it was last mapped */
+	cache.forget_if(a, overlaps);
+	if (a == mapped_as) {
+		/* stack is remapped on return to userspace */
+		if (stack && (const std::byte *)stack_begin <
+		    (const std::byte *)addr + len && addr < stack_end) {
+			for (size_t i = fixed; i < fixed + stack; ++i)
+				disable_region(i);
+			stack = 0;
+			mapped_thread = nullptr;
+		}
+		cache.unload_if(fixed + stack, overlaps, disable_region);
+		fault_addr = 0;
 	}
+	irq_restore(s);
 }
 
 static void
@@ -91,13 +181,23 @@ mpu_init(const mmumap *map, size_t count, int flags)
 		panic("MPU not implemented");
 	if (regions > 16)
 		panic("MPU not supported"); /* RBAR.REGION supports 0 to 15 */
-	if (count >= regions - 2)
+	if (count + 1 >= regions - 2)
 		panic("invalid");
 
 	/* all regions must be initialised before enabling */
 	for (size_t i = 0; i < count; ++i)
 		static_region(map + i, i);
-	fixed = victim = count;
+
+	/* time page is readable by all address spaces */
+	const mmumap tp{
+		.paddr = virt_to_phys(timer_time_page()),
+		.size = TIME_PAGE_SIZE,
+		.flags = RASR_USER_R_WBWA.r,
+	};
+	static_region(&tp, count);
+
+	fixed = count + 1;
+	cache.init(regions);
 	clear_dynamic();
 
 	write32(&MPU->CTRL, [&]{
@@ -114,11 +214,12 @@ mpu_init(const mmumap *map, size_t count, int flags)
  * mpu_switch - switch mpu to new address space
  */
 void
-mpu_switch(const as *as)
+mpu_switch(const as *a)
 {
+	/* working set is restored on return to userspace */
 	const int s = irq_disable();
-	clear_dynamic();
-	mpu_user_thread_switch();
+	if (a != mapped_as)
+		switch_as(a);
 	irq_restore(s);
 }
 
@@ -134,8 +235,8 @@ mpu_user_thread_switch()
 
 	if (t == mapped_thread)
 		return;
-	if (mapped_thread && mapped_thread->task != t->task)
-		mpu_switch(t->task->as);
+	if (t->task->as != mapped_as)
+		switch_as(t->task->as);
 
 	/* zombies have no ustack */
 	if (!t->ctx.usp)
@@ -149,20 +250,22 @@ mpu_user_thread_switch()
 		sig_thread(t, SIGSEGV);
 		return;
 	} else seg = r.val();
+	for (size_t i = fixed; i < fixed + stack; ++i)
+		disable_region(i);
 	stack = 0;
+	stack_begin = seg_begin(seg);
+	stack_end = seg_end(seg);
 	const auto rasr_prot = prot_to_rasr(seg_prot(seg));
 	for (std::byte *a = (std::byte *)seg_begin(seg); a < seg_end(seg);) {
 		const size_t size = (std::byte *)seg_end(seg) - a;
 		size_t o = MIN(std::countr_zero((uintptr_t)a), floor_log2(size));
-		write32(&MPU->RNR, fixed + stack);
-		write32(&MPU->RASR, {});
-		write32(&MPU->RBAR, {.ADDR = (uintptr_t)a >> 5});
-		write32(&MPU->RASR, [&] {
+		cache.unload(fixed + stack);
+		load_region(fixed + stack, {(uintptr_t)a, [&] {
 			mpu::rasr r{rasr_prot};
 			r.ENABLE = 1;
 			r.SIZE = o - 1;
 			return r;
-		}());
+		}()});
 		a += 1 << o;
 		++stack;
 
@@ -174,8 +277,13 @@ mpu_user_thread_switch()
 
 	fault_addr = 0;
 	mapped_thread = t;
-	if (victim < fixed + stack)
-		victim = fixed + stack;
+
+	/* reload working set saved when address space was switched out */
+	if (restore_pending) {
+		stats.restores += cache.restore(mapped_as, fixed + stack,
+		    load_region);
+		restore_pending = false;
+	}
 }
 
 /*
@@ -185,43 +293,40 @@ void
 mpu_thread_terminate(thread *th)
 {
 	const int s = irq_disable();
-	if (th == mapped_thread)
-		clear_dynamic();
+	if (th == mapped_thread) {
+		for (size_t i = fixed; i < fixed + stack; ++i)
+			disable_region(i);
+		stack = 0;
+		mapped_thread = nullptr;
+	}
 	irq_restore(s);
 }
 
 /*
- * mpu_unmap - unmap region from currently active address space
+ * mpu_unmap - unmap region from address space
  */
 void
-mpu_unmap(const void *addr, size_t len)
+mpu_unmap(const as *a, const void *addr, size_t len)
 {
-	const int s = irq_disable();
-	clear_dynamic();
-	mpu_user_thread_switch();
-	irq_restore(s);
+	invalidate(a, addr, len);
 }
 
 /*
- * mpu_map - map region into currently active address space
+ * mpu_map - map region into address space
  */
 void
-mpu_map(const void *addr, size_t len, int prot)
+mpu_map(const as *a, const void *addr, size_t len, int prot)
 {
 	/* nothing to do, rely on fault handler */
 }
 
 /*
- * mpu_protect - change protection flags on address range in currently active
- *		 address space
+ * mpu_protect - change protection flags on address range in address space
  */
 void
-mpu_protect(const void *addr, size_t len, int prot)
+mpu_protect(const as *a, const void *addr, size_t len, int prot)
 {
-	const int s = irq_disable();
-	clear_dynamic();
-	mpu_user_thread_switch();
-	irq_restore(s);
+	invalidate(a, addr, len);
 }
 
 /*
@@ -247,20 +352,18 @@ again:;
 	    floor_log2((uintptr_t)addr ^ (uintptr_t)seg_end(seg)),
 	    floor_log2((-(uintptr_t)addr - 1) ^ -(uintptr_t)seg_begin(seg)));
 
-	/* configure MPU */
+	/* replace least recently loaded region */
 	const uintptr_t region_base = (uintptr_t)addr & -(1UL << order);
-	write32(&MPU->RNR, victim);
-	write32(&MPU->RASR, {});
-	write32(&MPU->RBAR, {.ADDR = region_base >> 5});
-	write32(&MPU->RASR, [&] {
+	const region r{region_base, [&] {
 		mpu::rasr r{prot_to_rasr(seg_prot(seg))};
 		r.ENABLE = 1;
 		r.SIZE = order - 1;
 		return r;
-	}());
-
-	if (++victim == read32(&MPU->TYPE).DREGION)
-		victim = fixed + stack;
+	}()};
+	const size_t victim = cache.victim(fixed + stack);
+	load_region(victim, r);
+	cache.load(victim, r);
+	++stats.faults;
 
 	/* multiple mappings if access crosses mapping boundary */
 	if (len) {
@@ -273,6 +376,17 @@ again:;
 	}
 }
 
+/*
+ * mpu_get_stats - get mpu statistics
+ */
+void
+mpu_get_stats(mpu_stats *st)
+{
+	const int s = irq_disable();
+	*st = stats;
+	irq_restore(s);
+}
+
 /*
  * mpu_dump - dump mpu state
  */
@@ -281,8 +395,9 @@ mpu_dump()
 {
 #if defined(CONFIG_DEBUG)
 	dbg("*** MPU dump ***\n");
-	dbg("fixed:%x stack:%x victim:%x fault_addr:%8p\n",
-	    fixed, stack, victim, fault_addr);
+	dbg("fixed:%x stack:%x fault_addr:%8p\n", fixed, stack, fault_addr);
+	dbg("faults:%lu switches:%lu restores:%lu\n",
+	    stats.faults, stats.switches, stats.restores);
 
 	const mpu::type type = read32(&MPU->TYPE);
 	dbg("MPU_TYPE %08x: SEPARATE:%d IREGION:%d DREGION:%d\n",
@@ -7,6 +7,7 @@
 #include <intrinsics.h>
 #include <irq.h>
 #include <kernel.h>
+#include <lib/time_page.h>
 #include <locore.h>
 #include <sections.h>
 #include <seg.h>
@@ -14,12 +15,14 @@
 #include <sys/mman.h>
 #include <task.h>
 #include <thread.h>
+#include <timer.h>
 
 namespace {
 
 __fast_bss size_t victim;		    /* next victim to evict */
 __fast_bss const thread *mapped_thread;	    /* currently mapped thread */
 __fast_bss const void *fault_addr;	    /* last fault address */
+__fast_bss mpu_stats stats;
 
 void
 clear()
@@ -268,6 +271,34 @@ map_range_napot(uintptr_t base, size_t order, int prot)
 }
 #endif
 
+/*
+ * map_shared - map time page or time page counter containing access
+ *
+ * These regions are readable by all address spaces.
+ */
+bool
+map_shared(const void *addr, size_t len)
+{
+	const time_page *tp = timer_time_page();
+	auto map = [&](const void *p) {
+		const uintptr_t base = (uintptr_t)p & -TIME_PAGE_SIZE;
+		if ((uintptr_t)addr < base ||
+		    (uintptr_t)addr + len > base + TIME_PAGE_SIZE)
+			return false;
+#ifndef CONFIG_PMP_MISSING_TOR
+		map_range_tor((void *)base, (void *)(base + TIME_PAGE_SIZE),
+		    PROT_READ);
+#else
+		map_range_napot(base, floor_log2(TIME_PAGE_SIZE), PROT_READ);
+#endif
+		return true;
+	};
+
+	if (map(tp))
+		return true;
+	return tp->flags & TIME_PAGE_COUNTER && map((const void *)tp->counter);
+}
+
 }
 
 /*
@@ -284,6 +315,8 @@ mpu_init(const mmumap*, size_t, int)
 
 	if (gran > PAGE_SIZE)
 		panic("PMP granularity is larger than page size");
+	if (gran > TIME_PAGE_SIZE)
+		panic("PMP granularity is larger than time page");
 
 	dbg("PMP initialised, %u byte granularity\n", gran);
 }
@@ -297,15 +330,19 @@ mpu_switch(const as *)
 	/* clear all regions, fault handler will map in as required */
 	const int s = irq_disable();
 	clear();
+	++stats.switches;
 	irq_restore(s);
 }
 
 /*
- * mpu_unmap - unmap region from currently active address space
+ * mpu_unmap - unmap region from address space
  */
 void
-mpu_unmap(const void *, size_t)
+mpu_unmap(const as *a, const void *, size_t)
 {
+	if (a != task_cur()->as)
+		return;
+
 	/* clear all regions, fault handler will map in as required */
 	const int s = irq_disable();
 	clear();
@@ -313,21 +350,23 @@ mpu_unmap(const void *, size_t)
 }
 
 /*
- * mpu_map - map region into currently active address space
+ * mpu_map - map region into address space
  */
 void
-mpu_map(const void *, size_t, int)
+mpu_map(const as *, const void *, size_t, int)
 {
 	/* fault handler will map in as required */
 }
 
 /*
- * mpu_protect - change protection flags on address range in currently active
- *		 address space
+ * mpu_protect - change protection flags on address range in address space
  */
 void
-mpu_protect(const void *, size_t, int)
+mpu_protect(const as *a, const void *, size_t, int)
 {
+	if (a != task_cur()->as)
+		return;
+
 	/* clear all regions, fault handler will map in as required */
 	const int s = irq_disable();
 	clear();
@@ -343,6 +382,10 @@ mpu_fault(const void *addr, size_t len)
 {
 	/* double fault at the same address means that last time we faulted in
 	   a region the access still didn't satisfy the PMP permissions */
+	if (addr != fault_addr && map_shared(addr, len)) {
+		fault_addr = addr;
+		return;
+	}
 	const seg *seg;
 	if (auto r = as_find_seg(task_cur()->as, addr);
 	   !r.ok() || seg_prot(r.val()) == PROT_NONE || addr == fault_addr ||
@@ -351,6 +394,7 @@ mpu_fault(const void *addr, size_t len)
 		return;
 	} else seg = r.val();
 	fault_addr = addr;
+	++stats.faults;
 
 #ifndef CONFIG_PMP_MISSING_TOR
 	map_range_tor(seg_begin(seg), seg_end(seg), seg_prot(seg));
@@ -364,6 +408,17 @@ mpu_fault(const void *addr, size_t len)
 #endif
 }
 
+/*
+ * mpu_get_stats - get mpu statistics
+ */
+void
+mpu_get_stats(mpu_stats *st)
+{
+	const int s = irq_disable();
+	*st = stats;
+	irq_restore(s);
+}
+
 /*
  * mpu_dump - dump mpu state
  */
@@ -381,6 +436,7 @@ mpu_dump()
 
 	dbg("*** MPU dump ***\n");
 	dbg("victim:%x fault_addr:%8p\n", victim, fault_addr);
+	dbg("faults:%lu switches:%lu\n", stats.faults, stats.switches);
 	print(0, csrr<pmpcfg0>().pmp0cfg, csrr<pmpaddr0>().r);
 	print(1, csrr<pmpcfg0>().pmp1cfg, csrr<pmpaddr1>().r);
 	print(2, csrr<pmpcfg0>().pmp2cfg, csrr<pmpaddr2>().r);
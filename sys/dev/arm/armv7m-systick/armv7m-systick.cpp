@@ -9,6 +9,10 @@
 #include <timer.h>
 #include <v7m/bitfield.h>
 
+#if defined(CONFIG_TICKLESS)
+#error SysTick cannot keep exact time while reprogrammed, CONFIG_TICKLESS is not supported
+#endif
+
 namespace {
 
 /*
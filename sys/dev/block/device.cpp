@@ -9,6 +9,7 @@
 #include <kernel.h>
 #include <linux/fs.h>
 #include <sys/uio.h>
+#include <thread.h>
 #include <timer.h>
 
 namespace {
@@ -43,14 +44,30 @@ block_ioctl(file *f, unsigned long c, void *a)
 	return static_cast<block::device *>(f->f_data)->ioctl(c, a);
 }
 
+int
+block_fsync(file *f)
+{
+	return static_cast<block::device *>(f->f_data)->fsync();
+}
+
 constinit devio block_io{
 	.open = block_open,
 	.close = block_close,
 	.read = block_read,
 	.write = block_write,
 	.ioctl = block_ioctl,
+	.fsync = block_fsync,
 };
 
+/*
+ * Write back queue, ordered by due time
+ */
+a::spinlock writeback_lock;
+list writeback_queue = LIST_INIT(writeback_queue);
+a::semaphore writeback_sem;
+block::device *writeback_active;
+bool writeback_started;
+
 }
 
 namespace block {
@@ -62,7 +79,21 @@ device::device(::device *dev, off_t size)
 : dev_{dev}
 , nopens_{0}
 , size_{size}
+, wb_{.dev = this, .queued = false}
+, wb_error_{0}
+, dispatching_{false}
 {
+	queue_.init(merge_max_iov, merge_max_len);
+
+	/* start write back thread with first block device */
+	writeback_lock.lock();
+	const bool start = !writeback_started;
+	writeback_started = true;
+	writeback_lock.unlock();
+	if (start && !kthread_create(&writeback_thread, nullptr, PRI_KERN_LOW,
+	    "blk_writeback", MA_NORMAL))
+		panic("OOM");
+
 	device_attach(dev_, &block_io, DF_BLK, this);
 }
 
@@ -78,12 +109,22 @@ device::~device()
 	while (device_busy(dev_))
 		timer_delay(10e6);
 
+	/* wait for write back thread to finish with device */
+	writeback_lock.lock();
+	assert(!wb_.queued);
+	while (writeback_active == this) {
+		writeback_lock.unlock();
+		timer_delay(10e6);
+		writeback_lock.lock();
+	}
+	writeback_lock.unlock();
+
 	/* destroy device */
 	device_destroy(dev_);
 }
 
 /*
- * device::open - open block device and allocate block buffer
+ * device::open - open block device and allocate buffer cache
  */
 int
 device::open()
@@ -94,19 +135,31 @@ device::open()
 
 	if (nopens_++)
 		return 0;
-	page_ptr buf = page_alloc(PAGE_SIZE, MA_NORMAL | MA_DMA, this);
-	if (!buf)
-		return DERR(-ENOMEM);
-	if (auto r = v_open(); r < 0)
+	for (size_t i = 0; i < cache_pages; ++i) {
+		pages_[i] = page_alloc(PAGE_SIZE, MA_NORMAL | MA_DMA, this);
+		if (!pages_[i]) {
+			for (auto &p : pages_)
+				p.reset();
+			--nopens_;
+			return DERR(-ENOMEM);
+		}
+		bufs_[i].data = phys_to_virt(pages_[i]);
+	}
+	if (auto r = v_open(); r < 0) {
+		for (auto &p : pages_)
+			p.reset();
+		--nopens_;
 		return r;
-	buf_ = std::move(buf);
-	off_ = std::numeric_limits<off_t>::max();
-	dirty_ = false;
+	}
+	cache_.init(bufs_.data(), cache_pages, PAGE_SIZE);
+	ra_next_ = -1;
+	ra_pages_ = 0;
+	wb_error_ = 0;
 	return 0;
 }
 
 /*
- * device::close - close block device and free block buffer
+ * device::close - close block device and free buffer cache
  */
 int
 device::close()
@@ -119,8 +172,9 @@ device::close()
 
 	if (--nopens_)
 		return 0;
-	sync();
-	buf_.reset();
+	flush();
+	for (auto &p : pages_)
+		p.reset();
 	return v_close();
 }
 
@@ -173,11 +227,13 @@ device::ioctl(unsigned long cmd, void *arg)
 		/* discard data, no read guarantees */
 		if (!valid_range())
 			return DERR(-EINVAL);
+		invalidate(arg64[0], arg64[1]);
 		return v_discard(arg64[0], arg64[1], cmd == BLKSECDISCARD);
 	case BLKZEROOUT: {
 		/* discard data, guarantee read will return zeros */
 		if (!valid_range())
 			return DERR(-EINVAL);
+		invalidate(arg64[0], arg64[1]);
 		if (auto r = v_zeroout(arg64[0], arg64[1]); r != -ENOTSUP)
 			return r;
 
@@ -226,16 +282,28 @@ device::ioctl(unsigned long cmd, void *arg)
 			return -EINVAL;
 		*arg64 = size_;
 		return 0;
+	case BLKFLSBUF: {
+		/* write back dirty pages and empty buffer cache */
+		auto r = flush();
+		invalidate(0, size_);
+		if (r == 0) {
+			r = wb_error_;
+			wb_error_ = 0;
+		}
+		return r;
+	}
 	}
 
 	return v_ioctl(cmd, arg);
 }
 
 /*
- * device::transfer - transfer data to/from block device
+ * device::fsync - write back dirty pages
+ *
+ * Reports the first write back error since the last fsync or BLKFLSBUF.
  */
 int
-device::transfer(const iovec *iov, size_t count, off_t off, bool write)
+device::fsync()
 {
 	interruptible_lock l{mutex_};
 	if (auto r{l.lock()}; r < 0)
@@ -243,6 +311,30 @@ device::transfer(const iovec *iov, size_t count, off_t off, bool write)
 
 	assert(nopens_ > 0);
 
+	auto r = flush();
+	if (r == 0)
+		r = wb_error_;
+	wb_error_ = 0;
+	return r;
+}
+
+/*
+ * device::transfer - transfer data to/from block device
+ *
+ * Partial pages and pages which are already cached are transferred through
+ * the buffer cache. Runs of uncached whole pages are transferred directly
+ * unless they are short enough to benefit from read ahead. Direct reads
+ * release the device lock while in flight.
+ */
+ssize_t
+device::transfer(const iovec *iov, size_t count, off_t off, bool write)
+{
+	if (auto r = mutex_.interruptible_lock(); r < 0)
+		return r;
+	std::unique_lock l{mutex_, std::adopt_lock};
+
+	assert(nopens_ > 0);
+
 	if (!count)
 		return 0;
 	if (off >= size_)
@@ -256,45 +348,70 @@ device::transfer(const iovec *iov, size_t count, off_t off, bool write)
 		return l;
 	}());
 
-	std::byte *buf = static_cast<std::byte *>(phys_to_virt(buf_));
 	size_t iov_off = 0;
 	size_t t = 0;
 
-	/* clean write buffer if reading */
-	if (!write)
-		sync();
+	/* copy between iov and cached page */
+	auto copy = [&](buffer *b, size_t boff, size_t n) {
+		std::byte *d = static_cast<std::byte *>(b->data) + boff;
+		while (n) {
+			std::byte *p = static_cast<std::byte *>(iov->iov_base);
+			auto cp = std::min(n, iov->iov_len - iov_off);
+			if (write)
+				memcpy(d, p + iov_off, cp);
+			else
+				memcpy(p + iov_off, d, cp);
+			d += cp;
+			n -= cp;
+			t += cp;
+			iov_off += cp;
+			if (iov_off == iov->iov_len) {
+				++iov;
+				iov_off = 0;
+			}
+		}
+		if (write)
+			mark_dirty(b);
+	};
 
 	/* align start of transfer to page boundary */
 	if (const size_t align = PAGE_OFF(off); align) {
-		if (auto r = fill(off); r < 0)
+		buffer *b;
+		if (auto r = get(off, !write, &b); r < 0)
 			return r;
-		const auto fix = std::min(PAGE_SIZE - align, len);
-		while (t < fix) {
-			auto cp = std::min(fix - t, iov->iov_len);
-			auto bufloc = buf + align + t;
-			if (write) {
-				memcpy(bufloc, iov->iov_base, cp);
-				dirty_ = true;
-			} else memcpy(iov->iov_base, bufloc, cp);
-			t += cp;
-			if (cp >= iov->iov_len)
-				++iov;
-			else
-				iov_off = cp;
-		}
+		copy(b, align, std::min(PAGE_SIZE - align, len));
 	}
 
-	/* transfer whole pages directly from block device */
+	/* transfer whole pages */
 	while (len - t >= PAGE_SIZE) {
-		auto r = write
-		    ? v_write(iov, iov_off, PAGE_TRUNC(len - t), off + t)
-		    : v_read(iov, iov_off, PAGE_TRUNC(len - t), off + t);
+		const off_t o = off + t;
+		const size_t pages = (len - t) / PAGE_SIZE;
+		size_t run = 0;
+		while (run < pages && !cache_.lookup(o + run * PAGE_SIZE))
+			++run;
+
+		if (!run || (!write && run < readahead_max)) {
+			buffer *b;
+			if (auto r = get(o, !write, &b); r < 0)
+				return r;
+			copy(b, 0, PAGE_SIZE);
+			continue;
+		}
+
+		/* cache is not involved in a read, allow other i/o while
+		 * waiting. writes keep the lock so that the range can't be
+		 * cached, and possibly dirtied, before the write completes */
+		if (!write)
+			l.unlock();
+		auto r = submit(write, iov, iov_off, run * PAGE_SIZE, o);
+		if (!write)
+			l.lock();
 		if (r < 0)
 			return r;
 		assert(!PAGE_OFF(r));
 		t += r;
 		iov_off += r;
-		while (iov_off >= iov->iov_len) {
+		while (iov_off && iov_off >= iov->iov_len) {
 			iov_off -= iov->iov_len;
 			++iov;
 		}
@@ -302,64 +419,287 @@ device::transfer(const iovec *iov, size_t count, off_t off, bool write)
 
 	/* final partial page */
 	if (t < len) {
-		if (auto r = fill(off + t); r < 0)
+		buffer *b;
+		if (auto r = get(off + t, !write, &b); r < 0)
 			return r;
-		while (t < len) {
-			std::byte *p = static_cast<std::byte *>(iov->iov_base);
-			auto cp = std::min(len - t, iov->iov_len - iov_off);
-			auto bufloc = buf + PAGE_OFF(off + t);
-			if (write) {
-				memcpy(bufloc, p + iov_off, cp);
-				dirty_ = true;
-			} else memcpy(p + iov_off, bufloc, cp);
-			t += cp;
-			++iov;
-			iov_off = 0;
-		}
+		copy(b, 0, len - t);
 	}
 
 	return t;
 }
 
 /*
- * device::fill - fill block buffer
+ * device::submit - queue request and wait for it to complete
  *
- * 'off' is aligned to the nearest page boundary.
+ * Requests are merged with adjacent queued requests and dispatched by the
+ * waiting threads themselves. The first waiter to find the device idle
+ * dispatches the next batch, which may include requests from other threads,
+ * and keeps dispatching until its own request completes. No thread waits for
+ * i/o which does not precede or include its own request.
+ */
+ssize_t
+device::submit(bool write, const iovec *iov, size_t iov_off, size_t len,
+    off_t off)
+{
+	struct result {
+		ssize_t r;
+		bool done;
+	} res{0, false};
+
+	block_request rq{
+		.write = write,
+		.off = off,
+		.len = len,
+		.iov = iov,
+		.iov_off = iov_off,
+		.done = [](block_request *rq, ssize_t r) {
+			auto res = static_cast<result *>(rq->arg);
+			res->r = r;
+			res->done = true;
+		},
+		.arg = &res,
+	};
+
+	std::unique_lock l{queue_mutex_};
+	queue_.insert(&rq);
+	while (true) {
+		queue_cv_.wait(l, [&]{ return res.done || !dispatching_; });
+		if (res.done)
+			return res.r;
+
+		/* dispatch next batch */
+		dispatching_ = true;
+		block_queue::batch b;
+		queue_.dispatch(b);
+		l.unlock();
+
+		ssize_t r;
+		if (b.nreqs == 1) {
+			const block_request *only = list_entry(
+			    list_first(&b.reqs), block_request, link);
+			r = b.write
+			    ? v_write(only->iov, only->iov_off, b.len, b.off)
+			    : v_read(only->iov, only->iov_off, b.len, b.off);
+		} else {
+			iovec v[merge_max_iov];
+			block_queue::gather(b, v);
+			r = b.write
+			    ? v_write(v, 0, b.len, b.off)
+			    : v_read(v, 0, b.len, b.off);
+		}
+
+		l.lock();
+		block_queue::complete(b, r);
+		dispatching_ = false;
+		queue_cv_.notify_all();
+	}
+}
+
+/*
+ * device::get - get cached page containing 'off', reading it if required
+ *
+ * If 'ra' is set and the read continues from where the last read finished
+ * the following pages are read in the same request. The read ahead window
+ * doubles for each sequential miss up to half of the cache.
  */
 int
-device::fill(off_t off)
+device::get(off_t off, bool ra, buffer **bp)
 {
 	mutex_.assert_locked();
 
-	off &= ~PAGE_MASK;
-	if (off_ == off)
+	off -= PAGE_OFF(off);
+	const bool sequential = ra && off == ra_next_;
+	if (ra)
+		ra_next_ = off + PAGE_SIZE;
+
+	if (buffer *b = cache_.lookup(off); b) {
+		cache_.touch(b);
+		*bp = b;
 		return 0;
-	if (auto r = sync(); r < 0)
-		return r;
-	iovec iov{phys_to_virt(buf_), PAGE_SIZE};
-	if (auto r = v_read(&iov, 0, PAGE_SIZE, off); r != PAGE_SIZE) {
-		off_ = std::numeric_limits<off_t>::max();
+	}
+
+	if (!sequential)
+		ra_pages_ = 0;
+	else
+		ra_pages_ = std::clamp<size_t>(ra_pages_ * 2, 1, readahead_max);
+
+	/* assign buffers for requested page and read ahead window */
+	iovec iov[readahead_max + 1];
+	size_t n = 0;
+	while (n <= ra_pages_) {
+		const off_t o = off + n * PAGE_SIZE;
+		if (o >= size_ || (n && cache_.lookup(o)))
+			break;
+		buffer *b = cache_.victim();
+		if (n && b->off >= off && b->off < o)
+			break;
+		if (b->dirty) {
+			if (auto r = writeback(b); r < 0) {
+				while (n)
+					cache_.invalidate(cache_.lookup(off +
+					    --n * PAGE_SIZE));
+				return r;
+			}
+		}
+		cache_.assign(b, o);
+		iov[n++] = {b->data, PAGE_SIZE};
+	}
+
+	if (auto r = submit(false, iov, 0, n * PAGE_SIZE, off);
+	    r != static_cast<ssize_t>(n * PAGE_SIZE)) {
+		while (n)
+			cache_.invalidate(cache_.lookup(off + --n * PAGE_SIZE));
 		return r < 0 ? r : DERR(-EIO);
 	}
-	off_ = off;
+
+	/* requested page is most recently used */
+	*bp = cache_.lookup(off);
+	cache_.touch(*bp);
 	return 0;
 }
 
 /*
- * device::sync - synchronise block buffer with device
+ * device::mark_dirty - mark page dirty and queue device for write back
  */
-int
-device::sync()
+void
+device::mark_dirty(buffer *b)
 {
 	mutex_.assert_locked();
 
-	if (!dirty_)
-		return 0;
-	iovec iov{phys_to_virt(buf_), PAGE_SIZE};
-	if (auto r = v_write(&iov, 0, PAGE_SIZE, off_); r != PAGE_SIZE)
+	cache_.set_dirty(b, true);
+
+	writeback_lock.lock();
+	const bool queue = !wb_.queued;
+	if (queue) {
+		wb_.due = timer_monotonic() +
+		    CONFIG_BLOCK_WRITEBACK_MS * UINT64_C(1000000);
+		wb_.queued = true;
+		list_insert(list_last(&writeback_queue), &wb_.link);
+	}
+	writeback_lock.unlock();
+	if (queue)
+		writeback_sem.post_once();
+}
+
+/*
+ * device::writeback - write back run of dirty pages starting at 'b'
+ *
+ * Pages which fail to write back are discarded.
+ */
+int
+device::writeback(buffer *b)
+{
+	mutex_.assert_locked();
+	assert(b->dirty);
+
+	iovec iov[cache_pages];
+	size_t n = 0;
+	const off_t off = b->off;
+	for (; b && b->dirty; b = cache_.lookup(off + n * PAGE_SIZE))
+		iov[n++] = {b->data, PAGE_SIZE};
+
+	auto r = submit(true, iov, 0, n * PAGE_SIZE, off);
+	const bool ok = r == static_cast<ssize_t>(n * PAGE_SIZE);
+	for (size_t i = 0; i < n; ++i) {
+		buffer *w = cache_.lookup(off + i * PAGE_SIZE);
+		if (ok)
+			cache_.set_dirty(w, false);
+		else
+			cache_.invalidate(w);
+	}
+	if (!ok)
 		return r < 0 ? r : DERR(-EIO);
-	dirty_ = false;
 	return 0;
 }
 
+/*
+ * device::flush - write back all dirty pages
+ *
+ * Dirty pages are written back in device offset order with adjacent pages
+ * merged into a single request.
+ */
+int
+device::flush()
+{
+	mutex_.assert_locked();
+
+	int err = 0;
+	while (cache_.dirty()) {
+		buffer *first = nullptr;
+		cache_.for_each([&](buffer *b) {
+			if (b->dirty && (!first || b->off < first->off))
+				first = b;
+		});
+		if (auto r = writeback(first); r < 0 && !err)
+			err = r;
+	}
+
+	/* nothing left to write back */
+	writeback_lock.lock();
+	if (wb_.queued) {
+		list_remove(&wb_.link);
+		wb_.queued = false;
+	}
+	writeback_lock.unlock();
+
+	return err;
+}
+
+/*
+ * device::invalidate - discard cached pages in range
+ */
+void
+device::invalidate(off_t off, uint64_t len)
+{
+	mutex_.assert_locked();
+
+	cache_.for_each([&](buffer *b) {
+		if (b->off >= off && static_cast<uint64_t>(b->off - off) < len)
+			cache_.invalidate(b);
+	});
+}
+
+/*
+ * device::writeback_thread - write back dirty pages after a delay
+ *
+ * Devices are queued for write back when a clean page is first dirtied and
+ * are written back in full once CONFIG_BLOCK_WRITEBACK_MS has elapsed. Write
+ * back errors are reported by the next fsync or BLKFLSBUF.
+ */
+void
+device::writeback_thread(void *)
+{
+	while (true) {
+		writeback_sem.wait_interruptible();
+
+		writeback_lock.lock();
+		while (!list_empty(&writeback_queue)) {
+			writeback_entry *e = list_entry(
+			    list_first(&writeback_queue), writeback_entry, link);
+			const auto now = timer_monotonic();
+			if (e->due > now) {
+				const auto delay = e->due - now;
+				writeback_lock.unlock();
+				timer_delay(delay);
+				writeback_lock.lock();
+				continue;
+			}
+			list_remove(&e->link);
+			e->queued = false;
+			writeback_active = e->dev;
+			writeback_lock.unlock();
+
+			device *d = e->dev;
+			d->mutex_.lock();
+			if (auto r = d->flush(); r < 0 && !d->wb_error_)
+				d->wb_error_ = r;
+			d->mutex_.unlock();
+
+			writeback_lock.lock();
+			writeback_active = nullptr;
+		}
+		writeback_lock.unlock();
+	}
+}
+
 }
@@ -4,10 +4,28 @@
  * Generic Block Device
  */
 
+#include <array>
+#include <conf/config.h>
+#include <lib/block_queue.h>
+#include <lib/buffer_cache.h>
 #include <memory>
 #include <page.h>
 #include <sync.h>
 
+/*
+ * Number of pages cached per block device
+ */
+#if !defined(CONFIG_BLOCK_CACHE_PAGES)
+#define CONFIG_BLOCK_CACHE_PAGES 8
+#endif
+
+/*
+ * Maximum time dirty pages are held before being written back
+ */
+#if !defined(CONFIG_BLOCK_WRITEBACK_MS)
+#define CONFIG_BLOCK_WRITEBACK_MS 1000
+#endif
+
 struct device;
 struct iovec;
 
@@ -23,8 +41,14 @@ public:
 	ssize_t read(const iovec *, size_t, off_t);
 	ssize_t write(const iovec *, size_t, off_t);
 	int ioctl(unsigned long, void *);
+	int fsync();
 
 private:
+	static constexpr size_t cache_pages = CONFIG_BLOCK_CACHE_PAGES;
+	static constexpr size_t readahead_max = cache_pages / 2;
+	static constexpr size_t merge_max_iov = 32;
+	static constexpr size_t merge_max_len = 128 * 1024;
+
 	virtual int v_open() = 0;
 	virtual int v_close() = 0;
 	virtual ssize_t v_read(const iovec *, size_t, size_t, off_t) = 0;
@@ -35,16 +59,40 @@ private:
 	virtual bool v_discard_sets_to_zero() = 0;
 
 	ssize_t transfer(const iovec *, size_t, off_t, bool);
-	int fill(off_t);
-	int sync();
+	ssize_t submit(bool, const iovec *, size_t, size_t, off_t);
+	int get(off_t, bool, buffer **);
+	void mark_dirty(buffer *);
+	int writeback(buffer *);
+	int flush();
+	void invalidate(off_t, uint64_t);
+
+	static void writeback_thread(void *);
+
+	/*
+	 * Linkage on write back queue
+	 */
+	struct writeback_entry {
+		list link;
+		device *dev;
+		uint_fast64_t due;
+		bool queued;
+	};
 
 	a::mutex mutex_;
 	::device *dev_;
 	size_t nopens_;
 	off_t size_;
-	page_ptr buf_;
-	off_t off_;
-	bool dirty_;
+	std::array<page_ptr, cache_pages> pages_;
+	std::array<buffer, cache_pages> bufs_;
+	buffer_cache<4> cache_;
+	off_t ra_next_;
+	size_t ra_pages_;
+	writeback_entry wb_;
+	int wb_error_;
+	a::mutex queue_mutex_;
+	a::condition_variable queue_cv_;
+	block_queue queue_;
+	bool dispatching_;
 };
 
 }
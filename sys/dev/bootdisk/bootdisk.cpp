@@ -43,11 +43,25 @@ bootdisk_read_iov(file *f, const iovec *iov, size_t count, off_t offset)
 	});
 }
 
+/*
+ * Boot archive is memory resident so files can execute in place
+ */
+static void *
+bootdisk_xip(file *f, off_t offset, size_t len)
+{
+	if (offset < 0 || (size_t)offset > archive_size ||
+	    archive_size - offset < len)
+		return nullptr;
+
+	return (void *)(archive_addr + offset);
+}
+
 /*
  * Device I/O table
  */
 static devio io = {
 	.read = bootdisk_read_iov,
+	.xip = bootdisk_xip,
 };
 
 /*
@@ -5,6 +5,7 @@
 #include <cassert>
 #include <debug.h>
 #include <irq.h>
+#include <kernel.h>
 #include <sections.h>
 #include <timer.h>
 
@@ -75,6 +76,65 @@ static_assert(sizeof(regs) == 0x28);
 static_assert(BYTE_ORDER == LITTLE_ENDIAN);
 
 __fast_bss regs *gpt;
+#if defined(CONFIG_TICKLESS)
+__fast_bss uint32_t freq;	    /* counter frequency */
+__fast_bss uint32_t scale_int;	    /* whole nanoseconds per count */
+__fast_bss uint32_t scale_frac;	    /* fractional nanoseconds per count * 2^32 */
+__fast_bss uint32_t wraps;	    /* counter rollovers */
+__fast_data uint64_t deadline = UINT64_MAX; /* next event (nanoseconds) */
+
+/*
+ * Read 64-bit count by extending the free running counter with rollovers
+ *
+ * Must be called with gpt interrupt disabled
+ */
+uint64_t
+read_count()
+{
+	/* get CNT, making sure that we handle rollovers */
+	uint32_t cnt = read32(&gpt->CNT);
+	uint32_t w = wraps;
+	if (read32(&gpt->SR).ROV) {
+		cnt = read32(&gpt->CNT);
+		++w;
+	}
+	return static_cast<uint64_t>(w) << 32 | cnt;
+}
+
+/*
+ * Convert count to nanoseconds without overflowing 64 bits
+ */
+uint64_t
+count_to_ns(uint64_t c)
+{
+	return c * scale_int + (c >> 32) * scale_frac +
+	    ((c & 0xffffffff) * scale_frac >> 32);
+}
+
+/*
+ * Convert nanoseconds to count, rounding up
+ */
+uint64_t
+ns_to_count(uint64_t ns)
+{
+	return ns / 1000000000 * freq +
+	    div_ceil<uint64_t>(ns % 1000000000 * freq, 1000000000);
+}
+
+__fast_text int
+fsl_gpt_systick_isr(int, void *)
+{
+	/* acknowledge interrupt */
+	const auto sr = read32(&gpt->SR);
+	write32(&gpt->SR, sr);
+	if (sr.ROV)
+		++wraps;
+
+	/* timer_tick will program the next event */
+	timer_tick(count_to_ns(read_count()));
+	return INT_DONE;
+}
+#else
 __fast_bss uint64_t scale;
 __fast_bss std::atomic<uint64_t> monotonic;
 constexpr uint32_t tick_ns = 1000000000 / CONFIG_HZ;
@@ -112,6 +172,7 @@ ns_since_tick()
 		ns += tick_ns;
 	return ns;
 }
+#endif
 
 }
 
@@ -123,6 +184,23 @@ fsl_gpt_systick_init(const fsl_gpt_systick_desc *d)
 
 	gpt = reinterpret_cast<regs *>(d->base);
 
+#if defined(CONFIG_TICKLESS)
+	/* configure free running timer, events are set by timer_program */
+	regs::cr cr{{
+		.WAITEN = 1,
+		.DOZEEN = 1,
+		.STOPEN = 1,
+		.CLKSRC = static_cast<unsigned>(d->clksrc),
+		.FRR = 1,
+		.EN_24M = d->clksrc == fsl::gpt::clock::ipg_24M,
+	}};
+	write32(&gpt->CR, cr);
+	write32(&gpt->PR, {{
+		.PRESCALER = d->prescaler - 1,
+		.PRESCALER24M = d->prescaler_24M - 1,
+	}});
+	write32(&gpt->IR, {{.ROVIE = 1}});
+#else
 	/* configure timer to interrupt us at CONFIG_HZ */
 	regs::cr cr{{
 		.WAITEN = 1,
@@ -138,6 +216,7 @@ fsl_gpt_systick_init(const fsl_gpt_systick_desc *d)
 	}});
 	write32(&gpt->OCR[0], static_cast<uint32_t>(d->clock / d->prescaler / CONFIG_HZ - 1));
 	write32(&gpt->IR, {{.OF1IE = 1}});
+#endif
 
 	if (!irq_attach(d->irq, d->ipl, 0, fsl_gpt_systick_isr, 0, 0))
 		panic("irq_attach");
@@ -146,12 +225,81 @@ fsl_gpt_systick_init(const fsl_gpt_systick_desc *d)
 	cr.EN = 1;
 	write32(&gpt->CR, cr);
 
+#if defined(CONFIG_TICKLESS)
+	/* scaling factors from count to ns */
+	freq = d->clock / d->prescaler;
+	scale_int = 1000000000 / freq;
+	scale_frac = (static_cast<uint64_t>(1000000000 % freq) << 32) / freq;
+
+	/* program event requested before initialisation */
+	timer_program(deadline);
+
+	dbg("GPT System Timer initialised, tickless\n");
+#else
 	/* scaling factor from count to ns * 2^32 */
 	scale = 1000000000ull * 0x100000000 / (d->clock / d->prescaler);
 
 	dbg("GPT System Timer initialised, OCR1=%u\n", read32(&gpt->OCR[0]));
+#endif
 }
 
+#if defined(CONFIG_TICKLESS)
+/*
+ * Get monotonic time
+ */
+uint_fast64_t
+timer_monotonic()
+{
+	if (!gpt)
+		return 0;
+	const int s = irq_disable();
+	const uint_fast64_t r = count_to_ns(read_count());
+	irq_restore(s);
+	return r;
+}
+
+/*
+ * Get monotonic time (coarse, fast version), exact in tickless mode.
+ */
+uint_fast64_t
+timer_monotonic_coarse()
+{
+	return timer_monotonic();
+}
+
+/*
+ * Program timer interrupt for monotonic time ns.
+ *
+ * Output compare only matches the low 32 bits of the count, so deadlines
+ * beyond the next rollover are handled by the rollover interrupt.
+ *
+ * Must be called with interrupts disabled.
+ */
+__fast_text void
+timer_program(uint_fast64_t ns)
+{
+	deadline = ns;
+	if (!gpt)
+		return;
+
+	const uint64_t c = ns == UINT64_MAX ? UINT64_MAX : ns_to_count(ns);
+	uint64_t now = read_count();
+	if (c > now && c - now >= 0x100000000) {
+		write32(&gpt->IR, {{.ROVIE = 1}});
+		return;
+	}
+
+	/* compare matches on equality, make sure we don't miss it */
+	uint64_t cmp = c;
+	do {
+		if (cmp <= now + 1)
+			cmp = now + 2;
+		write32(&gpt->OCR[0], static_cast<uint32_t>(cmp));
+		now = read_count();
+	} while (cmp <= now);
+	write32(&gpt->IR, {{.OF1IE = 1, .ROVIE = 1}});
+}
+#else
 /*
  * Get monotonic time
  */
@@ -172,3 +320,4 @@ timer_monotonic_coarse()
 {
 	return monotonic;
 }
+#endif
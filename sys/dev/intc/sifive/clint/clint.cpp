@@ -3,6 +3,7 @@
 
 #include <arch/mmio.h>
 #include <debug.h>
+#include <kernel.h>
 #include <sections.h>
 #include <timer.h>
 
@@ -23,10 +24,14 @@ static_assert(offsetof(clint, mtime) == 0xbff8);
 
 __fast_bss clint *inst;
 __fast_bss uint32_t scale;	    /* scaling from timer to nanoseconds */
+#if defined(CONFIG_TICKLESS)
+__fast_data uint64_t deadline = UINT64_MAX; /* next event (nanoseconds) */
+#else
 __fast_bss uint32_t interval;	    /* tick interval in clocks */
 __fast_bss uint64_t prev;	    /* previous mtimecmp value */
 __fast_bss std::atomic<uint64_t> monotonic;
 constexpr uint32_t tick_ns = 1000000000 / CONFIG_HZ;
+#endif
 
 void
 write_mtimecmp(uint64_t val)
@@ -63,6 +68,15 @@ intc_sifive_clint_init(const intc_sifive_clint_desc *d)
 
 	/* scaling factor to nanoseconds */
 	scale = 1000000000 / d->clock;
+
+#if defined(CONFIG_TICKLESS)
+	/* TODO: fractional scaling */
+	if (scale * d->clock != 1000000000)
+		panic("clock requires fractional scaling");
+
+	/* program event requested before initialisation */
+	timer_program(deadline);
+#else
 	interval = d->clock / CONFIG_HZ;
 
 	/* TODO: fractional scaling */
@@ -73,6 +87,10 @@ intc_sifive_clint_init(const intc_sifive_clint_desc *d)
 	/* set next interrupt time, align interrupts with timebase */
 	prev = read_mtime() / interval * interval;
 	write_mtimecmp(prev += interval);
+#endif
+
+	/* userspace can read mtime through the time page */
+	timer_time_page_counter(inst->mtime, scale);
 }
 
 /*
@@ -82,8 +100,14 @@ __fast_text
 void
 intc_sifive_clint_timer_irq()
 {
+#if defined(CONFIG_TICKLESS)
+	/* timer_tick will program the next event */
+	write_mtimecmp(UINT64_MAX);
+	timer_tick(timer_monotonic());
+#else
 	write_mtimecmp(prev += interval);
 	timer_tick(monotonic += tick_ns, tick_ns);
+#endif
 }
 
 /*
@@ -97,6 +121,33 @@ timer_monotonic()
 	return read_mtime() * scale;
 }
 
+#if defined(CONFIG_TICKLESS)
+/*
+ * Get monotonic time (coarse, fast version), exact in tickless mode.
+ */
+uint_fast64_t
+timer_monotonic_coarse()
+{
+	return timer_monotonic();
+}
+
+/*
+ * Program timer interrupt for monotonic time ns.
+ *
+ * mtime >= mtimecmp holds the interrupt pending, so a deadline which has
+ * already passed interrupts immediately.
+ *
+ * Must be called with interrupts disabled.
+ */
+__fast_text void
+timer_program(uint_fast64_t ns)
+{
+	deadline = ns;
+	if (!inst)
+		return;
+	write_mtimecmp(ns == UINT64_MAX ? UINT64_MAX : div_ceil<uint64_t>(ns, scale));
+}
+#else
 /*
  * Get monotonic time (coarse, fast version), 1/CONFIG_HZ resolution.
  */
@@ -105,3 +156,4 @@ timer_monotonic_coarse()
 {
 	return monotonic;
 }
+#endif
@@ -4,6 +4,7 @@
 #include <debug.h>
 #include <dev/tty/tty.h>
 #include <irq.h>
+#include <iterator>
 #include <sync.h>
 
 namespace {
@@ -16,10 +17,13 @@ public:
 	ns16550_inst(const serial_ns16550_desc *d)
 	: uart{phys_to_virt(d->base)}
 	, clock{d->clock}
+	, tx_fifo{uart.fifo_enable(d->rx_trigger ?: 8)
+	    ? serial::ns16550::fifo_size : 1}
 	{ }
 
 	serial::ns16550 uart;
 	const unsigned long clock;
+	const size_t tx_fifo;	    /* transmit FIFO size */
 
 	a::spinlock_irq lock;
 };
@@ -43,17 +47,33 @@ isr(int vector, void *data)
 	const auto inst = get_inst(tp);
 	auto &u = inst->uart;
 
-	while (u.data_ready())
-		tty_rx_putc(tp, u.getch());
-
-	while (u.tx_empty()) {
-		int c;
-		if ((c = tty_tx_getc(tp)) < 0) {
+	/* drain receive FIFO */
+	char buf[serial::ns16550::fifo_size];
+	size_t n = 0;
+	while (u.data_ready()) {
+		buf[n++] = u.getch();
+		if (n == std::size(buf)) {
+			tty_rx_putchars(tp, buf, n);
+			n = 0;
+		}
+	}
+	if (n)
+		tty_rx_putchars(tp, buf, n);
+
+	/* refill transmit FIFO once it is empty */
+	if (u.tx_empty()) {
+		size_t room = inst->tx_fifo, len;
+		const void *p;
+		while (room && (len = tty_tx_getbuf(tp, room, &p))) {
+			for (size_t i = 0; i != len; ++i)
+				u.putch(static_cast<const char *>(p)[i]);
+			tty_tx_advance(tp, len);
+			room -= len;
+		}
+		if (room == inst->tx_fifo) {
 			tty_tx_complete(tp);
 			u.txint_enable(false);
-			break;
 		}
-		u.putch(c);
 	}
 
 	return INT_DONE;
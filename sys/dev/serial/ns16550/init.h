@@ -13,6 +13,7 @@ struct serial_ns16550_desc {
 	int ipl;
 	int irq;
 	int irq_mode;
+	unsigned rx_trigger;	/* receive FIFO trigger level, 0 for default */
 };
 
 void serial_ns16550_init(const serial_ns16550_desc *);
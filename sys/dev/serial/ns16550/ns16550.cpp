@@ -21,7 +21,19 @@ struct ns16550::regs {
 		bf::bit<S, bool, 1> ETBEI;  /* Transmit Hold Register Empty */
 		bf::bit<S, bool, 0> ERBFI;  /* Received Data Available */
 	} IER;
-	uint8_t IIR_FCR;
+	union {
+		using S = uint8_t;
+		struct { S r; };
+		/* read: Interrupt Identification */
+		bf::bits<S, unsigned, 6, 2> FIFOS;  /* FIFOs Enabled */
+		bf::bits<S, unsigned, 1, 3> IID;    /* Interrupt ID */
+		bf::bit<S, bool, 0> NINT;   /* No Interrupt Pending */
+		/* write: FIFO Control */
+		bf::bits<S, unsigned, 6, 2> RT;	    /* Receiver Trigger */
+		bf::bit<S, bool, 2> XFIFOR; /* Transmit FIFO Reset */
+		bf::bit<S, bool, 1> RFIFOR; /* Receive FIFO Reset */
+		bf::bit<S, bool, 0> FIFOE;  /* FIFO Enable */
+	} IIR_FCR;
 	uint8_t LCR;
 	uint8_t MCR;
 	union {
@@ -62,6 +74,27 @@ ns16550::txint_enable(bool en)
 	write8(&r_->IER, r);
 }
 
+/*
+ * Enable FIFOs with receive trigger level of 1, 4, 8 or 14 bytes
+ *
+ * Once the receive FIFO reaches the trigger level, or holds data which has
+ * not been read for 4 character times, a receive interrupt is raised.
+ *
+ * Returns false if the UART has no FIFOs.
+ */
+bool
+ns16550::fifo_enable(unsigned rx_trigger)
+{
+	decltype(r_->IIR_FCR) r{};
+	r.FIFOE = true;
+	r.RFIFOR = true;
+	r.XFIFOR = true;
+	r.RT = rx_trigger >= 14 ? 3 : rx_trigger >= 8 ? 2 :
+	    rx_trigger >= 4 ? 1 : 0;
+	write8(&r_->IIR_FCR, r);
+	return read8(&r_->IIR_FCR).FIFOS == 3;
+}
+
 void
 ns16550::putch(char c)
 {
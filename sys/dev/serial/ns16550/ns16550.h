@@ -11,10 +11,16 @@ namespace serial {
 
 class ns16550 {
 public:
+	/*
+	 * Size of transmit & receive FIFOs
+	 */
+	static constexpr size_t fifo_size = 16;
+
 	ns16550(void *base);
 
 	void rxint_enable(bool);
 	void txint_enable(bool);
+	bool fifo_enable(unsigned);
 	void putch(char);
 	void putch_polled(char);
 	char getch();
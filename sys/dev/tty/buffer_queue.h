@@ -226,6 +226,27 @@ public:
 		return true;
 	}
 
+	/*
+	 * append - append characters to the back of the queue
+	 *
+	 * Allocates & pushes buffers as necessary. Returns number of characters
+	 * appended which is less than len if the buffer pool is exhausted.
+	 */
+	size_t append(const char *s, size_t len)
+	{
+		size_t n = 0;
+		while (n != len) {
+			if (q_.empty() || q_.back().complete()) {
+				const auto buf = bufpool_get();
+				if (!buf)
+					break;
+				q_.emplace_back(buf, 0, false);
+			}
+			n += q_.back().append(s + n, len - n, bufsiz_);
+		}
+		return n;
+	}
+
 	/*
 	 * copy - copy data from the front of the queue
 	 *
@@ -342,6 +363,16 @@ private:
 			return true;
 		}
 
+		size_t append(const char *s, size_t len, size_t bufsiz)
+		{
+			const auto cp = std::min(len, bufsiz - len_);
+			memcpy(buf_ + len_, s, cp);
+			len_ += cp;
+			if (len_ == bufsiz)
+				complete_ = true;
+			return cp;
+		}
+
 		void expand(size_t bufsiz)
 		{
 			len_ = bufsiz;
@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ * tty output processing
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <termios.h>
+
+/*
+ * tty_output - process output characters & append to transmit queue
+ *
+ * Tracks the output column in column. ONLCR and XTABS are only applied if
+ * OPOST is set. Runs of characters which need no processing are queued in
+ * bulk.
+ *
+ * Returns number of characters consumed from buf. Stops early if there is
+ * not enough space in q for the next run or processed character.
+ */
+template<typename Q>
+size_t
+tty_output(Q &q, const char *buf, size_t len, tcflag_t oflag, size_t &column)
+{
+	const bool opost = oflag & OPOST;
+	const char *p = buf;
+	const char *const end = buf + len;
+
+	auto remain = [&] {
+		return q.capacity() - q.size();
+	};
+
+	while (p != end) {
+		/* queue run of ordinary characters */
+		const char *e = std::find_if(p, end, [](char c) {
+			return c == '\t' || c == '\n';
+		});
+		if (e != p) {
+			const size_t n = std::min<size_t>(e - p, remain());
+			q.insert(q.end(), p, p + n);
+			column += n;
+			p += n;
+			if (p != e)
+				break;
+			continue;
+		}
+
+		if (*p == '\t') {
+			/* expand tab */
+			const size_t s = 8 - (column & 7);
+			if (opost && oflag & XTABS) {
+				if (remain() < s)
+					break;
+				q.insert(q.end(), s, ' ');
+			} else {
+				if (!remain())
+					break;
+				q.push_back('\t');
+			}
+			column += s;
+		} else {
+			/* translate newline */
+			if (opost && oflag & ONLCR) {
+				if (remain() < 2)
+					break;
+				q.insert(q.end(), {'\r', '\n'});
+			} else {
+				if (!remain())
+					break;
+				q.push_back('\n');
+			}
+			column = 0;
+		}
+		++p;
+	}
+
+	return p - buf;
+}
@@ -1,6 +1,7 @@
 #include "tty.h"
 
 #include "buffer_queue.h"
+#include "output.h"
 #include <access.h>
 #include <conf/config.h>
 #include <debug.h>
@@ -9,9 +10,11 @@
 #include <event.h>
 #include <fcntl.h>
 #include <fs/file.h>
+#include <fs/poll.h>
 #include <fs/util.h>
 #include <memory>
 #include <mutex>
+#include <poll.h>
 #include <sch.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -58,6 +61,7 @@ public:
 	ssize_t read(file *, std::span<std::byte>);
 	ssize_t write(file *, std::span<const std::byte>);
 	int ioctl(file *, u_long, void *);
+	int poll(file *, poll_table *);
 	void terminate();
 
 	/* interface to drivers */
@@ -65,6 +69,7 @@ public:
 	char *rx_getbuf();
 	void rx_putbuf(char *, size_t);
 	void rx_putc(char);
+	void rx_putchars(const char *, size_t);
 	void rx_overflow();
 	int tx_getc();
 	size_t tx_getbuf(size_t, const void **);
@@ -85,12 +90,14 @@ private:
 	int tx_wait();
 	void cook();
 	void set_termios(const termios &t);
+	bool rx_avail();
 
 	::device *dev_;		    /* device handle */
 
 	event input_;		    /* input buffer ready */
 	event output_;		    /* output buffer ready */
 	event complete_;	    /* output complete */
+	poll_head poll_;	    /* readiness notification */
 
 	std::atomic_ulong flags_;   /* tty flags */
 
@@ -169,6 +176,7 @@ tty::tty(size_t rx_bufcnt, size_t rx_bufsiz, page_ptr rxp,
 	event_init(&input_, "TTY input", event::ev_IO);
 	event_init(&output_, "TTY output", event::ev_IO);
 	event_init(&complete_, "TTY complete", event::ev_IO);
+	poll_head_init(&poll_);
 
 	termios t{};
 	t.c_iflag = TTYDEF_IFLAG;
@@ -206,6 +214,7 @@ tty::tty(size_t rx_bufcnt, size_t rx_bufsiz, page_ptr rxp,
 tty::~tty()
 {
 	thread_terminate(rx_th_);
+	poll_head_terminate(&poll_);
 }
 
 /*
@@ -242,22 +251,29 @@ tty::close(file *f)
 	return 0;
 }
 
+/*
+ * tty::rx_avail - check if input is available for reading
+ *
+ * Caller must hold state_lock_.
+ */
+bool
+tty::rx_avail()
+{
+	/* raw input is not processed by thread */
+	if (!(flags_.load() & flags::cook_input)) {
+		std::unique_lock rl{rxq_lock_};
+		rxq_cooked_ = rxq_processed_ = rxq_pending_ = rxq_.end();
+		rl.unlock();
+	}
+	return rxq_cooked_ != rxq_.begin();
+}
+
 /*
  * tty::read - read data from a tty
  */
 ssize_t
 tty::read(file *f, std::span<std::byte> buf)
 {
-	auto rx_avail = [&] {
-		/* raw input is not processed by thread */
-		if (!(flags_.load() & flags::cook_input)) {
-			std::unique_lock rl{rxq_lock_};
-			rxq_cooked_ = rxq_processed_ = rxq_pending_ = rxq_.end();
-			rl.unlock();
-		}
-		return rxq_cooked_ != rxq_.begin();
-	};
-
 	/* each iov entry must be validated as userspace address space
 	 * can change between u_access_suspend and u_access_resume */
 	if (!u_access_continue(data(buf), size(buf), PROT_WRITE))
@@ -517,6 +533,26 @@ tty::ioctl(file *f, u_long cmd, void *arg)
 	return 0;
 }
 
+/*
+ * tty::poll - get tty readiness
+ */
+int
+tty::poll(file *f, poll_table *pt)
+{
+	poll_wait(&poll_, pt);
+
+	int events = 0;
+	std::unique_lock sl{state_lock_};
+	if (rx_avail())
+		events |= POLLIN | POLLRDNORM;
+	sl.unlock();
+
+	std::lock_guard tl{txq_lock_};
+	if (txq_.size() != txq_.capacity())
+		events |= POLLOUT | POLLWRNORM;
+	return events;
+}
+
 /*
  * tty::terminate - terminate all operations running on tty
  */
@@ -584,6 +620,25 @@ tty::rx_putc(char c)
 	cook();
 }
 
+/*
+ * tty::rx_putchars - put received characters from hardware driver into tty
+ *
+ * Interrupt safe.
+ */
+void
+tty::rx_putchars(const char *s, size_t len)
+{
+	std::unique_lock rl{rxq_lock_};
+	const auto n = rxq_.append(s, len);
+	rl.unlock();
+
+	/* characters which fit are cooked before the overflow is reported */
+	if (n)
+		cook();
+	if (n != len)
+		rx_overflow();
+}
+
 /*
  * tty::rx_overflow - notify tty of hardware receive overflow
  *
@@ -614,8 +669,10 @@ tty::tx_getc()
 		return -1;
 	const auto ret = txq_.front();
 	txq_.pop_front();
-	if (txq_.size() <= txq_.capacity() / 2)
+	if (txq_.size() <= txq_.capacity() / 2) {
 		sch_wakeone(&output_);
+		poll_wakeup(&poll_, POLLOUT | POLLWRNORM);
+	}
 	tl.unlock();
 
 	if (flags_ & flags::rx_blocked_on_tx_full) {
@@ -672,8 +729,10 @@ tty::tx_advance(size_t count)
 	const auto wakeup = txq_.size() <= txq_.capacity() / 2;
 	tl.unlock();
 
-	if (wakeup)
+	if (wakeup) {
 		sch_wakeone(&output_);
+		poll_wakeup(&poll_, POLLOUT | POLLWRNORM);
+	}
 
 	if (flags_ & flags::rx_blocked_on_tx_full) {
 		flags_ &= ~flags::rx_blocked_on_tx_full;
@@ -738,7 +797,8 @@ tty::output(const char *buf, size_t len, bool atomic)
 		return txq_.capacity() - txq_.size();
 	};
 
-	if (!(lflag & ICANON)) {
+	/* raw output is queued without tracking column */
+	if (!(lflag & ICANON) && !(oflag & OPOST)) {
 		if (atomic && txq_remain() < len)
 			return 0;
 		const auto cp = std::min(len, txq_remain());
@@ -749,65 +809,17 @@ tty::output(const char *buf, size_t len, bool atomic)
 		return cp;
 	}
 
-	auto write_s = [&](const char *s, size_t len, int n) {
-		if (txq_remain() < len)
-			return false;
-		txq_.insert(txq_.end(), s, s + len);
-		column_ += n;
-		return true;
-	};
-
-	auto write_c = [&](char c, int n) {
-		if (!txq_remain())
-			return false;
-		txq_.push_back(c);
-		column_ += n;
-		return true;
-	};
-
 	const auto prev_column = column_;
 	const auto prev_txq_size = txq_.size();
-	size_t pos;
-
-	for (pos = 0; pos != len; ++pos, ++buf) {
-		const auto c = *buf;
-		switch (c) {
-		case '\t': {
-			/* expand tab */
-			const auto s = 8 - (column_ & 7);
-			if (oflag & XTABS) {
-				if (!write_s("        ", s, s))
-					goto out;
-			} else {
-				if (!write_c(c, s))
-					goto out;
-			}
-			continue;
-		}
-		case '\n':
-			/* translate newlines */
-			if (oflag & ONLCR) {
-				if (!write_s("\r\n", 2, -column_))
-					goto out;
-			} else {
-				if (!write_c(c, -column_))
-					goto out;
-			}
-			continue;
-		}
+	const auto pos = tty_output(txq_, buf, len, oflag, column_);
 
-		if (!write_c(c, 1))
-			break;
-	}
-
-out:
 	if (atomic && pos != len) {
 		column_ = prev_column;
 		txq_.erase(txq_.begin() + prev_txq_size, txq_.end());
 		return 0;
 	}
 
-	if (rxq_pending_ == rxq_cooked_)
+	if (lflag & ICANON && rxq_pending_ == rxq_cooked_)
 		canon_column_ = prev_column;
 
 	std::lock_guard tl{txq_lock_};
@@ -976,6 +988,7 @@ tty::cook()
 
 	/* otherwise pass data straight through */
 	sch_wakeone(&input_);
+	poll_wakeup(&poll_, POLLIN | POLLRDNORM);
 }
 
 /*
@@ -989,7 +1002,8 @@ tty::set_termios(const termios &t)
 	termios_ = t;
 	auto lflag = termios_.c_lflag;
 	auto iflag = termios_.c_iflag;
-	if (lflag & (ECHO | ISIG | ICANON) || iflag & IXON)
+	if (lflag & (ECHO | ISIG | ICANON) ||
+	    iflag & (IXON | IGNCR | ICRNL | INLCR))
 		flags_ |= flags::cook_input;
 	else
 		flags_ &= ~flags::cook_input;
@@ -1173,8 +1187,10 @@ tty::rx_th()
 			iproc_(this);
 
 		/* wakeup threads waiting for input */
-		if (dataavail)
+		if (dataavail) {
 			sch_wakeone(&input_);
+			poll_wakeup(&poll_, POLLIN | POLLRDNORM);
+		}
 	}
 	sch_testexit();
 }
@@ -1249,6 +1265,16 @@ tty_ioctl(file *f, u_long cmd, void *data)
 	return t->ioctl(f, cmd, data);
 }
 
+/*
+ * tty_poll - get tty readiness
+ */
+int
+tty_poll(file *f, poll_table *pt)
+{
+	tty *t = static_cast<tty *>(f->f_data);
+	return t->poll(f, pt);
+}
+
 }
 
 /*
@@ -1288,6 +1314,7 @@ tty_create(const char *name, long attr, size_t rx_bufsiz, size_t rx_bufmin,
 		.read = tty_read_iov,
 		.write = tty_write_iov,
 		.ioctl = tty_ioctl,
+		.poll = tty_poll,
 	};
 	if (dev = device_create(&tty_io, name, DF_CHR, t.get()); !dev)
 		return DERR(std::errc::invalid_argument);
@@ -1362,6 +1389,17 @@ tty_rx_putc(tty *t, char c)
 	t->rx_putc(c);
 }
 
+/*
+ * tty_rx_putchars - put received characters from hardware driver into tty
+ *
+ * Interrupt safe.
+ */
+void
+tty_rx_putchars(tty *t, const char *s, size_t len)
+{
+	t->rx_putchars(s, len);
+}
+
 /*
  * tty_rx_overflow - notify tty of hardware receive overflow
  *
@@ -55,6 +55,7 @@ void *tty_data(tty *);
 char *tty_rx_getbuf(tty *);
 void tty_rx_putbuf(tty *, char *, size_t);
 void tty_rx_putc(tty *, char);
+void tty_rx_putchars(tty *, const char *, size_t);
 void tty_rx_overflow(tty *);
 
 int tty_tx_getc(tty *);
@@ -53,37 +53,188 @@
 #include <fs/mount.h>
 #include <fs/util.h>
 #include <fs/vnode.h>
+#include <jhash3.h>
 #include <sys/param.h>
 #include <sys/uio.h>
 
 #define afsdbg(...)
 
 /*
- * Read an extended filename from archive header
+ * Archive member
  */
-static bool
-read_extended_filename(int fd, const size_t off, char *buf, size_t len)
+struct arfs_member {
+	const char *name;	/* file name */
+	size_t name_len;	/* length of file name */
+	uint32_t hashval;	/* hash of file name */
+	size_t off;		/* offset of data in archive image */
+	size_t size;		/* size of data */
+	arfs_member *hnext;	/* next member on hash chain */
+	char short_name[17];	/* storage for name from member header */
+};
+
+/*
+ * Member index
+ *
+ * Built once at mount time so that lookup does not need to read the
+ * archive. Members are kept in archive order for readdir and are hashed
+ * by name for lookup.
+ */
+struct arfs_index {
+	arfs_member *members;	/* members in archive order */
+	size_t nmembers;	/* number of members */
+	arfs_member **hash;	/* hash table, size is a power of 2 */
+	size_t hashsize;	/* number of hash buckets */
+	char *names;		/* GNU extended filename table */
+	size_t names_size;	/* size of extended filename table */
+};
+
+static void
+arfs_free_index(arfs_index *ix)
+{
+	free(ix->members);
+	free(ix->hash);
+	free(ix->names);
+	free(ix);
+}
+
+/*
+ * Read GNU extended filename table
+ *
+ * Each name is terminated by "/\n". The '/' is replaced by NUL so that
+ * names can be used directly from the table.
+ */
+static int
+arfs_read_names(int fd, arfs_index *ix, size_t off, size_t size)
 {
-	char *p;
 	ssize_t rd;
-	size_t size;
+
+	if (ix->names)
+		return DERR(-EIO);
+	if (!(ix->names = (char *)malloc(size + 1)))
+		return DERR(-ENOMEM);
+	if ((rd = kpread(fd, ix->names, size, off)) < 0)
+		return rd;
+	if ((size_t)rd != size)
+		return DERR(-EIO);
+	for (size_t i = 1; i < size; ++i)
+		if (ix->names[i] == '\n' && ix->names[i - 1] == '/')
+			ix->names[i - 1] = 0;
+	ix->names[size] = 0;
+	ix->names_size = size;
+	return 0;
+}
+
+/*
+ * Get member name from archive header
+ *
+ * Returns 0 for archive members which are not files.
+ */
+static int
+arfs_member_name(const arfs_index *ix, const ar_hdr *h, arfs_member *m)
+{
+	const char *p;
+
+	if (h->ar_name[0] == '/') {
+		/* symbol table or extended filename table */
+		if (h->ar_name[1] < '0' || h->ar_name[1] > '9')
+			return 0;
+		/* extended filename */
+		const size_t off = atol(h->ar_name + 1);
+		if (!ix->names || off >= ix->names_size)
+			return DERR(-EIO);
+		m->name = ix->names + off;
+		m->name_len = strlen(m->name);
+		return 1;
+	}
+
+	memcpy(m->short_name, h->ar_name, sizeof h->ar_name);
+	if ((p = (const char *)memchr(m->short_name, '/', sizeof h->ar_name)))
+		m->name_len = p - m->short_name;
+	else {
+		/* BSD style name padded with spaces */
+		m->name_len = sizeof h->ar_name;
+		while (m->name_len && m->short_name[m->name_len - 1] == ' ')
+			--m->name_len;
+	}
+	m->short_name[m->name_len] = 0;
+	m->name = nullptr;
+	return 1;
+}
+
+/*
+ * Build member index
+ */
+static int
+arfs_build_index(int fd, arfs_index *ix)
+{
+	size_t off = SARMAG;
+	size_t capacity = 0;
 	ar_hdr h;
-	if (kpread(fd, &h, sizeof h, SARMAG) != sizeof h)
-		return false;
-	if (strncmp(h.ar_fmag, ARFMAG, sizeof ARFMAG  - 1))
-		return false;
-	if (h.ar_name[0] != '/' || h.ar_name[1] != '/')
-		return false;
-	size = atol(h.ar_size);
-	if (off >= size)
-		return false;
-	if ((rd = kpread(fd, buf, MIN(size - off, len), SARMAG + sizeof h + off)) < 0)
-		return false;
-	buf[(size_t)rd == len ? len - 1 : rd] = 0;
-	if (!(p = (char *)memchr(buf, '/', rd)))
-		return false;
-	*p = 0;
-	return true;
+	int err;
+
+	for (;;) {
+		if ((err = kpread(fd, &h, sizeof h, off)) < 0)
+			return err;
+		if ((size_t)err < sizeof h)
+			break;
+
+		/* Check file header */
+		if (strncmp(h.ar_fmag, ARFMAG, sizeof(ARFMAG) - 1))
+			return DERR(-EIO);
+
+		/* Get file size */
+		const size_t size = atol(h.ar_size);
+		const size_t data = off + sizeof h;
+
+		/* Proceed to next archive header */
+		off = data + size;
+		off += off % 2; /* Pad to even boundary */
+
+		/* Extended filename table */
+		if (h.ar_name[0] == '/' && h.ar_name[1] == '/') {
+			if ((err = arfs_read_names(fd, ix, data, size)) < 0)
+				return err;
+			continue;
+		}
+
+		if (ix->nmembers == capacity) {
+			capacity = capacity ? capacity * 2 : 32;
+			arfs_member *m = (arfs_member *)realloc(ix->members,
+			    capacity * sizeof *m);
+			if (!m)
+				return DERR(-ENOMEM);
+			ix->members = m;
+		}
+
+		arfs_member *m = &ix->members[ix->nmembers];
+		if ((err = arfs_member_name(ix, &h, m)) <= 0) {
+			if (err < 0)
+				return err;
+			continue;
+		}
+		m->off = data;
+		m->size = size;
+		++ix->nmembers;
+	}
+
+	/* Short names can only be referenced once members stop moving */
+	ix->hashsize = 1;
+	while (ix->hashsize < ix->nmembers)
+		ix->hashsize *= 2;
+	if (!(ix->hash = (arfs_member **)calloc(ix->hashsize, sizeof *ix->hash)))
+		return DERR(-ENOMEM);
+	for (size_t i = 0; i < ix->nmembers; ++i) {
+		arfs_member *m = &ix->members[i];
+		if (!m->name)
+			m->name = m->short_name;
+		m->hashval = jhash(m->name, m->name_len, 0);
+		arfs_member **hp = &ix->hash[m->hashval & (ix->hashsize - 1)];
+		m->hnext = *hp;
+		*hp = m;
+	}
+
+	afsdbg("arfs_build_index: %zu members\n", ix->nmembers);
+	return 0;
 }
 
 /*
@@ -93,6 +244,7 @@ static int
 arfs_mount(struct mount *mp, int flags, const void *data)
 {
 	char buf[SARMAG];
+	arfs_index *ix;
 	int err = 0;
 
 	/* Read first block */
@@ -108,11 +260,31 @@ arfs_mount(struct mount *mp, int flags, const void *data)
 		return DERR(-EINVAL);
 	}
 
+	/* Index archive members */
+	if (!(ix = (arfs_index *)calloc(1, sizeof *ix)))
+		return DERR(-ENOMEM);
+	if ((err = arfs_build_index(mp->m_devfd, ix)) < 0) {
+		arfs_free_index(ix);
+		return err;
+	}
+
 	/* Ok, we find the archive */
+	mp->m_data = ix;
 	mp->m_flags |= MS_RDONLY;
 	return 0;
 }
 
+/*
+ * Unmount file system.
+ */
+static int
+arfs_umount(struct mount *mp)
+{
+	arfs_free_index((arfs_index *)mp->m_data);
+	mp->m_data = nullptr;
+	return 0;
+}
+
 /*
  * Lookup vnode for the specified file/directory.
  * The vnode is filled properly.
@@ -121,61 +293,24 @@ static int
 arfs_lookup(vnode *dvp, const char *name, const size_t name_len,
     vnode *vp)
 {
-	ar_hdr h;
-	const struct mount *mp = vp->v_mount;
-	size_t off = SARMAG;
-	size_t size;
-	char *ar_name;
-	char name_buf[128];
+	const arfs_index *ix = (arfs_index *)vp->v_mount->m_data;
+	const uint32_t hash = jhash(name, name_len, 0);
+	const arfs_member *m;
 
 	afsdbg("arfs_lookup: name=(%zu):%s\n", name_len, name);
 
-	/* File name too long - impossible to match */
-	if (name_len >= sizeof name_buf - 1)
-		return DERR(-ENOENT);
-
-	for (;;) {
-		int err;
-
-		if ((err = kpread(mp->m_devfd, &h, sizeof(h), off)) < 0)
-			return err;
-		if (err == 0)
-			return DERR(-ENOENT);
-
-		/* Check file header */
-		if (strncmp(h.ar_fmag, ARFMAG, sizeof(ARFMAG) - 1))
-			return DERR(-EIO);
-
-		/* Get file size */
-		size = atol(h.ar_size);
-
-		if (h.ar_name[0] == '/') {
-			/* filename directory */
-			if (h.ar_name[1] == '/')
-				goto next;
-			/* extended filename */
-			if (!read_extended_filename(mp->m_devfd,
-			    atol(h.ar_name + 1), name_buf, sizeof name_buf))
-				return DERR(-EIO);
-			ar_name = name_buf;
-		} else
-			ar_name = h.ar_name;
-
-		/* Compare file name */
-		if (!strncmp(name, ar_name, name_len) &&
-		    (!ar_name[name_len] || ar_name[name_len] == '/'))
+	for (m = ix->hash[hash & (ix->hashsize - 1)]; m; m = m->hnext) {
+		if (m->hashval == hash && m->name_len == name_len &&
+		    !memcmp(m->name, name, name_len))
 			break;
-
-		/* Proceed to next archive header */
-next:
-		off += sizeof(h) + size;
-		off += off % 2; /* Pad to even boundary */
 	}
+	if (!m)
+		return DERR(-ENOENT);
 
 	/* No write access */
 	vp->v_mode = S_IFREG | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
-	vp->v_size = size;
-	vp->v_data = (void *)(off + sizeof(ar_hdr));
+	vp->v_size = m->size;
+	vp->v_data = (void *)m->off;
 
 	return 0;
 }
@@ -215,15 +350,29 @@ arfs_read_iov(file *fp, const iovec *iov, size_t count,
 	});
 }
 
+/*
+ * Get address of file data for execute in place mapping.
+ *
+ * Only possible if the archive is on a memory addressable device.
+ */
+static void *
+arfs_xip(file *fp, off_t offset, size_t len)
+{
+	const vnode *vp = fp->f_vnode;
+	const struct mount *mp = vp->v_mount;
+
+	if (offset < 0 || offset > vp->v_size ||
+	    len > (size_t)(vp->v_size - offset))
+		return nullptr;
+
+	return kxip(mp->m_devfd, (size_t)vp->v_data + offset, len);
+}
+
 static int
 arfs_readdir(file *fp, dirent *buf, size_t len)
 {
-	const struct mount *mp = fp->f_vnode->v_mount;
+	const arfs_index *ix = (arfs_index *)fp->f_vnode->v_mount->m_data;
 	size_t remain = len;
-	int err = 0;
-	char name_buf[128];
-	size_t i = 2;
-	off_t off = SARMAG;	/* offset in archive image */
 
 	if (fp->f_offset == 0) {
 		if (dirbuf_add(&buf, &remain, 0, fp->f_offset, DT_DIR, "."))
@@ -237,57 +386,14 @@ arfs_readdir(file *fp, dirent *buf, size_t len)
 		++fp->f_offset;
 	}
 
-	for (;;) {
-		ar_hdr h;
-
-		/* read file header */
-		if ((err = kpread(mp->m_devfd, &h, sizeof(h), off)) <= 0)
-			goto out;
-
-		/* Check file header */
-		if (strncmp(h.ar_fmag, ARFMAG, sizeof(ARFMAG) - 1)) {
-			err = DERR(-EIO);
+	for (; (size_t)fp->f_offset - 2 < ix->nmembers; ++fp->f_offset) {
+		const arfs_member *m = &ix->members[fp->f_offset - 2];
+		if (dirbuf_add(&buf, &remain, 0, fp->f_offset, DT_REG, m->name))
 			goto out;
-		}
-
-		/* Get file size */
-		size_t size = atol(h.ar_size);
-
-		if (i == fp->f_offset) {
-			/* Convert archive name */
-			char *p;
-			if (!(p = (char *)memchr(h.ar_name, '/', ARRAY_SIZE(h.ar_name)))) {
-				err = DERR(-EIO);
-				goto out;
-			}
-			const char *name = 0;
-			if (p != h.ar_name) {
-				*p = 0;
-				name = h.ar_name;
-			} else if (h.ar_name[1] != '/') {
-				/* Extended filename */
-				if (!read_extended_filename(mp->m_devfd,
-				    atol(h.ar_name + 1), name_buf, sizeof name_buf))
-					return DERR(-EIO);
-				name = name_buf;
-			}
-			if (name && dirbuf_add(&buf, &remain, 0, fp->f_offset, DT_REG, name))
-				goto out;
-			++fp->f_offset;
-		}
-
-		/* Proceed to next archive header */
-		off += sizeof(h) + size;
-		off += off % 2; /* Pad to even boundary */
-
-		++i;
 	}
 
 out:
-	if (remain != len)
-		return len - remain;
-
-	return err;
+	return len - remain;
 }
 
 /*
@@ -310,6 +416,8 @@ const vnops arfs_vnops = {
 	.vop_setattr = (vnop_setattr_fn)vop_nullop,
 	.vop_inactive = (vnop_inactive_fn)vop_nullop,
 	.vop_truncate = (vnop_truncate_fn)vop_nullop,
+	.vop_xip = arfs_xip,
+	.vop_poll = (vnop_poll_fn)vop_ready,
 };
 
 /*
@@ -318,7 +426,7 @@ const vnops arfs_vnops = {
 static const vfsops arfs_vfsops = {
 	.vfs_init = (vfsop_init_fn)vfs_nullop,
 	.vfs_mount = arfs_mount,
-	.vfs_umount = (vfsop_umount_fn)vfs_nullop,
+	.vfs_umount = arfs_umount,
 	.vfs_sync = (vfsop_sync_fn)vfs_nullop,
 	.vfs_vget = (vfsop_vget_fn)vfs_nullop,
 	.vfs_statfs = (vfsop_statfs_fn)vfs_nullop,
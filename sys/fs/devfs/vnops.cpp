@@ -53,6 +53,7 @@
 #include <fs/mount.h>
 #include <fs/util.h>
 #include <fs/vnode.h>
+#include <poll.h>
 #include <sys/stat.h>
 
 #define dfsdbg(...)
@@ -70,9 +71,12 @@ static ssize_t devfs_read(file *, const iovec *, size_t, off_t);
 static ssize_t devfs_write(file *, const iovec *, size_t, off_t);
 static int devfs_seek (file *, off_t, int);
 static int devfs_ioctl(file *, u_long, void *);
+static int devfs_fsync(file *);
 static int devfs_readdir(file *, dirent *, size_t);
 static int devfs_lookup(vnode *, const char *, size_t, vnode *);
 static int devfs_inactive(vnode *);
+static void *devfs_xip(file *, off_t, size_t);
+static int devfs_poll(file *, poll_table *);
 
 /*
  * vnode operations
@@ -84,7 +88,7 @@ static const vnops devfs_vnops = {
 	.vop_write = devfs_write,
 	.vop_seek = devfs_seek,
 	.vop_ioctl = devfs_ioctl,
-	.vop_fsync = ((vnop_fsync_fn)vop_nullop),
+	.vop_fsync = devfs_fsync,
 	.vop_readdir = devfs_readdir,
 	.vop_lookup = devfs_lookup,
 	.vop_mknod = ((vnop_mknod_fn)vop_einval),
@@ -94,6 +98,8 @@ static const vnops devfs_vnops = {
 	.vop_setattr = ((vnop_setattr_fn)vop_nullop),
 	.vop_inactive = devfs_inactive,
 	.vop_truncate = ((vnop_truncate_fn)vop_nullop),
+	.vop_xip = devfs_xip,
+	.vop_poll = devfs_poll,
 };
 
 /*
@@ -298,6 +304,93 @@ devfs_ioctl(file *fp, u_long cmd, void *arg)
 	return r;
 }
 
+static int
+devfs_fsync(file *fp)
+{
+	/*
+	 * Root has no device context.
+	 */
+	if (fp->f_vnode->v_flags & VROOT)
+		return 0;
+
+	device *dev = (device *)fp->f_vnode->v_data;
+
+	/*
+	 * Device may have been destroyed.
+	 */
+	if (!dev)
+		return -ENODEV;
+
+	/* Sync is optional */
+	if (!dev->devio->fsync)
+		return 0;
+
+	++dev->busy;
+	vn_unlock(fp->f_vnode);
+
+	int r = (*dev->devio->fsync)(fp);
+
+	vn_lock(fp->f_vnode);
+	--dev->busy;
+
+	return r;
+}
+
+/*
+ * Get address of device memory for execute in place mapping.
+ *
+ * Returns nullptr if the device is not memory addressable.
+ */
+static void *
+devfs_xip(file *fp, off_t off, size_t len)
+{
+	device *dev = (device *)fp->f_vnode->v_data;
+
+	/*
+	 * Device may have been destroyed.
+	 */
+	if (!dev || !dev->devio->xip)
+		return nullptr;
+
+	return (*dev->devio->xip)(fp, off, len);
+}
+
+/*
+ * Get device readiness for poll.
+ *
+ * Devices without a poll routine are always ready.
+ */
+static int
+devfs_poll(file *fp, poll_table *pt)
+{
+	/*
+	 * Root has no device context.
+	 */
+	if (fp->f_vnode->v_flags & VROOT)
+		return vop_ready();
+
+	device *dev = (device *)fp->f_vnode->v_data;
+
+	/*
+	 * Device may have been destroyed.
+	 */
+	if (!dev)
+		return POLLERR | POLLHUP;
+
+	if (!dev->devio->poll)
+		return vop_ready();
+
+	++dev->busy;
+	vn_unlock(fp->f_vnode);
+
+	int r = (*dev->devio->poll)(fp, pt);
+
+	vn_lock(fp->f_vnode);
+	--dev->busy;
+
+	return r;
+}
+
 static int
 devfs_readdir(file *fp, dirent *buf, size_t len)
 {
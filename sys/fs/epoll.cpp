@@ -0,0 +1,463 @@
+/*
+ * epoll.cpp - scalable i/o event notification
+ *
+ * Each watched file has an epoll item which stays registered on the poll head
+ * of the file. Wakeups queue the item on the ready queue of the epoll instance
+ * in O(1), so waiting only tests files which may be ready.
+ *
+ * epoll_mutex protects the interest lists of all epoll instances and the
+ * epoll item lists of all files. The mutex of each epoll instance serialises
+ * harvesting events with changes to the items of that instance, so waiting
+ * on one instance doesn't block others. Lock order is epoll_mutex -> epoll
+ * instance mutex -> vnode lock. An epoll instance can't watch another epoll
+ * instance.
+ *
+ * Readiness state is protected by the lock of each epoll instance which
+ * nests inside the poll lock.
+ */
+
+#include "epoll.h"
+
+#include "debug.h"
+#include "file.h"
+#include "poll.h"
+#include "vfs.h"
+#include "vnode.h"
+#include <cstdlib>
+#include <debug.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fs.h>
+#include <lib/ready_queue.h>
+#include <mutex>
+#include <poll.h>
+#include <sch.h>
+#include <sync.h>
+#include <sys/epoll.h>
+#include <timer.h>
+
+/*
+ * Epoll instance
+ */
+struct eventpoll {
+	eventpoll()
+	{
+		list_init(&items);
+		event_init(&event, "epoll", event::ev_IO);
+		poll_head_init(&poll);
+	}
+
+	a::mutex mutex;			/* harvest vs. item changes */
+	a::spinlock_irq lock;		/* protects ready queue */
+	ready_queue ready;		/* items which may be ready */
+	list items;			/* interest list */
+	struct event event;		/* threads waiting for events */
+	poll_head poll;			/* readiness of epoll file */
+};
+
+/*
+ * Epoll item - file watched by epoll instance
+ */
+struct epitem {
+	list link;			/* linkage on interest list */
+	list file_link;			/* linkage on file epoll list */
+	ready_item ready;		/* readiness state */
+	poll_entry entry;		/* registration on file poll head */
+	eventpoll *ep;			/* owning epoll instance */
+	file *fp;			/* watched file */
+	int fd;				/* watched file descriptor */
+	epoll_data_t data;		/* user data */
+};
+
+static a::mutex epoll_mutex;
+
+static int epoll_poll(file *, poll_table *);
+static int epoll_close(file *);
+
+static constinit anon_ops epoll_ops{
+	.read = nullptr,
+	.write = nullptr,
+	.poll = epoll_poll,
+	.close = epoll_close,
+};
+
+/*
+ * is_epoll - check if file is an epoll instance
+ */
+static bool
+is_epoll(const file *fp)
+{
+	return !fp->f_vnode->v_mount && fp->f_vnode->v_data == &epoll_ops;
+}
+
+/*
+ * ep_events - events of interest for epoll_event
+ *
+ * Errors and hangups are always reported.
+ */
+static unsigned
+ep_events(const epoll_event *ev)
+{
+	return (ev->events & ~(EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE |
+	    EPOLLWAKEUP)) | EPOLLERR | EPOLLHUP;
+}
+
+/*
+ * ep_wake - wake function for epoll items
+ *
+ * Called with poll lock held from the wakeup path of the watched file.
+ */
+static void
+ep_wake(poll_entry *e, unsigned events)
+{
+	epitem *it = list_entry(e, epitem, entry);
+	eventpoll *ep = it->ep;
+
+	std::lock_guard l{ep->lock};
+	if (!ep->ready.notify(&it->ready, events))
+		return;
+	sch_wakeup(&ep->event, 0);
+	poll_wakeup_locked(&ep->poll, POLLIN | POLLRDNORM);
+}
+
+/*
+ * ep_poll_item - poll watched file and queue item if ready
+ */
+static void
+ep_poll_item(epitem *it, poll_table *pt)
+{
+	eventpoll *ep = it->ep;
+	const unsigned events = fs_pollfp(it->fp, pt);
+
+	{
+		std::lock_guard l{ep->lock};
+		if (!ep->ready.notify(&it->ready, events))
+			return;
+		sch_wakeup(&ep->event, 0);
+	}
+	poll_wakeup(&ep->poll, POLLIN | POLLRDNORM);
+}
+
+/*
+ * ep_find - find item watching fd, fp
+ */
+static epitem *
+ep_find(eventpoll *ep, int fd, file *fp)
+{
+	epitem *it;
+	list_for_each_entry(it, &fp->f_epoll, file_link)
+		if (it->ep == ep && it->fd == fd)
+			return it;
+	return nullptr;
+}
+
+/*
+ * ep_insert - add file to interest list
+ */
+static int
+ep_insert(eventpoll *ep, int fd, file *fp, const epoll_event *ev)
+{
+	epitem *it;
+	if (!(it = (epitem *)malloc(sizeof *it)))
+		return DERR(-ENOMEM);
+
+	const unsigned events = ep_events(ev);
+	ready_queue::init(&it->ready, events, ev->events & EPOLLET,
+	    ev->events & EPOLLONESHOT);
+	it->entry = (poll_entry){
+		.head = nullptr,
+		.pt = nullptr,
+		.events = events,
+		.wake = ep_wake,
+	};
+	it->ep = ep;
+	it->fp = fp;
+	it->fd = fd;
+	it->data = ev->data;
+	list_insert(&ep->items, &it->link);
+	list_insert(&fp->f_epoll, &it->file_link);
+
+	poll_table pt;
+	poll_table_init(&pt);
+	pt.entry = &it->entry;
+	ep_poll_item(it, &pt);
+	return 0;
+}
+
+/*
+ * ep_modify - change events of interest
+ */
+static int
+ep_modify(epitem *it, const epoll_event *ev)
+{
+	eventpoll *ep = it->ep;
+	const unsigned events = ep_events(ev);
+
+	{
+		std::lock_guard m{ep->mutex};
+		std::lock_guard l{ep->lock};
+		it->ready.events = events;
+		it->ready.edge = ev->events & EPOLLET;
+		it->ready.oneshot = ev->events & EPOLLONESHOT;
+		it->data = ev->data;
+	}
+	ep_poll_item(it, nullptr);
+	return 0;
+}
+
+/*
+ * ep_remove - remove file from interest list
+ */
+static void
+ep_remove(epitem *it)
+{
+	eventpoll *ep = it->ep;
+
+	/* item must not be removed while it is being harvested */
+	std::lock_guard m{ep->mutex};
+	poll_entry_remove(&it->entry);
+	{
+		std::lock_guard l{ep->lock};
+		ep->ready.remove(&it->ready);
+	}
+	list_remove(&it->link);
+	list_remove(&it->file_link);
+	free(it);
+}
+
+/*
+ * ep_harvest - report events of items on ready queue
+ *
+ * Must be called with the epoll instance mutex held. Returns number of
+ * events stored in events.
+ */
+static int
+ep_harvest(eventpoll *ep, epoll_event *events, int maxevents)
+{
+	int n = 0;
+	list tx;
+
+	ep->mutex.assert_locked();
+	{
+		std::lock_guard l{ep->lock};
+		ep->ready.take(&tx, maxevents);
+	}
+
+	while (!list_empty(&tx)) {
+		epitem *it = list_entry(list_first(&tx), epitem, ready.link);
+		const unsigned revents = fs_pollfp(it->fp, nullptr) &
+		    it->ready.events;
+		if (revents) {
+			events[n].events = revents;
+			events[n].data = it->data;
+			++n;
+		}
+		std::lock_guard l{ep->lock};
+		ep->ready.finish(&it->ready, revents);
+	}
+
+	return n;
+}
+
+/*
+ * ep_sleep - wait for items to be queued
+ *
+ * nsec == 0 sleeps without timeout.
+ */
+static int
+ep_sleep(eventpoll *ep, uint_fast64_t nsec)
+{
+	std::unique_lock l{ep->lock};
+	if (!ep->ready.empty())
+		return 0;
+	if (auto r = sch_prepare_sleep(&ep->event, nsec); r)
+		return r;
+	l.unlock();
+	return sch_continue_sleep();
+}
+
+/*
+ * epoll_poll - epoll file is readable when items are queued
+ */
+static int
+epoll_poll(file *fp, poll_table *pt)
+{
+	eventpoll *ep = (eventpoll *)fp->f_data;
+
+	poll_wait(&ep->poll, pt);
+
+	std::lock_guard l{ep->lock};
+	return ep->ready.empty() ? 0 : POLLIN | POLLRDNORM;
+}
+
+/*
+ * epoll_close - destroy epoll instance
+ */
+static int
+epoll_close(file *fp)
+{
+	eventpoll *ep = (eventpoll *)fp->f_data;
+
+	{
+		std::lock_guard l{epoll_mutex};
+		while (!list_empty(&ep->items))
+			ep_remove(list_entry(list_first(&ep->items), epitem,
+			    link));
+	}
+	poll_head_terminate(&ep->poll);
+	delete ep;
+	return 0;
+}
+
+/*
+ * epoll_release - remove file which is being closed from all interest lists
+ */
+void
+epoll_release(file *fp)
+{
+	std::lock_guard l{epoll_mutex};
+	while (!list_empty(&fp->f_epoll))
+		ep_remove(list_entry(list_first(&fp->f_epoll), epitem,
+		    file_link));
+}
+
+/*
+ * epoll_create1 - create epoll instance
+ */
+int
+epoll_create1(int flags)
+{
+	vdbgsys("epoll_create1 flags=%x\n", flags);
+
+	if (flags & ~EPOLL_CLOEXEC)
+		return DERR(-EINVAL);
+
+	eventpoll *ep;
+	if (!(ep = new eventpoll))
+		return DERR(-ENOMEM);
+
+	const int fd = anon_file(&epoll_ops, ep,
+	    flags & EPOLL_CLOEXEC ? O_CLOEXEC : 0);
+	if (fd < 0)
+		delete ep;
+	return fd;
+}
+
+/*
+ * epoll_ctl - add, modify or remove file from interest list
+ */
+int
+epoll_ctl(int epfd, int op, int fd, epoll_event *ev)
+{
+	vdbgsys("epoll_ctl epfd=%d op=%d fd=%d ev=%p\n", epfd, op, fd, ev);
+
+	if (epfd == fd)
+		return DERR(-EINVAL);
+	if (op != EPOLL_CTL_DEL && !ev)
+		return DERR(-EFAULT);
+
+	auto epfp = fs_getfile(epfd);
+	if (!epfp.ok())
+		return epfp.sc_rval();
+	auto fp = fs_getfile(fd);
+	if (!fp.ok()) {
+		fs_putfile(epfp.val());
+		return fp.sc_rval();
+	}
+
+	int err;
+	if (!is_epoll(epfp.val()) || is_epoll(fp.val()))
+		err = DERR(-EINVAL);
+	else {
+		eventpoll *ep = (eventpoll *)epfp.val()->f_data;
+		interruptible_lock l(epoll_mutex);
+		if ((err = l.lock()) < 0)
+			goto out;
+		epitem *it = ep_find(ep, fd, fp.val());
+		switch (op) {
+		case EPOLL_CTL_ADD:
+			if (it)
+				err = DERR(-EEXIST);
+			else
+				err = ep_insert(ep, fd, fp.val(), ev);
+			break;
+		case EPOLL_CTL_MOD:
+			if (!it)
+				err = DERR(-ENOENT);
+			else
+				err = ep_modify(it, ev);
+			break;
+		case EPOLL_CTL_DEL:
+			if (!it)
+				err = DERR(-ENOENT);
+			else
+				ep_remove(it);
+			break;
+		default:
+			err = DERR(-EINVAL);
+			break;
+		}
+	}
+
+out:
+	fs_putfile(fp.val());
+	fs_putfile(epfp.val());
+	return err;
+}
+
+/*
+ * fs_epoll_wait - wait for events on epoll instance
+ *
+ * timeout is in nanoseconds. 0 returns immediately, < 0 waits forever.
+ *
+ * Returns number of events, 0 on timeout or -ve error code.
+ */
+int
+fs_epoll_wait(int epfd, epoll_event *events, int maxevents,
+    int_fast64_t timeout)
+{
+	vdbgsys("fs_epoll_wait epfd=%d events=%p maxevents=%d timeout=%lld\n",
+	    epfd, events, maxevents, (long long)timeout);
+
+	if (maxevents <= 0)
+		return DERR(-EINVAL);
+
+	auto epfp = fs_getfile(epfd);
+	if (!epfp.ok())
+		return epfp.sc_rval();
+	if (!is_epoll(epfp.val())) {
+		fs_putfile(epfp.val());
+		return DERR(-EINVAL);
+	}
+
+	eventpoll *ep = (eventpoll *)epfp.val()->f_data;
+	const uint_fast64_t expire = timer_monotonic() + timeout;
+	int r;
+	while (true) {
+		{
+			interruptible_lock l(ep->mutex);
+			if ((r = l.lock()) < 0)
+				break;
+			r = ep_harvest(ep, events, maxevents);
+		}
+		if (r || !timeout)
+			break;
+
+		uint_fast64_t ns = 0;
+		if (timeout > 0) {
+			const uint_fast64_t now = timer_monotonic();
+			if (now >= expire)
+				break;
+			ns = expire - now;
+		}
+
+		/* harvest once more on timeout */
+		if ((r = ep_sleep(ep, ns)) == -ETIMEDOUT)
+			timeout = 0;
+		else if (r)
+			break;
+	}
+
+	fs_putfile(epfp.val());
+	return r;
+}
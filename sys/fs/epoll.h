@@ -0,0 +1,5 @@
+#pragma once
+
+struct file;
+
+void epoll_release(file *);
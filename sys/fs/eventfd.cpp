@@ -0,0 +1,168 @@
+/*
+ * eventfd.cpp - event notification file
+ *
+ * An eventfd is a 64-bit counter. Writes add to the counter and reads return
+ * and clear it, or decrement it by one in semaphore mode. Reads block while
+ * the counter is zero and writes block while the counter would overflow.
+ *
+ * The counter is protected by the vnode lock.
+ */
+
+#include "debug.h"
+#include "file.h"
+#include "poll.h"
+#include "vfs.h"
+#include "vnode.h"
+#include <cstring>
+#include <debug.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sync.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+/*
+ * Largest value the counter can hold
+ */
+static constexpr uint64_t efd_max = UINT64_MAX - 1;
+
+/*
+ * eventfd_data
+ */
+struct eventfd_data {
+	struct cond cond;	    /* readers & writers wait here */
+	poll_head poll;		    /* readiness notification */
+	uint64_t count;		    /* counter value */
+	bool semaphore;		    /* read decrements counter by one */
+};
+
+static ssize_t efd_read(file *, const iovec *, size_t);
+static ssize_t efd_write(file *, const iovec *, size_t);
+static int efd_poll(file *, poll_table *);
+static int efd_close(file *);
+
+static constinit anon_ops eventfd_ops{
+	.read = efd_read,
+	.write = efd_write,
+	.poll = efd_poll,
+	.close = efd_close,
+};
+
+/*
+ * efd_read - read and clear or decrement counter
+ */
+static ssize_t
+efd_read(file *fp, const iovec *iov, size_t count)
+{
+	eventfd_data *e = (eventfd_data *)fp->f_data;
+
+	if (!count || iov->iov_len < sizeof(uint64_t))
+		return DERR(-EINVAL);
+
+	while (!e->count) {
+		if (fp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (auto err = cond_wait_interruptible(&e->cond,
+		    &fp->f_vnode->v_lock); err)
+			return err;
+	}
+
+	const uint64_t v = e->semaphore ? 1 : e->count;
+	e->count -= v;
+	cond_broadcast(&e->cond);	/* wake blocked writers */
+	memcpy(iov->iov_base, &v, sizeof v);
+	poll_wakeup(&e->poll, POLLOUT | POLLWRNORM);
+
+	return sizeof v;
+}
+
+/*
+ * efd_write - add to counter
+ */
+static ssize_t
+efd_write(file *fp, const iovec *iov, size_t count)
+{
+	eventfd_data *e = (eventfd_data *)fp->f_data;
+	uint64_t v;
+
+	if (!count || iov->iov_len < sizeof v)
+		return DERR(-EINVAL);
+	memcpy(&v, iov->iov_base, sizeof v);
+	if (v > efd_max)
+		return DERR(-EINVAL);
+
+	while (efd_max - e->count < v) {
+		if (fp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (auto err = cond_wait_interruptible(&e->cond,
+		    &fp->f_vnode->v_lock); err)
+			return err;
+	}
+
+	if (!v)
+		return sizeof v;
+	e->count += v;
+	cond_broadcast(&e->cond);	/* wake blocked readers */
+	poll_wakeup(&e->poll, POLLIN | POLLRDNORM);
+
+	return sizeof v;
+}
+
+/*
+ * efd_poll - readable when counter is non-zero, writable until it is full
+ */
+static int
+efd_poll(file *fp, poll_table *pt)
+{
+	eventfd_data *e = (eventfd_data *)fp->f_data;
+	int events = 0;
+
+	poll_wait(&e->poll, pt);
+
+	if (e->count)
+		events |= POLLIN | POLLRDNORM;
+	if (e->count < efd_max)
+		events |= POLLOUT | POLLWRNORM;
+	return events;
+}
+
+/*
+ * efd_close - destroy eventfd
+ */
+static int
+efd_close(file *fp)
+{
+	eventfd_data *e = (eventfd_data *)fp->f_data;
+
+	poll_head_terminate(&e->poll);
+	delete e;
+	return 0;
+}
+
+/*
+ * eventfd - create eventfd with counter initialised to initval
+ */
+int
+eventfd(unsigned initval, int flags)
+{
+	vdbgsys("eventfd initval=%u flags=%x\n", initval, flags);
+
+	if (flags & ~(EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE))
+		return DERR(-EINVAL);
+
+	eventfd_data *e;
+	if (!(e = new eventfd_data))
+		return DERR(-ENOMEM);
+	cond_init(&e->cond);
+	poll_head_init(&e->poll);
+	e->count = initval;
+	e->semaphore = flags & EFD_SEMAPHORE;
+
+	const int fd = anon_file(&eventfd_ops, e,
+	    (flags & EFD_CLOEXEC ? O_CLOEXEC : 0) |
+	    (flags & EFD_NONBLOCK ? O_NONBLOCK : 0));
+	if (fd < 0)
+		delete e;
+	return fd;
+}
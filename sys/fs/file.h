@@ -29,6 +29,7 @@
 
 #pragma once
 
+#include <list.h>
 #include <sys/types.h>
 
 struct vnode;
@@ -42,4 +43,5 @@ struct file {
 	off_t f_offset;	/* current position in file */
 	void *f_data;	/* per-handle data for drivers */
 	vnode *f_vnode;	/* vnode */
+	list f_epoll;	/* epoll items watching this file */
 };
@@ -1,8 +1,11 @@
 #include "pipe.h"
 
 #include "file.h"
+#include "poll.h"
 #include "vnode.h"
 #include <address.h>
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <climits>
 #include <cstdlib>
@@ -11,9 +14,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <page.h>
+#include <poll.h>
 #include <sig.h>
 #include <sync.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <task.h>
 
 /*
@@ -41,15 +46,23 @@ static_assert(PIPE_BUF == 4096);
  */
 static char pipe_id;
 
+/*
+ * Largest pipe buffer which can be requested with F_SETPIPE_SZ
+ */
+static constexpr size_t pipe_max_size = 1024 * 1024;
+
 /*
  * pipe_data
  */
 struct pipe_data {
-	struct cond cond;	    /* condition variable for this pipe */
+	struct cond rcond;	    /* readers wait here for data */
+	struct cond wcond;	    /* writers wait here for space */
+	poll_head poll;		    /* readiness notification */
 	size_t read_fds;	    /* number of fd open for reading */
 	size_t write_fds;	    /* number of fd open for writing */
 	size_t wr;		    /* write bytes */
 	size_t rd;		    /* read bytes */
+	size_t size;		    /* buffer size, power of 2 >= PIPE_BUF */
 	std::byte *buf;		    /* pipe data buffer */
 };
 
@@ -71,11 +84,14 @@ pipe_alloc(file *fp)
 	pipe_data *p;
 	if (!(p = (pipe_data *)malloc(sizeof *p)))
 		return -ENOMEM;
-	cond_init(&p->cond);
+	cond_init(&p->rcond);
+	cond_init(&p->wcond);
+	poll_head_init(&p->poll);
 	p->read_fds = 0;
 	p->write_fds = 0;
 	p->wr = 0;
 	p->rd = 0;
+	p->size = PIPE_BUF;
 	p->buf = (std::byte *)phys_to_virt(b.release());
 
 	vp->v_pipe = p;
@@ -91,8 +107,9 @@ pipe_free(file *fp)
 	vnode *vp = fp->f_vnode;
 	pipe_data *p = (pipe_data *)vp->v_pipe;
 
-	page_free(virt_to_phys(p->buf), PIPE_BUF, &pipe_id);
+	page_free(virt_to_phys(p->buf), p->size, &pipe_id);
 	free(p);
+	vp->v_pipe = nullptr;
 }
 
 /*
@@ -145,12 +162,16 @@ pipe_close(file *fp)
 
 	switch (fp->f_flags & O_ACCMODE) {
 	case O_RDONLY:
-		if (--p->read_fds == 0)
-			cond_signal(&p->cond); /* wake blocked write */
+		if (--p->read_fds == 0) {
+			cond_broadcast(&p->wcond); /* wake blocked write */
+			poll_wakeup(&p->poll, POLLERR);
+		}
 		break;
 	case O_WRONLY:
-		if (--p->write_fds == 0)
-			cond_signal(&p->cond); /* wake blocked read */
+		if (--p->write_fds == 0) {
+			cond_broadcast(&p->rcond); /* wake blocked read */
+			poll_wakeup(&p->poll, POLLHUP);
+		}
 		break;
 	}
 
@@ -161,10 +182,14 @@ pipe_close(file *fp)
 }
 
 /*
- * pipe_read
+ * pipe_splice_read - move data out of pipe with fn
+ *
+ * fn is called with the pipe locked for each contiguous region of data in the
+ * pipe buffer. Stops early if fn moves less than it was offered.
  */
 ssize_t
-pipe_read(file *fp, void *buf, size_t size, off_t offset)
+pipe_splice_read(file *fp, size_t size, bool nonblock, pipe_splice_fn fn,
+    void *arg)
 {
 	int err = 0;
 	size_t read = 0;	/* bytes read so far */
@@ -183,47 +208,59 @@ pipe_read(file *fp, void *buf, size_t size, off_t offset)
 				break; /* no writers: EOF */
 			if (read > 0)
 				break; /* data read, return */
-			if (fp->f_flags & O_NONBLOCK) {
+			if (nonblock) {
 				err = -EAGAIN;
 				break;
 			}
 
 			/* wait for write or close */
 			pdbg("read: no data, wait\n");
-			err = cond_wait_interruptible(&p->cond, &vp->v_lock);
+			err = cond_wait_interruptible(&p->rcond, &vp->v_lock);
 			if (err)
 				break;
 			continue; /* validate data available */
-		} else if (avail == PIPE_BUF) {
+		} else if (avail == p->size) {
 			pdbg("read: full, signal\n");
 			/* notify write: will have space when we unlock the mutex */
-			cond_signal(&p->cond);
+			cond_broadcast(&p->wcond);
 		}
 
 		/* offset into circular buf */
-		size_t off = p->rd & (PIPE_BUF - 1);
+		size_t off = p->rd & (p->size - 1);
 
 		/* contiguous data available to end of curcular buffer */
-		if (avail > PIPE_BUF - off)
-			avail = PIPE_BUF - off;
+		if (avail > p->size - off)
+			avail = p->size - off;
 
 		size_t len = (size < avail) ? size : avail;
 		pdbg("read: off %d len %d avail %d\n", off, len, avail);
-		memcpy(buf, p->buf + off, len);
-		p->rd += len;
-		read += len;
-		size -= len;
-		buf = (char *)buf + len;
+		const ssize_t r = fn(p->buf + off, len, arg);
+		if (r < 0) {
+			err = r;
+			break;
+		}
+		p->rd += r;
+		read += r;
+		size -= r;
+		if ((size_t)r < len)
+			break;
 	}
 
+	if (read > 0)
+		poll_wakeup(&p->poll, POLLOUT | POLLWRNORM);
+
 	return (read > 0) ? (ssize_t)read : err;
 }
 
 /*
- * pipe_write
+ * pipe_splice_write - move data into pipe with fn
+ *
+ * fn is called with the pipe locked for each contiguous region of space in
+ * the pipe buffer. Stops early if fn moves less than it was offered.
  */
 ssize_t
-pipe_write(file *fp, void *buf, size_t size, off_t offset)
+pipe_splice_write(file *fp, size_t size, bool nonblock, pipe_splice_fn fn,
+    void *arg)
 {
 	int err = 0;
 	size_t written = 0;	/* bytes written so far */
@@ -240,39 +277,254 @@ pipe_write(file *fp, void *buf, size_t size, off_t offset)
 			err = -EPIPE;
 			break;
 		}
-		size_t free = PIPE_BUF - (p->wr - p->rd);
+		size_t free = p->size - (p->wr - p->rd);
 		pdbg("written: %d, %d remaining\n", written, size);
 		if (free == 0) {
-			if (fp->f_flags & O_NONBLOCK) {
+			if (nonblock) {
 				err = -EAGAIN;
 				break;
 			}
 
 			/* wait for read or close */
 			pdbg("write: full, wait\n");
-			err = cond_wait_interruptible(&p->cond, &vp->v_lock);
+			err = cond_wait_interruptible(&p->wcond, &vp->v_lock);
 			if (err)
 				break;
 			continue; /* calculate free again */
-		} else if (free == PIPE_BUF) {
+		} else if (free == p->size) {
 			pdbg("write: empty, signal\n");
 			/* notify read: will have data when we unlock the mutex */
-			cond_signal(&p->cond);
+			cond_broadcast(&p->rcond);
 		}
 
 		/* offset into circular buf */
-		size_t off = p->wr & (PIPE_BUF - 1);
-		if (free > PIPE_BUF - off)
-			free = PIPE_BUF - off; /* space wrapped in buffer */
+		size_t off = p->wr & (p->size - 1);
+		if (free > p->size - off)
+			free = p->size - off; /* space wrapped in buffer */
 
 		size_t len = (size < free) ? size : free;
 		pdbg("write: off %d len %d free %d\n", off, len, free);
-		memcpy(p->buf + off, buf, len);
-		p->wr += len;
-		written += len;
-		size -= len;
-		buf = (char *)buf + len;
+		const ssize_t r = fn(p->buf + off, len, arg);
+		if (r < 0) {
+			err = r;
+			break;
+		}
+		p->wr += r;
+		written += r;
+		size -= r;
+		if ((size_t)r < len)
+			break;
 	}
 
+	if (written > 0)
+		poll_wakeup(&p->poll, POLLIN | POLLRDNORM);
+
 	return (written > 0) ? (ssize_t)written : err;
 }
+
+/*
+ * pipe_wait_space - wait for space in pipe buffer
+ *
+ * Must be called with the pipe locked. Returns number of bytes which can be
+ * written without waiting or -ve error code.
+ */
+ssize_t
+pipe_wait_space(file *fp, bool nonblock)
+{
+	vnode *vp = fp->f_vnode;
+
+	if (!S_ISFIFO(vp->v_mode))
+		return DERR(-EINVAL);
+
+	pipe_data *p = (pipe_data *)vp->v_pipe;
+
+	while (true) {
+		if (p->read_fds == 0) {
+			sig_task(task_cur(), SIGPIPE);
+			return -EPIPE;
+		}
+		if (const size_t free = p->size - (p->wr - p->rd); free)
+			return free;
+		if (nonblock)
+			return -EAGAIN;
+
+		/* wait for read or close */
+		if (auto err = cond_wait_interruptible(&p->wcond, &vp->v_lock);
+		    err)
+			return err;
+	}
+}
+
+/*
+ * iov_cursor - position within iovec array
+ */
+struct iov_cursor {
+	const iovec *iov;	    /* current iovec */
+	size_t off;		    /* offset into current iovec */
+};
+
+/*
+ * iov_copy - pipe_splice_fn which copies between pipe buffer and iovecs
+ *
+ * Callers never request more than remains in the iovec array.
+ */
+template<bool to_pipe>
+static ssize_t
+iov_copy(std::byte *pbuf, size_t len, void *arg)
+{
+	iov_cursor *c = static_cast<iov_cursor *>(arg);
+
+	for (size_t done = 0; done < len;) {
+		std::byte *b = static_cast<std::byte *>(c->iov->iov_base) +
+		    c->off;
+		const size_t n = std::min(len - done, c->iov->iov_len - c->off);
+		if (to_pipe)
+			memcpy(pbuf + done, b, n);
+		else
+			memcpy(b, pbuf + done, n);
+		done += n;
+		if ((c->off += n) == c->iov->iov_len) {
+			++c->iov;
+			c->off = 0;
+		}
+	}
+	return len;
+}
+
+/*
+ * iov_total - total length of iovec array
+ */
+static size_t
+iov_total(const iovec *iov, size_t count)
+{
+	size_t total = 0;
+	while (count--)
+		total += iov++->iov_len;
+	return total;
+}
+
+/*
+ * pipe_read - read from pipe into iovecs
+ *
+ * The whole iovec array is transferred with the pipe locked and readiness
+ * is notified once.
+ */
+ssize_t
+pipe_read(file *fp, const iovec *iov, size_t count)
+{
+	iov_cursor c{iov, 0};
+	return pipe_splice_read(fp, iov_total(iov, count),
+	    fp->f_flags & O_NONBLOCK, iov_copy<false>, &c);
+}
+
+/*
+ * pipe_write - write iovecs to pipe
+ *
+ * The whole iovec array is transferred with the pipe locked and readiness
+ * is notified once.
+ */
+ssize_t
+pipe_write(file *fp, const iovec *iov, size_t count)
+{
+	iov_cursor c{iov, 0};
+	return pipe_splice_write(fp, iov_total(iov, count),
+	    fp->f_flags & O_NONBLOCK, iov_copy<true>, &c);
+}
+
+/*
+ * pipe_get_size - get size of pipe buffer
+ */
+int
+pipe_get_size(file *fp)
+{
+	vnode *vp = fp->f_vnode;
+
+	if (!S_ISFIFO(vp->v_mode))
+		return DERR(-EBADF);
+
+	return ((pipe_data *)vp->v_pipe)->size;
+}
+
+/*
+ * pipe_set_size - resize pipe buffer
+ *
+ * size is rounded up to a power of 2 which is at least PIPE_BUF.
+ *
+ * Returns new size or -ve error code.
+ */
+int
+pipe_set_size(file *fp, size_t size)
+{
+	vnode *vp = fp->f_vnode;
+
+	if (!S_ISFIFO(vp->v_mode))
+		return DERR(-EBADF);
+	if (size > pipe_max_size)
+		return DERR(-EPERM);
+
+	pipe_data *p = (pipe_data *)vp->v_pipe;
+	const size_t used = p->wr - p->rd;
+
+	size = std::bit_ceil(std::max<size_t>(size, PIPE_BUF));
+	if (size == p->size)
+		return size;
+	if (used > size)
+		return DERR(-EBUSY);
+
+	page_ptr b;
+	if (!(b = page_alloc(size, MA_NORMAL, &pipe_id)))
+		return DERR(-ENOMEM);
+	std::byte *buf = (std::byte *)phys_to_virt(b.release());
+
+	/* copy data to start of new buffer */
+	const size_t off = p->rd & (p->size - 1);
+	const size_t n = std::min(used, p->size - off);
+	memcpy(buf, p->buf + off, n);
+	memcpy(buf + n, p->buf, used - n);
+
+	page_free(virt_to_phys(p->buf), p->size, &pipe_id);
+	if (size > p->size && used == p->size) {
+		/* notify write: will have space when we unlock the mutex */
+		cond_broadcast(&p->wcond);
+		poll_wakeup(&p->poll, POLLOUT | POLLWRNORM);
+	}
+	p->buf = buf;
+	p->size = size;
+	p->rd = 0;
+	p->wr = used;
+
+	return size;
+}
+
+/*
+ * pipe_poll
+ */
+int
+pipe_poll(file *fp, poll_table *pt)
+{
+	vnode *vp = fp->f_vnode;
+
+	if (!S_ISFIFO(vp->v_mode))
+		return DERR(-EINVAL);
+
+	pipe_data *p = (pipe_data *)vp->v_pipe;
+
+	poll_wait(&p->poll, pt);
+
+	int events = 0;
+	switch (fp->f_flags & O_ACCMODE) {
+	case O_RDONLY:
+		if (p->wr != p->rd)
+			events |= POLLIN | POLLRDNORM;
+		if (p->write_fds == 0)
+			events |= POLLHUP;
+		break;
+	case O_WRONLY:
+		if (p->wr - p->rd != p->size)
+			events |= POLLOUT | POLLWRNORM;
+		if (p->read_fds == 0)
+			events |= POLLERR;
+		break;
+	}
+	return events;
+}
@@ -1,10 +1,26 @@
 #pragma once
 
+#include <cstddef>
 #include <sys/types.h>
 
 struct file;
+struct iovec;
+struct poll_table;
+
+/*
+ * Function to move data to or from a region of a pipe buffer
+ *
+ * Returns number of bytes moved or -ve error code.
+ */
+typedef ssize_t (*pipe_splice_fn)(std::byte *, size_t, void *);
 
 int pipe_open(file *, int, mode_t);
 int pipe_close(file *);
-ssize_t pipe_read(file *, void *, size_t, off_t);
-ssize_t pipe_write(file *, void *, size_t, off_t);
+ssize_t pipe_read(file *, const iovec *, size_t);
+ssize_t pipe_write(file *, const iovec *, size_t);
+int pipe_poll(file *, poll_table *);
+ssize_t pipe_splice_read(file *, size_t, bool, pipe_splice_fn, void *);
+ssize_t pipe_splice_write(file *, size_t, bool, pipe_splice_fn, void *);
+ssize_t pipe_wait_space(file *, bool);
+int pipe_get_size(file *);
+int pipe_set_size(file *, size_t);
@@ -0,0 +1,154 @@
+/*
+ * poll.cpp - file readiness notification
+ */
+
+#include "poll.h"
+
+#include <cassert>
+#include <mutex>
+#include <poll.h>
+#include <sch.h>
+#include <sync.h>
+
+/*
+ * Lock protecting all poll heads and poll table trigger state
+ *
+ * Wakeups are infrequent compared to the cost of a lock in every object, and
+ * must be possible from interrupt context.
+ */
+static a::spinlock_irq poll_lock;
+
+/*
+ * wake - wake owner of poll entry
+ */
+static void
+wake(poll_entry *e, unsigned events)
+{
+	if (e->wake) {
+		e->wake(e, events);
+		return;
+	}
+	if (!(events & (e->events | POLLERR | POLLHUP)))
+		return;
+	e->pt->triggered = true;
+	sch_wakeup(&e->pt->event, 0);
+}
+
+/*
+ * poll_head_init - initialise poll head
+ */
+void
+poll_head_init(poll_head *h)
+{
+	list_init(&h->waiters);
+}
+
+/*
+ * poll_head_terminate - detach all waiters from poll head which is about to
+ *			 be destroyed
+ *
+ * Waiters are woken with POLLHUP and will not touch the head again.
+ */
+void
+poll_head_terminate(poll_head *h)
+{
+	std::lock_guard l{poll_lock};
+	while (!list_empty(&h->waiters)) {
+		poll_entry *e = list_entry(list_first(&h->waiters), poll_entry,
+		    link);
+		list_remove(&e->link);
+		e->head = nullptr;
+		wake(e, POLLHUP);
+	}
+}
+
+/*
+ * poll_wait - register poll table on poll head
+ *
+ * Must be called before testing readiness so that no wakeup can be missed.
+ */
+void
+poll_wait(poll_head *h, poll_table *pt)
+{
+	if (!pt || !pt->entry)
+		return;
+	poll_entry *e = pt->entry;
+	pt->entry = nullptr;
+	e->head = h;
+	e->pt = pt;
+	std::lock_guard l{poll_lock};
+	list_insert(&h->waiters, &e->link);
+}
+
+/*
+ * poll_wakeup - wake waiters interested in events
+ *
+ * POLLERR and POLLHUP wake all waiters.
+ *
+ * Interrupt safe.
+ */
+void
+poll_wakeup(poll_head *h, unsigned events)
+{
+	std::lock_guard l{poll_lock};
+	poll_wakeup_locked(h, events);
+}
+
+/*
+ * poll_wakeup_locked - wake waiters interested in events from a wake function
+ *
+ * Must be called with poll lock held.
+ */
+void
+poll_wakeup_locked(poll_head *h, unsigned events)
+{
+	poll_entry *e;
+	list_for_each_entry(e, &h->waiters, link)
+		wake(e, events);
+}
+
+/*
+ * poll_table_init - initialise poll table
+ */
+void
+poll_table_init(poll_table *pt)
+{
+	event_init(&pt->event, "poll", event::ev_IO);
+	pt->triggered = false;
+	pt->entry = nullptr;
+}
+
+/*
+ * poll_entry_remove - remove poll entry from poll head
+ */
+void
+poll_entry_remove(poll_entry *e)
+{
+	std::lock_guard l{poll_lock};
+	if (e->head)
+		list_remove(&e->link);
+	e->head = nullptr;
+}
+
+/*
+ * poll_table_sleep - wait for wakeup of a registered poll head
+ *
+ * Returns 0 if a registered head was woken since the last call, otherwise
+ * returns the sleep result. nsec == 0 sleeps without timeout.
+ */
+int
+poll_table_sleep(poll_table *pt, uint_fast64_t nsec)
+{
+	std::unique_lock l{poll_lock};
+	if (pt->triggered) {
+		pt->triggered = false;
+		return 0;
+	}
+	if (auto r = sch_prepare_sleep(&pt->event, nsec); r)
+		return r;
+	l.unlock();
+	const int r = sch_continue_sleep();
+	l.lock();
+	pt->triggered = false;
+	return r;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * File readiness notification
+ *
+ * Objects which can become ready for i/o while nobody is reading or writing,
+ * e.g. pipes and ttys, embed a poll_head. Their poll routine registers the
+ * poll_head with poll_wait before testing readiness and they call poll_wakeup
+ * whenever readiness may have changed. A poll routine must register at most
+ * one poll_head.
+ *
+ * Poll routines return a mask of POLL* events which are currently ready.
+ *
+ * By default a wakeup wakes the thread waiting on the poll table which owns
+ * the entry. Entries which are registered for longer than a single wait, e.g.
+ * by epoll, provide a wake function instead.
+ */
+
+#include <cstdint>
+#include <event.h>
+#include <list.h>
+
+/*
+ * Poll head
+ */
+struct poll_head {
+	list waiters;			/* registered poll entries */
+};
+
+struct poll_entry;
+struct poll_table;
+
+/*
+ * Wake function, called with poll lock held
+ */
+typedef void (*poll_wake_fn)(poll_entry *, unsigned);
+
+/*
+ * Poll entry - registration of a poll table on a poll head
+ */
+struct poll_entry {
+	list link;			/* linkage on poll head */
+	poll_head *head;		/* head entry is registered on */
+	poll_table *pt;			/* owning poll table */
+	unsigned events;		/* events of interest */
+	poll_wake_fn wake;		/* wake function, nullptr for default */
+};
+
+/*
+ * Poll table - state of a thread waiting for readiness
+ */
+struct poll_table {
+	struct event event;		/* event for sleep/wakeup */
+	bool triggered;			/* a registered head has been woken */
+	poll_entry *entry;		/* entry for next registration */
+};
+
+/*
+ * Interface for objects
+ */
+void poll_head_init(poll_head *);
+void poll_head_terminate(poll_head *);
+void poll_wait(poll_head *, poll_table *);
+void poll_wakeup(poll_head *, unsigned);
+void poll_wakeup_locked(poll_head *, unsigned);
+
+/*
+ * Interface for waiters
+ */
+void poll_table_init(poll_table *);
+void poll_entry_remove(poll_entry *);
+int poll_table_sleep(poll_table *, uint_fast64_t);
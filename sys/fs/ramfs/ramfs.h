@@ -29,6 +29,7 @@
 
 #pragma once
 
+#include <list.h>
 #include <sys/types.h>
 
 #define rfsdbg(...)
@@ -37,14 +38,24 @@
  * File/directory node for RAMFS
  */
 struct ramfs_node {
-	struct ramfs_node   *rn_next;	    /* next node in the same directory */
-	struct ramfs_node   *rn_child;	    /* first child node */
+	list		     rn_link;	    /* linkage on parent's child list */
+	list		     rn_children;   /* child nodes in creation order */
+	struct ramfs_node   *rn_hnext;	    /* next node in same hash bucket */
+	uint32_t	     rn_hashval;    /* hash of name */
+	off_t		     rn_cookie;	    /* readdir position in parent */
+	struct ramfs_node  **rn_hash;	    /* hash index of child nodes */
+	size_t		     rn_hashsize;   /* number of hash buckets */
+	size_t		     rn_nchildren;  /* number of child nodes */
+	off_t		     rn_nextcookie; /* readdir position of next child */
+	struct ramfs_node   *rn_cursor;	    /* next child for readdir */
 	mode_t		     rn_mode;	    /* node mode */
 	char		    *rn_name;	    /* name (null-terminated) */
 	size_t		     rn_namelen;    /* length of name not including terminator */
 	size_t		     rn_size;	    /* file size */
-	char		    *rn_buf;	    /* buffer to the file data */
+	char		    *rn_buf;	    /* small file data buffer */
 	size_t		     rn_bufsize;    /* allocated buffer size */
+	char		   **rn_pages;	    /* file data pages, null for holes */
+	size_t		     rn_npages;	    /* length of page vector */
 };
 
 ramfs_node *ramfs_allocate_node(const char *, size_t, mode_t);
@@ -33,6 +33,8 @@
 
 #include "ramfs.h"
 
+#include <algorithm>
+#include <cassert>
 #include <climits>
 #include <cstdlib>
 #include <cstring>
@@ -42,6 +44,7 @@
 #include <fs/file.h>
 #include <fs/util.h>
 #include <fs/vnode.h>
+#include <jhash3.h>
 #include <kernel.h>
 #include <page.h>
 #include <sys/stat.h>
@@ -51,10 +54,13 @@
  */
 static char ramfs_id;
 
+/*
+ * Directories with more than this many entries are hash indexed
+ */
+#define RAMFS_HASH_MIN	8
+
 /*
  * TODO: ramfs cleanup
- * - use hash map?
- * - use kernel list.h instead of self-rolled
  * - don't duplicate tests guaranteed by vfs
  */
 
@@ -87,6 +93,8 @@ const vnops ramfs_vnops = {
 	.vop_setattr = ((vnop_setattr_fn)vop_nullop),
 	.vop_inactive = ((vnop_inactive_fn)vop_nullop),
 	.vop_truncate = ramfs_truncate,
+	.vop_xip = ((vnop_xip_fn)vop_nullop),
+	.vop_poll = ((vnop_poll_fn)vop_ready),
 };
 
 ramfs_node *
@@ -105,10 +113,14 @@ ramfs_allocate_node(const char *name, size_t name_len, mode_t mode)
 	memcpy(rn_name, name, name_len);
 	rn_name[name_len] = 0;
 	*np = (ramfs_node) {
+		.rn_hashval = jhash(rn_name, name_len, 0),
+		.rn_nextcookie = 2,
 		.rn_mode = mode,
 		.rn_name = rn_name,
 		.rn_namelen = name_len,
 	};
+	list_init(&np->rn_link);
+	list_init(&np->rn_children);
 
 	return np;
 }
@@ -120,66 +132,213 @@ ramfs_free_node(ramfs_node *np)
 	free(np);
 }
 
+/*
+ * File data storage
+ *
+ * Small files are stored in a malloc'd buffer. Once a file grows beyond half
+ * a page its data is stored in individually allocated pages indexed by a
+ * page vector, so growing a file never copies file data and never needs more
+ * than a page of contiguous memory. Pages which have never been written are
+ * not allocated and read as zeros.
+ *
+ * File data beyond the end of file is always zero.
+ */
+static void
+ramfs_free_data(ramfs_node *np)
+{
+	free(np->rn_buf);
+	np->rn_buf = nullptr;
+	np->rn_bufsize = 0;
+	for (size_t i = 0; i < np->rn_npages; ++i) {
+		if (np->rn_pages[i])
+			page_free(virt_to_phys(np->rn_pages[i]), PAGE_SIZE,
+				  &ramfs_id);
+	}
+	free(np->rn_pages);
+	np->rn_pages = nullptr;
+	np->rn_npages = 0;
+	np->rn_size = 0;
+}
+
+/*
+ * Grow page vector to hold at least npages pages
+ */
+static int
+ramfs_reserve(ramfs_node *np, size_t npages)
+{
+	if (npages <= np->rn_npages)
+		return 0;
+	npages = std::max({npages, np->rn_npages * 2, (size_t)4});
+	char **pages = (char **)realloc(np->rn_pages, npages * sizeof(char *));
+	if (!pages)
+		return -ENOSPC;
+	std::fill(pages + np->rn_npages, pages + npages, nullptr);
+	np->rn_pages = pages;
+	np->rn_npages = npages;
+	return 0;
+}
+
+/*
+ * Get file data page, allocating it if required
+ */
+static char *
+ramfs_page(ramfs_node *np, size_t i)
+{
+	assert(i < np->rn_npages);
+	if (np->rn_pages[i])
+		return np->rn_pages[i];
+	page_ptr p = page_alloc(PAGE_SIZE, MA_NORMAL, &ramfs_id);
+	if (!p)
+		return nullptr;
+	char *page = (char *)phys_to_virt(p.release());
+	memset(page, 0, PAGE_SIZE);
+	return np->rn_pages[i] = page;
+}
+
+/*
+ * Move small file data from buffer to first page
+ */
+static int
+ramfs_to_pages(ramfs_node *np)
+{
+	if (!np->rn_buf)
+		return 0;
+	char *page;
+	if (ramfs_reserve(np, 1) < 0 || !(page = ramfs_page(np, 0)))
+		return -ENOSPC;
+	memcpy(page, np->rn_buf, np->rn_size);
+	free(np->rn_buf);
+	np->rn_buf = nullptr;
+	np->rn_bufsize = 0;
+	return 0;
+}
+
+/*
+ * Directory index
+ *
+ * Child nodes are kept on a list in creation order. Each child is given a
+ * readdir cookie which increases in list order and is never reused, so a
+ * readdir position remains valid across insertions and removals. Large
+ * directories also have a hash index of child names which doubles in size
+ * as the directory grows. Growing the index is best effort: if memory is
+ * short lookups fall back to walking the list.
+ */
+static bool
+ramfs_match(const ramfs_node *np, const char *name, size_t name_len,
+    uint32_t hash)
+{
+	return np->rn_hashval == hash && np->rn_namelen == name_len &&
+	    !memcmp(name, np->rn_name, name_len);
+}
+
 static ramfs_node *
-ramfs_add_node(ramfs_node *dnp, const char *name, size_t name_len, mode_t mode)
+ramfs_find_node(ramfs_node *dnp, const char *name, size_t name_len)
 {
-	ramfs_node *np, *prev;
+	const uint32_t hash = jhash(name, name_len, 0);
+	ramfs_node *np;
 
-	if (!(np = ramfs_allocate_node(name, name_len, mode)))
+	if (dnp->rn_hash) {
+		for (np = dnp->rn_hash[hash & (dnp->rn_hashsize - 1)]; np;
+		     np = np->rn_hnext) {
+			if (ramfs_match(np, name, name_len, hash))
+				return np;
+		}
 		return nullptr;
+	}
 
-	/* Link to the directory list */
-	if (!dnp->rn_child) {
-		dnp->rn_child = np;
-	} else {
-		prev = dnp->rn_child;
-		while (prev->rn_next)
-			prev = prev->rn_next;
-		prev->rn_next = np;
+	list_for_each_entry(np, &dnp->rn_children, rn_link) {
+		if (ramfs_match(np, name, name_len, hash))
+			return np;
 	}
-	return np;
+	return nullptr;
 }
 
-static int
-ramfs_remove_node(ramfs_node *dnp, ramfs_node *np)
+static ramfs_node *
+ramfs_next_node(ramfs_node *dnp, ramfs_node *np)
+{
+	if (list_next(&np->rn_link) == &dnp->rn_children)
+		return nullptr;
+	return list_entry(list_next(&np->rn_link), ramfs_node, rn_link);
+}
+
+static void
+ramfs_hash_insert(ramfs_node *dnp, ramfs_node *np)
 {
-	ramfs_node *prev;
+	ramfs_node **b = &dnp->rn_hash[np->rn_hashval & (dnp->rn_hashsize - 1)];
+	np->rn_hnext = *b;
+	*b = np;
+}
 
-	if (!dnp->rn_child)
-		return -ENOENT;
+static void
+ramfs_hash_grow(ramfs_node *dnp)
+{
+	if (dnp->rn_nchildren <= RAMFS_HASH_MIN ||
+	    dnp->rn_nchildren <= dnp->rn_hashsize * 2)
+		return;
+
+	const size_t size = dnp->rn_hashsize ? dnp->rn_hashsize * 2 :
+	    RAMFS_HASH_MIN * 2;
+	ramfs_node **hash = (ramfs_node **)malloc(size * sizeof(ramfs_node *));
+	if (!hash)
+		return;
+	std::fill(hash, hash + size, nullptr);
+	free(dnp->rn_hash);
+	dnp->rn_hash = hash;
+	dnp->rn_hashsize = size;
 
-	/* Unlink from the directory list */
-	if (dnp->rn_child == np) {
-		dnp->rn_child = np->rn_next;
-	} else {
-		for (prev = dnp->rn_child; prev->rn_next != np;
-		     prev = prev->rn_next) {
-			if (!prev->rn_next)
-				return -ENOENT;
-		}
-		prev->rn_next = np->rn_next;
+	ramfs_node *np;
+	list_for_each_entry(np, &dnp->rn_children, rn_link)
+		ramfs_hash_insert(dnp, np);
+}
+
+static void
+ramfs_link_node(ramfs_node *dnp, ramfs_node *np)
+{
+	np->rn_cookie = dnp->rn_nextcookie++;
+	list_insert(list_last(&dnp->rn_children), &np->rn_link);
+	++dnp->rn_nchildren;
+	if (dnp->rn_hash)
+		ramfs_hash_insert(dnp, np);
+	ramfs_hash_grow(dnp);
+}
+
+static void
+ramfs_unlink_node(ramfs_node *dnp, ramfs_node *np)
+{
+	if (dnp->rn_cursor == np)
+		dnp->rn_cursor = ramfs_next_node(dnp, np);
+	if (dnp->rn_hash) {
+		ramfs_node **pp = &dnp->rn_hash[np->rn_hashval &
+		    (dnp->rn_hashsize - 1)];
+		while (*pp != np)
+			pp = &(*pp)->rn_hnext;
+		*pp = np->rn_hnext;
+	}
+	list_remove(&np->rn_link);
+	list_init(&np->rn_link);
+	if (!--dnp->rn_nchildren) {
+		free(dnp->rn_hash);
+		dnp->rn_hash = nullptr;
+		dnp->rn_hashsize = 0;
 	}
-	ramfs_free_node(np);
-	return 0;
+}
+
+static ramfs_node *
+ramfs_add_node(ramfs_node *dnp, const char *name, size_t name_len, mode_t mode)
+{
+	ramfs_node *np;
+
+	if (!(np = ramfs_allocate_node(name, name_len, mode)))
+		return nullptr;
+	ramfs_link_node(dnp, np);
+	return np;
 }
 
 static int
-ramfs_rename_node(ramfs_node *np, const char *name, size_t name_len)
+ramfs_remove_node(ramfs_node *dnp, ramfs_node *np)
 {
-	char *tmp;
-
-	if (name_len <= np->rn_namelen) {
-		/* Reuse current name buffer */
-		strlcpy(np->rn_name, name, np->rn_namelen + 1);
-	} else {
-		/* Expand name buffer */
-		if (!(tmp = (char *)malloc(name_len + 1)))
-			return -ENOMEM;
-		strlcpy(tmp, name, name_len + 1);
-		free(np->rn_name);
-		np->rn_name = tmp;
-	}
-	np->rn_namelen = name_len;
+	ramfs_unlink_node(dnp, np);
+	ramfs_free_node(np);
 	return 0;
 }
 
@@ -188,20 +347,11 @@ ramfs_lookup(vnode *dvp, const char *name, size_t name_len, vnode *vp)
 {
 	ramfs_node *np;
 	ramfs_node *dnp = (ramfs_node *)dvp->v_data;
-	int found;
 
 	if (*name == '\0')
 		return -ENOENT;
 
-	found = 0;
-	for (np = dnp->rn_child; np; np = np->rn_next) {
-		if (np->rn_namelen == name_len &&
-		    memcmp(name, np->rn_name, name_len) == 0) {
-			found = 1;
-			break;
-		}
-	}
-	if (found == 0)
+	if (!(np = ramfs_find_node(dnp, name, name_len)))
 		return -ENOENT;
 	vp->v_data = np;
 	vp->v_mode = np->rn_mode;
@@ -220,19 +370,10 @@ ramfs_unlink(vnode *dvp, vnode *vp)
 
 	np = (ramfs_node *)vp->v_data;
 
-	if (np->rn_child)
+	if (!list_empty(&np->rn_children))
 		return -ENOTEMPTY;
 
-	if (np->rn_buf) {
-		if (np->rn_bufsize > PAGE_SIZE / 2)
-			page_free(virt_to_phys(np->rn_buf), np->rn_bufsize,
-				  &ramfs_id);
-		else
-			free(np->rn_buf);
-		np->rn_buf = nullptr; /* incase remove_node fails */
-		np->rn_bufsize = 0;
-		np->rn_size = 0;
-	}
+	ramfs_free_data(np);
 	vp->v_size = 0;
 	return ramfs_remove_node((ramfs_node *)dvp->v_data, np);
 }
@@ -244,16 +385,7 @@ ramfs_truncate(vnode *vp)
 	ramfs_node *np = (ramfs_node *)vp->v_data;
 
 	rfsdbg("truncate %s\n", vp->v_path);
-	if (np->rn_buf) {
-		if (np->rn_bufsize > PAGE_SIZE / 2)
-			page_free(virt_to_phys(np->rn_buf), np->rn_bufsize,
-				  &ramfs_id);
-		else
-			free(np->rn_buf);
-		np->rn_buf = nullptr;
-		np->rn_bufsize = 0;
-		np->rn_size = 0;
-	}
+	ramfs_free_data(np);
 	vp->v_size = 0;
 	return 0;
 }
@@ -290,7 +422,21 @@ ramfs_read(file *fp, void *buf, size_t size, off_t offset)
 	if (vp->v_size - offset < size)
 		size = vp->v_size - offset;
 
-	memcpy(buf, np->rn_buf + offset, size);
+	if (np->rn_buf) {
+		memcpy(buf, np->rn_buf + offset, size);
+		return size;
+	}
+
+	for (size_t t = 0; t < size;) {
+		const off_t o = offset + t;
+		const size_t i = o / PAGE_SIZE;
+		const size_t n = std::min<size_t>(size - t, PAGE_SIZE - PAGE_OFF(o));
+		if (i < np->rn_npages && np->rn_pages[i])
+			memcpy((char *)buf + t, np->rn_pages[i] + PAGE_OFF(o), n);
+		else
+			memset((char *)buf + t, 0, n);
+		t += n;
+	}
 
 	return size;
 }
@@ -305,76 +451,57 @@ ramfs_read_iov(file *fp, const iovec *iov, size_t count,
 	});
 }
 
-static int
-ramfs_grow(ramfs_node *np, off_t new_size)
-{
-	void *new_buf = nullptr;
-
-	if (new_size <= np->rn_bufsize)
-		return 0;
-
-	/*
-	 * We allocate small files using malloc. Once a file grows to more
-	 * than half a page in size we switch to using page_alloc.
-	 */
-	if (new_size > PAGE_SIZE / 2) {
-		new_size = PAGE_ALIGN(new_size);
-		page_ptr p = page_alloc(new_size, MA_NORMAL, &ramfs_id);
-		if (!p)
-			return -1;
-		new_buf = phys_to_virt(p.release());
-	} else {
-		/* try not to fragment malloc too much */
-		new_size = ALIGNn(new_size, 32);
-		new_buf = malloc(new_size);
-		if (!new_buf)
-			return -1;
-	}
-
-	/* copy file data to new buffer */
-	if (np->rn_size != 0)
-		memcpy(new_buf, np->rn_buf, np->rn_size);
-
-	/* free old buffer */
-	if (np->rn_buf) {
-		if (np->rn_bufsize > PAGE_SIZE / 2)
-			page_free(virt_to_phys(np->rn_buf), np->rn_bufsize,
-				  &ramfs_id);
-		else
-			free(np->rn_buf);
-	}
-
-	np->rn_buf = (char *)new_buf;
-	np->rn_bufsize = new_size;
-
-	return 0;
-}
-
 static ssize_t
 ramfs_write(file *fp, void *buf, size_t size, off_t offset)
 {
 	ramfs_node *np = (ramfs_node *)fp->f_vnode->v_data;
 	vnode *vp = fp->f_vnode;
+	const off_t end = offset + size;
 
 	if (!S_ISREG(vp->v_mode) && !S_ISLNK(vp->v_mode))
 		return -EINVAL;
 
-	/* Check if the file position exceeds the end of file. */
-	if (offset + size > vp->v_size) {
-		/* Expand the file size before writing to it */
-		const off_t end_pos = offset + size;
-		if (ramfs_grow(np, end_pos) < 0)
-			return -EIO;
+	/* small files are stored in a malloc'd buffer */
+	if (!np->rn_pages && end <= PAGE_SIZE / 2) {
+		if ((size_t)end > np->rn_bufsize) {
+			/* try not to fragment malloc too much */
+			const size_t new_size = ALIGNn(end, 32);
+			char *new_buf = (char *)realloc(np->rn_buf, new_size);
+			if (!new_buf)
+				return -ENOSPC;
+			memset(new_buf + np->rn_bufsize, 0,
+			    new_size - np->rn_bufsize);
+			np->rn_buf = new_buf;
+			np->rn_bufsize = new_size;
+		}
+		memcpy(np->rn_buf + offset, buf, size);
+		if (end > vp->v_size) {
+			np->rn_size = end;
+			vp->v_size = end;
+		}
+		return size;
+	}
 
-		/* zero sparse file data */
-		if (vp->v_size < offset)
-			memset(np->rn_buf + vp->v_size, 0, offset - vp->v_size);
+	if (ramfs_to_pages(np) < 0 ||
+	    ramfs_reserve(np, (end + PAGE_SIZE - 1) / PAGE_SIZE) < 0)
+		return -ENOSPC;
 
-		np->rn_size = end_pos;
-		vp->v_size = end_pos;
+	size_t t = 0;
+	while (t < size) {
+		const off_t o = offset + t;
+		char *page = ramfs_page(np, o / PAGE_SIZE);
+		if (!page)
+			break;
+		const size_t n = std::min<size_t>(size - t, PAGE_SIZE - PAGE_OFF(o));
+		memcpy(page + PAGE_OFF(o), (char *)buf + t, n);
+		t += n;
 	}
-	memcpy(np->rn_buf + offset, buf, size);
-	return size;
+
+	if (offset + (off_t)t > vp->v_size) {
+		np->rn_size = offset + t;
+		vp->v_size = offset + t;
+	}
+	return t ? t : -ENOSPC;
 }
 
 static ssize_t
@@ -391,40 +518,36 @@ static int
 ramfs_rename(vnode *dvp1, vnode *vp1, vnode *dvp2,
     vnode *vp2, const char *name, size_t name_len)
 {
-	ramfs_node *np, *old_np;
+	ramfs_node *np = (ramfs_node *)vp1->v_data;
+	char *new_name = nullptr;
 	int err;
 
+	/* Expand name buffer */
+	if (name_len > np->rn_namelen &&
+	    !(new_name = (char *)malloc(name_len + 1)))
+		return -ENOMEM;
+
 	if (vp2) {
 		/* Remove destination file, first */
 		err = ramfs_remove_node((ramfs_node *)dvp2->v_data,
 					(ramfs_node *)vp2->v_data);
-		if (err)
-			return err;
-	}
-	/* Same directory ? */
-	if (dvp1 == dvp2) {
-		/* Change the name of existing file */
-		err = ramfs_rename_node((ramfs_node *)vp1->v_data, name,
-					name_len);
-		if (err)
+		if (err) {
+			free(new_name);
 			return err;
-	} else {
-		/* Create new file or directory */
-		old_np = (ramfs_node *)vp1->v_data;
-		if (!(np = ramfs_add_node((ramfs_node *)dvp2->v_data, name,
-					  name_len, vp1->v_mode)))
-			return -ENOMEM;
-
-		if (S_ISREG(vp1->v_mode)) {
-			/* Copy file data */
-			np->rn_buf = old_np->rn_buf;
-			np->rn_size = old_np->rn_size;
-			np->rn_bufsize = old_np->rn_bufsize;
 		}
-		/* Remove source file */
-		ramfs_remove_node((ramfs_node *)dvp1->v_data,
-				  (ramfs_node *)vp1->v_data);
 	}
+
+	/* Move node to new name, directory contents move with it */
+	ramfs_unlink_node((ramfs_node *)dvp1->v_data, np);
+	if (new_name) {
+		free(np->rn_name);
+		np->rn_name = new_name;
+	}
+	memcpy(np->rn_name, name, name_len);
+	np->rn_name[name_len] = 0;
+	np->rn_namelen = name_len;
+	np->rn_hashval = jhash(name, name_len, 0);
+	ramfs_link_node((ramfs_node *)dvp2->v_data, np);
 	return 0;
 }
 
@@ -450,23 +573,24 @@ ramfs_readdir(file *fp, dirent *buf, size_t len)
 		++fp->f_offset;
 	}
 
-	np = dnp->rn_child;
-	if (!np)
-		goto out;
-
-	for (off_t i = 0; i != (fp->f_offset - 2); i++) {
-		np = np->rn_next;
-		if (!np)
-			goto out;
+	/* Resume from cursor unless it is past the requested position */
+	np = dnp->rn_cursor;
+	if (!np || np->rn_cookie > fp->f_offset) {
+		np = list_empty(&dnp->rn_children) ? nullptr
+		    : list_entry(list_first(&dnp->rn_children), ramfs_node,
+				 rn_link);
 	}
+	while (np && np->rn_cookie < fp->f_offset)
+		np = ramfs_next_node(dnp, np);
 
 	while (np) {
-		if (dirbuf_add(&buf, &remain, 0, fp->f_offset,
+		if (dirbuf_add(&buf, &remain, 0, np->rn_cookie,
 		    IFTODT(np->rn_mode), np->rn_name))
-			goto out;
-		++fp->f_offset;
-		np = np->rn_next;
+			break;
+		fp->f_offset = np->rn_cookie + 1;
+		np = ramfs_next_node(dnp, np);
 	}
+	dnp->rn_cursor = np;
 
 out:
 	if (remain != len)
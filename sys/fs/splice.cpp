@@ -0,0 +1,501 @@
+/*
+ * splice.cpp - move data between files without copying through userspace
+ *
+ * When one end of a transfer is a pipe data moves directly between the pipe
+ * buffer and the other file. Otherwise data is bounced through a kernel
+ * buffer which is large enough to move big transfers in few chunks.
+ *
+ * The pipe stays locked while a regular file or block device is read or
+ * written so the lock order is pipe vnode -> other vnode. Other files may
+ * wait indefinitely, e.g. a tty waiting for input, so they are bounced and
+ * read or written with the pipe unlocked. Otherwise every other user of the
+ * pipe, including poll and epoll, would wait too. Pipe to pipe transfers are
+ * also bounced so that two pipes are never locked at once.
+ */
+
+#include "debug.h"
+#include "file.h"
+#include "pipe.h"
+#include "vfs.h"
+#include "vnode.h"
+#include <address.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <debug.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fs.h>
+#include <kernel.h>
+#include <page.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+/*
+ * Page ownership identifier for bounce buffers
+ */
+static char splice_id;
+
+/*
+ * Largest bounce buffer
+ */
+static constexpr size_t bounce_max = std::max<size_t>(16384, PAGE_SIZE);
+
+/*
+ * One end of a transfer
+ */
+struct splice_file {
+	file *fp;		    /* referenced file */
+	off_t *offset;		    /* explicit offset, nullptr for position */
+};
+
+/*
+ * Position in bounce buffer
+ */
+struct bounce_cursor {
+	std::byte *p;
+};
+
+/*
+ * is_pipe - check if file is a pipe or fifo
+ */
+static bool
+is_pipe(const file *fp)
+{
+	return IFTODT(fp->f_vnode->v_mode) == DT_FIFO;
+}
+
+/*
+ * is_bounded - check if i/o on file completes without waiting for another
+ *		party
+ */
+static bool
+is_bounded(const file *fp)
+{
+	switch (IFTODT(fp->f_vnode->v_mode)) {
+	case DT_BLK:
+	case DT_REG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * to_file - pipe_splice_fn which writes pipe data to file
+ */
+static ssize_t
+to_file(std::byte *buf, size_t len, void *arg)
+{
+	const splice_file *out = static_cast<splice_file *>(arg);
+	return fs_writefp(out->fp, buf, len, out->offset);
+}
+
+/*
+ * from_file - pipe_splice_fn which reads file data into pipe
+ */
+static ssize_t
+from_file(std::byte *buf, size_t len, void *arg)
+{
+	const splice_file *in = static_cast<splice_file *>(arg);
+	return fs_readfp(in->fp, buf, len, in->offset);
+}
+
+/*
+ * to_bounce - pipe_splice_fn which reads pipe data into bounce buffer
+ */
+static ssize_t
+to_bounce(std::byte *buf, size_t len, void *arg)
+{
+	bounce_cursor *c = static_cast<bounce_cursor *>(arg);
+	memcpy(c->p, buf, len);
+	c->p += len;
+	return len;
+}
+
+/*
+ * from_bounce - pipe_splice_fn which writes bounce buffer data to pipe
+ */
+static ssize_t
+from_bounce(std::byte *buf, size_t len, void *arg)
+{
+	bounce_cursor *c = static_cast<bounce_cursor *>(arg);
+	memcpy(buf, c->p, len);
+	c->p += len;
+	return len;
+}
+
+/*
+ * unread - give back data which was read but could not be written
+ *
+ * Data read from files which can't seek is lost.
+ */
+static void
+unread(const splice_file &in, size_t len)
+{
+	if (!is_bounded(in.fp))
+		return;
+	if (in.offset) {
+		*in.offset -= len;
+		return;
+	}
+	vn_lock(in.fp->f_vnode);
+	in.fp->f_offset -= len;
+	vn_unlock(in.fp->f_vnode);
+}
+
+/*
+ * bounce_alloc - allocate bounce buffer of at most size bytes
+ *
+ * Updates size to the size allocated.
+ */
+static page_ptr
+bounce_alloc(size_t *size)
+{
+	page_ptr pg;
+	*size = bounce_max;
+	while (!(pg = page_alloc(*size, MA_NORMAL, &splice_id)) &&
+	    *size > PAGE_SIZE)
+		*size /= 2;
+	return pg;
+}
+
+/*
+ * bounce - move data through kernel buffer
+ */
+static ssize_t
+bounce(const splice_file &in, const splice_file &out, size_t len)
+{
+	size_t size;
+	page_ptr pg = bounce_alloc(&size);
+	if (!pg)
+		return DERR(-ENOMEM);
+	std::byte *buf = (std::byte *)phys_to_virt(pg.get());
+
+	ssize_t total = 0, err = 0;
+	while (len != 0) {
+		const size_t n = std::min(len, size);
+		const ssize_t r = fs_readfp(in.fp, buf, n, in.offset);
+		if (r <= 0) {
+			err = r;
+			break;
+		}
+		ssize_t w = 0;
+		while (w < r) {
+			const ssize_t rw = fs_writefp(out.fp, buf + w, r - w,
+			    out.offset);
+			if (rw <= 0) {
+				err = rw;
+				break;
+			}
+			w += rw;
+		}
+		total += w;
+		len -= w;
+		if (w < r) {
+			unread(in, r - w);
+			break;
+		}
+		/* short read: end of file or no more data available */
+		if ((size_t)r < n)
+			break;
+	}
+
+	return total > 0 ? total : err;
+}
+
+/*
+ * stream - move data between pipe and a file which may wait indefinitely
+ *
+ * Data is bounced so that the pipe is unlocked while the other file is read
+ * or written. Only as much is read from the other file as the pipe has space
+ * for. Data taken from the pipe is lost if it can't be written.
+ */
+static ssize_t
+stream(file *pfp, const splice_file &in, const splice_file &out, size_t len,
+    bool nonblock)
+{
+	size_t size;
+	page_ptr pg = bounce_alloc(&size);
+	if (!pg)
+		return DERR(-ENOMEM);
+	std::byte *buf = (std::byte *)phys_to_virt(pg.get());
+	vnode *pvp = pfp->f_vnode;
+
+	ssize_t total = 0, err = 0;
+	while (len != 0) {
+		/* don't wait for the pipe once data has moved */
+		const bool nb = nonblock || total > 0;
+		size_t n = std::min(len, size);
+		bounce_cursor c{buf};
+		ssize_t r, w = 0;
+
+		if ((err = vn_lock_interruptible(pvp)))
+			break;
+		if (pfp == in.fp) {
+			r = pipe_splice_read(pfp, n, nb, to_bounce, &c);
+			vn_unlock(pvp);
+			if (r <= 0) {
+				err = r;
+				break;
+			}
+			while (w < r) {
+				const ssize_t rw = fs_writefp(out.fp, buf + w,
+				    r - w, out.offset);
+				if (rw <= 0) {
+					err = rw;
+					break;
+				}
+				w += rw;
+			}
+		} else {
+			r = pipe_wait_space(pfp, nb);
+			vn_unlock(pvp);
+			if (r <= 0) {
+				err = r;
+				break;
+			}
+			n = std::min<size_t>(n, r);
+			r = fs_readfp(in.fp, buf, n, in.offset);
+			if (r <= 0) {
+				err = r;
+				break;
+			}
+			/* data has been read so wait if another writer took
+			 * the space */
+			vn_lock(pvp);
+			w = pipe_splice_write(pfp, r, false, from_bounce, &c);
+			vn_unlock(pvp);
+			if (w < 0) {
+				err = w;
+				w = 0;
+			}
+		}
+		total += w;
+		len -= w;
+		if (w < r)
+			break;
+		/* short transfer: end of file or no more data available */
+		if ((size_t)r < n)
+			break;
+	}
+
+	return total > 0 ? total : err;
+}
+
+/*
+ * pipes - move data from pipe to pipe
+ *
+ * Data is bounced so that only one pipe is locked at a time. Only as much is
+ * read from the input pipe as the output pipe has space for so that data is
+ * only lost if the output pipe is closed or another writer takes the space
+ * and the wait is interrupted.
+ */
+static ssize_t
+pipes(const splice_file &in, const splice_file &out, size_t len,
+    bool nonblock)
+{
+	size_t size;
+	page_ptr pg = bounce_alloc(&size);
+	if (!pg)
+		return DERR(-ENOMEM);
+	std::byte *buf = (std::byte *)phys_to_virt(pg.get());
+	vnode *ivp = in.fp->f_vnode, *ovp = out.fp->f_vnode;
+	const bool in_nb = nonblock || in.fp->f_flags & O_NONBLOCK;
+	const bool out_nb = nonblock || out.fp->f_flags & O_NONBLOCK;
+
+	ssize_t total = 0, err = 0;
+	while (len != 0) {
+		size_t n = std::min(len, size);
+		bounce_cursor c{buf};
+		ssize_t r, w;
+
+		/* don't wait for either pipe once data has moved */
+		if ((err = vn_lock_interruptible(ovp)))
+			break;
+		r = pipe_wait_space(out.fp, out_nb || total > 0);
+		vn_unlock(ovp);
+		if (r <= 0) {
+			err = r;
+			break;
+		}
+		n = std::min<size_t>(n, r);
+
+		if ((err = vn_lock_interruptible(ivp)))
+			break;
+		r = pipe_splice_read(in.fp, n, in_nb || total > 0, to_bounce,
+		    &c);
+		vn_unlock(ivp);
+		if (r <= 0) {
+			err = r;
+			break;
+		}
+
+		/* data has been read so wait if another writer took the
+		 * space */
+		c.p = buf;
+		vn_lock(ovp);
+		w = pipe_splice_write(out.fp, r, false, from_bounce, &c);
+		vn_unlock(ovp);
+		if (w < 0) {
+			err = w;
+			w = 0;
+		}
+		total += w;
+		len -= w;
+		if (w < r)
+			break;
+		/* short transfer: no more data available */
+		if ((size_t)r < n)
+			break;
+	}
+
+	return total > 0 ? total : err;
+}
+
+/*
+ * transfer - move up to len bytes from in to out
+ *
+ * nonblock requests non-blocking pipe operations.
+ */
+static ssize_t
+transfer(splice_file in, splice_file out, size_t len, bool nonblock)
+{
+	if (in.offset && *in.offset < 0)
+		return DERR(-EINVAL);
+	if (out.offset && *out.offset < 0)
+		return DERR(-EINVAL);
+	len = std::min<size_t>(len, SSIZE_MAX);
+
+	file *pfp;
+	if (is_pipe(in.fp) && !is_pipe(out.fp))
+		pfp = in.fp;
+	else if (is_pipe(out.fp) && !is_pipe(in.fp))
+		pfp = out.fp;
+	else if (is_pipe(in.fp))
+		return pipes(in, out, len, nonblock);
+	else
+		return bounce(in, out, len);
+
+	nonblock |= pfp->f_flags & O_NONBLOCK;
+	if (!is_bounded(pfp == in.fp ? out.fp : in.fp))
+		return stream(pfp, in, out, len, nonblock);
+
+	if (auto err = vn_lock_interruptible(pfp->f_vnode); err)
+		return err;
+	const ssize_t r = pfp == in.fp
+	    ? pipe_splice_read(pfp, len, nonblock, to_file, &out)
+	    : pipe_splice_write(pfp, len, nonblock, from_file, &in);
+	vn_unlock(pfp->f_vnode);
+	return r;
+}
+
+/*
+ * do_transfer - get files for fds then transfer
+ *
+ * check is called to validate the files before any data is moved.
+ */
+template<typename F>
+static ssize_t
+do_transfer(int in_fd, off_t *in_off, int out_fd, off_t *out_off,
+    size_t len, bool nonblock, F check)
+{
+	auto in = fs_getfile(in_fd);
+	if (!in.ok())
+		return in.sc_rval();
+	auto out = fs_getfile(out_fd);
+	if (!out.ok()) {
+		fs_putfile(in.val());
+		return out.sc_rval();
+	}
+
+	ssize_t r;
+	if ((in.val()->f_flags & O_ACCMODE) == O_WRONLY ||
+	    (out.val()->f_flags & O_ACCMODE) == O_RDONLY)
+		r = DERR(-EBADF);
+	else if ((r = check(in.val(), out.val())) == 0 && len)
+		r = transfer({in.val(), in_off}, {out.val(), out_off}, len,
+		    nonblock);
+
+	fs_putfile(out.val());
+	fs_putfile(in.val());
+	return r;
+}
+
+/*
+ * sendfile - move data from in_fd to out_fd
+ *
+ * Reads from *offset and advances it if offset is not null, in which case the
+ * file position of in_fd is not changed.
+ */
+ssize_t
+sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	vdbgsys("sendfile out_fd=%d in_fd=%d offset=%p count=%zu\n",
+	    out_fd, in_fd, offset, count);
+
+	return do_transfer(in_fd, offset, out_fd, nullptr, count, false,
+	    [](file *, file *) { return 0; });
+}
+
+/*
+ * splice - move data to or from a pipe
+ */
+ssize_t
+splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len,
+    unsigned flags)
+{
+	vdbgsys("splice fd_in=%d off_in=%p fd_out=%d off_out=%p len=%zu "
+	    "flags=%x\n", fd_in, off_in, fd_out, off_out, len, flags);
+
+	if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE |
+	    SPLICE_F_GIFT))
+		return DERR(-EINVAL);
+
+	return do_transfer(fd_in, off_in, fd_out, off_out, len,
+	    flags & SPLICE_F_NONBLOCK, [&](file *in, file *out) {
+		if (!is_pipe(in) && !is_pipe(out))
+			return DERR(-EINVAL);
+		if ((is_pipe(in) && off_in) || (is_pipe(out) && off_out))
+			return DERR(-ESPIPE);
+		if (in->f_vnode == out->f_vnode)
+			return DERR(-EINVAL);
+		return 0;
+	});
+}
+
+/*
+ * copy_file_range - copy data between regular files
+ */
+ssize_t
+copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+    size_t len, unsigned flags)
+{
+	vdbgsys("copy_file_range fd_in=%d off_in=%p fd_out=%d off_out=%p "
+	    "len=%zu flags=%x\n", fd_in, off_in, fd_out, off_out, len, flags);
+
+	if (flags)
+		return DERR(-EINVAL);
+
+	return do_transfer(fd_in, off_in, fd_out, off_out, len, false,
+	    [&](file *in, file *out) {
+		if (IFTODT(in->f_vnode->v_mode) == DT_DIR ||
+		    IFTODT(out->f_vnode->v_mode) == DT_DIR)
+			return DERR(-EISDIR);
+		if (IFTODT(in->f_vnode->v_mode) != DT_REG ||
+		    IFTODT(out->f_vnode->v_mode) != DT_REG)
+			return DERR(-EINVAL);
+		if (out->f_flags & O_APPEND)
+			return DERR(-EBADF);
+		if (in->f_vnode != out->f_vnode)
+			return 0;
+		/* overlapping ranges within the same file */
+		const off_t i = off_in ? *off_in : in->f_offset;
+		const off_t o = off_out ? *off_out : out->f_offset;
+		const off_t n = std::min<size_t>(len, SSIZE_MAX);
+		if ((i <= o && o - i < n) || (o <= i && i - o < n))
+			return DERR(-EINVAL);
+		return 0;
+	});
+}
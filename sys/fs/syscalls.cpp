@@ -14,15 +14,22 @@
 #include <linux/fs.h>
 #include <linux/ioctl.h>
 #include <linux/stat.h>
+#include <poll.h>
+#include <sig.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <sys/epoll.h>
 #include <sys/mount.h>
 #include <sys/param.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/statfs.h>
+#include <sys/timerfd.h>
 #include <sys/uio.h>
 #include <syscalls.h>
 #include <task.h>
 #include <termios.h>
+#include <time32.h>
 #include <unistd.h>
 
 /*
@@ -84,9 +91,388 @@ do_iov(int fd, const iovec *uiov, int count, off_t offset,
 	}
 }
 
+/*
+ * do_poll - copy pollfds from userspace into kernel, wait for events then
+ * copy results back to userspace.
+ *
+ * If mask is not null it replaces the signal mask while waiting.
+ */
+static int
+do_poll(pollfd *ufds, nfds_t nfds, int_fast64_t timeout,
+    const k_sigset_t *mask)
+{
+	/* nfds can't exceed the number of open files */
+	if (nfds > ARRAY_SIZE(task_cur()->file))
+		return DERR(-EINVAL);
+
+	int r;
+	pollfd *fds = nullptr;
+	const size_t len = sizeof *fds * nfds;
+	interruptible_lock l(u_access_lock);
+
+	if (nfds && !(fds = (pollfd *)malloc(len)))
+		return DERR(-ENOMEM);
+	if ((r = l.lock()) < 0)
+		goto out;
+	if (!u_access_ok(ufds, len, PROT_WRITE)) {
+		r = DERR(-EFAULT);
+		goto out;
+	}
+	memcpy(fds, ufds, len);
+	l.unlock();
+
+	if (mask)
+		sig_temporary_mask(mask);
+
+	if ((r = fs_poll(fds, nfds, timeout)) < 0)
+		goto out;
+
+	if (auto err = l.lock(); err < 0) {
+		r = err;
+		goto out;
+	}
+	if (!u_access_ok(ufds, len, PROT_WRITE)) {
+		r = DERR(-EFAULT);
+		goto out;
+	}
+	for (nfds_t i = 0; i < nfds; ++i)
+		ufds[i].revents = fds[i].revents;
+
+out:
+	free(fds);
+	return r == -EINTR ? -EINTR_NORESTART : r;
+}
+
+/*
+ * do_select - convert fd_sets to pollfds, wait for events then convert
+ * results back to fd_sets.
+ *
+ * Only the first n bits of each fd_set are accessed.
+ */
+static int
+do_select(int n, fd_set *ufds[3], int_fast64_t timeout,
+    const k_sigset_t *mask)
+{
+	constexpr size_t bits = sizeof(long) * 8;
+	constexpr size_t max = sizeof task::file / sizeof *task::file;
+	constexpr unsigned events[3] = {
+		POLLIN | POLLRDNORM | POLLHUP | POLLERR,
+		POLLOUT | POLLWRNORM | POLLERR,
+		POLLPRI,
+	};
+
+	if (n < 0)
+		return DERR(-EINVAL);
+
+	/* bits beyond the number of open files are ignored */
+	const size_t nfds = std::min<size_t>(n, max);
+	const size_t words = (nfds + bits - 1) / bits;
+	unsigned long in[3][(max + bits - 1) / bits] = {};
+	unsigned long out[3][(max + bits - 1) / bits] = {};
+	size_t npoll = 0;
+	pollfd *fds = nullptr;
+	int r;
+	interruptible_lock l(u_access_lock);
+
+	if ((r = l.lock()) < 0)
+		return r;
+	for (size_t s = 0; s < 3; ++s) {
+		if (!ufds[s])
+			continue;
+		if (!u_access_ok(ufds[s], words * sizeof(long), PROT_WRITE))
+			return DERR(-EFAULT);
+		memcpy(in[s], ufds[s]->fds_bits, words * sizeof(long));
+	}
+	l.unlock();
+
+	/* bits in the last word beyond nfds are ignored */
+	for (size_t s = 0; s < 3 && nfds % bits; ++s)
+		if (words)
+			in[s][words - 1] &= (1UL << nfds % bits) - 1;
+
+	auto selected = [&](size_t s, size_t fd) {
+		return in[s][fd / bits] & 1UL << fd % bits;
+	};
+
+	for (size_t fd = 0; fd < nfds; ++fd)
+		if (selected(0, fd) || selected(1, fd) || selected(2, fd))
+			++npoll;
+	if (npoll && !(fds = (pollfd *)malloc(sizeof *fds * npoll)))
+		return DERR(-ENOMEM);
+	for (size_t fd = 0, i = 0; fd < nfds; ++fd) {
+		short ev = 0;
+		for (size_t s = 0; s < 3; ++s)
+			if (selected(s, fd))
+				ev |= events[s];
+		if (ev)
+			fds[i++] = {.fd = (int)fd, .events = ev};
+	}
+
+	if (mask)
+		sig_temporary_mask(mask);
+
+	if ((r = fs_poll(fds, npoll, timeout)) < 0)
+		goto out;
+
+	/* select fails if any fd is invalid */
+	for (size_t i = 0; i < npoll; ++i) {
+		if (fds[i].revents & POLLNVAL) {
+			r = DERR(-EBADF);
+			goto out;
+		}
+	}
+
+	/* build result sets */
+	r = 0;
+	for (size_t i = 0; i < npoll; ++i) {
+		const size_t fd = fds[i].fd;
+		for (size_t s = 0; s < 3; ++s) {
+			if (!selected(s, fd) || !(fds[i].revents & events[s]))
+				continue;
+			out[s][fd / bits] |= 1UL << fd % bits;
+			++r;
+		}
+	}
+
+	if (auto err = l.lock(); err < 0) {
+		r = err;
+		goto out;
+	}
+	for (size_t s = 0; s < 3; ++s) {
+		if (!ufds[s])
+			continue;
+		if (!u_access_ok(ufds[s], words * sizeof(long), PROT_WRITE)) {
+			r = DERR(-EFAULT);
+			goto out;
+		}
+		memcpy(ufds[s]->fds_bits, out[s], words * sizeof(long));
+	}
+
+out:
+	free(fds);
+	return r == -EINTR ? -EINTR_NORESTART : r;
+}
+
+/*
+ * ts_timeout - convert userspace timespec to poll timeout
+ *
+ * Returns -1 for no timeout, -EINVAL if timespec is invalid.
+ */
+template<typename T>
+static int_fast64_t
+ts_timeout(const T *uts)
+{
+	if (!uts)
+		return -1;
+	const T ts = read_once(uts);
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+		return DERR(-EINVAL);
+	if (ts.tv_sec >= INT64_MAX / 1000000000 - 1)
+		return -1;
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * do_ppoll - ppoll with userspace timespec of type T
+ */
+template<typename T>
+static int
+do_ppoll(pollfd *ufds, nfds_t nfds, const T *uts, const k_sigset_t *umask,
+    size_t sigsetsize)
+{
+	if (umask && sigsetsize != sizeof(k_sigset_t))
+		return DERR(-EINVAL);
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if ((uts && !u_access_ok(uts, sizeof *uts, PROT_READ)) ||
+	    (umask && !u_access_ok(umask, sizeof *umask, PROT_READ)))
+		return DERR(-EFAULT);
+	const int_fast64_t timeout = ts_timeout(uts);
+	if (timeout == -EINVAL)
+		return timeout;
+	k_sigset_t mask;
+	if (umask)
+		mask = read_once(umask);
+	l.unlock();
+	return do_poll(ufds, nfds, timeout, umask ? &mask : nullptr);
+}
+
+/*
+ * do_pselect6 - pselect6 with userspace timespec of type T
+ */
+template<typename T>
+static int
+do_pselect6(int n, fd_set *rfds, fd_set *wfds, fd_set *efds, T *uts,
+    const void *usig)
+{
+	/* usig points to a {const k_sigset_t *, size_t} pair */
+	struct sigdata {
+		const k_sigset_t *ss;
+		size_t ss_len;
+	};
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if ((uts && !u_access_ok(uts, sizeof *uts, PROT_READ)) ||
+	    (usig && !u_access_ok(usig, sizeof(sigdata), PROT_READ)))
+		return DERR(-EFAULT);
+	const int_fast64_t timeout = ts_timeout(uts);
+	if (timeout == -EINVAL)
+		return timeout;
+	sigdata sd{};
+	if (usig)
+		sd = read_once(static_cast<const sigdata *>(usig));
+	if (sd.ss && sd.ss_len != sizeof(k_sigset_t))
+		return DERR(-EINVAL);
+	if (sd.ss && !u_access_ok(sd.ss, sizeof *sd.ss, PROT_READ))
+		return DERR(-EFAULT);
+	k_sigset_t mask;
+	if (sd.ss)
+		mask = read_once(sd.ss);
+	l.unlock();
+	fd_set *ufds[3] = {rfds, wfds, efds};
+	return do_select(n, ufds, timeout, sd.ss ? &mask : nullptr);
+}
+
 /*
  * Syscalls
  */
+
+/*
+ * its_in - convert userspace itimerspec
+ */
+static itimerspec
+its_in(const itimerspec &its)
+{
+	return its;
+}
+
+static itimerspec
+its_in(const itimerspec32 &its)
+{
+	return {
+		.it_interval = {
+			its.it_interval.tv_sec,
+			its.it_interval.tv_nsec,
+		},
+		.it_value = {its.it_value.tv_sec, its.it_value.tv_nsec},
+	};
+}
+
+/*
+ * its_out - convert itimerspec for userspace
+ */
+static void
+its_out(itimerspec *uits, const itimerspec &its)
+{
+	*uits = its;
+}
+
+static void
+its_out(itimerspec32 *uits, const itimerspec &its)
+{
+	*uits = {
+		.it_interval = {(int32_t)its.it_interval.tv_sec,
+				(int32_t)its.it_interval.tv_nsec},
+		.it_value = {(int32_t)its.it_value.tv_sec,
+			     (int32_t)its.it_value.tv_nsec},
+	};
+}
+
+/*
+ * do_timerfd_settime - timerfd_settime with userspace itimerspec of type T
+ */
+template<typename T>
+static int
+do_timerfd_settime(int fd, int flags, const T *unew, T *uold)
+{
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if (!u_access_ok(unew, sizeof *unew, PROT_READ) ||
+	    (uold && !u_access_ok(uold, sizeof *uold, PROT_WRITE)))
+		return DERR(-EFAULT);
+	const itimerspec its = its_in(read_once(unew));
+	l.unlock();
+
+	itimerspec old;
+	int r = timerfd_settime(fd, flags, &its, &old);
+	if (r < 0 || !uold)
+		return r;
+
+	/* timer has been set, copy out must not be interrupted */
+	u_access_begin();
+	if (u_access_ok(uold, sizeof *uold, PROT_WRITE))
+		its_out(uold, old);
+	else
+		r = DERR(-EFAULT);
+	u_access_end();
+	return r;
+}
+
+/*
+ * do_timerfd_gettime - timerfd_gettime with userspace itimerspec of type T
+ */
+template<typename T>
+static int
+do_timerfd_gettime(int fd, T *ucur)
+{
+	itimerspec cur;
+	if (auto r = timerfd_gettime(fd, &cur); r < 0)
+		return r;
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if (!u_access_ok(ucur, sizeof *ucur, PROT_WRITE))
+		return DERR(-EFAULT);
+	its_out(ucur, cur);
+	return 0;
+}
+
+/*
+ * do_splice - call fn with optional file offsets copied from userspace
+ *
+ * Offsets are copied back once fn has moved data.
+ */
+template<typename F>
+static ssize_t
+do_splice(off_t *uoff_in, off_t *uoff_out, F fn)
+{
+	constexpr int prot = PROT_READ | PROT_WRITE;
+	off_t off_in, off_out;
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if ((uoff_in && !u_access_ok(uoff_in, sizeof *uoff_in, prot)) ||
+	    (uoff_out && !u_access_ok(uoff_out, sizeof *uoff_out, prot)))
+		return DERR(-EFAULT);
+	if (uoff_in)
+		off_in = read_once(uoff_in);
+	if (uoff_out)
+		off_out = read_once(uoff_out);
+	l.unlock();
+
+	ssize_t r = fn(uoff_in ? &off_in : nullptr,
+	    uoff_out ? &off_out : nullptr);
+	if (r <= 0 || (!uoff_in && !uoff_out))
+		return r;
+
+	/* data has been moved, copy out must not be interrupted */
+	u_access_begin();
+	if ((uoff_in && !u_access_ok(uoff_in, sizeof *uoff_in, prot)) ||
+	    (uoff_out && !u_access_ok(uoff_out, sizeof *uoff_out, prot)))
+		r = DERR(-EFAULT);
+	else {
+		if (uoff_in)
+			*uoff_in = off_in;
+		if (uoff_out)
+			*uoff_out = off_out;
+	}
+	u_access_end();
+	return r;
+}
+
 int
 sc_access(const char *path, int mode)
 {
@@ -116,6 +502,72 @@ sc_chown(const char *path, uid_t uid, gid_t gid)
 	return sc_fchownat(AT_FDCWD, path, uid, gid, 0);
 }
 
+int
+sc_epoll_ctl(int epfd, int op, int fd, epoll_event *uev)
+{
+	epoll_event ev;
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if (uev) {
+		if (!u_access_ok(uev, sizeof *uev, PROT_READ))
+			return DERR(-EFAULT);
+		ev = read_once(uev);
+	}
+	l.unlock();
+	return epoll_ctl(epfd, op, fd, uev ? &ev : nullptr);
+}
+
+int
+sc_epoll_pwait(int epfd, epoll_event *uevents, int maxevents, int timeout,
+    const k_sigset_t *umask, size_t sigsetsize)
+{
+	/* events which don't fit remain queued for the next call */
+	constexpr int max = sizeof task::file / sizeof *task::file;
+
+	if (maxevents <= 0)
+		return DERR(-EINVAL);
+	if (umask && sigsetsize != sizeof(k_sigset_t))
+		return DERR(-EINVAL);
+
+	int r;
+	k_sigset_t mask;
+	epoll_event *events;
+	const int n = std::min(maxevents, max);
+	interruptible_lock l(u_access_lock);
+
+	if ((r = l.lock()) < 0)
+		return r;
+	if (!u_access_ok(uevents, sizeof *events * n, PROT_WRITE) ||
+	    (umask && !u_access_ok(umask, sizeof *umask, PROT_READ)))
+		return DERR(-EFAULT);
+	if (umask)
+		mask = read_once(umask);
+	l.unlock();
+
+	if (!(events = (epoll_event *)malloc(sizeof *events * n)))
+		return DERR(-ENOMEM);
+
+	if (umask)
+		sig_temporary_mask(&mask);
+
+	r = fs_epoll_wait(epfd, events, n,
+	    timeout < 0 ? -1 : timeout * 1000000LL);
+
+	/* events have been consumed, copy out must not be interrupted */
+	if (r > 0) {
+		u_access_begin();
+		if (u_access_ok(uevents, sizeof *events * r, PROT_WRITE))
+			memcpy(uevents, events, sizeof *events * r);
+		else
+			r = DERR(-EFAULT);
+		u_access_end();
+	}
+
+	free(events);
+	return r == -EINTR ? -EINTR_NORESTART : r;
+}
+
 int
 sc_faccessat(int dirfd, const char *path, int mode, int flags)
 {
@@ -397,6 +849,41 @@ sc_pipe2(int fd[2], int flags)
 	return pipe2(fd, flags);
 }
 
+int
+sc_poll(pollfd *fds, nfds_t nfds, int timeout)
+{
+	return do_poll(fds, nfds, timeout < 0 ? -1 : timeout * 1000000LL,
+	    nullptr);
+}
+
+int
+sc_ppoll(pollfd *fds, nfds_t nfds, const timespec *ts,
+    const k_sigset_t *mask, size_t sigsetsize)
+{
+	return do_ppoll(fds, nfds, ts, mask, sigsetsize);
+}
+
+int
+sc_ppoll32(pollfd *fds, nfds_t nfds, const timespec32 *ts,
+    const k_sigset_t *mask, size_t sigsetsize)
+{
+	return do_ppoll(fds, nfds, ts, mask, sigsetsize);
+}
+
+int
+sc_pselect6(int n, fd_set *rfds, fd_set *wfds, fd_set *efds, timespec *ts,
+    const void *sig)
+{
+	return do_pselect6(n, rfds, wfds, efds, ts, sig);
+}
+
+int
+sc_pselect6_32(int n, fd_set *rfds, fd_set *wfds, fd_set *efds,
+    timespec32 *ts, const void *sig)
+{
+	return do_pselect6(n, rfds, wfds, efds, ts, sig);
+}
+
 int
 sc_rename(const char *from, const char *to)
 {
@@ -425,6 +912,26 @@ sc_rmdir(const char *path)
 	return rmdir(path);
 }
 
+int
+sc_select(int n, fd_set *rfds, fd_set *wfds, fd_set *efds, timeval32 *utv)
+{
+	int_fast64_t timeout = -1;
+	interruptible_lock l(u_access_lock);
+	if (auto r = l.lock(); r < 0)
+		return r;
+	if (utv) {
+		if (!u_access_ok(utv, sizeof *utv, PROT_READ))
+			return DERR(-EFAULT);
+		const timeval32 tv = read_once(utv);
+		if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000)
+			return DERR(-EINVAL);
+		timeout = tv.tv_sec * 1000000000LL + tv.tv_usec * 1000LL;
+	}
+	l.unlock();
+	fd_set *ufds[3] = {rfds, wfds, efds};
+	return do_select(n, ufds, timeout, nullptr);
+}
+
 int
 sc_stat(const char *path, struct stat *st)
 {
@@ -480,6 +987,32 @@ sc_symlinkat(const char *target, int dirfd, const char *path)
 	return symlinkat(target, dirfd, path);
 }
 
+int
+sc_timerfd_gettime(int fd, itimerspec *cur)
+{
+	return do_timerfd_gettime(fd, cur);
+}
+
+int
+sc_timerfd_gettime32(int fd, itimerspec32 *cur)
+{
+	return do_timerfd_gettime(fd, cur);
+}
+
+int
+sc_timerfd_settime(int fd, int flags, const itimerspec *its,
+    itimerspec *old)
+{
+	return do_timerfd_settime(fd, flags, its, old);
+}
+
+int
+sc_timerfd_settime32(int fd, int flags, const itimerspec32 *its,
+    itimerspec32 *old)
+{
+	return do_timerfd_settime(fd, flags, its, old);
+}
+
 int
 sc_umount2(const char *dir, int flags)
 {
@@ -641,3 +1174,29 @@ sc_writev(int fd, const iovec *iov, int count)
 {
 	return do_iov(fd, iov, count, 0, do_writev, PROT_READ);
 }
+
+ssize_t
+sc_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+    size_t len, unsigned flags)
+{
+	return do_splice(off_in, off_out, [&](off_t *in, off_t *out) {
+		return copy_file_range(fd_in, in, fd_out, out, len, flags);
+	});
+}
+
+ssize_t
+sc_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	return do_splice(offset, nullptr, [&](off_t *in, off_t *) {
+		return sendfile(out_fd, in_fd, in, count);
+	});
+}
+
+ssize_t
+sc_splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len,
+    unsigned flags)
+{
+	return do_splice(off_in, off_out, [&](off_t *in, off_t *out) {
+		return splice(fd_in, in, fd_out, out, len, flags);
+	});
+}
@@ -0,0 +1,295 @@
+/*
+ * timerfd.cpp - timer notification file
+ *
+ * A timerfd counts expirations of a kernel timer. Reads return and clear the
+ * expiration count, blocking while it is zero.
+ *
+ * Expirations are counted from the timer thread which can't take the vnode
+ * lock, so timer state is protected by a spinlock and readers wait with the
+ * vnode unlocked.
+ *
+ * Absolute CLOCK_REALTIME deadlines are converted to monotonic time when the
+ * timer is set and are not adjusted if the realtime clock is later changed.
+ */
+
+#include "debug.h"
+#include "file.h"
+#include "poll.h"
+#include "vfs.h"
+#include "vnode.h"
+#include <cstring>
+#include <debug.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <sch.h>
+#include <sync.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <timer.h>
+
+/*
+ * timerfd_data
+ */
+struct timerfd_data {
+	timerfd_data(clockid_t clock)
+	: tmr{}
+	, ticks{0}
+	, clock{clock}
+	{
+		event_init(&event, "timerfd", event::ev_IO);
+		poll_head_init(&poll);
+	}
+
+	a::spinlock_irq lock;	    /* protects tmr & ticks */
+	timer tmr;		    /* kernel timer */
+	uint64_t ticks;		    /* expirations since last read */
+	const clockid_t clock;	    /* clock for absolute deadlines */
+	struct event event;	    /* readers wait here */
+	poll_head poll;		    /* readiness notification */
+};
+
+static ssize_t tfd_read(file *, const iovec *, size_t);
+static int tfd_poll(file *, poll_table *);
+static int tfd_close(file *);
+
+static constinit anon_ops timerfd_ops{
+	.read = tfd_read,
+	.write = nullptr,
+	.poll = tfd_poll,
+	.close = tfd_close,
+};
+
+/*
+ * is_timerfd - check if file is a timerfd
+ */
+static bool
+is_timerfd(const file *fp)
+{
+	return !fp->f_vnode->v_mount && fp->f_vnode->v_data == &timerfd_ops;
+}
+
+/*
+ * ts_valid - check that timespec is in range
+ */
+static bool
+ts_valid(const timespec &ts)
+{
+	return ts.tv_sec >= 0 && ts.tv_nsec >= 0 && ts.tv_nsec < 1000000000;
+}
+
+/*
+ * tfd_expire - timer callout, runs in timer thread
+ */
+static void
+tfd_expire(void *arg)
+{
+	timerfd_data *t = (timerfd_data *)arg;
+
+	{
+		std::lock_guard l{t->lock};
+		++t->ticks;
+		sch_wakeup(&t->event, 0);
+	}
+	poll_wakeup(&t->poll, POLLIN | POLLRDNORM);
+}
+
+/*
+ * tfd_current - get current setting of timer
+ *
+ * Must be called with timer lock held.
+ */
+static itimerspec
+tfd_current(const timerfd_data *t)
+{
+	uint_fast64_t remain = 0;
+	if (t->tmr.active) {
+		/* an expired timer which is yet to run has 1ns remaining */
+		const uint_fast64_t now = timer_monotonic();
+		remain = t->tmr.expire > now ? t->tmr.expire - now : 1;
+	}
+	return {
+		.it_interval = ns_to_ts(t->tmr.interval),
+		.it_value = ns_to_ts(remain),
+	};
+}
+
+/*
+ * tfd_read - read and clear expiration count
+ */
+static ssize_t
+tfd_read(file *fp, const iovec *iov, size_t count)
+{
+	timerfd_data *t = (timerfd_data *)fp->f_data;
+	uint64_t v = 0;
+	int err = 0;
+
+	if (!count || iov->iov_len < sizeof v)
+		return DERR(-EINVAL);
+
+	vn_unlock(fp->f_vnode);
+	{
+		std::unique_lock l{t->lock};
+		while (!t->ticks) {
+			if (fp->f_flags & O_NONBLOCK) {
+				err = -EAGAIN;
+				break;
+			}
+			if ((err = sch_prepare_sleep(&t->event, 0)))
+				break;
+			l.unlock();
+			err = sch_continue_sleep();
+			l.lock();
+			if (err)
+				break;
+		}
+		if (!err) {
+			v = t->ticks;
+			t->ticks = 0;
+		}
+	}
+	vn_lock(fp->f_vnode);
+
+	if (err)
+		return err;
+	memcpy(iov->iov_base, &v, sizeof v);
+	return sizeof v;
+}
+
+/*
+ * tfd_poll - readable when timer has expired since last read
+ */
+static int
+tfd_poll(file *fp, poll_table *pt)
+{
+	timerfd_data *t = (timerfd_data *)fp->f_data;
+
+	poll_wait(&t->poll, pt);
+
+	std::lock_guard l{t->lock};
+	return t->ticks ? POLLIN | POLLRDNORM : 0;
+}
+
+/*
+ * tfd_close - destroy timerfd
+ */
+static int
+tfd_close(file *fp)
+{
+	timerfd_data *t = (timerfd_data *)fp->f_data;
+
+	timer_stop(&t->tmr);
+	poll_head_terminate(&t->poll);
+	delete t;
+	return 0;
+}
+
+/*
+ * timerfd_create - create timerfd using clock
+ */
+int
+timerfd_create(int clock, int flags)
+{
+	vdbgsys("timerfd_create clock=%d flags=%x\n", clock, flags);
+
+	switch (clock) {
+	case CLOCK_BOOTTIME:
+	case CLOCK_MONOTONIC:
+	case CLOCK_REALTIME:
+		break;
+	default:
+		return DERR(-EINVAL);
+	}
+	if (flags & ~(TFD_CLOEXEC | TFD_NONBLOCK))
+		return DERR(-EINVAL);
+
+	timerfd_data *t;
+	if (!(t = new timerfd_data(clock)))
+		return DERR(-ENOMEM);
+
+	const int fd = anon_file(&timerfd_ops, t,
+	    (flags & TFD_CLOEXEC ? O_CLOEXEC : 0) |
+	    (flags & TFD_NONBLOCK ? O_NONBLOCK : 0));
+	if (fd < 0)
+		delete t;
+	return fd;
+}
+
+/*
+ * timerfd_settime - arm or disarm timerfd
+ *
+ * With TFD_TIMER_ABSTIME it_value is an absolute deadline on the clock of the
+ * timerfd. Periodic timers reload from the previous deadline so that they do
+ * not drift. A zero it_value disarms the timer.
+ */
+int
+timerfd_settime(int fd, int flags, const itimerspec *its, itimerspec *old)
+{
+	vdbgsys("timerfd_settime fd=%d flags=%x its=%p old=%p\n",
+	    fd, flags, its, old);
+
+	if (flags & ~TFD_TIMER_ABSTIME)
+		return DERR(-EINVAL);
+	if (!ts_valid(its->it_value) || !ts_valid(its->it_interval))
+		return DERR(-EINVAL);
+
+	auto fp = fs_getfile(fd);
+	if (!fp.ok())
+		return fp.sc_rval();
+	if (!is_timerfd(fp.val())) {
+		fs_putfile(fp.val());
+		return DERR(-EINVAL);
+	}
+
+	timerfd_data *t = (timerfd_data *)fp.val()->f_data;
+	uint_fast64_t value = ts_to_ns(its->it_value);
+	const uint_fast64_t interval = ts_to_ns(its->it_interval);
+
+	{
+		std::lock_guard l{t->lock};
+		if (old)
+			*old = tfd_current(t);
+		timer_stop(&t->tmr);
+		t->ticks = 0;
+		if (value && flags & TFD_TIMER_ABSTIME) {
+			const uint_fast64_t now = t->clock == CLOCK_REALTIME
+			    ? timer_realtime() : timer_monotonic();
+			value = value > now ? value - now : 1;
+		}
+		if (value)
+			timer_callout(&t->tmr, value, interval, tfd_expire,
+			    t);
+		else
+			t->tmr.interval = 0;
+	}
+
+	fs_putfile(fp.val());
+	return 0;
+}
+
+/*
+ * timerfd_gettime - get time remaining until next expiration and interval
+ */
+int
+timerfd_gettime(int fd, itimerspec *its)
+{
+	vdbgsys("timerfd_gettime fd=%d its=%p\n", fd, its);
+
+	auto fp = fs_getfile(fd);
+	if (!fp.ok())
+		return fp.sc_rval();
+	if (!is_timerfd(fp.val())) {
+		fs_putfile(fp.val());
+		return DERR(-EINVAL);
+	}
+
+	timerfd_data *t = (timerfd_data *)fp.val()->f_data;
+	{
+		std::lock_guard l{t->lock};
+		*its = tfd_current(t);
+	}
+
+	fs_putfile(fp.val());
+	return 0;
+}
@@ -8,9 +8,11 @@
 #include <fs.h>
 
 #include "debug.h"
+#include "epoll.h"
 #include "file.h"
 #include "mount.h"
 #include "pipe.h"
+#include "poll.h"
 #include "util.h"
 #include "vnode.h"
 #include <alloca.h>
@@ -29,6 +31,7 @@
 #include <kernel.h>
 #include <linux/stat.h>
 #include <page.h>
+#include <poll.h>
 #include <sch.h>
 #include <sig.h>
 #include <sync.h>
@@ -262,6 +265,20 @@ mount_readonly(const vnode *vp)
 	return vp->v_mount->m_flags & MS_RDONLY;
 }
 
+/*
+ * fp_anon - get operations of anonymous file
+ *
+ * Returns nullptr if file is not an anonymous file.
+ */
+static const anon_ops *
+fp_anon(const file *fp)
+{
+	const vnode *vp = fp->f_vnode;
+	if (vp->v_mount || S_ISFIFO(vp->v_mode))
+		return nullptr;
+	return (const anon_ops *)vp->v_data;
+}
+
 /*
  * lookup_v - Lookup path relative to vnode vp
  *
@@ -690,6 +707,7 @@ fs_openfp(task *t, const int dirfd, const char *path, int flags,
 		.f_offset = 0,
 		.f_vnode = vp,
 	};
+	list_init(&fp->f_epoll);
 
 	/* try to open */
 	if (S_ISFIFO(vp->v_mode))
@@ -723,6 +741,17 @@ vn_reference(vnode *vn)
 	vref(vn);
 }
 
+/*
+ * vn_readonly - check if vnode is on a read only file system
+ *
+ * for use by vm layer
+ */
+bool
+vn_readonly(vnode *vn)
+{
+	return mount_readonly(vn);
+}
+
 /*
  * vn_name - get vnode name
  *
@@ -753,8 +782,17 @@ putfp(file *fp)
 		return 0;
 	}
 
+	/* file can't be referenced again, drop lock to remove from epolls */
+	if (!list_empty(&fp->f_epoll)) {
+		vn_unlock(vp);
+		epoll_release(fp);
+		vn_lock(vp);
+	}
+
 	if (S_ISFIFO(vp->v_mode))
 		err = pipe_close(fp);
+	else if (auto ops = fp_anon(fp); ops)
+		err = ops->close(fp);
 	else
 		err = VOP_CLOSE(fp);
 
@@ -775,6 +813,31 @@ fs_closefp(file *fp)
 	return putfp(fp);
 }
 
+/*
+ * fs_getfile - get referenced file for fd of current task
+ *
+ * The vnode of the file is not locked. The reference must be released with
+ * fs_putfile.
+ */
+expect<file *>
+fs_getfile(int fd)
+{
+	auto fp = task_file_interruptible(task_cur(), fd);
+	if (fp.ok())
+		vn_unlock(fp.val()->f_vnode);
+	return fp;
+}
+
+/*
+ * fs_putfile - release file reference from fs_getfile
+ */
+void
+fs_putfile(file *fp)
+{
+	vn_lock(fp->f_vnode);
+	putfp(fp);
+}
+
 /*
  * fs_thread - filesystem worker thread
  */
@@ -847,6 +910,7 @@ fs_kinit()
 		.f_offset = 0,
 		.f_vnode = vp,
 	};
+	list_init(&t->cwdfp->f_epoll);
 
 	/* try to open */
 	if (VOP_OPEN(t->cwdfp, O_RDONLY, 0))
@@ -1258,7 +1322,7 @@ lseek(int fd, off_t off, int whence)
 
 	vnode *vp = fp->f_vnode;
 
-	if (S_ISFIFO(vp->v_mode)) {
+	if (S_ISFIFO(vp->v_mode) || fp_anon(fp)) {
 		err = DERR(-ESPIPE);
 		goto out;
 	}
@@ -1327,10 +1391,7 @@ do_readv(file *fp, const iovec *iov, int count, off_t offset,
 
 	switch (IFTODT(vp->v_mode)) {
 	case DT_FIFO:
-		res = for_each_iov(iov, count, offset,
-		    [fp](std::span<std::byte> buf, off_t offset) {
-			return pipe_read(fp, data(buf), size(buf), offset);
-		});
+		res = pipe_read(fp, iov, count);
 		break;
 	case DT_CHR:
 		update_offset = false;
@@ -1342,6 +1403,13 @@ do_readv(file *fp, const iovec *iov, int count, off_t offset,
 		res = -EISDIR;
 		break;
 	case DT_UNKNOWN:
+		if (auto ops = fp_anon(fp); ops && ops->read) {
+			update_offset = false;
+			res = ops->read(fp, iov, count);
+			break;
+		}
+		res = -EINVAL;
+		break;
 	case DT_LNK:
 	case DT_SOCK:
 	case DT_WHT:
@@ -1427,6 +1495,31 @@ kpreadv(int fd, const iovec *iov, int count, off_t offset)
 	return do_readv(fp, iov, count, offset, update_offset);
 }
 
+/*
+ * fs_readfp - read from referenced file into kernel buffer
+ *
+ * Reads from *offset and advances it if offset is not null, otherwise reads
+ * from and advances the file position.
+ */
+ssize_t
+fs_readfp(file *fp, void *buf, size_t len, off_t *offset)
+{
+	iovec iov = {
+		.iov_base = buf,
+		.iov_len = len,
+	};
+
+	if (auto err = vn_lock_interruptible(fp->f_vnode); err)
+		return err;
+	++fp->f_count;	/* released by do_readv */
+
+	const ssize_t res = do_readv(fp, &iov, 1,
+	    offset ? *offset : fp->f_offset, !offset);
+	if (offset && res > 0)
+		*offset += res;
+	return res;
+}
+
 ssize_t
 vn_pread(vnode *vp, void *buf, size_t len, off_t offset)
 {
@@ -1456,6 +1549,47 @@ vn_preadv(vnode *vp, const iovec *iov, int count, off_t offset)
 	return do_readv(&f, iov, count, offset, update_offset);
 }
 
+/*
+ * Get address of file data for execute in place mapping.
+ *
+ * Returns nullptr if the file is not stored in memory addressable storage.
+ */
+void *
+kxip(int fd, off_t offset, size_t len)
+{
+	file *fp;
+	if (auto r = task_file_interruptible(&kern_task, fd); !r.ok())
+		return nullptr;
+	else fp = r.val();
+
+	void *res = nullptr;
+	if (IFTODT(fp->f_vnode->v_mode) == DT_BLK)
+		res = VOP_XIP(fp, offset, len);
+
+	putfp(fp);
+	return res;
+}
+
+void *
+vn_xip(vnode *vp, off_t offset, size_t len)
+{
+	/* dummy file */
+	file f = {
+		.f_flags = O_RDONLY,
+		.f_count = 99,
+		.f_offset = 0,
+		.f_data = nullptr,
+		.f_vnode = vp,
+	};
+
+	void *res = nullptr;
+	vn_lock(vp);
+	if (IFTODT(vp->v_mode) == DT_REG)
+		res = VOP_XIP(&f, offset, len);
+	vn_unlock(vp);
+	return res;
+}
+
 /*
  * write
  */
@@ -1482,10 +1616,7 @@ do_writev(file *fp, const iovec *iov, int count, off_t offset,
 
 	switch (IFTODT(vp->v_mode)) {
 	case DT_FIFO:
-		res = for_each_iov(iov, count, offset,
-		    [fp](std::span<std::byte> buf, off_t offset) {
-			return pipe_write(fp, data(buf), size(buf), offset);
-		});
+		res = pipe_write(fp, iov, count);
 		break;
 	case DT_CHR:
 		update_offset = false;
@@ -1497,6 +1628,13 @@ do_writev(file *fp, const iovec *iov, int count, off_t offset,
 		res = -EISDIR;
 		break;
 	case DT_UNKNOWN:
+		if (auto ops = fp_anon(fp); ops && ops->write) {
+			update_offset = false;
+			res = ops->write(fp, iov, count);
+			break;
+		}
+		res = -EINVAL;
+		break;
 	case DT_LNK:
 	case DT_SOCK:
 	case DT_WHT:
@@ -1593,6 +1731,33 @@ kpwritev(int fd, const iovec *iov, int count, off_t offset)
 	return do_writev(fp, iov, count, offset, update_offset);
 }
 
+/*
+ * fs_writefp - write kernel buffer to referenced file
+ *
+ * Writes at *offset and advances it if offset is not null, otherwise writes
+ * at and advances the file position.
+ */
+ssize_t
+fs_writefp(file *fp, const void *buf, size_t len, off_t *offset)
+{
+	iovec iov = {
+		.iov_base = (void*)buf,
+		.iov_len = len,
+	};
+
+	if (auto err = vn_lock_interruptible(fp->f_vnode); err)
+		return err;
+	++fp->f_count;	/* released by do_writev */
+
+	/* append sets file position to end before writing */
+	const off_t pos = offset ? *offset : fp->f_flags & O_APPEND
+	    ? fp->f_vnode->v_size : fp->f_offset;
+	const ssize_t res = do_writev(fp, &iov, 1, pos, !offset);
+	if (offset && res > 0)
+		*offset += res;
+	return res;
+}
+
 /*
  * ioctl
  */
@@ -1667,7 +1832,10 @@ fsync(int fd)
 		return DERR(-EBADF);
 	}
 
-	err = VOP_FSYNC(fp);
+	if (!fp->f_vnode->v_mount)
+		err = DERR(-EINVAL); /* pipe or anonymous file */
+	else
+		err = VOP_FSYNC(fp);
 
 	putfp(fp);
 	return err;
@@ -2205,6 +2373,12 @@ fcntl(int fd, int cmd, ...)
 	case F_SETFL:
 		fp->f_flags = arg;
 		break;
+	case F_GETPIPE_SZ:
+		ret = pipe_get_size(fp);
+		break;
+	case F_SETPIPE_SZ:
+		ret = pipe_set_size(fp, arg);
+		break;
 	default:
 		ret = DERR(-ENOSYS);
 		break;
@@ -2325,6 +2499,8 @@ pipe2(int fd[2], int flags)
 		.f_count = 1,
 		.f_vnode = vp,
 	};
+	list_init(&rfp->f_epoll);
+	list_init(&wfp->f_epoll);
 
 	/* open both ends of pipe */
 	if ((r = pipe_open(rfp, rfp->f_flags, 0)) < 0)
@@ -2365,6 +2541,201 @@ pipe(int fd[2])
 	return pipe2(fd, 0);
 }
 
+/*
+ * anon_file - create file which is not backed by a file system
+ *
+ * data is stored in f_data of the new file. flags may contain O_CLOEXEC and
+ * O_NONBLOCK.
+ *
+ * Returns new file descriptor or -ve error code. data is not released on
+ * failure.
+ */
+int
+anon_file(const anon_ops *ops, void *data, int flags)
+{
+	vdbgsys("anon_file ops=%p data=%p flags=%x\n", ops, data, flags);
+
+	task *t = task_cur();
+	file *fp;
+	vnode *vp;
+	int fd, err;
+
+	if ((err = task_write_lock_interruptible(t)))
+		return err;
+	if ((fd = task_newfd(t, 0)) < 0) {
+		task_write_unlock(t);
+		return DERR(-EMFILE);
+	}
+	t->file[fd] = FP_RESERVED;
+	task_write_unlock(t);
+
+	if (!(vp = vget_anon(ops))) {
+		err = DERR(-ENOMEM);
+		goto out;
+	}
+	if (!(fp = (file *)malloc(sizeof(file)))) {
+		vput(vp);
+		err = DERR(-ENOMEM);
+		goto out;
+	}
+	*fp = (file){
+		.f_flags = O_RDWR | (flags & O_NONBLOCK),
+		.f_count = 1,
+		.f_data = data,
+		.f_vnode = vp,
+	};
+	list_init(&fp->f_epoll);
+	vn_unlock(vp);
+
+	task_write_lock(t);
+	t->file[fd] = (uintptr_t)fp | (flags & O_CLOEXEC ? FF_CLOEXEC : 0);
+	task_write_unlock(t);
+	return fd;
+
+out:
+	task_write_lock(t);
+	t->file[fd] = 0;
+	task_write_unlock(t);
+	return err;
+}
+
+/*
+ * poll
+ */
+struct poll_file {
+	file *fp;		/* referenced file, nullptr if none */
+	poll_entry entry;	/* registration on file poll head */
+};
+
+/*
+ * fs_pollfp - get events ready on referenced file
+ *
+ * Registers pt on the poll head of the file, if any.
+ */
+int
+fs_pollfp(file *fp, poll_table *pt)
+{
+	vnode *vp = fp->f_vnode;
+	int events;
+
+	vn_lock(vp);
+	if (IFTODT(vp->v_mode) == DT_FIFO)
+		events = pipe_poll(fp, pt);
+	else if (auto ops = fp_anon(fp); ops)
+		events = ops->poll ? ops->poll(fp, pt) : vop_ready();
+	else
+		events = VOP_POLL(fp, pt);
+	vn_unlock(vp);
+
+	return events < 0 ? POLLERR : events;
+}
+
+/*
+ * fs_poll - wait for events on files
+ *
+ * timeout is in nanoseconds. 0 returns immediately, < 0 waits forever.
+ *
+ * Files are referenced for the duration of the call so that their poll heads
+ * remain valid while we are registered on them.
+ *
+ * Returns number of fds with events, 0 on timeout or -ve error code.
+ */
+int
+fs_poll(pollfd *fds, size_t nfds, int_fast64_t timeout)
+{
+	task *t = task_cur();
+	poll_file *pf = nullptr;
+	int r = 0;
+	size_t i;
+
+	vdbgsys("fs_poll: fds=%p nfds=%zu timeout=%lld\n", fds, nfds,
+	    (long long)timeout);
+
+	if (nfds && !(pf = (poll_file *)malloc(sizeof *pf * nfds)))
+		return DERR(-ENOMEM);
+
+	for (i = 0; i < nfds; ++i) {
+		pf[i].fp = nullptr;
+		pf[i].entry.head = nullptr;
+		pf[i].entry.wake = nullptr;
+	}
+
+	/* reference files */
+	for (i = 0; i < nfds; ++i) {
+		if (fds[i].fd < 0)
+			continue;
+		auto fp = task_file_interruptible(t, fds[i].fd);
+		if (!fp.ok() && fp.err() != std::errc::bad_file_descriptor) {
+			r = fp.sc_rval();
+			goto out;
+		}
+		if (!fp.ok())
+			continue;
+		pf[i].fp = fp.val();
+		vn_unlock(pf[i].fp->f_vnode);
+	}
+
+	poll_table pt;
+	poll_table_init(&pt);
+	{
+		const uint_fast64_t expire = timer_monotonic() + timeout;
+		bool registered = false, expired = false;
+		while (true) {
+			int n = 0;
+			for (i = 0; i < nfds; ++i) {
+				fds[i].revents = 0;
+				if (fds[i].fd < 0)
+					continue;
+				if (!pf[i].fp) {
+					fds[i].revents = POLLNVAL;
+					++n;
+					continue;
+				}
+				pt.entry = registered ? nullptr : &pf[i].entry;
+				pf[i].entry.events = fds[i].events;
+				const int events = fs_pollfp(pf[i].fp, &pt) &
+				    (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+				if (events) {
+					fds[i].revents = events;
+					++n;
+				}
+			}
+			registered = true;
+
+			if (n || expired || !timeout) {
+				r = n;
+				break;
+			}
+
+			uint_fast64_t ns = 0;
+			if (timeout > 0) {
+				const uint_fast64_t now = timer_monotonic();
+				if (now >= expire) {
+					r = 0;
+					break;
+				}
+				ns = expire - now;
+			}
+
+			if ((r = poll_table_sleep(&pt, ns)) == -ETIMEDOUT)
+				expired = true;
+			else if (r)
+				break;
+		}
+	}
+
+out:
+	for (i = 0; i < nfds; ++i) {
+		if (!pf[i].fp)
+			continue;
+		poll_entry_remove(&pf[i].entry);
+		vn_lock(pf[i].fp->f_vnode);
+		putfp(pf[i].fp);
+	}
+	free(pf);
+	return r;
+}
+
 /*
  * symlink
  */
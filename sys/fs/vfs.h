@@ -30,15 +30,40 @@
 #pragma once
 
 #include <cstddef>
+#include <lib/expect.h>
+#include <sys/types.h>
 
+struct file;
+struct iovec;
 struct mount;
+struct poll_table;
 struct task;
 struct vnode;
 
+/*
+ * Anonymous file operations
+ *
+ * Operations are called with the vnode locked. Null read or write
+ * operations fail with EINVAL, a null poll operation is always ready.
+ */
+struct anon_ops {
+	ssize_t (*read)(file *, const iovec *, size_t);
+	ssize_t (*write)(file *, const iovec *, size_t);
+	int (*poll)(file *, poll_table *);
+	int (*close)(file *);
+};
+
 int lookup_t(task *, int, const char *, vnode **, const char **, size_t *, int);
 int lookup_t_dir(task *, int, const char *, vnode **, const char **, size_t *, int);
 int lookup_t_noexist(task *, int, const char *, vnode **, const char **, size_t *, int);
 
+int anon_file(const anon_ops *, void *, int);
+expect<file *> fs_getfile(int);
+void fs_putfile(file *);
+int fs_pollfp(file *, poll_table *);
+ssize_t fs_readfp(file *, void *, size_t, off_t *);
+ssize_t fs_writefp(file *, const void *, size_t, off_t *);
+
 void vnode_init();
 void mount_init();
 
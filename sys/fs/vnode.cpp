@@ -44,6 +44,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <jhash3.h>
+#include <poll.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <thread.h>
@@ -280,6 +281,31 @@ vget_pipe()
 	return vp;
 }
 
+/*
+ * Allocate a new vnode for anonymous file
+ *
+ * Anonymous files have no mount. v_data points to the file operations.
+ */
+vnode *
+vget_anon(const void *ops)
+{
+	vnode *vp;
+
+	if (!(vp = (vnode *)malloc(sizeof(vnode))))
+		return nullptr;
+
+	*vp = (vnode) {
+		.v_refcnt = 1,
+		.v_data = const_cast<void *>(ops),
+	};
+
+	mutex_init(&vp->v_lock);
+
+	vn_lock(vp);
+
+	return vp;
+}
+
 /*
  * Unlock vnode and decrement its reference count.
  *
@@ -430,6 +456,12 @@ vop_einval()
 	return -EINVAL;
 }
 
+int
+vop_ready()
+{
+	return POLLIN | POLLRDNORM | POLLOUT | POLLWRNORM;
+}
+
 void
 vnode_init()
 {
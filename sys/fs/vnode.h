@@ -35,6 +35,7 @@
 struct dirent;
 struct file;
 struct iovec;
+struct poll_table;
 struct stat;
 
 /*
@@ -94,6 +95,8 @@ typedef	int (*vnop_getattr_fn) (vnode *, vattr *);
 typedef	int (*vnop_setattr_fn) (vnode *, vattr *);
 typedef	int (*vnop_inactive_fn) (vnode *);
 typedef	int (*vnop_truncate_fn) (vnode *);
+typedef	void *(*vnop_xip_fn) (file *, off_t, size_t);
+typedef	int (*vnop_poll_fn) (file *, poll_table *);
 
 struct vnops {
 	vnop_open_fn vop_open;
@@ -112,6 +115,8 @@ struct vnops {
 	vnop_setattr_fn vop_setattr;
 	vnop_inactive_fn vop_inactive;
 	vnop_truncate_fn vop_truncate;
+	vnop_xip_fn vop_xip;
+	vnop_poll_fn vop_poll;
 };
 
 /*
@@ -133,18 +138,22 @@ struct vnops {
 #define VOP_SETATTR(VP, VAP) ((VP)->v_mount->m_op->vfs_vnops->vop_setattr)(VP, VAP)
 #define VOP_INACTIVE(VP) ((VP)->v_mount->m_op->vfs_vnops->vop_inactive)(VP)
 #define VOP_TRUNCATE(VP) ((VP)->v_mount->m_op->vfs_vnops->vop_truncate)(VP)
+#define VOP_XIP(FP, O, L) ((FP)->f_vnode->v_mount->m_op->vfs_vnops->vop_xip)(FP, O, L)
+#define VOP_POLL(FP, PT) ((FP)->f_vnode->v_mount->m_op->vfs_vnops->vop_poll)(FP, PT)
 
 /*
- * Generic null/invalid operations
+ * Generic null/invalid/always ready operations
  */
 int vop_nullop();
 int vop_einval();
+int vop_ready();
 
 /*
  * vnode cache interface
  */
 vnode *vget(struct mount *, vnode *, const char *, size_t);
 vnode *vget_pipe();
+vnode *vget_anon(const void *);
 vnode *vn_lookup(vnode *, const char *, size_t);
 int vn_lock_interruptible(vnode *);
 void vn_lock(vnode *);
@@ -32,11 +32,18 @@ phys mmu_extract(pgd *, void *, size_t, int);
 #endif
 
 #if defined(CONFIG_MPU)
+struct mpu_stats {
+	unsigned long faults;	    /* regions loaded by fault handler */
+	unsigned long switches;	    /* address space switches */
+	unsigned long restores;	    /* regions restored on switch */
+};
+
 void mpu_init(const mmumap*, size_t, int);
 void mpu_switch(const as *);
-void mpu_unmap(const void *, size_t);
-void mpu_map(const void *, size_t, int);
-void mpu_protect(const void *, size_t, int);
+void mpu_unmap(const as *, const void *, size_t);
+void mpu_map(const as *, const void *, size_t, int);
+void mpu_protect(const as *, const void *, size_t, int);
 void mpu_fault(const void *, size_t);
+void mpu_get_stats(mpu_stats *);
 void mpu_dump();
 #endif
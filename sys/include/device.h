@@ -34,6 +34,7 @@
 
 struct file;
 struct iovec;
+struct poll_table;
 struct vnode;
 
 /*
@@ -54,6 +55,9 @@ struct devio {
 	ssize_t (*write)(file *, const iovec *, size_t, off_t);
 	int (*seek)(file *, off_t, int);
 	int (*ioctl)(file *, u_long, void *);
+	int (*fsync)(file *);
+	void *(*xip)(file *, off_t, size_t);
+	int (*poll)(file *, poll_table *);
 };
 
 /*
@@ -14,7 +14,7 @@ struct as;
 struct elf_load_result {
 	void (*entry)();
 	void *sp;
-	std::array<unsigned, 24> auxv;
+	std::array<unsigned, 26> auxv;
 };
 expect<elf_load_result>
 elf_load(as *, int fd);
@@ -29,8 +29,11 @@
 
 #pragma once
 
+#include <list.h>
 #include <queue.h>
 
+struct thread;
+
 /*
  * Event for sleep/wakeup
  */
@@ -57,3 +60,22 @@ struct event {
 	} while (0)
 
 #define event_waiting(event)   (!queue_empty(&(event)->sleepq))
+
+/*
+ * Event with priority inheritance
+ *
+ * While threads are waiting the owner inherits the priority of the highest
+ * priority waiter.
+ */
+struct pi_event {
+	struct event event;		/* event */
+	thread *owner;			/* owner while threads are waiting */
+	list link;			/* linkage on owner's pi_events list */
+};
+
+/* Macro to initialize priority inheritance event dynamically */
+#define pi_event_init(pi, evt_name) \
+	do { \
+		event_init(&(pi)->event, evt_name, event::ev_LOCK); \
+		(pi)->owner = nullptr; \
+	} while (0)
@@ -7,7 +7,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+struct epoll_event;
 struct iovec;
+struct pollfd;
 struct statx;
 struct task;
 struct vnode;
@@ -40,6 +42,7 @@ ssize_t kpreadv(int, const iovec *, int, off_t);
 ssize_t kpwrite(int, const void *, size_t, off_t);
 ssize_t kpwritev(int, const iovec *, int, off_t);
 int kioctl(int, int, ...);
+void *kxip(int, off_t, size_t);
 
 /*
  * These functions deal directly with vnodes.
@@ -49,6 +52,8 @@ void vn_reference(vnode *);
 void vn_close(vnode *);
 ssize_t vn_pread(vnode *, void *, size_t, off_t);
 ssize_t vn_preadv(vnode *, const iovec *, int, off_t);
+void *vn_xip(vnode *, off_t, size_t);
+bool vn_readonly(vnode *);
 char *vn_name(vnode *);
 
 /*
@@ -56,6 +61,12 @@ char *vn_name(vnode *);
  */
 int statx(int, const char *, int, unsigned int, struct statx *);
 
+/*
+ * Wait for events on files of the current task.
+ */
+int fs_poll(pollfd *, size_t, int_fast64_t);
+int fs_epoll_wait(int, epoll_event *, int, int_fast64_t);
+
 namespace std {
 
 template<>
@@ -18,17 +18,7 @@ struct task;
 
 #define FUTEX_OWNER_DIED	0x40000000
 #define FUTEX_WAITERS           0x80000000
-
-/*
- * futex state stored on task
- */
-struct futexes {
-	union {
-		char storage[12];
-		unsigned align;
-	};
-};
+#define FUTEX_TID_MASK		0x3fffffff
 
 int futex(task *, int *, int, int, void *, int *);
-void futexes_init(futexes *);
-void futexes_destroy(futexes *);
+void futex_init();
@@ -29,6 +29,9 @@
 
 #pragma once
 
+#include <conf/config.h>
+#include <cstdint>
+
 struct irq;
 
 /*
@@ -46,3 +49,14 @@ void irq_restore(int);
 void irq_dump();
 void irq_handler(int);
 void irq_init();
+
+#if defined(CONFIG_IRQ_TRACE)
+/*
+ * Interrupt latency tracing
+ */
+int irq_trace_disable(const void *);
+void irq_trace_restore(int, const void *);
+void irq_trace_isr(int, uint_fast64_t, const void *);
+void irq_trace_ist(int, uint_fast64_t, const void *);
+void irq_trace_init();
+#endif
@@ -99,3 +99,17 @@ list_remove(list *node)
 	     &ptr->member != (head);					\
 	     ptr = tmp,							\
 		     tmp = list_entry(tmp->member.next, typeof(*tmp), member))
+
+/*
+ * iterate over list of given type starting at ptr - safe against removal of
+ * list entry
+ * ptr:    the type * to use as a loop counter, initialised to first entry.
+ * tmp:    temporary storage, same as ptr
+ * head:   the head for your list.
+ * member: the name of the list_struct within the struct.
+ */
+#define list_for_each_entry_safe_from(ptr, tmp, head, member)		\
+	for (tmp = list_entry(ptr->member.next, typeof(*ptr), member);	\
+	     &ptr->member != (head);					\
+	     ptr = tmp,							\
+		     tmp = list_entry(tmp->member.next, typeof(*tmp), member))
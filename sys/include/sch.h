@@ -29,10 +29,12 @@
 
 #pragma once
 
+#include <conf/config.h>
 #include <cstdint>
 #include <queue.h>
 
 struct event;
+struct pi_event;
 struct thread;
 
 /*
@@ -52,8 +54,10 @@ extern "C" void sch_switch();
 thread *sch_active();
 unsigned sch_wakeup(event *, int);
 thread *sch_wakeone(event *);
+thread *sch_wakeone_pi(pi_event *);
 thread *sch_requeue(event *, event *);
 int sch_prepare_sleep(event *, uint_fast64_t);
+int sch_prepare_sleep_pi(pi_event *, thread *, uint_fast64_t);
 int sch_continue_sleep();
 void sch_cancel_sleep();
 void sch_unsleep(thread *, int);
@@ -61,7 +65,10 @@ void sch_signal(thread *);
 void sch_suspend(thread *);
 void sch_resume(thread *);
 void sch_suspend_resume(thread *, thread *);
-void sch_elapse(uint_fast32_t);
+void sch_elapse(uint_fast64_t);
+#if defined(CONFIG_TICKLESS)
+uint_fast32_t sch_timeleft();
+#endif
 void sch_start(thread *);
 void sch_stop(thread *);
 bool sch_testexit();
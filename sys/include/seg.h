@@ -11,6 +11,7 @@ struct seg;
 struct vnode;
 
 expect<const seg *> as_find_seg(const as *, const void *);
+bool as_overlaps(const as *, const void *, size_t);
 void *seg_begin(const seg *);
 void *seg_end(const seg *);
 size_t seg_size(const seg *);
@@ -14,6 +14,7 @@ void sig_thread(thread *, int);
 bool sig_unblocked_pending(thread *);
 k_sigset_t sig_block_all();
 void sig_restore(const k_sigset_t *);
+void sig_temporary_mask(const k_sigset_t *);
 void sig_exec(task *);
 void sig_wait();
 extern "C" int sig_deliver(int);
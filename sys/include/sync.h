@@ -49,7 +49,7 @@ struct cond {
 
 struct mutex {
 	union {
-		char storage[28];
+		char storage[40];
 		unsigned align;
 	};
 };
@@ -6,12 +6,17 @@
  * Note: this file must compile as C.
  */
 
+#include <poll.h>
 #include <stdint.h>
+#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 struct dirent;
+struct epoll_event;
 struct iovec;
+struct itimerspec32;
+struct itimerspec;
 struct k_itimerval;
 struct k_sigaction;
 struct k_sigset_t;
@@ -22,6 +27,7 @@ struct statfs;
 struct statx;
 struct timespec32;
 struct timespec;
+struct timeval32;
 struct utsname;
 
 #if defined(__cplusplus)
@@ -48,6 +54,8 @@ int sc_access(const char *, int);
 int sc_chdir(const char*);
 int sc_chmod(const char *, mode_t);
 int sc_chown(const char *, uid_t, gid_t);
+int sc_epoll_ctl(int, int, int, struct epoll_event *);
+int sc_epoll_pwait(int, struct epoll_event *, int, int, const struct k_sigset_t *, size_t);
 int sc_faccessat(int, const char *, int, int);
 int sc_fchmodat(int, const char *, mode_t, int);
 int sc_fchownat(int, const char *, uid_t, gid_t, int);
@@ -70,15 +78,25 @@ int sc_open(const char *, int, int);
 int sc_openat(int, const char*, int, int);
 int sc_pipe(int [2]);
 int sc_pipe2(int [2], int);
+int sc_poll(struct pollfd *, nfds_t, int);
+int sc_ppoll(struct pollfd *, nfds_t, const struct timespec *, const struct k_sigset_t *, size_t);
+int sc_ppoll32(struct pollfd *, nfds_t, const struct timespec32 *, const struct k_sigset_t *, size_t);
+int sc_pselect6(int, fd_set *, fd_set *, fd_set *, struct timespec *, const void *);
+int sc_pselect6_32(int, fd_set *, fd_set *, fd_set *, struct timespec32 *, const void *);
 int sc_rename(const char*, const char*);
 int sc_renameat(int, const char*, int, const char*);
 int sc_rmdir(const char*);
+int sc_select(int, fd_set *, fd_set *, fd_set *, struct timeval32 *);
 int sc_stat(const char *, struct stat *);
 int sc_statfs(const char *, size_t, struct statfs *);
 int sc_statx(int, const char *, int, unsigned, struct statx *);
 int sc_symlink(const char*, const char*);
 int sc_symlinkat(const char*, int, const char*);
 int sc_sync(void);
+int sc_timerfd_gettime(int, struct itimerspec *);
+int sc_timerfd_gettime32(int, struct itimerspec32 *);
+int sc_timerfd_settime(int, int, const struct itimerspec *, struct itimerspec *);
+int sc_timerfd_settime32(int, int, const struct itimerspec32 *, struct itimerspec32 *);
 int sc_umount2(const char *, int);
 int sc_unlink(const char *);
 int sc_unlinkat(int, const char *, int);
@@ -91,6 +109,9 @@ ssize_t sc_readlinkat(int, const char *, char *, size_t);
 ssize_t sc_readv(int, const struct iovec *, int);
 ssize_t sc_write(int, const void *, size_t);
 ssize_t sc_writev(int, const struct iovec *, int);
+ssize_t sc_copy_file_range(int, off_t *, int, off_t *, size_t, unsigned);
+ssize_t sc_sendfile(int, int, off_t *, size_t);
+ssize_t sc_splice(int, off_t *, int, off_t *, size_t, unsigned);
 long sc_mmap2(void *, size_t, int, int, int, int);
 int sc_munmap(void *, size_t);
 int sc_mprotect(void *, size_t, int);
@@ -49,7 +49,6 @@ struct task {
 	int suscnt;			/* suspend counter */
 	unsigned capability;		/* security permission flag */
 	task *parent;			/* parent task */
-	struct futexes	futexes;	/* futex state for task */
 	itimer itimer_prof;		/* interval timer ITIMER_PROF */
 	itimer itimer_virtual;		/* interval timer ITIMER_VIRTUAL */
 	timer itimer_real;		/* interval timer ITIMER_REAL */
@@ -111,6 +110,5 @@ int task_resume(task *);
 int task_path(task *, const char *);
 bool task_capable(unsigned);
 bool task_access(task *);
-futexes *task_futexes(task *);
 void task_dump();
 void task_init();
@@ -52,10 +52,14 @@ struct thread {
 	int timeleft;		/* remaining nanoseconds to run */
 	uint_fast64_t time;	/* total running time (nanoseconds) */
 	event *slpevt;		/* sleep event */
+	pi_event *pi_blocked;	/* priority inheritance event waiting on */
+	list pi_events;		/* owned priority inheritance events */
 	int slpret;		/* sleep result code */
 	timer timeout;		/* thread timer */
 	k_sigset_t sig_pending;	/* bitmap of pending signals */
 	k_sigset_t sig_blocked;	/* bitmap of blocked signals */
+	k_sigset_t sig_saved;	/* signal mask to restore on return */
+	bool sig_saved_valid;	/* sig_saved must be restored */
 	void *kstack;		/* base address of kernel stack */
 	int *clear_child_tid;	/* clear & futex_wake this on exit */
 	context ctx;		/* machine specific context */
@@ -9,6 +9,16 @@ struct timespec32 {
 	int32_t tv_nsec;
 };
 
+struct itimerspec32 {
+	timespec32 it_interval;
+	timespec32 it_value;
+};
+
+struct timeval32 {
+	int32_t tv_sec;
+	int32_t tv_usec;
+};
+
 /*
  * kernel itimerval uses native 'long' types except for x32
  */
@@ -29,10 +29,13 @@
 
 #pragma once
 
+#include <conf/config.h>
 #include <event.h>
 #include <list.h>
 #include <types.h>
 
+struct thread;
+struct time_page;
 struct timespec32;
 struct timespec;
 struct timeval;
@@ -40,6 +43,7 @@ struct timeval;
 struct timer {
 	list link;			/* linkage on timer chain */
 	int active;			/* true if active */
+	unsigned slot;			/* timer wheel slot */
 	uint_fast64_t expire;		/* expire time (nsec) */
 	uint_fast64_t interval;		/* time interval (nsec) */
 	void (*func)(void *);		/* function to call */
@@ -62,10 +66,20 @@ void timer_callout(timer *, uint_fast64_t, uint_fast64_t, void (*)(void *), void
 void timer_redirect(timer *, void (*)(void *), void *);
 void timer_stop(timer *);
 uint_fast64_t timer_delay(uint_fast64_t);
+#if defined(CONFIG_TICKLESS)
+void timer_tick(uint_fast64_t);
+uint_fast64_t timer_switch(thread *);
+#else
 void timer_tick(uint_fast64_t, uint_fast32_t);
+#endif
 uint_fast64_t timer_monotonic();
 uint_fast64_t timer_monotonic_coarse();
+#if defined(CONFIG_TICKLESS)
+void timer_program(uint_fast64_t);
+#endif
 int timer_realtime_set(uint_fast64_t);
 uint_fast64_t timer_realtime();
 uint_fast64_t timer_realtime_coarse();
+const time_page *timer_time_page();
+void timer_time_page_counter(const volatile uint32_t *, uint32_t);
 void timer_init();
@@ -9,8 +9,10 @@
 #include <elf_native.h>
 #include <errno.h>
 #include <kernel.h>
+#include <lib/time_page.h>
 #include <mmap.h>
 #include <sys/mman.h>
+#include <timer.h>
 #include <unistd.h>
 #include <vm.h>
 
@@ -178,7 +180,9 @@ elf_load(as *a, int fd)
 	res.auxv[16] = AT_GID;	    res.auxv[17] = 500;
 	res.auxv[18] = AT_EGID;	    res.auxv[19] = 500;
 	res.auxv[20] = AT_HWCAP;    res.auxv[21] = arch_elf_hwcap();
-	res.auxv[22] = AT_NULL;	    res.auxv[23] = 0; /* terminating entry */
+	res.auxv[22] = AT_APEX_TIME;
+	res.auxv[23] = (uintptr_t)timer_time_page();
+	res.auxv[24] = AT_NULL;	    res.auxv[25] = 0; /* terminating entry */
 
 	return res;
 }
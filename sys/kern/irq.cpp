@@ -68,6 +68,7 @@
 #include <sections.h>
 #include <sync.h>
 #include <thread.h>
+#include <timer.h>
 
 struct irq {
 	int vector;			/* vector number */
@@ -78,6 +79,9 @@ struct irq {
 	void *data;			/* handler data */
 	struct thread *thread;		/* thread id of ist */
 	event istevt;			/* event for ist */
+#if defined(CONFIG_IRQ_TRACE)
+	uint_fast64_t istwake;		/* time ist was requested */
+#endif
 };
 
 static void irq_thread(void *);
@@ -170,9 +174,13 @@ irq_detach(irq *i)
 int
 irq_disable()
 {
+#if defined(CONFIG_IRQ_TRACE)
+	return irq_trace_disable(__builtin_return_address(0));
+#else
 	int s;
 	interrupt_save_disable(&s);
 	return s;
+#endif
 }
 
 /*
@@ -183,7 +191,11 @@ irq_disable()
 void
 irq_restore(int s)
 {
+#if defined(CONFIG_IRQ_TRACE)
+	irq_trace_restore(s, __builtin_return_address(0));
+#else
 	interrupt_restore(s);
+#endif
 }
 
 /*
@@ -215,6 +227,12 @@ irq_thread(void *arg)
 		}
 		i->istreq--;
 		assert(i->istreq >= 0);
+#if defined(CONFIG_IRQ_TRACE)
+		if (i->istwake) {
+			irq_trace_ist(vec, i->istwake, (const void *)func);
+			i->istwake = 0;
+		}
+#endif
 		interrupt_enable();
 
 		/*
@@ -256,6 +274,10 @@ irq_handler(int vector)
 	irq *i;
 	int rc;
 
+#if defined(CONFIG_IRQ_TRACE)
+	const uint_fast64_t start = timer_monotonic();
+#endif
+
 	const int s = spinlock_lock_irq_disable(&lock);
 	i = irq_table[vector];
 	spinlock_unlock_irq_restore(&lock, s);
@@ -275,10 +297,18 @@ irq_handler(int vector)
 		 * Kick IST
 		 */
 		assert(i->ist);
+#if defined(CONFIG_IRQ_TRACE)
+		if (!i->istwake)
+			i->istwake = start;
+#endif
 		i->istreq++;
 		sch_wakeup(&i->istevt, 0);
 		assert(i->istreq != 0);
 	}
+
+#if defined(CONFIG_IRQ_TRACE)
+	irq_trace_isr(vector, start, (const void *)i->isr);
+#endif
 }
 
 /*
@@ -0,0 +1,287 @@
+/*
+ * irq_trace.cpp - interrupt latency tracing
+ */
+
+/*
+ * Measures how long interrupts are disabled by irq_disable, how long
+ * interrupt service routines run and how long it takes from an interrupt
+ * to the start of its interrupt service thread.
+ *
+ * Each measurement is counted in a histogram. The worst cases are kept
+ * along with the code which caused them: the callers of irq_disable and
+ * irq_restore for disabled intervals and the handler for interrupts.
+ *
+ * Results are read as text from /dev/irqtrace. Writing to /dev/irqtrace
+ * clears all results.
+ */
+
+#include <irq.h>
+
+#include <arch/interrupt.h>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <device.h>
+#include <errno.h>
+#include <fs/file.h>
+#include <fs/util.h>
+#include <lib/latency_hist.h>
+#include <sections.h>
+#include <sys/uio.h>
+#include <timer.h>
+
+namespace {
+
+using hist = latency_hist<32, 8>;
+
+struct trace {
+	hist off;		/* interrupts disabled by irq_disable */
+	hist isr;		/* interrupt service routine run time */
+	hist ist;		/* interrupt to service thread start */
+};
+
+/*
+ * /dev/irqtrace snapshot
+ */
+struct report {
+	trace tr;
+	size_t len;		/* length of text in buf */
+	size_t pos;		/* read position in buf */
+	char buf[6144];
+};
+
+__fast_bss trace tr;
+__fast_bss bool off_valid;		/* interrupts disabled by irq_disable */
+__fast_bss uint_fast64_t off_start;	/* time interrupts were disabled */
+__fast_bss const void *off_from;	/* caller of irq_disable */
+
+/*
+ * elapsed - nanoseconds from start to end
+ */
+uint32_t
+elapsed(uint_fast64_t start, uint_fast64_t end)
+{
+	if (end < start)
+		return 0;
+	const uint_fast64_t ns = end - start;
+	return ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+/*
+ * record - add latency to histogram with interrupts disabled
+ */
+void
+record(hist &h, uint32_t ns, int id, const void *from, const void *to)
+{
+	int s;
+	interrupt_save_disable(&s);
+	h.add(ns, id, from, to);
+	interrupt_restore(s);
+}
+
+}
+
+/*
+ * irq_trace_disable - disable interrupts for caller at address from
+ */
+int
+irq_trace_disable(const void *from)
+{
+	const bool enabled = interrupt_enabled();
+	int s;
+	interrupt_save_disable(&s);
+	if (enabled) {
+		/* timer_monotonic may disable interrupts again */
+		off_valid = false;
+		off_start = timer_monotonic();
+		off_from = from;
+		off_valid = true;
+	}
+	return s;
+}
+
+/*
+ * irq_trace_restore - restore interrupts for caller at address to
+ */
+void
+irq_trace_restore(int s, const void *to)
+{
+	if (!off_valid) {
+		interrupt_restore(s);
+		return;
+	}
+
+	/* an interrupt may disable interrupts again as soon as they are
+	 * enabled, so everything is sampled beforehand */
+	off_valid = false;
+	const uint_fast64_t start = off_start;
+	const void *from = off_from;
+	const uint_fast64_t end = timer_monotonic();
+	interrupt_restore(s);
+	if (!interrupt_enabled()) {
+		/* nested irq_disable */
+		off_valid = true;
+		return;
+	}
+	record(tr.off, elapsed(start, end), 0, from, to);
+}
+
+/*
+ * irq_trace_isr - record run time of interrupt service routine isr
+ */
+void
+irq_trace_isr(int vector, uint_fast64_t start, const void *isr)
+{
+	record(tr.isr, elapsed(start, timer_monotonic()), vector, isr, nullptr);
+}
+
+/*
+ * irq_trace_ist - record latency from interrupt to interrupt service
+ *		   thread ist
+ */
+void
+irq_trace_ist(int vector, uint_fast64_t start, const void *ist)
+{
+	record(tr.ist, elapsed(start, timer_monotonic()), vector, ist, nullptr);
+}
+
+/*
+ * format - append text for histogram h to report r
+ */
+static void
+format(report *r, const char *name, const hist &h)
+{
+	auto print = [r](const char *fmt, auto ...args) {
+		if (r->len >= sizeof(r->buf))
+			return;
+		const int n = snprintf(r->buf + r->len,
+		    sizeof(r->buf) - r->len, fmt, args...);
+		if (n > 0)
+			r->len = std::min(r->len + n, sizeof(r->buf));
+	};
+
+	hist::record w[8];
+	h.worst(w);
+	const unsigned long long n = h.count();
+	print("%s: count %llu mean %llu max %lu ns\n", name, n,
+	    n ? h.total() / n : 0ull, (unsigned long)w[0].ns);
+
+	for (size_t i = 0; i < 32; ++i) {
+		if (!h.bucket(i))
+			continue;
+		if (i == 31)
+			print("  >= %10lu ns %10lu\n", 1ul << (i - 1),
+			    (unsigned long)h.bucket(i));
+		else
+			print("  <  %10lu ns %10lu\n", 1ul << i,
+			    (unsigned long)h.bucket(i));
+	}
+
+	for (const auto &e : w) {
+		if (!e.from && !e.to)
+			continue;
+		if (e.to)
+			print("  worst %10lu ns %p -> %p\n",
+			    (unsigned long)e.ns, e.from, e.to);
+		else
+			print("  worst %10lu ns irq %d %p\n",
+			    (unsigned long)e.ns, e.id, e.from);
+	}
+}
+
+/*
+ * /dev/irqtrace interface
+ */
+static int
+irqtrace_open(file *file)
+{
+	report *r = (report *)malloc(sizeof(report));
+	if (!r)
+		return -ENOMEM;
+
+	int s;
+	interrupt_save_disable(&s);
+	r->tr = tr;
+	interrupt_restore(s);
+
+	r->len = 0;
+	r->pos = 0;
+	format(r, "irq off", r->tr.off);
+	format(r, "isr", r->tr.isr);
+	format(r, "ist latency", r->tr.ist);
+
+	file->f_data = r;
+	return 0;
+}
+
+static int
+irqtrace_close(file *file)
+{
+	report *r = (report *)file->f_data;
+	if (!r)
+		return -EBADF;
+
+	file->f_data = nullptr;
+	free(r);
+	return 0;
+}
+
+static ssize_t
+irqtrace_read_iov(file *file, const iovec *iov, size_t count, off_t offset)
+{
+	report *r = (report *)file->f_data;
+	if (!r)
+		return -EBADF;
+
+	/* character devices have no file offset, so position is per open */
+	return for_each_iov(iov, count, offset,
+	    [r](std::span<std::byte> buf, off_t) -> ssize_t {
+		const size_t n = std::min(size(buf), r->len - r->pos);
+		memcpy(data(buf), r->buf + r->pos, n);
+		r->pos += n;
+		return n;
+	});
+}
+
+/*
+ * Writing any data clears all results.
+ */
+static ssize_t
+irqtrace_write_iov(file *file, const iovec *iov, size_t count, off_t offset)
+{
+	ssize_t res = 0;
+	while (count--) {
+		res += iov->iov_len;
+		++iov;
+	}
+
+	int s;
+	interrupt_save_disable(&s);
+	tr.off.reset();
+	tr.isr.reset();
+	tr.ist.reset();
+	interrupt_restore(s);
+
+	return res;
+}
+
+/*
+ * Device I/O table
+ */
+static devio irqtrace_io = {
+	.open = irqtrace_open,
+	.close = irqtrace_close,
+	.read = irqtrace_read_iov,
+	.write = irqtrace_write_iov,
+};
+
+/*
+ * Initialize
+ */
+void
+irq_trace_init()
+{
+	device *d = device_create(&irqtrace_io, "irqtrace", DF_CHR, nullptr);
+	assert(d);
+}
@@ -40,6 +40,7 @@
 #include <exec.h>
 #include <fcntl.h>
 #include <fs.h>
+#include <futex.h>
 #include <irq.h>
 #include <kernel.h>
 #include <kmem.h>
@@ -107,6 +108,7 @@ kernel_main(unsigned long archive_addr, unsigned long archive_size,
 	thread_init();
 	sch_init();
 	timer_init();
+	futex_init();
 
 	/*
 	 * Create boot thread then run idle loop.
@@ -186,6 +188,9 @@ boot_thread(void *arg)
 	null_init();
 	zero_init();
 	kmsg_init();
+#if defined(CONFIG_IRQ_TRACE)
+	irq_trace_init();
+#endif
 	machine_driver_init(args);
 
 	/*
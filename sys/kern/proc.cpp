@@ -138,7 +138,6 @@ proc_reap_zombie(task *t)
 	list_remove(&t->link);
 	sch_unlock();
 	fs_exit(t);
-	futexes_destroy(task_futexes(t));
 	as_modify_begin(t->as);
 	as_destroy(t->as);
 	t->magic = 0;
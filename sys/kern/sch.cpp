@@ -88,7 +88,9 @@
 #include <sch.h>
 
 #include <arch/context.h>
+#include <algorithm>
 #include <arch/interrupt.h>
+#include <bit>
 #include <cassert>
 #include <compiler.h>
 #include <debug.h>
@@ -112,7 +114,6 @@
 #define DPC_FREE	0x4470463f	/* 'DpF?' */
 #define DPC_PENDING	0x4470503f	/* 'DpP?' */
 
-static queue runq;		/* run queue */
 static queue dpcq;		/* DPC queue */
 static event dpc_event;		/* event for DPC */
 
@@ -122,6 +123,51 @@ __attribute__((used)) __fast_data thread *active_thread = &idle_thread;
 __fast_bss static int resched;
 __fast_bss static int locks;
 
+/*
+ * Run queue.
+ *
+ * Each priority level has its own FIFO queue. A bit is set in map for each
+ * priority level with a non-empty queue and a bit is set in summary for each
+ * non-zero word in map. Bits are stored most significant first so that the
+ * highest priority (lowest number) runnable thread can be found with two
+ * count leading zeros operations.
+ */
+#define RUNQ_WORD_BITS 32
+#define RUNQ_WORDS ((PRI_MIN + 1) / RUNQ_WORD_BITS)
+
+static_assert(RUNQ_WORDS <= RUNQ_WORD_BITS);
+
+__fast_bss static struct {
+	queue q[PRI_MIN + 1];		/* per-priority thread queues */
+	uint32_t map[RUNQ_WORDS];	/* non-empty queue bitmap */
+	uint32_t summary;		/* non-zero map word bitmap */
+} runq;
+
+/*
+ * Mark priority level as having runnable threads.
+ */
+static void
+runq_map_set(int prio)
+{
+	const int w = prio / RUNQ_WORD_BITS;
+	runq.map[w] |= 0x80000000u >> (prio % RUNQ_WORD_BITS);
+	runq.summary |= 0x80000000u >> w;
+}
+
+/*
+ * Mark priority level as having no runnable threads if its queue is empty.
+ */
+static void
+runq_map_update(int prio)
+{
+	if (!queue_empty(&runq.q[prio]))
+		return;
+	const int w = prio / RUNQ_WORD_BITS;
+	runq.map[w] &= ~(0x80000000u >> (prio % RUNQ_WORD_BITS));
+	if (!runq.map[w])
+		runq.summary &= ~(0x80000000u >> w);
+}
+
 /*
  * Return priority of highest-priority runnable thread.
  */
@@ -130,11 +176,11 @@ runq_top()
 {
 	assert(!interrupt_enabled());
 
-	if (queue_empty(&runq))
+	if (!runq.summary)
 		return PRI_MIN + 1;
 
-	thread *th = queue_entry(queue_first(&runq), thread, link);
-	return th->prio;
+	const int w = std::countl_zero(runq.summary);
+	return w * RUNQ_WORD_BITS + std::countl_zero(runq.map[w]);
 }
 
 /*
@@ -157,15 +203,8 @@ runq_enqueue(thread *th)
 	assert(!interrupt_enabled());
 	assert(thread_runnable(th));
 
-	queue *q = queue_first(&runq);
-	while (!queue_end(&runq, q)) {
-		thread *qth = queue_entry(q, thread, link);
-		if (th->prio < qth->prio)
-			break;
-		q = queue_next(q);
-	}
-
-	queue_insert(queue_prev(q), &th->link);
+	enqueue(&runq.q[th->prio], &th->link);
+	runq_map_set(th->prio);
 
 	/* it is only preemption when resched is not pending */
 	if (th->prio < active_thread->prio && resched == 0)
@@ -181,15 +220,8 @@ runq_insert(thread *th)
 {
 	assert(!interrupt_enabled());
 
-	queue *q = queue_first(&runq);
-	while (!queue_end(&runq, q)) {
-		thread *qth = queue_entry(q, thread, link);
-		if (th->prio <= qth->prio)
-			break;
-		q = queue_next(q);
-	}
-
-	queue_insert(queue_prev(q), &th->link);
+	queue_insert(&runq.q[th->prio], &th->link);
+	runq_map_set(th->prio);
 }
 
 /*
@@ -201,10 +233,11 @@ runq_dequeue()
 {
 	assert(!interrupt_enabled());
 
-	thread *th;
+	const int prio = runq_top();
+	assert(prio <= PRI_MIN);
 
-	th = queue_entry(queue_first(&runq), thread, link);
-	queue_remove(&th->link);
+	thread *th = queue_entry(dequeue(&runq.q[prio]), thread, link);
+	runq_map_update(prio);
 	return th;
 }
 
@@ -217,6 +250,7 @@ runq_remove(thread *th)
 	assert(!interrupt_enabled());
 
 	queue_remove(&th->link);
+	runq_map_update(th->prio);
 }
 
 /*
@@ -231,6 +265,120 @@ schedule()
 		arch_schedule();
 }
 
+/*
+ * Change the priority of a thread and adjust its run queue position.
+ *
+ * The rescheduling flag is set if the active thread is lowered below the
+ * highest priority runnable thread.
+ */
+static void
+runq_setprio(thread *th, int prio)
+{
+	assert(!interrupt_enabled());
+
+	if (th->prio == prio)
+		return;
+	if (th == active_thread) {
+		th->prio = prio;
+		/* it is only preemption when resched is not pending */
+		if (prio > runq_top() && resched == 0)
+			resched = RESCHED_PREEMPT;
+	} else if (thread_runnable(th)) {
+		runq_remove(th);
+		th->prio = prio;
+		runq_enqueue(th);
+	} else
+		th->prio = prio;
+}
+
+/*
+ * pi_inherit - apply priority inherited from waiters to prio.
+ *
+ * Returns the highest of prio and the priority of any thread waiting on a
+ * priority inheritance event owned by th.
+ */
+static int
+pi_inherit(const thread *th, int prio)
+{
+	const pi_event *pi;
+	list_for_each_entry(pi, &th->pi_events, link) {
+		const queue *head = &pi->event.sleepq;
+		for (const queue *q = queue_first(head); !queue_end(head, q);
+		    q = queue_next(q))
+			prio = std::min(prio, queue_entry(q, thread, link)->prio);
+	}
+	return prio;
+}
+
+/*
+ * pi_adjust - recalculate inherited priority along a blocking chain.
+ *
+ * Starting at th, each owner in the chain of priority inheritance events is
+ * updated until a priority stops changing. A chain which loops back to th
+ * is a deadlock and is only walked once.
+ */
+static void
+pi_adjust(thread *th)
+{
+	assert(!interrupt_enabled());
+
+	for (thread *o = th; o;) {
+		const int prio = pi_inherit(o, o->baseprio);
+		if (prio == o->prio)
+			break;
+		runq_setprio(o, prio);
+		if (!o->pi_blocked || (o = o->pi_blocked->owner) == th)
+			break;
+	}
+}
+
+/*
+ * pi_set_owner - set owner of priority inheritance event.
+ *
+ * An event is only linked to its owner while threads are waiting on it.
+ */
+static void
+pi_set_owner(pi_event *pi, thread *owner)
+{
+	assert(!interrupt_enabled());
+
+	if (!event_waiting(&pi->event))
+		owner = nullptr;
+	thread *prev = pi->owner;
+	if (prev == owner)
+		return;
+	if (prev) {
+		list_remove(&pi->link);
+		pi->owner = nullptr;
+		pi_adjust(prev);
+	}
+	if (owner) {
+		list_insert(&owner->pi_events, &pi->link);
+		pi->owner = owner;
+		pi_adjust(owner);
+	}
+}
+
+/*
+ * pi_unblock - thread has been removed from priority inheritance event.
+ */
+static void
+pi_unblock(thread *th)
+{
+	assert(!interrupt_enabled());
+
+	pi_event *pi = th->pi_blocked;
+	if (!pi)
+		return;
+	th->pi_blocked = nullptr;
+	if (!pi->owner)
+		return;
+	if (!event_waiting(&pi->event))
+		pi_set_owner(pi, nullptr);
+	else
+		pi_adjust(pi->owner);
+}
+
 /*
  * sleep_expire - sleep timer is expired:
  *
@@ -292,6 +440,20 @@ sch_switch()
 		return;
 	active_thread = next;
 
+#if defined(CONFIG_TICKLESS)
+	/*
+	 * There is no periodic tick to charge running time so charge the
+	 * previous thread now.
+	 */
+	const uint_fast64_t ns = timer_switch(prev);
+	prev->time += ns;
+	if (prev->policy == SCHED_RR) {
+		prev->timeleft -= ns;
+		if (prev->timeleft <= 0)
+			prev->timeleft = QUANTUM;
+	}
+#endif
+
 	/*
 	 * Queue zombie for deletion
 	 */
@@ -353,6 +515,7 @@ sch_wakeup(event *evt, int result)
 		th->slpevt = nullptr;
 		th->state &= ~TH_SLEEP;
 		timer_stop(&th->timeout);
+		pi_unblock(th);
 		if (th != active_thread)
 			runq_enqueue(th);
 		++n;
@@ -397,7 +560,8 @@ sch_wakeone(event *evt)
 		top->slpevt = nullptr;
 		top->state &= ~TH_SLEEP;
 		timer_stop(&top->timeout);
-		if (th != active_thread)
+		pi_unblock(top);
+		if (top != active_thread)
 			runq_enqueue(top);
 		schedule();
 	}
@@ -406,6 +570,24 @@ sch_wakeone(event *evt)
 	return top;
 }
 
+/*
+ * sch_wakeone_pi - wake up one thread sleeping on priority inheritance event.
+ *
+ * Ownership of the event passes to the woken thread, which inherits the
+ * priority of any threads still waiting. The priority of the previous owner
+ * is recalculated.
+ */
+thread *
+sch_wakeone_pi(pi_event *pi)
+{
+	const int s = irq_disable();
+	thread *top = sch_wakeone(&pi->event);
+	pi_set_owner(pi, top);
+	irq_restore(s);
+
+	return top;
+}
+
 /*
  * sch_requeue - move one thread sleeping on event l to sleeping on event r
  */
@@ -419,6 +601,7 @@ sch_requeue(event *l, event *r)
 	if (!queue_empty(&l->sleepq)) {
 		q = dequeue(&l->sleepq);
 		th = queue_entry(q, thread, link);
+		pi_unblock(th);
 		enqueue(&r->sleepq, q);
 		timer_redirect(&th->timeout, &sleep_expire, th);
 	}
@@ -465,6 +648,32 @@ sch_prepare_sleep(event *evt, uint_fast64_t nsec)
 	return 0;
 }
 
+/*
+ * sch_prepare_sleep_pi - prepare to sleep on a priority inheritance event
+ *
+ * owner inherits the priority of the active thread, and in turn passes it
+ * on to the owner of any priority inheritance event owner is waiting on.
+ *
+ * On success, must be followed by sch_continue_sleep or sch_cancel_sleep.
+ */
+int
+sch_prepare_sleep_pi(pi_event *pi, thread *owner, uint_fast64_t nsec)
+{
+	int err;
+
+	const int s = irq_disable();
+	if ((err = sch_prepare_sleep(&pi->event, nsec)) == 0) {
+		active_thread->pi_blocked = pi;
+		if (pi->owner != owner)
+			pi_set_owner(pi, owner);
+		else if (owner)
+			pi_adjust(owner);
+	}
+	irq_restore(s);
+
+	return err;
+}
+
 /*
  * sch_continue_sleep - sleep on prepared event
  *
@@ -528,6 +737,7 @@ sch_unsleep(thread *th, int result)
 		th->slpevt = nullptr;
 		th->state &= ~TH_SLEEP;
 		timer_stop(&th->timeout);
+		pi_unblock(th);
 		if (th != active_thread) {
 			runq_enqueue(th);
 			schedule();
@@ -637,7 +847,7 @@ sch_suspend_resume(thread *suspend, thread *resume)
  * Check quantum expiration, and mark a rescheduling flag.
  */
 __fast_text void
-sch_elapse(uint_fast32_t nsec)
+sch_elapse(uint_fast64_t nsec)
 {
 	const int s = irq_disable();
 
@@ -652,6 +862,8 @@ sch_elapse(uint_fast32_t nsec)
 			 * Give the thread another.
 			 */
 			active_thread->timeleft += QUANTUM;
+			if (active_thread->timeleft <= 0)
+				active_thread->timeleft = QUANTUM;
 
 			/*
 			 * If there are other threads of equal or higher
@@ -666,6 +878,23 @@ sch_elapse(uint_fast32_t nsec)
 	irq_restore(s);
 }
 
+#if defined(CONFIG_TICKLESS)
+/*
+ * sch_timeleft - time until the active thread's quantum expires.
+ *
+ * Returns 0 if the active thread is not subject to quantum expiry.
+ */
+__fast_text uint_fast32_t
+sch_timeleft()
+{
+	assert(!interrupt_enabled());
+
+	if (active_thread->policy != SCHED_RR)
+		return 0;
+	return active_thread->timeleft > 0 ? active_thread->timeleft : 1;
+}
+#endif
+
 /*
  * Set up stuff for thread scheduling.
  */
@@ -677,6 +906,8 @@ sch_start(thread *th)
 	th->prio = PRI_DEFAULT;
 	th->baseprio = PRI_DEFAULT;
 	th->timeleft = QUANTUM;
+	th->pi_blocked = nullptr;
+	list_init(&th->pi_events);
 }
 
 /*
@@ -706,6 +937,14 @@ sch_testexit()
 		return false;
 	}
 
+	/* waiters on events we still own no longer inherit anything */
+	while (!list_empty(&active_thread->pi_events)) {
+		pi_event *pi = list_entry(list_first(&active_thread->pi_events),
+		    pi_event, link);
+		list_remove(&pi->link);
+		pi->owner = nullptr;
+	}
+
 	/* mark thread as zombie */
 	active_thread->state |= TH_ZOMBIE;
 	resched = RESCHED_SWITCH;
@@ -775,6 +1014,11 @@ sch_getprio(thread *th)
 /*
  * sch_setprio - set priority of thread.
  *
+ * The thread runs at the higher of prio and any priority inherited from
+ * threads waiting on priority inheritance events it owns. If the thread is
+ * itself waiting on a priority inheritance event the change is passed on to
+ * the owner.
+ *
  * The rescheduling flag is set if the priority is
  * higher (less than) than the currently running thread.
  */
@@ -783,27 +1027,9 @@ sch_setprio(thread *th, int baseprio, int prio)
 {
 	int s = irq_disable();
 	th->baseprio = baseprio;
-	if (th == active_thread) {
-		/*
-		 * If we change the current thread's priority
-		 * it may be preempted.
-		 */
-		th->prio = prio;
-		/* it is only preemption when resched is not pending */
-		if (prio > runq_top() && resched == 0)
-			resched = RESCHED_PREEMPT;
-	} else {
-		if (thread_runnable(th)) {
-			/*
-			 * Update the thread priority and adjust
-			 * the run queue position for new priority.
-			 */
-			runq_remove(th);
-			th->prio = prio;
-			runq_enqueue(th);
-		} else
-			th->prio = prio;
-	}
+	runq_setprio(th, pi_inherit(th, prio));
+	if (th->pi_blocked && th->pi_blocked->owner)
+		pi_adjust(th->pi_blocked->owner);
 	schedule();
 	irq_restore(s);
 }
@@ -915,11 +1141,13 @@ sch_dump()
 	info("==============\n");
 	info(" thread      th         pri\n");
 	info(" ----------- ---------- ---\n");
-	queue *q = queue_first(&runq);
-	while (!queue_end(&runq, q)) {
-		thread *th = queue_entry(q, thread, link);
-		info(" %11s %p %3d\n", th->name, th, th->prio);
-		q = queue_next(q);
+	for (auto &head : runq.q) {
+		queue *q = queue_first(&head);
+		while (!queue_end(&head, q)) {
+			thread *th = queue_entry(q, thread, link);
+			info(" %11s %p %3d\n", th->name, th, th->prio);
+			q = queue_next(q);
+		}
 	}
 }
 
@@ -931,7 +1159,8 @@ sch_init()
 {
 	thread *th;
 
-	queue_init(&runq);
+	for (auto &q : runq.q)
+		queue_init(&q);
 	queue_init(&dpcq);
 	event_init(&dpc_event, "dpc", event::ev_SLEEP);
 
@@ -397,6 +397,33 @@ sig_restore(const k_sigset_t *old)
 	sch_unlock();
 }
 
+/*
+ * sig_temporary_mask - replace signal mask until return to userspace
+ *
+ * For system calls which atomically replace the signal mask while waiting,
+ * e.g. ppoll and pselect6. Signal handlers run with the temporary mask and
+ * the original mask is restored by sigreturn. If no handler runs the original
+ * mask is restored by sig_deliver.
+ */
+void
+sig_temporary_mask(const k_sigset_t *mask)
+{
+	thread *th = thread_cur();
+	sch_lock();
+	if (!th->sig_saved_valid) {
+		th->sig_saved = th->sig_blocked;
+		th->sig_saved_valid = true;
+	}
+	th->sig_blocked = *mask;
+
+	/* SIGSTOP and SIGKILL cannot be blocked */
+	ksigdelset(&th->sig_blocked, SIGSTOP);
+	ksigdelset(&th->sig_blocked, SIGKILL);
+
+	sig_flush(th->task);
+	sch_unlock();
+}
+
 /*
  * Adjust signal handlers after exec call
  */
@@ -503,12 +530,15 @@ sig_deliver_slowpath(k_sigset_t pending, int rval)
 			};
 		}
 
-		/* setup context to run signal handler */
-		if (!context_set_signal(&th->ctx, &th->sig_blocked, handler,
+		/* setup context to run signal handler, sigreturn restores
+		 * the mask replaced by sig_temporary_mask if any */
+		if (!context_set_signal(&th->ctx, th->sig_saved_valid ?
+		    &th->sig_saved : &th->sig_blocked, handler,
 		    sig_restorer(task, sig), sig, info ? &si : 0, rval)) {
 			dbg("Signal setup failed. Terminate.\n");
 			goto fatal;
 		}
+		th->sig_saved_valid = false;
 
 		/* adjust blocked signal mask */
 		ksigorset(&th->sig_blocked, &th->sig_blocked, sig_mask(task, sig));
@@ -593,6 +623,16 @@ sig_deliver(int rval)
 	if (!ksigisemptyset(&pending))
 		rval = sig_deliver_slowpath(pending, rval);
 
+	/*
+	 * Restore signal mask replaced by sig_temporary_mask
+	 */
+	if (th->sig_saved_valid) {
+		sch_lock();
+		th->sig_blocked = th->sig_saved;
+		th->sig_saved_valid = false;
+		sch_unlock();
+	}
+
 	/*
 	 * Returning to userspace with a locked kernel mutex is a bug.
 	 */
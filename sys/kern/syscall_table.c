@@ -3,8 +3,11 @@
 #include <sched.h>
 #include <sections.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <syscall.h>
 #include <syscalls.h>
 #include <unistd.h>
@@ -105,6 +108,7 @@ syscall_table[SYSCALL_TABLE_SIZE] = {
 #endif
 	[SYS_clone] = sc_clone,
 	[SYS_close] = close,
+	[SYS_copy_file_range] = sc_copy_file_range,
 	[SYS_dup] = dup,
 #ifdef SYS_dup2
 	[SYS_dup2] = dup2,
@@ -112,6 +116,10 @@ syscall_table[SYSCALL_TABLE_SIZE] = {
 #ifdef SYS_dup3
 	[SYS_dup3] = dup3,
 #endif
+	[SYS_epoll_create1] = epoll_create1,
+	[SYS_epoll_ctl] = sc_epoll_ctl,
+	[SYS_epoll_pwait] = sc_epoll_pwait,
+	[SYS_eventfd2] = eventfd,
 	[SYS_execve] = sc_execve,
 	[SYS_exit] = sc_exit,
 	[SYS_exit_group] = sc_exit_group,
@@ -172,10 +180,21 @@ syscall_table[SYSCALL_TABLE_SIZE] = {
 	[SYS_pipe2] = sc_pipe2,
 #ifdef SYS_pipe
 	[SYS_pipe] = sc_pipe,
+#endif
+#ifdef SYS_poll
+	[SYS_poll] = sc_poll,
+#endif
+	[SYS_ppoll_time64] = sc_ppoll,
+#ifdef SYS_ppoll
+	[SYS_ppoll] = sc_ppoll32,
 #endif
 	[SYS_prctl] = prctl,
 	[SYS_pread64] = sc_pread,
 	[SYS_preadv] = sc_preadv,
+	[SYS_pselect6_time64] = sc_pselect6,
+#ifdef SYS_pselect6
+	[SYS_pselect6] = sc_pselect6_32,
+#endif
 	[SYS_pwrite64] = sc_pwrite,
 	[SYS_pwritev] = sc_pwritev,
 	[SYS_read] = sc_read,
@@ -203,6 +222,10 @@ syscall_table[SYSCALL_TABLE_SIZE] = {
 	[SYS_sched_getscheduler] = sc_sched_getscheduler,
 	[SYS_sched_setscheduler] = sc_sched_setscheduler,
 	[SYS_sched_yield] = sched_yield,
+#ifdef SYS__newselect
+	[SYS__newselect] = sc_select,
+#endif
+	[SYS_sendfile64] = sc_sendfile,
 	[SYS_set_tid_address] = sc_set_tid_address,
 	[SYS_setitimer] = sc_setitimer,
 	[SYS_setpgid] = setpgid,
@@ -210,6 +233,7 @@ syscall_table[SYSCALL_TABLE_SIZE] = {
 #ifdef SYS_sigreturn
 	[SYS_sigreturn] = sc_sigreturn,
 #endif
+	[SYS_splice] = sc_splice,
 #ifdef SYS_stat64
 	[SYS_stat64] = sc_stat,
 #endif
@@ -222,6 +246,15 @@ syscall_table[SYSCALL_TABLE_SIZE] = {
 	[SYS_sync] = sc_sync,
 	[SYS_syslog] = sc_syslog,
 	[SYS_tgkill] = sc_tgkill,
+	[SYS_timerfd_create] = timerfd_create,
+	[SYS_timerfd_gettime64] = sc_timerfd_gettime,
+#ifdef SYS_timerfd_gettime
+	[SYS_timerfd_gettime] = sc_timerfd_gettime32,
+#endif
+	[SYS_timerfd_settime64] = sc_timerfd_settime,
+#ifdef SYS_timerfd_settime
+	[SYS_timerfd_settime] = sc_timerfd_settime32,
+#endif
 	[SYS_tkill] = sc_tkill,
 	[SYS_umask] = umask,
 	[SYS_umount2] = sc_umount2,
@@ -302,6 +302,6 @@ sc_sched_setscheduler(int id, int policy, const sched_param *param)
 
 	if (auto r{sch_setpolicy(th, policy)}; r < 0)
 		return r;
-	sch_setprio(th, prio, min(prio, sch_getprio(th)));
+	sch_setprio(th, prio, prio);
 	return 0;
 }
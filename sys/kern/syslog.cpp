@@ -15,8 +15,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <fs/file.h>
+#include <fs/poll.h>
 #include <fs/util.h>
 #include <kernel.h>
+#include <lib/bin_printf.h>
+#include <lib/log_ring.h>
+#include <poll.h>
 #include <sync.h>
 #include <sys/mman.h>
 #include <sys/time.h>
@@ -36,28 +40,31 @@
 
 /*
  * ent - system log entry
+ *
+ * Text entries hold a null terminated message. With CONFIG_SYSLOG_BINARY
+ * kernel messages hold the arguments saved by bin_vencode and are formatted
+ * when read.
  */
 struct ent {
 	uint_fast64_t nsec;	/* timestamp in nanoseconds */
 	long seq;		/* sequence number of message - safe to roll over */
-	size_t len_term;	/* length of msg including null terminator, 0: wrap */
 	long priority;		/* syslog facility and priority */
-	char msg[];		/* message text */
+	const char *fmt;	/* format of binary entry, nullptr for text */
+	char msg[];		/* message text or saved arguments */
 };
 
-alignas(ent) static char log[CONFIG_SYSLOG_SIZE];
-static std::atomic_long log_first_seq = 1, log_last_seq;
-static long clear_seq = 1;
-static ent *head = (ent *)log;
-static ent *tail = (ent *)log;
-static ent *clear_ent = (ent *)log;
+alignas(log_ring::align) static char log[CONFIG_SYSLOG_SIZE];
+static constinit log_ring ring{log, sizeof(log)};
+static std::atomic_long log_seq;
+static unsigned long clear_pos;
 
 static event log_wait;
-static spinlock lock;	/* REVISIT: may need init for SMP */
+static poll_head log_poll;
 static struct kmsg_output {
-	long seq;
-	struct ent *ent;
-} console_output = { .seq = 1, .ent = (ent *)log };
+	long seq;		/* expected sequence number of next message */
+	unsigned long pos;	/* position of next message in ring */
+	bool overrun;		/* messages were dropped before being read */
+} console_output = { .seq = 1, .pos = 0, .overrun = false };
 
 static int conlev = CONFIG_CONSOLE_LOGLEVEL + 1;
 static const int min_conlev = LOG_WARNING + 1;
@@ -77,6 +84,9 @@ static_assert((sizeof(log) & (sizeof(log) - 1)) == 0,
 static_assert(sizeof(log) >= 128,
     "SYSLOG_SIZE must be at least 128 bytes");
 
+static_assert(sizeof(log) >= 2 * log_ring::align,
+    "SYSLOG_SIZE too small for log_ring");
+
 #if 0
 /*
  * print direct to console: useful for debugging kmsg
@@ -118,21 +128,6 @@ panic_console_print_default(const char *s, size_t len)
 }
 weak_alias(panic_console_print_default, panic_console_print);
 
-/*
- * advance - move pointer to next entry
- */
-static void
-advance(ent **p)
-{
-	size_t len = (*p)->len_term;
-	assert(len && len < sizeof(log));
-
-	*p = (ent *)ALIGNn((char *)*p + sizeof(**p) + len,
-	    alignof(ent));
-	if ((char *)(*p + 1) >= (log + sizeof(log)))
-		*p = (ent *)log;
-}
-
 /*
  * console_print_all - print new messages using console_print
  *
@@ -149,82 +144,115 @@ console_print_all()
 }
 
 /*
- * log_trim - drop one msg from log buffer
+ * syslog_begin - start writing a message with len bytes of data
+ *
+ * Must be interrupt safe. Never blocks or disables interrupts.
  */
-static void
-log_trim()
+static int
+syslog_begin(ent **entry, unsigned long *pos, const size_t len)
 {
-	ent *entry = tail;
-	++log_first_seq;
-	advance(&tail);
-	if (!tail->len_term) /* sentinel: wrap */
-		tail = (ent *)log;
-	entry->len_term = -1;
+	ent *e;
+	if (!(e = (ent *)ring.reserve(sizeof(ent) + len, pos)))
+		return -ENOSPC;
+
+	e->nsec = timer_monotonic();
+	e->seq = ++log_seq;
+	e->fmt = nullptr;
+	*entry = e;
+	return 0;
 }
 
 /*
- * syslog_begin - start writing a message
+ * syslog_end - finish writing a message
  */
-static ssize_t
-syslog_begin(ent **entry, long *seq, const size_t len)
+static void
+syslog_end(ent *entry, unsigned long pos, long priority)
 {
-	const size_t len_term = len + 1; /* terminating '\0' */
-	const size_t ent_len = sizeof(ent) + len_term;
-	if (ent_len > sizeof(log))
-		return -ENOSPC;
+	entry->priority = priority;
+	ring.commit(pos);	/* entry not read until committed */
 
-	const int s = spinlock_lock_irq_disable(&lock);
-	ssize_t rem;	/* linear free space in buffer */
+	void (*fn)() = read_once(&log_output);
+	if (fn)
+		fn();
+
+	if (log_wait.sleepq.next) /* event initialised */
+		sch_wakeup(&log_wait, 0);
+	if (log_poll.waiters.next) /* poll head initialised */
+		poll_wakeup(&log_poll, POLLIN | POLLRDNORM);
+}
 
-check_len:
-	rem = (char *)tail - (char *)head;
-	if (rem > 0) {
-		if ((size_t)rem < ent_len) {
-			log_trim();
-			goto check_len;
+/*
+ * log_avail - check if reader has messages to read
+ */
+static bool
+log_avail(const kmsg_output *kmsg)
+{
+	return kmsg->pos != ring.head();
+}
+
+/*
+ * log_next - find next message for reader
+ *
+ * Copies the entry header to entry and sets len to the length of the entry
+ * data. Returns a pointer to the entry in the log, or nullptr if no entry is
+ * ready. The entry data must be checked with ring.valid() after it has been
+ * copied.
+ *
+ * If messages were dropped before they were read the reader is moved to the
+ * oldest message and kmsg->overrun is set.
+ */
+static const ent *
+log_next(kmsg_output *kmsg, ent *entry, size_t *len)
+{
+	while (true) {
+		if (!ring.valid(kmsg->pos)) {
+			kmsg->pos = ring.tail();
+			kmsg->overrun = true;
 		}
-	} else {
-		rem = log + sizeof(log) - (char *)head;
-		if ((size_t)rem < ent_len) {
-			/*
-			 * not enough space to end of log - wrap head
-			 * back to start
-			 */
-			head->len_term = 0;	/* sentinel: wrap */
-			head = (ent *)log;
-			if (tail == head) /* catch wrap to completely full */
-				log_trim();
-			goto check_len;
+		const ent *e = (const ent *)ring.read(&kmsg->pos, len);
+		if (!e || *len < sizeof(ent)) {
+			if (!ring.valid(kmsg->pos))
+				continue; /* overrun while reading */
+			return nullptr; /* still being written... */
 		}
+		*entry = read_once(e);
+		if (!ring.valid(kmsg->pos))
+			continue; /* overrun while reading header */
+		*len -= sizeof(ent);
+		return e;
 	}
-
-	head->nsec = timer_monotonic();
-	head->len_term = len_term;
-	*entry = head;
-	*seq = ++log_last_seq;
-	advance(&head);
-	if (tail == head) /* catch wrap to completely full */
-		log_trim();
-
-	spinlock_unlock_irq_restore(&lock, s);
-	return len_term;
 }
 
 /*
- * syslog_end - finish writing a message
+ * log_consume - move reader past message
  */
 static void
-syslog_end(ent *entry, long seq, long priority)
+log_consume(kmsg_output *kmsg, const ent &entry, size_t len)
 {
-	write_once(&entry->priority, priority);
-	write_once(&entry->seq, seq);	     /* entry not read until seq is valid */
-
-	void (*fn)() = read_once(&log_output);
-	if (fn)
-		fn();
+	kmsg->pos = ring.next(kmsg->pos, sizeof(ent) + len);
+	kmsg->seq = entry.seq + 1;
+	kmsg->overrun = false;
+}
 
-	if (log_wait.sleepq.next) /* event initialised */
-		sch_wakeup(&log_wait, 0);
+/*
+ * log_msg - format message text
+ *
+ * Behaves like snprintf.
+ */
+static int
+log_msg(char *buf, size_t len, const ent &entry, const ent *e,
+    size_t data_len)
+{
+	if (entry.fmt)
+		return bin_format(buf, len, entry.fmt, e->msg, data_len);
+
+	const size_t n = data_len ? data_len - 1 : 0; /* strip '\0' */
+	if (len) {
+		const size_t cp = std::min(n, len - 1);
+		memcpy(buf, e->msg, cp);
+		buf[cp] = 0;
+	}
+	return n;
 }
 
 /*
@@ -251,18 +279,32 @@ syslog_printf(int level, const char *fmt, ...)
 int
 syslog_vprintf(int level, const char *fmt, va_list ap)
 {
-	int len = vsnprintf(nullptr, 0, fmt, ap); /* get length */
+	va_list aq;
+	va_copy(aq, ap);
+#if defined(CONFIG_SYSLOG_BINARY)
+	/* save arguments, message is formatted when read */
+	const int len = bin_vencode(nullptr, 0, fmt, aq);
+	const size_t size = len;
+#else
+	const int len = vsnprintf(nullptr, 0, fmt, aq); /* get length */
+	const size_t size = len + 1;
+#endif
+	va_end(aq);
 	if (len < 0)
-		return len;
+		return DERR(-EINVAL);
 
 	ent *entry;
-	long seq;
-	ssize_t len_term = syslog_begin(&entry, &seq, len);
-	if (len_term < 0)
-		return len_term;
+	unsigned long pos;
+	if (auto err = syslog_begin(&entry, &pos, size); err < 0)
+		return err;
 
-	vsnprintf(entry->msg, len_term, fmt, ap); /* can't fail? */
-	syslog_end(entry, seq, LOG_MAKEPRI(LOG_KERN, level));
+#if defined(CONFIG_SYSLOG_BINARY)
+	bin_vencode(entry->msg, size, fmt, ap);
+	entry->fmt = fmt;
+#else
+	vsnprintf(entry->msg, size, fmt, ap); /* can't fail? */
+#endif
+	syslog_end(entry, pos, LOG_MAKEPRI(LOG_KERN, level));
 	return len;
 }
 
@@ -285,55 +327,49 @@ syslog_format(char *buf, const size_t len)
 {
 	kmsg_output *kmsg = &console_output;
 	size_t rem = len;
-
-	/* lock-less read of log message */
-	while ((log_last_seq - kmsg->seq) >= 0) { /* seq can rollover */
-		ent entry = read_once(kmsg->ent);
-		long overrun = log_first_seq - kmsg->seq;
-		if (overrun > 0) {
+	const ent *e;
+	ent entry;
+	size_t l;
+
+	/* lock-less read of log messages */
+	while ((e = log_next(kmsg, &entry, &l))) {
+		const long missed = entry.seq - kmsg->seq;
+		if (kmsg->overrun && missed > 0) {
 			int n = snprintf(buf, rem, "*** missed %ld messages\n",
-					 overrun);
+					 missed);
 			if (n < 0 || (size_t)n >= rem)
 				break;
 			buf += n;
 			rem -= n;
-			kmsg->seq = log_first_seq;
-			kmsg->ent = read_once(&tail);
-			continue; /* process updated kmsg state */
-		}
-		if (entry.seq != kmsg->seq) { /* entry not valid */
-			if (!entry.len_term) { /* sentinel: wrap */
-				kmsg->ent = (ent *)log;
-				continue;
-			} else
-				break; /* still being written... */
+			kmsg->seq = entry.seq;
+			kmsg->overrun = false;
 		}
 		if (LOG_PRI(entry.priority) < conlev) {
 			timeval tv = ns_to_tv(entry.nsec);
 			int n = snprintf(buf, rem, "[%5lld.%06lld] ", tv.tv_sec, tv.tv_usec);
-			size_t l = entry.len_term - 1;
+			if (n < 0 || (size_t)n >= rem)
+				break;
+			size_t m = log_msg(buf + n, rem - n, entry, e, l);
 			bool trunc = false;
-			if (n < 0 || (n + l) > rem) {
+			if (n + m >= rem) {
 				if (rem < len)
 					break; /* won't fit in this buffer, try again */
 				/* won't fit in empty buffer, truncate */
-				l = rem - n;
+				m = rem - n - 1;
 				trunc = true;
 			}
 
-			memcpy(buf + n, kmsg->ent->msg, l); /* strip '\0' */
-			if (log_first_seq - kmsg->seq > 0)
+			if (!ring.valid(kmsg->pos))
 				continue; /* overrun while consuming entry, so skip */
 			if (trunc)
-				memcpy(buf + n + l - 4, "...\n", 4);
+				memcpy(buf + n + m - 4, "...\n", 4);
 
-			l += n;
-			buf += l;
-			rem -= l;
+			m += n;
+			buf += m;
+			rem -= m;
 		}
 
-		++kmsg->seq;
-		advance(&kmsg->ent);
+		log_consume(kmsg, entry, l);
 	}
 
 	return len - rem;
@@ -346,40 +382,35 @@ int
 kmsg_format(char *buf, const size_t len, kmsg_output *kmsg)
 {
 	/* lock-less read of log message */
-	ent entry = read_once(kmsg->ent);
-	long overrun = log_first_seq - kmsg->seq;
-	if (overrun > 0) {
+	ent entry;
+	size_t l;
+	const ent *e = log_next(kmsg, &entry, &l);
+	if (kmsg->overrun) {
 	overrun:
-		/* message we expect is gone: reset and return error */
-		kmsg->seq = log_first_seq;
-		kmsg->ent = read_once(&tail);
+		/* message we expect is gone: return error */
+		kmsg->overrun = false;
 		return -EPIPE;	/* Linux compatible */
 	}
-
-	if (entry.seq != kmsg->seq) { /* entry not valid */
-		if (!entry.len_term) /* sentinel: wrap */
-			kmsg->ent = (ent *)log;
-		else
-			return -EAGAIN;	/* still being written... */
-	}
+	if (!e)
+		return -EAGAIN;	/* still being written... */
 
 	int n = snprintf(buf, len, "%lu,%lu,%llu,-; ",
 			 entry.priority, entry.seq, entry.nsec / 1000);
 	if (n < 0)
 		return n;
+	if ((size_t)n >= len)
+		return DERR(-EINVAL);
 
-	size_t ent_len = entry.len_term - 1;
-	if (ent_len > (len - n))
-		ent_len = len - n; /* won't fit: truncate */
-
-	memcpy(buf + n, kmsg->ent->msg, ent_len); /* strip '\0' */
-	if (log_first_seq - kmsg->seq > 0)
+	/* truncate if message won't fit */
+	const size_t m = std::min<size_t>(
+	    log_msg(buf + n, len - n, entry, e, l), len - n - 1);
+	if (!ring.valid(kmsg->pos)) {
+		kmsg->pos = ring.tail();
 		goto overrun; /* overrun while consuming entry, so skip */
+	}
 
-	++kmsg->seq;
-	advance(&kmsg->ent);
-
-	return ent_len + n;
+	log_consume(kmsg, entry, l);
+	return n + m;
 }
 
 /*
@@ -392,7 +423,8 @@ syslog_panic()
 {
 	/* reset console output */
 	console_output.seq = 1;	   /* will report how many msg are dropped if panic is partial */
-	console_output.ent = (ent *)log;
+	console_output.pos = ring.tail();
+	console_output.overrun = true;
 
 	panic_console_init();
 	panic_console_print("\n*** syslog_panic\n", 18);
@@ -431,8 +463,7 @@ sc_syslog(int type, char *buf, int len)
 		/* TODO: implement */
 		return DERR(-ENOSYS);
 	case 5: /* clear */
-		clear_seq = log_last_seq + 1;
-		clear_ent = read_once(&head);
+		clear_pos = ring.head();
 		return 0;
 	case 6: /* console off */
 		if (prev_conlev == -1)
@@ -472,8 +503,9 @@ static int kmsg_open(file *file)
 
 	file->f_data = kmsg;
 
-	kmsg->seq = log_first_seq;
-	kmsg->ent = read_once(&tail);
+	kmsg->seq = 1;
+	kmsg->pos = ring.tail();
+	kmsg->overrun = false;
 
 	return 0;
 }
@@ -502,14 +534,14 @@ kmsg_read(file *file, void *buf, size_t len, off_t offset)
 		return -EFAULT;
 
 	int rc;
-	if ((log_last_seq - kmsg->seq) >= 0) /* seq can rollover */
+	if (log_avail(kmsg))
 		rc = 0;
 	else if (file->f_flags & O_NONBLOCK)
 		rc = -EAGAIN;
 	else {
 		u_access_suspend();
 		rc = wait_event_interruptible(log_wait, [&] {
-			return (log_last_seq - kmsg->seq) >= 0;
+			return log_avail(kmsg);
 		});
 		int r = u_access_resume(buf, len, PROT_WRITE);
 		if (r < 0)
@@ -577,10 +609,10 @@ kmsg_write_iov(file *file, const iovec *iov, size_t count,
 	}
 
 	ent *entry;
-	long seq;
-	ssize_t len_term = syslog_begin(&entry, &seq, msg_len - pri_len);
-	if (len_term < 0)
-		return len_term;
+	unsigned long pos;
+	if (auto err = syslog_begin(&entry, &pos, msg_len - pri_len + 1);
+	    err < 0)
+		return err;
 
 	char *dst = entry->msg;
 	if (iov_len) {
@@ -592,12 +624,27 @@ kmsg_write_iov(file *file, const iovec *iov, size_t count,
 		memcpy(dst, iov->iov_base, iov->iov_len);
 		dst += iov->iov_len;
 	}
-	entry->msg[msg_len] = '\0'; /* guarantee NULL terminated */
+	entry->msg[msg_len - pri_len] = '\0'; /* guarantee NULL terminated */
 
-	syslog_end(entry, seq, priority);
+	syslog_end(entry, pos, priority);
 	return msg_len;
 }
 
+static int
+kmsg_poll(file *file, poll_table *pt)
+{
+	kmsg_output *kmsg = (kmsg_output *)file->f_data;
+	if (!kmsg)
+		return POLLNVAL;
+
+	poll_wait(&log_poll, pt);
+
+	int events = POLLOUT | POLLWRNORM;
+	if (log_avail(kmsg))
+		events |= POLLIN | POLLRDNORM;
+	return events;
+}
+
 static int
 kmsg_seek(file *file, off_t offset, int whence)
 {
@@ -608,18 +655,16 @@ kmsg_seek(file *file, off_t offset, int whence)
 	if (offset)
 		return -ESPIPE;
 
+	kmsg->overrun = false;
 	switch (whence) {
 	case SEEK_SET:
-		kmsg->seq = log_first_seq;
-		kmsg->ent = read_once(&tail);
+		kmsg->pos = ring.tail();
 		return 0;
 	case SEEK_DATA:
-		kmsg->seq = clear_seq;
-		kmsg->ent = clear_ent;
+		kmsg->pos = clear_pos;
 		return 0;
 	case SEEK_END:
-		clear_seq = log_last_seq + 1;
-		clear_ent = read_once(&head);
+		clear_pos = ring.head();
 		return 0;
 	default:
 		return -EINVAL;
@@ -635,6 +680,7 @@ static devio kmsg_io = {
 	.read = kmsg_read_iov,
 	.write = kmsg_write_iov,
 	.seek = kmsg_seek,
+	.poll = kmsg_poll,
 };
 
 /*
@@ -644,6 +690,7 @@ void
 kmsg_init()
 {
 	event_init(&log_wait, "kmsg_wait", event::ev_IO);
+	poll_head_init(&log_poll);
 
 	/* Create device object */
 	device *d = device_create(&kmsg_io, "kmsg", DF_CHR, nullptr);
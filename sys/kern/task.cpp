@@ -201,7 +201,6 @@ task_create(task *parent, int vm_option, task **child)
 	t->capability = parent->capability;
 	t->parent = parent;
 	list_init(&t->threads);
-	futexes_init(&t->futexes);
 	t->pgid = parent->pgid;
 	t->sid = parent->sid;
 	t->state = PS_RUN;
@@ -391,12 +390,6 @@ task_access(task *t)
 	    task_capable(CAP_TASK);
 }
 
-futexes *
-task_futexes(task *t)
-{
-	return &t->futexes;
-}
-
 void
 task_dump()
 {
@@ -405,6 +405,7 @@ thread_init()
 	idle_thread.policy = SCHED_FIFO;
 	idle_thread.prio = PRI_IDLE;
 	idle_thread.baseprio = PRI_IDLE;
+	list_init(&idle_thread.pi_events);
 	strcpy(idle_thread.name, "idle");
 	context_init_idle(&idle_thread.ctx, &__stack_start + (int)&__stack_size);
 	list_insert(&kern_task.threads, &idle_thread.task_link);
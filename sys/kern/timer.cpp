@@ -39,11 +39,14 @@
 #include <access.h>
 #include <arch/interrupt.h>
 #include <cassert>
+#include <climits>
 #include <compiler.h>
 #include <cstdlib>	    /* remove when lldiv is no longer required */
 #include <debug.h>
 #include <errno.h>
 #include <irq.h>
+#include <lib/time_page.h>
+#include <lib/timer_wheel.h>
 #include <sch.h>
 #include <sections.h>
 #include <sig.h>
@@ -56,10 +59,38 @@
 
 uint_fast64_t realtime_offset;	/* monotonic + realtime_offset = realtime */
 
+/*
+ * Time page shared read-only with userspace. Padded so that nothing else
+ * shares its protection region.
+ */
+struct alignas(TIME_PAGE_SIZE) shared_time_page : time_page { };
+static_assert(sizeof(shared_time_page) == TIME_PAGE_SIZE);
+static shared_time_page tpage{{
+	.seq = 0,
+#if defined(CONFIG_TICKLESS)
+	.flags = 0,
+#else
+	.flags = TIME_PAGE_TICK,
+#endif
+}};
+
+/*
+ * Active timers are kept in a 4 level wheel of 64 slots per level with
+ * 1/CONFIG_HZ slot resolution at level 0, which covers about 4.6 hours at
+ * 1000Hz before timers need to be cascaded more than once.
+ */
+__fast_bss static timer_wheel<6, 4> wheel{1000000000 / CONFIG_HZ};
+
+#define SLOT_EXPIRED	UINT_MAX	/* timer is on expire_list */
+
 static event	timer_event;	/* event to wakeup a timer thread */
 static event	delay_event;	/* event for the thread delay */
-static list	timer_list;	/* list of active timers */
 static list	expire_list;	/* list of expired timers */
+#if defined(CONFIG_TICKLESS)
+__fast_bss static uint_fast64_t tick_time; /* time accounted up to (nsec) */
+/* programmed event time (nsec), UINT_FAST64_MAX if none */
+__fast_data static uint_fast64_t next_event = UINT_FAST64_MAX;
+#endif
 
 /*
  * Get remaining nanoseconds to the expiration time.
@@ -74,28 +105,62 @@ time_remain(uint_fast64_t expire)
 	return 0;
 }
 
+#if defined(CONFIG_TICKLESS)
+/*
+ * Program timer hardware for the next event.
+ *
+ * The next event is the earliest of the next timer wheel expiry, the
+ * expiry of the active thread's quantum or the expiry of the active task's
+ * profiling timers. Requires interrupts to be disabled by the caller.
+ */
+__fast_text static void
+timer_reprogram()
+{
+	uint_fast64_t deadline = wheel.next_expiry();
+	auto earlier = [&](uint_fast64_t remain) {
+		if (remain && tick_time + remain < deadline)
+			deadline = tick_time + remain;
+	};
+
+	earlier(sch_timeleft());
+	const task *t = task_cur();
+	earlier(t->itimer_prof.remain);
+	earlier(t->itimer_virtual.remain);
+
+	next_event = deadline;
+	timer_program(deadline);
+}
+#endif
+
 /*
- * Insert a timer element into the timer list in the proper place.
+ * Insert a timer element into the timer wheel.
  * Requires interrupts to be disabled by the caller.
  */
 static void
 timer_insert(timer *tmr)
 {
-	list *head, *n;
-	timer *t;
+	wheel.insert(tmr);
 
-	/*
-	 * We sort the timer list by time. So, we can
-	 * quickly get the next expiration time from
-	 * the head element of the timer list.
-	 */
-	head = &timer_list;
-	for (n = list_first(head); n != head; n = list_next(n)) {
-		t = list_entry(n, timer, link);
-		if (tmr->expire < t->expire)
-			break;
+#if defined(CONFIG_TICKLESS)
+	/* new timer is next to expire */
+	if (tmr->expire < next_event) {
+		next_event = tmr->expire;
+		timer_program(next_event);
 	}
-	list_insert(list_prev(n), &tmr->link);
+#endif
+}
+
+/*
+ * Remove a timer element from the timer wheel or expire list.
+ * Requires interrupts to be disabled by the caller.
+ */
+static void
+timer_remove(timer *tmr)
+{
+	if (tmr->slot == SLOT_EXPIRED)
+		list_remove(&tmr->link);
+	else
+		wheel.remove(tmr);
 }
 
 /*
@@ -161,6 +226,9 @@ ns_to_tv(uint_fast64_t ns)
  * timer_callout()/timer_stop() from ISR at interrupt level.
  *
  * If nsec == 1 we call out after the next tick.
+ *
+ * In tickless mode there is no tick and timers expire as soon as possible
+ * after nsec.
  */
 void
 timer_callout(timer *tmr, uint_fast64_t nsec, uint_fast64_t interval,
@@ -168,19 +236,25 @@ timer_callout(timer *tmr, uint_fast64_t nsec, uint_fast64_t interval,
 {
 	assert(tmr);
 
+#if !defined(CONFIG_TICKLESS)
 	const uint_fast64_t period = 1000000000 / CONFIG_HZ;
+#endif
 
 	const int s = irq_disable();
 	if (tmr->active)
-		list_remove(&tmr->link);
+		timer_remove(tmr);
 	tmr->func = func;
 	tmr->arg = arg;
 	tmr->active = 1;
 	tmr->interval = interval;
+#if defined(CONFIG_TICKLESS)
+	tmr->expire = timer_monotonic() + nsec;
+#else
 	/*
 	 * Guarantee that we will call out after at least nsec.
 	 */
 	tmr->expire = timer_monotonic_coarse() + period + (nsec == 1 ? 0 : nsec);
+#endif
 	timer_insert(tmr);
 	irq_restore(s);
 }
@@ -209,7 +283,7 @@ timer_stop(timer *tmr)
 
 	const int s = irq_disable();
 	if (tmr->active) {
-		list_remove(&tmr->link);
+		timer_remove(tmr);
 		tmr->active = 0;
 	}
 	irq_restore(s);
@@ -287,7 +361,7 @@ timer_thread(void *arg)
  * reload if configured to do so.
  */
 __fast_text static void
-run_itimer(itimer *it, uint_fast32_t ns, int sig)
+run_itimer(task *t, itimer *it, uint_fast64_t ns, int sig)
 {
 	/* disabled */
 	if (!it->remain)
@@ -303,61 +377,105 @@ run_itimer(itimer *it, uint_fast32_t ns, int sig)
 	it->remain = it->interval - (ns - it->remain);
 	if (it->remain > it->interval)
 		it->remain = 1;	    /* overflow */
-	sig_task(task_cur(), sig);
+	sig_task(t, sig);
 }
 
 /*
  * Timer tick handler
  *
  * timer_tick() is called straight from the real time clock interrupt.
+ *
+ * In tickless mode the timer driver calls timer_tick() when the time
+ * programmed by timer_program() is reached and elapsed time is accounted
+ * since the last timer tick or context switch.
  */
+#if defined(CONFIG_TICKLESS)
+__fast_text void
+timer_tick(uint_fast64_t monotonic)
+#else
 __fast_text void
 timer_tick(uint_fast64_t monotonic, uint_fast32_t ns)
+#endif
 {
-	timer *tmr;
 	int wakeup = 0;
 	task *t = task_cur();
 
+#if defined(CONFIG_TICKLESS)
+	const uint_fast64_t ns = monotonic - tick_time;
+	tick_time = monotonic;
+#endif
+
 	/*
-	 * Handle all of the timer elements that have expired.
+	 * Move expired timers from timer wheel to expire list.
 	 */
-	while (!list_empty(&timer_list)) {
-		/*
-		 * Check timer expiration.
-		 */
-		tmr = list_entry(list_first(&timer_list), timer, link);
-		if (monotonic < tmr->expire)
-			break;
-		/*
-		 * Move expired timers from timer list to expire list.
-		 */
-		list_remove(&tmr->link);
-		list_insert(&expire_list, &tmr->link);
+	wheel.advance(monotonic, [&](timer *tmr) {
+		tmr->slot = SLOT_EXPIRED;
+		list_insert(list_last(&expire_list), &tmr->link);
 		wakeup = 1;
-	}
+	});
 	if (wakeup)
 		sch_wakeup(&timer_event, 0);
 
 	/* itimer_prof decrements any time the process is running */
-	run_itimer(&t->itimer_prof, ns, SIGPROF);
+	run_itimer(t, &t->itimer_prof, ns, SIGPROF);
 
 	/* itimer_virtual decrements only when the process is in userspace */
 	if (interrupt_from_userspace())
-		run_itimer(&t->itimer_virtual, ns, SIGVTALRM);
+		run_itimer(t, &t->itimer_virtual, ns, SIGVTALRM);
 
 	sch_elapse(ns);
+
+#if defined(CONFIG_TICKLESS)
+	timer_reprogram();
+#else
+	time_page_write_begin(&tpage);
+	tpage.coarse = monotonic;
+	time_page_write_end(&tpage);
+#endif
 }
 
+#if defined(CONFIG_TICKLESS)
+/*
+ * Account time on context switch
+ *
+ * Called by the scheduler with interrupts disabled after the active thread
+ * has changed. Charges elapsed time to the task of the previous thread,
+ * programs the next timer event for the new thread and returns the elapsed
+ * time so that the scheduler can charge it to the previous thread.
+ */
+__fast_text uint_fast64_t
+timer_switch(thread *prev)
+{
+	const uint_fast64_t monotonic = timer_monotonic();
+	const uint_fast64_t ns = monotonic - tick_time;
+	tick_time = monotonic;
+
+	task *t = prev->task;
+	run_itimer(t, &t->itimer_prof, ns, SIGPROF);
+
+	timer_reprogram();
+
+	return ns;
+}
+#endif
+
 /*
  * Set real time
  */
 int
 timer_realtime_set(uint_fast64_t ns)
 {
+	const int s = irq_disable();
 	uint_fast64_t m = timer_monotonic();
-	if (ns < m)
+	if (ns < m) {
+		irq_restore(s);
 		return DERR(-EINVAL);
+	}
 	write_once(&realtime_offset, ns - m);
+	time_page_write_begin(&tpage);
+	tpage.realtime_offset = ns - m;
+	time_page_write_end(&tpage);
+	irq_restore(s);
 	return 0;
 }
 
@@ -379,6 +497,33 @@ timer_realtime_coarse()
 	return timer_monotonic_coarse() + realtime_offset;
 }
 
+/*
+ * Return time page shared with userspace
+ */
+const time_page *
+timer_time_page()
+{
+	return &tpage;
+}
+
+/*
+ * Publish counter for reading time from userspace
+ *
+ * counter is a free running 64-bit counter which can be mapped read-only
+ * into userspace and counter_ns is its period in nanoseconds.
+ */
+void
+timer_time_page_counter(const volatile uint32_t *counter, uint32_t counter_ns)
+{
+	const int s = irq_disable();
+	time_page_write_begin(&tpage);
+	tpage.counter = counter;
+	tpage.counter_ns = counter_ns;
+	tpage.flags |= TIME_PAGE_COUNTER;
+	time_page_write_end(&tpage);
+	irq_restore(s);
+}
+
 /*
  * Initialize the timer facility, called at system startup time.
  */
@@ -387,7 +532,6 @@ timer_init()
 {
 	thread *th;
 
-	list_init(&timer_list);
 	list_init(&expire_list);
 	event_init(&timer_event, "timer", event::ev_SLEEP);
 	event_init(&delay_event, "delay", event::ev_SLEEP);
@@ -396,6 +540,10 @@ timer_init()
 	th = kthread_create(&timer_thread, nullptr, PRI_TIMER, "timer", MA_FAST);
 	if (!th)
 		panic("timer_init");
+
+#if defined(CONFIG_TICKLESS)
+	tick_time = timer_monotonic();
+#endif
 }
 
 /*
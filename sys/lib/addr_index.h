@@ -0,0 +1,146 @@
+#pragma once
+
+/*
+ * Address range index
+ *
+ * Sorted array of non-overlapping address ranges for finding the range
+ * containing an address by binary search rather than by walking a list.
+ * The most recent hit is remembered as lookups tend to repeat, e.g. checking
+ * several system call arguments on the same stack.
+ *
+ * The index is rebuilt in full after a change rather than updated in place.
+ * While it is out of date lookups are not possible and the caller must use
+ * its own list instead.
+ *
+ * The index does not allocate memory or perform locking itself. Lookups may
+ * run concurrently with each other but not with a rebuild.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+template<typename T>
+class addr_index {
+public:
+	struct entry {
+		const void *begin;	/* start of range */
+		const void *end;	/* end of range */
+		T *val;			/* object describing range */
+	};
+
+	/*
+	 * capacity - number of entries which fit in storage
+	 */
+	size_t capacity() const
+	{
+		return capacity_;
+	}
+
+	/*
+	 * assign - replace storage with space for capacity entries
+	 *
+	 * Invalidates the index. Returns the previous storage.
+	 */
+	entry *assign(entry *storage, size_t capacity)
+	{
+		invalidate();
+		entry *old = v_;
+		v_ = storage;
+		capacity_ = capacity;
+		return old;
+	}
+
+	/*
+	 * invalidate - mark index out of date
+	 */
+	void invalidate()
+	{
+		valid_ = false;
+		n_ = 0;
+		hint_.store(0, std::memory_order_relaxed);
+	}
+
+	/*
+	 * push_back - append range while rebuilding
+	 *
+	 * Ranges must be appended in ascending address order.
+	 */
+	void push_back(const void *begin, const void *end, T *val)
+	{
+		assert(!valid_ && n_ < capacity_);
+		assert(!n_ || v_[n_ - 1].end <= begin);
+		v_[n_++] = {begin, end, val};
+	}
+
+	/*
+	 * validate - finish rebuilding index
+	 */
+	void validate()
+	{
+		valid_ = true;
+	}
+
+	/*
+	 * valid - check if index is up to date
+	 */
+	bool valid() const
+	{
+		return valid_;
+	}
+
+	/*
+	 * size - number of ranges in index
+	 */
+	size_t size() const
+	{
+		return n_;
+	}
+
+	/*
+	 * find - find range containing addr
+	 *
+	 * Index must be valid. Returns nullptr if no range contains addr.
+	 */
+	T *find(const void *addr) const
+	{
+		assert(valid_);
+		const size_t h = hint_.load(std::memory_order_relaxed);
+		if (h < n_ && v_[h].begin <= addr && v_[h].end > addr)
+			return v_[h].val;
+		const size_t i = upper(addr);
+		if (i == n_ || v_[i].begin > addr)
+			return nullptr;
+		hint_.store(i, std::memory_order_relaxed);
+		return v_[i].val;
+	}
+
+	/*
+	 * first_above - find first range ending above addr
+	 *
+	 * Index must be valid. Returns nullptr if there is no such range.
+	 */
+	T *first_above(const void *addr) const
+	{
+		assert(valid_);
+		const size_t i = upper(addr);
+		return i == n_ ? nullptr : v_[i].val;
+	}
+
+private:
+	/* index of first range ending above addr */
+	size_t upper(const void *addr) const
+	{
+		return std::upper_bound(v_, v_ + n_, addr,
+		    [](const void *a, const entry &e) {
+			return a < e.end;
+		}) - v_;
+	}
+
+	entry *v_ = nullptr;
+	size_t n_ = 0;
+	size_t capacity_ = 0;
+	bool valid_ = false;
+	mutable std::atomic<size_t> hint_{0};
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+/*
+ * Binary printf
+ *
+ * Saves printf arguments so that formatting can be deferred until the output
+ * is needed. Arguments are stored unaligned in the order they are consumed.
+ * Strings are copied including their terminating null so they need not
+ * outlive the call, but the format string itself must.
+ *
+ * Formatting is robust against corrupt argument data: it stops at the end of
+ * the argument data and never reads outside it.
+ */
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+/*
+ * Parsed conversion specification
+ */
+struct bin_spec {
+	const char *end;	/* character after conversion */
+	int stars;		/* number of '*' width & precision arguments */
+	char type;		/* argument type, 0 for none */
+};
+
+/*
+ * bin_parse - parse conversion specification following '%'
+ *
+ * Argument types are 'i' int, 'l' long, 'L' long long, 'j' intmax_t,
+ * 'z' size_t, 't' ptrdiff_t, 'p' pointer, 's' string, 'n' ignored pointer,
+ * 'd' double and 'D' long double.
+ */
+inline bin_spec
+bin_parse(const char *p)
+{
+	bin_spec s{.end = nullptr, .stars = 0, .type = 0};
+	char mod = 0;
+
+	/* flags */
+	while (*p && strchr("-+ #0'", *p))
+		++p;
+	/* width & precision */
+	auto field = [&] {
+		if (*p == '*') {
+			++s.stars;
+			++p;
+		} else while (*p >= '0' && *p <= '9')
+			++p;
+	};
+	field();
+	if (*p == '.') {
+		++p;
+		field();
+	}
+	/* length modifier */
+	switch (*p) {
+	case 'h':
+		if (*++p == 'h')
+			++p;
+		break;
+	case 'l':
+		mod = 'l';
+		if (*++p == 'l') {
+			mod = 'L';
+			++p;
+		}
+		break;
+	case 'q':
+	case 'L':
+		mod = 'L';
+		++p;
+		break;
+	case 'j':
+	case 'z':
+	case 't':
+		mod = *p++;
+		break;
+	}
+	/* conversion */
+	switch (*p) {
+	case 'c':
+		s.type = 'i';
+		break;
+	case 'd':
+	case 'i':
+	case 'o':
+	case 'u':
+	case 'x':
+	case 'X':
+		s.type = mod ?: 'i';
+		break;
+	case 'a': case 'A':
+	case 'e': case 'E':
+	case 'f': case 'F':
+	case 'g': case 'G':
+		s.type = mod == 'L' ? 'D' : 'd';
+		break;
+	case 'n':
+	case 'p':
+	case 's':
+		s.type = *p;
+		break;
+	}
+	s.end = *p ? p + 1 : p;
+	return s;
+}
+
+/*
+ * bin_vencode - save arguments for fmt
+ *
+ * Stores at most len bytes in buf. Returns number of bytes required.
+ */
+inline size_t
+bin_vencode(void *buf, size_t len, const char *fmt, va_list ap)
+{
+	char *const b = static_cast<char *>(buf);
+	size_t n = 0;
+
+	auto put = [&](const void *v, size_t sz) {
+		if (n + sz <= len)
+			memcpy(b + n, v, sz);
+		n += sz;
+	};
+	auto put_v = [&](auto v) {
+		put(&v, sizeof v);
+	};
+
+	for (const char *p = fmt; (p = strchr(p, '%'));) {
+		const auto s = bin_parse(p + 1);
+		p = s.end;
+		for (int i = 0; i < s.stars; ++i)
+			put_v(va_arg(ap, int));
+		switch (s.type) {
+		case 'i': put_v(va_arg(ap, int)); break;
+		case 'l': put_v(va_arg(ap, long)); break;
+		case 'L': put_v(va_arg(ap, long long)); break;
+		case 'j': put_v(va_arg(ap, intmax_t)); break;
+		case 'z': put_v(va_arg(ap, size_t)); break;
+		case 't': put_v(va_arg(ap, ptrdiff_t)); break;
+		case 'p': put_v(va_arg(ap, void *)); break;
+		case 'n': va_arg(ap, void *); break;
+		case 'd': put_v(va_arg(ap, double)); break;
+		case 'D': put_v(va_arg(ap, long double)); break;
+		case 's': {
+			const char *str = va_arg(ap, const char *);
+			if (!str)
+				str = "(null)";
+			put(str, strlen(str) + 1);
+			break;
+		}
+		}
+	}
+
+	return n;
+}
+
+/*
+ * bin_format - format saved arguments
+ *
+ * Behaves like snprintf: returns the length of the complete output and null
+ * terminates buf if len is non-zero.
+ */
+inline int
+bin_format(char *buf, size_t len, const char *fmt, const void *args,
+    size_t args_len)
+{
+	const char *a = static_cast<const char *>(args);
+	const char *const a_end = a + args_len;
+	size_t n = 0;
+
+	auto emit = [&](const char *s, size_t sz) {
+		if (n < len)
+			memcpy(buf + n, s, std::min(sz, len - n));
+		n += sz;
+	};
+	auto get = [&](auto &v) {
+		if ((size_t)(a_end - a) < sizeof v)
+			return false;
+		memcpy(&v, a, sizeof v);
+		a += sizeof v;
+		return true;
+	};
+
+	const char *p = fmt;
+	while (*p) {
+		const char *pct = strchr(p, '%');
+		if (!pct) {
+			emit(p, strlen(p));
+			break;
+		}
+		emit(p, pct - p);
+		const auto s = bin_parse(pct + 1);
+		p = s.end;
+
+		char spec[32];
+		const size_t spec_len = s.end - pct;
+		if (pct[1] == '%') {
+			emit("%", 1);
+			continue;
+		}
+		if (!s.type || spec_len >= sizeof spec) {
+			/* unsupported conversion */
+			emit(pct, spec_len);
+			continue;
+		}
+		memcpy(spec, pct, spec_len);
+		spec[spec_len] = 0;
+
+		int star[2];
+		for (int i = 0; i < s.stars; ++i)
+			if (!get(star[i]))
+				goto out;
+
+		auto print = [&](auto v) {
+			char *o = buf + std::min(n, len);
+			const size_t r = len - std::min(n, len);
+			int l;
+			switch (s.stars) {
+			case 0: l = snprintf(o, r, spec, v); break;
+			case 1: l = snprintf(o, r, spec, star[0], v); break;
+			default: l = snprintf(o, r, spec, star[0], star[1], v);
+			}
+			if (l > 0)
+				n += l;
+			return true;
+		};
+		auto print_v = [&](auto v) {
+			return get(v) && print(v);
+		};
+
+		bool ok = true;
+		switch (s.type) {
+		case 'i': ok = print_v(0); break;
+		case 'l': ok = print_v(0L); break;
+		case 'L': ok = print_v(0LL); break;
+		case 'j': ok = print_v(intmax_t{}); break;
+		case 'z': ok = print_v(size_t{}); break;
+		case 't': ok = print_v(ptrdiff_t{}); break;
+		case 'p': ok = print_v((void *)nullptr); break;
+		case 'd': ok = print_v(0.0); break;
+		case 'D': ok = print_v(0.0L); break;
+		case 's': {
+			const char *e = static_cast<const char *>(
+			    memchr(a, 0, a_end - a));
+			if (!(ok = e))
+				break;
+			print(a);
+			a = e + 1;
+			break;
+		}
+		}
+		if (!ok)
+			break;
+	}
+
+out:
+	if (len)
+		buf[std::min(n, len - 1)] = 0;
+	return n;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+/*
+ * Block request queue
+ *
+ * Requests are kept sorted by device offset and dispatched in ascending
+ * offset order starting from the end of the previous dispatch, wrapping
+ * around to the lowest offset when no request lies beyond it (C-LOOK).
+ *
+ * Each dispatch removes a batch of requests which are adjacent on the
+ * device and in the same direction so that they can be issued to the driver
+ * as a single multi-block transfer. Requests which overlap an earlier
+ * request are never dispatched before it, so reordering cannot change the
+ * result of overlapping reads and writes.
+ *
+ * The queue does not perform i/o or locking itself. The owner dispatches
+ * batches, performs the transfer and reports the result with complete(),
+ * which calls each request's completion callback.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <errno.h>
+#include <list.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Block request
+ */
+struct block_request {
+	list link;			/* linkage on queue or batch */
+	bool write;			/* transfer direction */
+	off_t off;			/* device offset */
+	size_t len;			/* transfer length */
+	const iovec *iov;		/* data buffers */
+	size_t iov_off;			/* offset into first buffer */
+	void (*done)(block_request *, ssize_t); /* completion callback */
+	void *arg;			/* completion callback argument */
+	size_t niov;			/* number of buffers spanned */
+	unsigned long seq;		/* submission order */
+};
+
+class block_queue {
+public:
+	/*
+	 * Batch of adjacent requests
+	 */
+	struct batch {
+		list reqs;		/* requests in offset order */
+		bool write;		/* transfer direction */
+		off_t off;		/* device offset */
+		size_t len;		/* total transfer length */
+		size_t niov;		/* total number of buffers */
+		size_t nreqs;		/* number of requests */
+	};
+
+	/*
+	 * init - initialise queue.
+	 *
+	 * Requests are merged while the batch spans no more than max_iov
+	 * buffers and max_len bytes. A single request may exceed these limits.
+	 */
+	void init(size_t max_iov, size_t max_len)
+	{
+		list_init(&queue_);
+		max_iov_ = max_iov;
+		max_len_ = max_len;
+		head_ = 0;
+		seq_ = 0;
+		nreqs_ = 0;
+		nbatches_ = 0;
+	}
+
+	/*
+	 * insert - queue request.
+	 */
+	void insert(block_request *rq)
+	{
+		assert(rq->len);
+		rq->seq = seq_++;
+		rq->niov = 0;
+		for (size_t l = 0, o = rq->iov_off; l < rq->len; o = 0)
+			l += rq->iov[rq->niov++].iov_len - o;
+
+		list *n;
+		for (n = list_first(&queue_); n != &queue_; n = list_next(n))
+			if (rq->off < entry(n)->off)
+				break;
+		list_insert(list_prev(n), &rq->link);
+		++nreqs_;
+	}
+
+	/*
+	 * dispatch - remove next batch of requests from queue.
+	 *
+	 * Queue must not be empty.
+	 */
+	void dispatch(batch &b)
+	{
+		assert(!empty());
+
+		/* first request at or beyond head, otherwise wrap */
+		block_request *rq = entry(list_first(&queue_));
+		block_request *i;
+		list_for_each_entry(i, &queue_, link) {
+			if (i->off >= head_) {
+				rq = i;
+				break;
+			}
+		}
+
+		/* don't pass an earlier overlapping request */
+		while (block_request *h = hazard(rq))
+			rq = h;
+
+		/* extend batch with adjacent requests */
+		block_request *first = rq, *last = rq;
+		b.write = rq->write;
+		b.len = rq->len;
+		b.niov = rq->niov;
+		b.nreqs = 1;
+		while (list_next(&last->link) != &queue_) {
+			block_request *n = entry(list_next(&last->link));
+			if (!mergeable(b, n) || n->off != last->off +
+			    static_cast<off_t>(last->len))
+				break;
+			last = n;
+			add(b, n);
+		}
+		while (list_prev(&first->link) != &queue_) {
+			block_request *p = entry(list_prev(&first->link));
+			if (!mergeable(b, p) || p->off + static_cast<off_t>(
+			    p->len) != first->off)
+				break;
+			first = p;
+			add(b, p);
+		}
+		b.off = first->off;
+
+		/* move batch from queue */
+		list_init(&b.reqs);
+		for (block_request *r = first, *next;; r = next) {
+			next = entry(list_next(&r->link));
+			list_remove(&r->link);
+			list_insert(list_last(&b.reqs), &r->link);
+			if (r == last)
+				break;
+		}
+
+		head_ = b.off + b.len;
+		++nbatches_;
+	}
+
+	/*
+	 * gather - fill iov with buffers for batch.
+	 *
+	 * iov must have space for b.niov entries.
+	 */
+	static void gather(const batch &b, iovec *iov)
+	{
+		block_request *rq;
+		list_for_each_entry(rq, &b.reqs, link) {
+			size_t o = rq->iov_off, l = rq->len;
+			for (const iovec *v = rq->iov; l; ++v, o = 0) {
+				const size_t n = std::min(v->iov_len - o, l);
+				*iov++ = {static_cast<char *>(v->iov_base) + o, n};
+				l -= n;
+			}
+		}
+	}
+
+	/*
+	 * complete - report result of batch transfer to each request.
+	 *
+	 * r is the number of bytes transferred or a negative error. Requests
+	 * which were only partially transferred fail with -EIO.
+	 */
+	static void complete(batch &b, ssize_t r)
+	{
+		size_t end = 0;
+		while (!list_empty(&b.reqs)) {
+			block_request *rq = entry(list_first(&b.reqs));
+			list_remove(&rq->link);
+			end += rq->len;
+			if (r < 0)
+				rq->done(rq, r);
+			else if (static_cast<size_t>(r) < end)
+				rq->done(rq, -EIO);
+			else
+				rq->done(rq, rq->len);
+		}
+	}
+
+	bool empty() const { return list_empty(&queue_); }
+	size_t max_iov() const { return max_iov_; }
+	unsigned long requests() const { return nreqs_; }
+	unsigned long batches() const { return nbatches_; }
+
+private:
+	static block_request *entry(const list *l)
+	{
+		return list_entry(l, block_request, link);
+	}
+
+	static bool overlap(const block_request *a, const block_request *b)
+	{
+		return a->off < b->off + static_cast<off_t>(b->len) &&
+		    b->off < a->off + static_cast<off_t>(a->len);
+	}
+
+	/*
+	 * hazard - find earlier queued request overlapping rq.
+	 */
+	block_request *hazard(const block_request *rq) const
+	{
+		block_request *i;
+		list_for_each_entry(i, &queue_, link)
+			if (i->seq < rq->seq && overlap(i, rq))
+				return i;
+		return nullptr;
+	}
+
+	bool mergeable(const batch &b, const block_request *rq) const
+	{
+		return rq->write == b.write &&
+		    b.niov + rq->niov <= max_iov_ &&
+		    b.len + rq->len <= max_len_ &&
+		    !hazard(rq);
+	}
+
+	static void add(batch &b, const block_request *rq)
+	{
+		b.len += rq->len;
+		b.niov += rq->niov;
+		++b.nreqs;
+	}
+
+	list queue_;			/* queued requests in offset order */
+	size_t max_iov_;		/* maximum buffers per merged batch */
+	size_t max_len_;		/* maximum length of merged batch */
+	off_t head_;			/* end of last dispatched batch */
+	unsigned long seq_;		/* next submission sequence number */
+	unsigned long nreqs_;		/* number of requests queued */
+	unsigned long nbatches_;	/* number of batches dispatched */
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * Buffer cache index
+ *
+ * Tracks a fixed set of buffers, each of which may cache one block of a
+ * device. Valid buffers are hashed by block offset so that lookup is constant
+ * time. All buffers are kept on a least recently used list with invalid
+ * buffers at the cold end so that they are reused first.
+ *
+ * The index does not hold data or perform i/o itself. The owner supplies
+ * buffer memory, reads blocks into buffers and writes back dirty buffers.
+ */
+
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <list.h>
+#include <sys/types.h>
+
+/*
+ * Buffer descriptor
+ */
+struct buffer {
+	off_t off;			/* device offset, -1 if invalid */
+	bool dirty;			/* buffer must be written back */
+	void *data;			/* buffer memory, owned by cache owner */
+	list hash_link;			/* linkage on hash chain */
+	list lru_link;			/* linkage on lru list */
+};
+
+template<unsigned HashBits>
+class buffer_cache {
+public:
+	/*
+	 * init - initialise cache of n buffers for blocks of block_size.
+	 *
+	 * block_size must be a power of 2. Buffer data pointers are preserved,
+	 * all other buffer state is reset.
+	 */
+	void init(buffer *bufs, size_t n, size_t block_size)
+	{
+		assert(std::has_single_bit(block_size));
+		bufs_ = bufs;
+		nbufs_ = n;
+		shift_ = std::countr_zero(block_size);
+		ndirty_ = 0;
+		for (auto &h : hash_)
+			list_init(&h);
+		list_init(&lru_);
+		for (size_t i = 0; i < n; ++i) {
+			buffer *b = &bufs_[i];
+			b->off = -1;
+			b->dirty = false;
+			list_init(&b->hash_link);
+			list_insert(&lru_, &b->lru_link);
+		}
+	}
+
+	/*
+	 * lookup - find buffer caching block at off, nullptr if not cached.
+	 */
+	buffer *lookup(off_t off) const
+	{
+		const list *h = &hash_[hash(off)];
+		buffer *b;
+		list_for_each_entry(b, h, hash_link)
+			if (b->off == off)
+				return b;
+		return nullptr;
+	}
+
+	/*
+	 * touch - mark buffer as most recently used.
+	 */
+	void touch(buffer *b)
+	{
+		list_remove(&b->lru_link);
+		list_insert(list_last(&lru_), &b->lru_link);
+	}
+
+	/*
+	 * victim - find buffer to reuse.
+	 *
+	 * Returns the least recently used clean buffer if there is one so that
+	 * reuse does not need to wait for write back, otherwise returns the
+	 * least recently used buffer.
+	 */
+	buffer *victim() const
+	{
+		buffer *b;
+		list_for_each_entry(b, &lru_, lru_link)
+			if (!b->dirty)
+				return b;
+		return list_entry(list_first(&lru_), buffer, lru_link);
+	}
+
+	/*
+	 * assign - reuse clean buffer to cache block at off.
+	 *
+	 * The buffer becomes most recently used.
+	 */
+	void assign(buffer *b, off_t off)
+	{
+		assert(!b->dirty && !lookup(off));
+		list_remove(&b->hash_link);
+		b->off = off;
+		list_insert(&hash_[hash(off)], &b->hash_link);
+		touch(b);
+	}
+
+	/*
+	 * invalidate - discard contents of buffer.
+	 *
+	 * The buffer is reused before any valid buffer.
+	 */
+	void invalidate(buffer *b)
+	{
+		set_dirty(b, false);
+		list_remove(&b->hash_link);
+		list_init(&b->hash_link);
+		b->off = -1;
+		list_remove(&b->lru_link);
+		list_insert(&lru_, &b->lru_link);
+	}
+
+	/*
+	 * set_dirty - mark buffer dirty or clean.
+	 */
+	void set_dirty(buffer *b, bool dirty)
+	{
+		assert(b->off != -1 || !dirty);
+		if (b->dirty == dirty)
+			return;
+		b->dirty = dirty;
+		dirty ? ++ndirty_ : --ndirty_;
+	}
+
+	/*
+	 * for_each - call fn for each valid buffer.
+	 *
+	 * fn may invalidate the buffer it is passed.
+	 */
+	template<typename F>
+	void for_each(F fn)
+	{
+		for (size_t i = 0; i < nbufs_; ++i)
+			if (bufs_[i].off != -1)
+				fn(&bufs_[i]);
+	}
+
+	size_t size() const { return nbufs_; }
+	size_t dirty() const { return ndirty_; }
+
+private:
+	unsigned hash(off_t off) const
+	{
+		return (off >> shift_) & ((1u << HashBits) - 1);
+	}
+
+	buffer *bufs_;			/* buffer descriptors */
+	size_t nbufs_;			/* number of buffers */
+	unsigned shift_;		/* log2 of block size */
+	size_t ndirty_;			/* number of dirty buffers */
+	list lru_;			/* buffers, least recently used first */
+	list hash_[1u << HashBits];	/* valid buffers hashed by offset */
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+/*
+ * Latency histogram
+ *
+ * Counts latencies in power of two buckets and keeps the worst latency seen
+ * from each of a small number of code paths. Bucket 0 holds latencies of
+ * 0ns, bucket n holds latencies in [2^(n-1), 2^n) ns and the last bucket
+ * holds everything longer.
+ *
+ * A code path is identified by the pair of addresses where the measured
+ * interval started and ended. When all worst case slots are in use a new
+ * path replaces the best of the worst if its latency is longer.
+ *
+ * The histogram does not perform locking itself.
+ */
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+template<size_t Buckets, size_t Worst>
+class latency_hist {
+public:
+	struct record {
+		uint32_t ns;		/* latency */
+		int id;			/* caller supplied id, e.g. vector */
+		const void *from;	/* start of interval */
+		const void *to;		/* end of interval */
+	};
+
+	/*
+	 * bucket_of - bucket holding latency ns
+	 */
+	static constexpr size_t bucket_of(uint32_t ns)
+	{
+		const size_t b = std::bit_width(ns);
+		return b < Buckets ? b : Buckets - 1;
+	}
+
+	/*
+	 * add - record latency of interval from, to
+	 */
+	void add(uint32_t ns, int id, const void *from, const void *to)
+	{
+		++count_;
+		total_ += ns;
+		++buckets_[bucket_of(ns)];
+
+		/* replace worst case for same path, or least bad worst case */
+		record *v = nullptr;
+		for (auto &w : worst_) {
+			if (w.from == from && w.to == to) {
+				v = &w;
+				break;
+			}
+			if (!v || w.ns < v->ns)
+				v = &w;
+		}
+		if (ns > v->ns || (!v->from && !v->to))
+			*v = {ns, id, from, to};
+	}
+
+	/*
+	 * reset - clear histogram
+	 */
+	void reset()
+	{
+		*this = {};
+	}
+
+	/*
+	 * count - number of latencies recorded
+	 */
+	uint64_t count() const
+	{
+		return count_;
+	}
+
+	/*
+	 * total - sum of latencies recorded
+	 */
+	uint64_t total() const
+	{
+		return total_;
+	}
+
+	/*
+	 * bucket - number of latencies recorded in bucket i
+	 */
+	uint32_t bucket(size_t i) const
+	{
+		return buckets_[i];
+	}
+
+	/*
+	 * worst - worst case records, longest first
+	 *
+	 * Unused records have from and to set to nullptr.
+	 */
+	void worst(record (&r)[Worst]) const
+	{
+		for (size_t i = 0; i < Worst; ++i) {
+			size_t j = i;
+			for (; j && r[j - 1].ns < worst_[i].ns; --j)
+				r[j] = r[j - 1];
+			r[j] = worst_[i];
+		}
+	}
+
+private:
+	uint64_t count_ = 0;
+	uint64_t total_ = 0;
+	uint32_t buckets_[Buckets]{};
+	record worst_[Worst]{};
+};
@@ -0,0 +1,233 @@
+#pragma once
+
+/*
+ * Log ring
+ *
+ * Lock-free multi-producer ring of variable length records. Producers reserve
+ * space by advancing the head with compare and swap, fill in the record, then
+ * commit it by publishing its position in the record state. Reservation never
+ * waits so it is safe from interrupt handlers and needs no interrupt masking.
+ *
+ * When the ring is full the oldest committed records are dropped by
+ * advancing the tail, also with compare and swap. A record which is still
+ * being written can't be dropped, so reservation fails if the ring wraps
+ * around to a record which is still being written.
+ *
+ * Readers don't modify the ring. A reader copies a record then checks that it
+ * was not dropped while it was copying, in the same way as a sequence lock.
+ *
+ * Positions are free running byte counts which are allowed to wrap. Records
+ * are aligned so that the unused space at the end of the ring can always
+ * hold a wrap record.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+
+class log_ring {
+public:
+	/*
+	 * Record alignment
+	 */
+	static constexpr size_t align = std::max(alignof(std::max_align_t),
+	    2 * sizeof(unsigned long));
+
+	/*
+	 * log_ring - construct ring in buf
+	 *
+	 * buf must be aligned to align and size must be a power of 2.
+	 */
+	constexpr log_ring(char *buf, size_t size)
+	: buf_{buf}
+	, size_{size}
+	, head_{0}
+	, tail_{0}
+	{
+		assert(!(size & (size - 1)) && size >= 2 * align);
+	}
+
+	/*
+	 * reserve - reserve space for len byte record
+	 *
+	 * Returns pointer to record data and sets pos to the position of the
+	 * record, or returns nullptr if there is not enough space.
+	 */
+	void *reserve(size_t len, unsigned long *pos)
+	{
+		const size_t need = total(len);
+		if (need > size_ / 2)
+			return nullptr;
+
+		unsigned long h = head_.load(std::memory_order_relaxed), n;
+		size_t wrap;
+		do {
+			/* wrap if record would not fit before end of ring */
+			wrap = size_ - idx(h);
+			if (wrap >= need)
+				wrap = 0;
+			n = h + wrap + need;
+
+			/* drop oldest records to make space */
+			for (unsigned long t = tail_.load(
+			    std::memory_order_acquire);
+			    (long)(n - t - size_) > 0;
+			    t = tail_.load(std::memory_order_acquire)) {
+				if (!drop(t))
+					return nullptr;
+			}
+		} while (!head_.compare_exchange_weak(h, n,
+		    std::memory_order_acq_rel, std::memory_order_relaxed));
+
+		if (wrap) {
+			hdr *w = at(h);
+			w->len.store(wrap - sizeof(hdr),
+			    std::memory_order_relaxed);
+			w->state.store(h | st_wrap | st_committed,
+			    std::memory_order_release);
+			h += wrap;
+		}
+
+		hdr *r = at(h);
+		r->state.store(h, std::memory_order_relaxed);
+		r->len.store(len, std::memory_order_relaxed);
+		*pos = h;
+		return r + 1;
+	}
+
+	/*
+	 * commit - publish record reserved at pos
+	 */
+	void commit(unsigned long pos)
+	{
+		at(pos)->state.store(pos | st_committed,
+		    std::memory_order_release);
+	}
+
+	/*
+	 * read - find record at pos
+	 *
+	 * Skips wrap records by updating pos. Returns pointer to record data
+	 * and sets len, or returns nullptr if pos is the head of the ring or
+	 * the record at pos is not yet committed.
+	 *
+	 * Record data must be copied then checked with valid.
+	 */
+	const void *read(unsigned long *pos, size_t *len) const
+	{
+		while (*pos != head_.load(std::memory_order_acquire)) {
+			const hdr *r = at(*pos);
+			const unsigned long s = r->state.load(
+			    std::memory_order_acquire);
+			const size_t l = r->len.load(std::memory_order_relaxed);
+			if ((s & ~st_mask) != *pos || !(s & st_committed) ||
+			    l > size_ - idx(*pos) - sizeof(hdr))
+				return nullptr;
+			if (s & st_wrap) {
+				*pos += sizeof(hdr) + l;
+				continue;
+			}
+			*len = l;
+			return r + 1;
+		}
+		return nullptr;
+	}
+
+	/*
+	 * next - position of record following record of len bytes at pos
+	 */
+	unsigned long next(unsigned long pos, size_t len) const
+	{
+		return pos + total(len);
+	}
+
+	/*
+	 * valid - check that record at pos has not been dropped
+	 */
+	bool valid(unsigned long pos) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return (long)(pos - tail_.load(std::memory_order_relaxed)) >= 0;
+	}
+
+	/*
+	 * head - position after newest record
+	 */
+	unsigned long head() const
+	{
+		return head_.load(std::memory_order_acquire);
+	}
+
+	/*
+	 * tail - position of oldest record
+	 */
+	unsigned long tail() const
+	{
+		return tail_.load(std::memory_order_acquire);
+	}
+
+	/*
+	 * reset - drop all records
+	 *
+	 * Must not be called concurrently with producers.
+	 */
+	void reset()
+	{
+		tail_.store(head_.load());
+	}
+
+private:
+	static constexpr unsigned long st_committed = 1;
+	static constexpr unsigned long st_wrap = 2;
+	static constexpr unsigned long st_mask = 3;
+
+	/*
+	 * record header
+	 */
+	struct hdr {
+		std::atomic_ulong state;    /* position | st_ flags */
+		std::atomic_ulong len;	    /* length of record data */
+	};
+
+	static_assert(sizeof(hdr) <= align);
+
+	static size_t total(size_t len)
+	{
+		return (sizeof(hdr) + len + align - 1) & -align;
+	}
+
+	size_t idx(unsigned long pos) const
+	{
+		return pos & (size_ - 1);
+	}
+
+	hdr *at(unsigned long pos) const
+	{
+		return reinterpret_cast<hdr *>(buf_ + idx(pos));
+	}
+
+	/*
+	 * drop - drop record at tail position t
+	 *
+	 * Returns false if the record is still being written.
+	 */
+	bool drop(unsigned long t)
+	{
+		const hdr *r = at(t);
+		const unsigned long s =
+		    r->state.load(std::memory_order_acquire);
+		const size_t l = r->len.load(std::memory_order_relaxed);
+		if ((s & ~st_mask) != t || !(s & st_committed))
+			return tail_.load(std::memory_order_acquire) != t;
+		const unsigned long n = s & st_wrap
+		    ? t + sizeof(hdr) + l : next(t, l);
+		tail_.compare_exchange_strong(t, n, std::memory_order_acq_rel);
+		return true;
+	}
+
+	char *const buf_;
+	const size_t size_;
+	std::atomic_ulong head_;    /* position after newest record */
+	std::atomic_ulong tail_;    /* position of oldest record */
+};
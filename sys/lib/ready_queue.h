@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+ * Ready queue
+ *
+ * Queue of items which may have events pending, e.g. files watched by an
+ * epoll instance. Items are queued in O(1) by notify, normally from the
+ * wakeup path of the object which became ready, so that a waiter examines
+ * only items which may be ready instead of scanning every item.
+ *
+ * Harvesting is split so that readiness can be tested without holding the
+ * lock protecting the queue: take moves items to a private list, the caller
+ * tests each item then calls finish. Level triggered items which are still
+ * ready are requeued at the tail so that busy items can't starve others.
+ * Edge triggered items are requeued only if notified while being harvested.
+ *
+ * The queue does not perform locking itself.
+ */
+
+#include <cstddef>
+#include <list.h>
+
+/*
+ * Ready queue item
+ */
+struct ready_item {
+	list link;			/* linkage on ready queue or harvest */
+	unsigned events;		/* events of interest, 0 if disabled */
+	bool edge;			/* edge triggered */
+	bool oneshot;			/* disable once events are reported */
+	bool queued;			/* on ready queue or being harvested */
+	bool pending;			/* notified while queued */
+};
+
+class ready_queue {
+public:
+	ready_queue()
+	{
+		list_init(&ready_);
+	}
+
+	/*
+	 * init - initialise item which is not queued.
+	 */
+	static void init(ready_item *it, unsigned events, bool edge,
+	    bool oneshot)
+	{
+		it->events = events;
+		it->edge = edge;
+		it->oneshot = oneshot;
+		it->queued = false;
+		it->pending = false;
+	}
+
+	/*
+	 * notify - notify item of events.
+	 *
+	 * Returns true if the item was added to the queue.
+	 */
+	bool notify(ready_item *it, unsigned events)
+	{
+		if (!(events & it->events))
+			return false;
+		if (it->queued) {
+			it->pending = true;
+			return false;
+		}
+		it->queued = true;
+		it->pending = false;
+		list_insert(list_last(&ready_), &it->link);
+		return true;
+	}
+
+	/*
+	 * remove - remove item from queue.
+	 *
+	 * Must not be called for an item which is being harvested.
+	 */
+	void remove(ready_item *it)
+	{
+		if (it->queued)
+			list_remove(&it->link);
+		it->queued = false;
+	}
+
+	/*
+	 * take - move up to max items from head of queue to harvest list tx.
+	 *
+	 * Returns number of items taken.
+	 */
+	size_t take(list *tx, size_t max)
+	{
+		size_t n = 0;
+		list_init(tx);
+		for (; n < max && !list_empty(&ready_); ++n) {
+			list *l = list_remove(list_first(&ready_));
+			list_entry(l, ready_item, link)->pending = false;
+			list_insert(list_last(tx), l);
+		}
+		return n;
+	}
+
+	/*
+	 * finish - complete harvest of item taken from queue.
+	 *
+	 * ready is true if events were reported for the item.
+	 */
+	void finish(ready_item *it, bool ready)
+	{
+		list_remove(&it->link);
+		if (ready && it->oneshot)
+			it->events = 0;
+		if (it->events && (it->pending || (ready && !it->edge))) {
+			it->pending = false;
+			list_insert(list_last(&ready_), &it->link);
+			return;
+		}
+		it->queued = false;
+	}
+
+	bool empty() const { return list_empty(&ready_); }
+
+private:
+	list ready_;			/* items which may be ready */
+};
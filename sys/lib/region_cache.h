@@ -0,0 +1,212 @@
+#pragma once
+
+/*
+ * Protection region cache
+ *
+ * Tracks the dynamic regions loaded into a memory protection unit and saves
+ * the working set of each address space when it is switched out so that it
+ * can be reloaded when it is switched back in instead of being faulted back
+ * in one region at a time.
+ *
+ * Loaded regions are stamped when they are loaded and the least recently
+ * loaded region is the victim when a new region is needed. The protection
+ * hardware doesn't record accesses, so the most recently faulted regions
+ * are taken to be the most recently used.
+ *
+ * Saved working sets are kept for a limited number of address spaces. The
+ * least recently saved working set is replaced when there is no free slot.
+ *
+ * The cache does not access the hardware. Callers program the regions which
+ * the cache selects. The cache is all zeroes until init is called so that it
+ * can be placed in uninitialised memory.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+template<typename T, size_t Regions, size_t Spaces>
+class region_cache {
+public:
+	/*
+	 * init - set number of regions implemented by hardware
+	 *
+	 * Must be called before any other member.
+	 */
+	void init(size_t regions)
+	{
+		regions_ = std::min(regions, Regions);
+	}
+
+	/*
+	 * victim - select region to replace in range [first, Regions)
+	 *
+	 * Returns a free region if there is one, otherwise the least recently
+	 * loaded region.
+	 */
+	size_t victim(size_t first) const
+	{
+		size_t v = first;
+		for (size_t i = first; i < regions_; ++i) {
+			if (!loaded_[i].stamp)
+				return i;
+			if (loaded_[i].stamp < loaded_[v].stamp)
+				v = i;
+		}
+		return v;
+	}
+
+	/*
+	 * load - record that region i has been loaded with r
+	 */
+	void load(size_t i, const T &r)
+	{
+		loaded_[i] = {r, ++clock_};
+	}
+
+	/*
+	 * unload - record that region i has been disabled
+	 */
+	void unload(size_t i)
+	{
+		loaded_[i].stamp = 0;
+	}
+
+	/*
+	 * unload_all - record that all regions have been disabled
+	 */
+	void unload_all()
+	{
+		for (auto &l : loaded_)
+			l.stamp = 0;
+	}
+
+	/*
+	 * unload_if - disable loaded regions in [first, Regions) matching pred
+	 *
+	 * Calls disable(i) for each region which must be disabled.
+	 */
+	template<typename P, typename F>
+	void unload_if(size_t first, P pred, F disable)
+	{
+		for (size_t i = first; i < regions_; ++i) {
+			if (!loaded_[i].stamp || !pred(loaded_[i].r))
+				continue;
+			loaded_[i].stamp = 0;
+			disable(i);
+		}
+	}
+
+	/*
+	 * save - save regions loaded in [first, Regions) for address space key
+	 */
+	void save(const void *key, size_t first)
+	{
+		/* save in load order, oldest first */
+		entry e[Regions];
+		size_t n = 0;
+		for (size_t i = first; i < regions_; ++i) {
+			if (!loaded_[i].stamp)
+				continue;
+			size_t j = n++;
+			for (; j && e[j - 1].stamp > loaded_[i].stamp; --j)
+				e[j] = e[j - 1];
+			e[j] = loaded_[i];
+		}
+
+		space *s = find(key);
+		if (!s && !n)
+			return;
+		if (!s)
+			s = std::min_element(std::begin(spaces_),
+			    std::end(spaces_), [](auto &a, auto &b) {
+				return a.stamp < b.stamp;
+			});
+		for (size_t i = 0; i < n; ++i)
+			s->r[i] = e[i].r;
+		s->n = n;
+		s->key = key;
+		s->stamp = ++clock_;
+	}
+
+	/*
+	 * restore - load regions saved for address space key into
+	 *	     [first, Regions)
+	 *
+	 * All regions in [first, Regions) must have been unloaded. Calls
+	 * program(i, r) for each region to be loaded. If there is not enough
+	 * space the most recently loaded regions are restored. Returns number
+	 * of regions restored.
+	 */
+	template<typename F>
+	size_t restore(const void *key, size_t first, F program)
+	{
+		const space *s = find(key);
+		const size_t end = std::min(regions_, Regions);
+		if (!s || first >= end)
+			return 0;
+		const size_t n = std::min(s->n, end - first);
+		for (size_t i = 0; i < n; ++i) {
+			const T &r = s->r[s->n - n + i];
+			load(first + i, r);
+			program(first + i, r);
+		}
+		return n;
+	}
+
+	/*
+	 * forget_if - remove regions saved for address space key matching pred
+	 */
+	template<typename P>
+	void forget_if(const void *key, P pred)
+	{
+		space *s = find(key);
+		if (!s)
+			return;
+		s->n = std::remove_if(s->r, s->r + s->n, pred) - s->r;
+	}
+
+	/*
+	 * saved - number of regions saved for address space key
+	 */
+	size_t saved(const void *key) const
+	{
+		const space *s = find(key);
+		return s ? s->n : 0;
+	}
+
+private:
+	struct entry {
+		T r;
+		uint64_t stamp;		/* load time, 0 if not loaded */
+	};
+
+	struct space {
+		const void *key;	/* address space, nullptr if free */
+		uint64_t stamp;		/* save time */
+		size_t n;		/* number of saved regions */
+		T r[Regions];		/* saved regions, oldest first */
+	};
+
+	const space *find(const void *key) const
+	{
+		if (!key)
+			return nullptr;
+		for (auto &s : spaces_)
+			if (s.key == key)
+				return &s;
+		return nullptr;
+	}
+
+	space *find(const void *key)
+	{
+		return const_cast<space *>(std::as_const(*this).find(key));
+	}
+
+	size_t regions_ = 0;
+	uint64_t clock_ = 0;
+	entry loaded_[Regions]{};
+	space spaces_[Spaces]{};
+};
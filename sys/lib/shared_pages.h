@@ -0,0 +1,163 @@
+#pragma once
+
+/*
+ * Shared page index
+ *
+ * Tracks regions of pages which are mapped by more than one address space,
+ * e.g. read only file mappings of the same program text. Regions are keyed
+ * by the object they were filled from and the offset and length within it,
+ * and can also be found by address so that unmapping can release them.
+ *
+ * Each page has its own reference count as a mapping may be partially
+ * unmapped. Once any page of a region has been released the region is no
+ * longer complete and is not handed out to new mappings.
+ *
+ * The index does not allocate memory, fill pages or perform locking itself.
+ */
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <list.h>
+#include <sys/types.h>
+
+/*
+ * Shared region
+ */
+struct shared_region {
+	list link;			/* linkage on index */
+	const void *key;		/* object region was filled from */
+	off_t off;			/* offset of region in object */
+	size_t len;			/* length of region in object */
+	std::byte *base;		/* page aligned base address */
+	size_t npages;			/* number of pages */
+	size_t live;			/* number of referenced pages */
+	bool complete;			/* all pages are still referenced */
+	uint16_t refs[];		/* per page reference counts */
+};
+
+class shared_pages {
+public:
+	/*
+	 * size - size of region descriptor for npages pages.
+	 */
+	static constexpr size_t size(size_t npages)
+	{
+		return sizeof(shared_region) + npages * sizeof(uint16_t);
+	}
+
+	shared_pages(size_t page_size)
+	: page_size_{page_size}
+	{
+		list_init(&regions_);
+	}
+
+	/*
+	 * find - find complete region filled from key at off, len.
+	 */
+	shared_region *find(const void *key, off_t off, size_t len) const
+	{
+		shared_region *r;
+		list_for_each_entry(r, &regions_, link)
+			if (r->complete && r->key == key && r->off == off &&
+			    r->len == len)
+				return r;
+		return nullptr;
+	}
+
+	/*
+	 * find_addr - find region containing addr.
+	 */
+	shared_region *find_addr(const void *addr) const
+	{
+		shared_region *r;
+		list_for_each_entry(r, &regions_, link)
+			if (addr >= r->base &&
+			    addr < r->base + r->npages * page_size_)
+				return r;
+		return nullptr;
+	}
+
+	/*
+	 * insert - add region with one reference to each page.
+	 *
+	 * r must have space for npages reference counts.
+	 */
+	void insert(shared_region *r, const void *key, off_t off, size_t len,
+	    void *base, size_t npages)
+	{
+		assert(npages);
+		r->key = key;
+		r->off = off;
+		r->len = len;
+		r->base = static_cast<std::byte *>(base);
+		r->npages = npages;
+		r->live = npages;
+		r->complete = true;
+		for (size_t i = 0; i < npages; ++i)
+			r->refs[i] = 1;
+		list_insert(&regions_, &r->link);
+	}
+
+	/*
+	 * ref - add reference to each page of complete region.
+	 *
+	 * Returns false if a page can't take another reference.
+	 */
+	bool ref(shared_region *r)
+	{
+		assert(r->complete);
+		for (size_t i = 0; i < r->npages; ++i)
+			if (r->refs[i] == UINT16_MAX)
+				return false;
+		for (size_t i = 0; i < r->npages; ++i)
+			++r->refs[i];
+		return true;
+	}
+
+	/*
+	 * unref - drop reference to pages of r in addr, len.
+	 *
+	 * Calls release(addr, len) for each run of pages which is no longer
+	 * referenced. Returns true if no page of the region is referenced, in
+	 * which case the region has been removed from the index.
+	 */
+	template<typename F>
+	bool unref(shared_region *r, void *addr, size_t len, F release)
+	{
+		const size_t first = (static_cast<std::byte *>(addr) - r->base) /
+		    page_size_;
+		const size_t last = first + (len + page_size_ - 1) / page_size_;
+		assert(first < last && last <= r->npages);
+
+		size_t run = last;
+		for (size_t i = first; i <= last; ++i) {
+			if (i < last) {
+				assert(r->refs[i]);
+				if (!--r->refs[i]) {
+					r->complete = false;
+					--r->live;
+					if (run == last)
+						run = i;
+					continue;
+				}
+			}
+			if (run != last) {
+				release(r->base + run * page_size_,
+				    (i - run) * page_size_);
+				run = last;
+			}
+		}
+
+		if (r->live)
+			return false;
+		list_remove(&r->link);
+		return true;
+	}
+
+	bool empty() const { return list_empty(&regions_); }
+
+private:
+	list regions_;			/* shared regions */
+	size_t page_size_;		/* size of page */
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+/*
+ * Slab cache for fixed size objects
+ *
+ * A slab is a naturally aligned block of memory holding a header followed by
+ * objects of one size. A bitmap in the header records which objects are
+ * allocated. Slabs with free objects are kept on a partial list so that
+ * allocating and freeing are constant time.
+ *
+ * The cache does not allocate memory itself. When alloc() fails the owner
+ * hands the cache a new slab with grow(), and free() returns slabs which
+ * are no longer needed so that the owner can release them. If no other slab
+ * has free objects one empty slab is retained to avoid thrashing when
+ * allocations hover around a slab boundary. The owner can take it back with
+ * shrink() when memory is short.
+ */
+
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list.h>
+
+class slab_cache;
+
+/*
+ * Slab header, placed at the start of each slab
+ */
+struct slab {
+	uint32_t magic;			/* magic number, owned by cache owner */
+	uint16_t nfree;			/* number of free objects */
+	slab_cache *cache;		/* cache this slab belongs to */
+	list link;			/* linkage on partial list */
+	uint32_t map[8];		/* allocated object bitmap */
+};
+
+class slab_cache {
+public:
+	static constexpr size_t max_objects = sizeof(slab::map) * 8;
+
+	/*
+	 * init - initialise cache for objects of obj_size in slabs of
+	 *	  slab_size. magic is stored in each slab header.
+	 *
+	 * obj_size must be a multiple of align and slab_size a power of 2.
+	 */
+	void init(size_t obj_size, size_t slab_size, uint32_t magic,
+	    size_t align = 16)
+	{
+		assert(obj_size && !(obj_size % align));
+		assert(std::has_single_bit(slab_size));
+		obj_size_ = obj_size;
+		slab_size_ = slab_size;
+		first_ = (sizeof(slab) + align - 1) / align * align;
+		assert(first_ + obj_size_ <= slab_size_);
+		nobjs_ = (slab_size_ - first_) / obj_size_;
+		if (nobjs_ > max_objects)
+			nobjs_ = max_objects;
+		magic_ = magic;
+		list_init(&partial_);
+		empty_ = nullptr;
+		nslabs_ = 0;
+		nalloc_ = 0;
+	}
+
+	/*
+	 * alloc - allocate an object, returns nullptr if cache needs to grow.
+	 */
+	void *alloc()
+	{
+		slab *s;
+		if (!list_empty(&partial_))
+			s = list_entry(list_first(&partial_), slab, link);
+		else if (empty_) {
+			s = empty_;
+			empty_ = nullptr;
+			list_insert(&partial_, &s->link);
+		} else
+			return nullptr;
+
+		assert(s->magic == magic_ && s->nfree);
+		unsigned w = 0;
+		while (!~s->map[w])
+			++w;
+		const unsigned b = std::countr_one(s->map[w]);
+		s->map[w] |= 1u << b;
+		if (!--s->nfree)
+			list_remove(&s->link);
+		++nalloc_;
+		return reinterpret_cast<char *>(s) + first_ +
+		    (w * 32 + b) * obj_size_;
+	}
+
+	/*
+	 * grow - add an empty slab to the cache.
+	 *
+	 * mem must be slab_size bytes aligned to slab_size.
+	 */
+	void grow(void *mem)
+	{
+		assert(!(reinterpret_cast<uintptr_t>(mem) & (slab_size_ - 1)));
+		slab *s = static_cast<slab *>(mem);
+		s->magic = magic_;
+		s->nfree = nobjs_;
+		s->cache = this;
+		/* objects past the end of the slab are permanently allocated */
+		for (unsigned w = 0; w < std::size(s->map); ++w) {
+			const unsigned first = w * 32;
+			if (first + 32 <= nobjs_)
+				s->map[w] = 0;
+			else if (first >= nobjs_)
+				s->map[w] = ~0u;
+			else
+				s->map[w] = ~0u << (nobjs_ - first);
+		}
+		list_insert(&partial_, &s->link);
+		++nslabs_;
+	}
+
+	/*
+	 * free - free an object.
+	 *
+	 * Returns a slab which is no longer needed, or nullptr.
+	 */
+	void *free(void *p)
+	{
+		slab *s = slab_of(p, slab_size_);
+		assert(s->magic == magic_ && s->cache == this);
+		const size_t off = static_cast<char *>(p) -
+		    reinterpret_cast<char *>(s) - first_;
+		assert(!(off % obj_size_));
+		const size_t i = off / obj_size_;
+		assert(s->map[i / 32] & 1u << i % 32);
+		s->map[i / 32] &= ~(1u << i % 32);
+		--nalloc_;
+		if (!s->nfree++)
+			list_insert(&partial_, &s->link);
+		if (s->nfree < nobjs_) {
+			/* retained slab is not needed while s has space */
+			return shrink();
+		}
+
+		/* slab is empty */
+		list_remove(&s->link);
+		if (!empty_ && list_empty(&partial_)) {
+			empty_ = s;
+			return nullptr;
+		}
+		--nslabs_;
+		s->magic = 0;
+		return s;
+	}
+
+	/*
+	 * shrink - release retained empty slab, returns nullptr if none.
+	 */
+	void *shrink()
+	{
+		slab *s = empty_;
+		if (!s)
+			return nullptr;
+		empty_ = nullptr;
+		--nslabs_;
+		s->magic = 0;
+		return s;
+	}
+
+	/*
+	 * slab_of - find slab header for object.
+	 */
+	static slab *slab_of(const void *p, size_t slab_size)
+	{
+		return reinterpret_cast<slab *>(
+		    reinterpret_cast<uintptr_t>(p) & ~(slab_size - 1));
+	}
+
+	size_t size() const { return obj_size_; }
+	size_t objects_per_slab() const { return nobjs_; }
+	size_t slabs() const { return nslabs_; }
+	size_t allocated() const { return nalloc_; }
+
+private:
+	size_t obj_size_;		/* object size */
+	size_t slab_size_;		/* slab size */
+	size_t first_;			/* offset of first object in slab */
+	unsigned nobjs_;		/* objects per slab */
+	uint32_t magic_;		/* slab magic number */
+	list partial_;			/* slabs with free objects */
+	slab *empty_;			/* retained empty slab */
+	size_t nslabs_;			/* number of slabs in cache */
+	size_t nalloc_;			/* number of allocated objects */
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+/*
+ * Shared time page
+ *
+ * The kernel publishes timekeeping state in a small read-only region which
+ * is mapped into every address space. Its address is passed to programs in
+ * the AT_APEX_TIME auxiliary vector entry so that the C library can read the
+ * time without a system call:
+ *
+ *	const struct time_page *tp = (void *)getauxval(AT_APEX_TIME);
+ *	if (tp && !time_page_gettime(tp, clk, ts))
+ *		return 0;
+ *	... fall back to clock_gettime system call ...
+ *
+ * The page is protected by a sequence count which is odd while the kernel is
+ * updating it. Readers retry if the count changed while they were reading.
+ *
+ * This header is shared with userspace so must remain valid C.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Auxiliary vector entry holding address of time page. Apex specific, well
+ * outside the range used by Linux.
+ */
+#define AT_APEX_TIME 0x4150
+
+/*
+ * Size & alignment of time page region
+ */
+#define TIME_PAGE_SIZE 64
+
+/*
+ * Time page flags
+ */
+#define TIME_PAGE_TICK 1	/* coarse is updated by a periodic tick */
+#define TIME_PAGE_COUNTER 2	/* counter is readable by userspace */
+
+struct time_page {
+	uint32_t seq;			/* odd while being updated */
+	uint32_t flags;			/* TIME_PAGE_ flags */
+	uint64_t coarse;		/* monotonic time at last tick (ns) */
+	uint64_t realtime_offset;	/* realtime - monotonic (ns) */
+	const volatile uint32_t *counter; /* 64-bit counter, low word first */
+	uint32_t counter_ns;		/* nanoseconds per count */
+};
+
+/*
+ * time_page_write_begin - start updating time page
+ *
+ * Must be called with interrupts disabled.
+ */
+static inline void
+time_page_write_begin(struct time_page *tp)
+{
+	__atomic_store_n(&tp->seq, tp->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * time_page_write_end - finish updating time page
+ */
+static inline void
+time_page_write_end(struct time_page *tp)
+{
+	__atomic_store_n(&tp->seq, tp->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * time_page_counter - read counter and convert to nanoseconds
+ */
+static inline uint64_t
+time_page_counter(const volatile uint32_t *c, uint32_t counter_ns)
+{
+	uint32_t h, l;
+	do {
+		h = c[1];
+		l = c[0];
+	} while (h != c[1]);
+	return ((uint64_t)h << 32 | l) * counter_ns;
+}
+
+/*
+ * time_page_gettime - read clock from time page
+ *
+ * Returns 0 on success or -1 if the clock can't be read from the time page,
+ * in which case the caller must use the clock_gettime system call.
+ */
+static inline int
+time_page_gettime(const struct time_page *tp, clockid_t clk,
+    struct timespec *ts)
+{
+	int realtime, coarse;
+	switch (clk) {
+	case CLOCK_REALTIME:
+		realtime = 1; coarse = 0; break;
+	case CLOCK_REALTIME_COARSE:
+		realtime = 1; coarse = 1; break;
+	case CLOCK_MONOTONIC:
+	case CLOCK_MONOTONIC_RAW:
+		realtime = 0; coarse = 0; break;
+	case CLOCK_MONOTONIC_COARSE:
+		realtime = 0; coarse = 1; break;
+	default:
+		return -1;
+	}
+
+	uint32_t seq;
+	uint64_t ns;
+	do {
+		seq = __atomic_load_n(&tp->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		const uint32_t flags = tp->flags;
+		if (coarse && flags & TIME_PAGE_TICK)
+			ns = tp->coarse;
+		else if (flags & TIME_PAGE_COUNTER)
+			ns = time_page_counter(tp->counter, tp->counter_ns);
+		else
+			return -1;
+		if (realtime)
+			ns += tp->realtime_offset;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq & 1 || seq != __atomic_load_n(&tp->seq, __ATOMIC_RELAXED));
+
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+	return 0;
+}
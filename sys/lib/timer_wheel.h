@@ -0,0 +1,219 @@
+#pragma once
+
+/*
+ * Hierarchical timer wheel
+ *
+ * Timers are hashed into one of Levels levels of 2^Bits slots by the number
+ * of ticks until they expire. Level 0 slots are one tick wide, level 1 slots
+ * are 2^Bits ticks wide and so on. Each slot is an unsorted list so arming
+ * and cancelling a timer is constant time.
+ *
+ * When the wheel reaches a level n slot its timers are cascaded to lower
+ * levels. Level 0 timers are checked against their exact expiry time so
+ * timers expire at nanosecond resolution even though slots are one tick wide.
+ *
+ * A bitmap of non-empty slots is kept for each level so that empty slots can
+ * be skipped without being visited, which keeps advancing the wheel cheap
+ * after long idle periods.
+ */
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <list.h>
+#include <timer.h>
+
+template<unsigned Bits, unsigned Levels>
+class timer_wheel {
+	static_assert(Bits <= 6 && Levels * Bits < 64);
+
+public:
+	timer_wheel(uint_fast64_t tick_ns)
+	: tick_ns_{tick_ns}
+	, now_{}
+	, map_{}
+	{
+		for (auto &s : slots_)
+			list_init(&s);
+	}
+
+	timer_wheel(const timer_wheel &) = delete;
+	timer_wheel &operator=(const timer_wheel &) = delete;
+
+	/*
+	 * insert - arm timer, tmr->expire must be set.
+	 */
+	void insert(timer *tmr)
+	{
+		uint_fast64_t t = std::max<uint_fast64_t>(tmr->expire / tick_ns_, now_);
+		const auto delta = t - now_;
+		unsigned level = delta ? (std::bit_width(delta) - 1) / Bits : 0;
+		if (level >= Levels) {
+			/* beyond wheel range, cascading will reconsider */
+			level = Levels - 1;
+			t = now_ + (uint_fast64_t{1} << (Levels * Bits)) - 1;
+		}
+		const unsigned idx = (t >> (level * Bits)) & mask;
+		const unsigned slot = level * size + idx;
+		list_insert(list_last(&slots_[slot]), &tmr->link);
+		map_[level] |= uint64_t{1} << idx;
+		tmr->slot = slot;
+	}
+
+	/*
+	 * remove - cancel timer.
+	 */
+	void remove(timer *tmr)
+	{
+		list_remove(&tmr->link);
+		if (list_empty(&slots_[tmr->slot]))
+			map_[tmr->slot / size] &= ~(uint64_t{1} << (tmr->slot % size));
+	}
+
+	/*
+	 * advance - advance wheel to monotonic time.
+	 *
+	 * Removes each timer which has expired and passes it to fn.
+	 */
+	template<typename F>
+	void advance(uint_fast64_t monotonic, F fn)
+	{
+		const auto tick = monotonic / tick_ns_;
+		expire(monotonic, fn);
+		while (now_ < tick) {
+			now_ = std::min(next_tick(), tick);
+			for (unsigned l = 1; l < Levels; ++l) {
+				if (now_ & ((uint_fast64_t{1} << (l * Bits)) - 1))
+					break;
+				cascade(l);
+			}
+			expire(monotonic, fn);
+		}
+	}
+
+	/*
+	 * next_expiry - monotonic time at which wheel next needs advancing.
+	 *
+	 * This is the exact expiry time of the next timer if it is in level 0,
+	 * otherwise it is the time at which the next timer will be cascaded.
+	 *
+	 * Returns UINT_FAST64_MAX if wheel is empty.
+	 */
+	uint_fast64_t next_expiry() const
+	{
+		uint_fast64_t next = UINT_FAST64_MAX;
+		for (unsigned l = 1; l < Levels; ++l)
+			if (map_[l])
+				next = std::min(next, reach(l) * tick_ns_);
+		if (map_[0]) {
+			const auto &s = slots_[reach(0) & mask];
+			timer *tmr;
+			list_for_each_entry(tmr, &s, link)
+				next = std::min(next, tmr->expire);
+		}
+		return next;
+	}
+
+	/*
+	 * empty - true if there are no timers in the wheel.
+	 */
+	bool empty() const
+	{
+		for (auto m : map_)
+			if (m)
+				return false;
+		return true;
+	}
+
+private:
+	static constexpr unsigned size = 1u << Bits;
+	static constexpr unsigned mask = size - 1;
+
+	/*
+	 * reach - first tick at which a non-empty slot at level is reached.
+	 *
+	 * The current slot at level 0 holds timers for the current tick. The
+	 * current slot at higher levels is reached again after a full
+	 * revolution.
+	 */
+	uint_fast64_t reach(unsigned level) const
+	{
+		const auto shift = level * Bits;
+		const auto pos = now_ >> shift;
+		const unsigned cur = pos & mask;
+		const unsigned d = level
+		    ? std::countr_zero(rotr(map_[level], (cur + 1) & mask)) + 1
+		    : std::countr_zero(rotr(map_[level], cur));
+		return (pos + d) << shift;
+	}
+
+	/*
+	 * next_tick - first tick after now at which the wheel has work to do.
+	 */
+	uint_fast64_t next_tick() const
+	{
+		uint_fast64_t next = UINT_FAST64_MAX;
+		for (unsigned l = 0; l < Levels; ++l)
+			if (map_[l])
+				next = std::min(next, reach(l));
+		return next;
+	}
+
+	/*
+	 * expire - expire timers in current level 0 slot.
+	 */
+	template<typename F>
+	void expire(uint_fast64_t monotonic, F fn)
+	{
+		list *s = &slots_[now_ & mask];
+		timer *tmr, *tmp;
+		list_for_each_entry_safe(tmr, tmp, s, link) {
+			if (tmr->expire > monotonic)
+				continue;
+			remove(tmr);
+			fn(tmr);
+		}
+	}
+
+	/*
+	 * cascade - move timers in current slot at level to lower levels.
+	 */
+	void cascade(unsigned level)
+	{
+		const unsigned idx = (now_ >> (level * Bits)) & mask;
+		list *s = &slots_[level * size + idx];
+		if (list_empty(s))
+			return;
+
+		/* detach slot as far timers may hash back into it */
+		list head;
+		head.next = s->next;
+		head.prev = s->prev;
+		head.next->prev = &head;
+		head.prev->next = &head;
+		list_init(s);
+		map_[level] &= ~(uint64_t{1} << idx);
+
+		while (!list_empty(&head)) {
+			timer *tmr = list_entry(list_first(&head), timer, link);
+			list_remove(&tmr->link);
+			insert(tmr);
+		}
+	}
+
+	/*
+	 * rotr - rotate size bit map right.
+	 */
+	static uint64_t rotr(uint64_t map, unsigned n)
+	{
+		if constexpr (size == 64)
+			return std::rotr(map, n);
+		else
+			return (map >> n | map << (size - n)) & ((uint64_t{1} << size) - 1);
+	}
+
+	const uint_fast64_t tick_ns_;	/* tick length in nanoseconds */
+	uint_fast64_t now_;		/* current tick */
+	uint64_t map_[Levels];		/* non-empty slot bitmap per level */
+	list slots_[Levels * size];	/* timer lists */
+};
@@ -43,6 +43,11 @@
  *  2) All blocks divided in the same page are linked.
  *  3) All free blocks of the same size are linked.
  *
+ * Small requests are served from slab caches of fixed size classes, which
+ * allocate and free in constant time and return pages to the page allocator
+ * as soon as they are empty. Requests larger than the largest size class,
+ * or which cannot be served from a slab, use the block allocator above.
+ *
  * Currently, it can not handle the memory size exceeding one page.
  * Instead, a driver can use page_alloc() to allocate larger memory.
  *
@@ -56,12 +61,15 @@
 #include <kmem.h>
 
 #include <access.h>
+#include <array>
 #include <cassert>
 #include <conf/config.h>
 #include <cstdlib>
 #include <cstring>
 #include <debug.h>
+#include <iterator>
 #include <kernel.h>
+#include <lib/slab.h>
 #include <page.h>
 #include <sync.h>
 #include <task.h>
@@ -130,6 +138,35 @@ struct page_hdr {
 /* number of free block list */
 #define NR_BLOCK_LIST	(PAGE_SIZE / ALIGN_SIZE)
 
+#define SLAB_MAGIC	0x51ab0000	/* slab magic offset by memory type */
+#define SLAB_MAGIC_OK(x) ((x)->magic >= SLAB_MAGIC && (x)->magic < SLAB_MAGIC + MEM_ALLOC)
+
+/*
+ * Slab size classes
+ *
+ * Classes are spaced at powers of two and half way between so that no more
+ * than a third of an object is wasted. They cover the common kernel objects
+ * (thread, seg, k_futex, irq, vnode, file).
+ */
+static constexpr uint16_t slab_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512
+};
+#define NR_SLAB_CLASS	std::size(slab_sizes)
+#define MAX_SLAB_SIZE	slab_sizes[NR_SLAB_CLASS - 1]
+
+/*
+ * Map from size in ALIGN_SIZE units to slab size class
+ */
+static constexpr auto slab_class = []{
+	std::array<uint8_t, MAX_SLAB_SIZE / ALIGN_SIZE + 1> t{};
+	for (size_t i = 0, c = 0; i < t.size(); ++i) {
+		if (i * ALIGN_SIZE > slab_sizes[c])
+			++c;
+		t[i] = c;
+	}
+	return t;
+}();
+
 /**
  * Array of the head block of free block list.
  *
@@ -156,6 +193,7 @@ struct page_hdr {
  * embedded system with low foot print.
  */
 static list free_blocks[MEM_ALLOC][NR_BLOCK_LIST];
+static slab_cache slab_caches[MEM_ALLOC][NR_SLAB_CLASS];
 static list kmem_pages[MEM_ALLOC];
 static spinlock kmem_lock;
 
@@ -203,6 +241,71 @@ block_find(size_t size, unsigned type)
 	return list_entry(n, block_hdr, link);
 }
 
+/*
+ * Release empty slabs retained by the slab caches of memory type.
+ * Returns true if any slab was released.
+ */
+static bool
+slab_shrink(unsigned type)
+{
+	bool released = false;
+
+	for (auto &c : slab_caches[type]) {
+		if (void *m = c.shrink(); m) {
+			page_free(virt_to_phys(m), PAGE_SIZE, &kern_task);
+			released = true;
+		}
+	}
+	return released;
+}
+
+/*
+ * Allocate page for memory type.
+ * Empty slabs are released and the allocation retried before failing.
+ */
+static page_ptr
+kmem_page_alloc(unsigned type)
+{
+	const unsigned long ma_paf = type_to_attr(type) | PAF_EXACT_SPEED;
+
+	if (page_ptr pp = page_alloc_order(0, ma_paf, &kern_task); pp)
+		return pp;
+	if (!slab_shrink(type))
+		return {};
+	return page_alloc_order(0, ma_paf, &kern_task);
+}
+
+/*
+ * Allocate object from slab cache.
+ * Returns NULL if no memory is available for a new slab.
+ */
+static void *
+slab_alloc(size_t size, unsigned type)
+{
+	const unsigned cls = slab_class[(size + ALIGN_MASK) / ALIGN_SIZE];
+	slab_cache *c = &slab_caches[type][cls];
+	void *p;
+
+	if ((p = c->alloc()))
+		return p;
+
+	page_ptr pp = kmem_page_alloc(type);
+	if (!pp)
+		return nullptr;
+	c->grow(phys_to_virt(pp.release()));
+	return c->alloc();
+}
+
+/*
+ * Free object to slab cache, releasing the slab if it is no longer needed.
+ */
+static void
+slab_free(slab *s, void *ptr)
+{
+	if (void *m = s->cache->free(ptr); m)
+		page_free(virt_to_phys(m), PAGE_SIZE, &kern_task);
+}
+
 /*
  * Allocate memory block for kernel
  *
@@ -220,6 +323,13 @@ kmem_alloc_internal(size_t size, unsigned type)
 
 	spinlock_lock(&kmem_lock);
 	kmem_check();
+
+	/*
+	 * Small allocations come from the slab caches. If there is no
+	 * memory for a new slab fall back to searching for a free block.
+	 */
+	if (size && size <= MAX_SLAB_SIZE && (p = slab_alloc(size, type)))
+		goto out;
 	/*
 	 * First, the free block of enough size is searched
 	 * from the page already used. If it does not exist,
@@ -236,8 +346,7 @@ kmem_alloc_internal(size_t size, unsigned type)
 		pg = PAGE_TOP(blk);	 /* Get the page address */
 	} else {
 		/* No block found. Allocate new page */
-		page_ptr pp = page_alloc_order(0,
-		    type_to_attr(type) | PAF_EXACT_SPEED, &kern_task);
+		page_ptr pp = kmem_page_alloc(type);
 		if (!pp)
 			goto out;
 		pg = (page_hdr *)phys_to_virt(pp.release());
@@ -343,18 +452,24 @@ realloc(void *p, size_t size)
 	if (!p)
 		return malloc(size);
 
-	block_hdr *blk = (block_hdr *)((char *)p - BLKHDR_SIZE);
-	if (!ALLOC_MAGIC_OK(blk))
-		panic("realloc: invalid address");
+	size_t cur;
+	if (slab *s = (slab *)PAGE_TOP(p); SLAB_MAGIC_OK(s))
+		cur = s->cache->size();
+	else {
+		block_hdr *blk = (block_hdr *)((char *)p - BLKHDR_SIZE);
+		if (!ALLOC_MAGIC_OK(blk))
+			panic("realloc: invalid address");
+		cur = blk->size - BLKHDR_SIZE;
+	}
 
-	if (blk->size >= size)
+	if (cur >= size)
 		return p;
 
 	void *np = malloc(size);
 	if (!np)
 		return nullptr;
 
-	memcpy(np, p, MIN(size, blk->size));
+	memcpy(np, p, MIN(size, cur));
 	free(p);
 
 	return np;
@@ -382,6 +497,13 @@ kmem_free(void *ptr)
 	spinlock_lock(&kmem_lock);
 	kmem_check();
 
+	/* Objects in slab pages belong to a slab cache */
+	if (slab *s = (slab *)PAGE_TOP(ptr); SLAB_MAGIC_OK(s)) {
+		slab_free(s, ptr);
+		spinlock_unlock(&kmem_lock);
+		return;
+	}
+
 	/* Get the block header */
 	blk = (block_hdr *)((char *)ptr - BLKHDR_SIZE);
 	if (!ALLOC_MAGIC_OK(blk))
@@ -475,6 +597,14 @@ kmem_dump()
 			if (cnt > 0)
 				info("       %4d %8d\n", i << 4, cnt);
 		}
+
+		info(" slab size  slabs    objects\n");
+		info(" --------- -------- --------\n");
+		for (const auto &c : slab_caches[type]) {
+			if (c.slabs())
+				info("      %4zu %8zu %8zu\n", c.size(), c.slabs(),
+				    c.allocated());
+		}
 #if 0
 		info(" all blocks\n");
 		info(" ----------\n");
@@ -529,6 +659,9 @@ kmem_init()
 		list_init(&kmem_pages[type]);
 		for (unsigned i = 0; i < NR_BLOCK_LIST; i++)
 			list_init(&free_blocks[type][i]);
+		for (unsigned i = 0; i < NR_SLAB_CLASS; i++)
+			slab_caches[type][i].init(slab_sizes[i], PAGE_SIZE,
+			    SLAB_MAGIC + type, ALIGN_SIZE);
 	}
 	spinlock_init(&kmem_lock);
 }
@@ -11,6 +11,9 @@
 #include <debug.h>
 #include <fs.h>
 #include <kernel.h>
+#include <kmem.h>
+#include <lib/shared_pages.h>
+#include <mutex>
 #include <page.h>
 #include <sch.h>
 #include <sys/mman.h>
@@ -18,6 +21,12 @@
 #include <task.h>
 #include <thread.h>
 
+/*
+ * Read only file mappings shared between address spaces
+ */
+static a::mutex shared_lock;
+static shared_pages shared_idx{PAGE_SIZE};
+
 /*
  * vm_read - read data from address space
  */
@@ -81,6 +90,127 @@ as_switch(as *a)
 #endif
 }
 
+/*
+ * not_owned - check if file mapping refers to memory owned elsewhere
+ *
+ * This is the case for storage mapped in place and for shared mappings.
+ * Memory for every other mapping is allocated to the address space.
+ */
+static bool
+not_owned(as *a, void *addr, size_t len, vnode *vn)
+{
+	return vn && !page_valid(virt_to_phys(addr), len, a);
+}
+
+/*
+ * as_map_xip - map file in place from memory addressable storage
+ *
+ * Read only private mappings of files on memory addressable devices (e.g.
+ * the boot archive) can refer to the storage directly instead of copying
+ * the file into newly allocated memory. Storage must be congruent with the
+ * file offset modulo the page size as segments are page granular, and
+ * segments can't overlap, so storage pages which are already mapped (e.g.
+ * shared with an adjacent file) are copied instead. Unlike a copy, the tail
+ * of the last page is not zero filled.
+ */
+static expect<void *>
+as_map_xip(as *a, size_t len, int prot, int flags, std::unique_ptr<vnode> &vn,
+    off_t off, long attr)
+{
+	std::byte *addr;
+	if (!(addr = (std::byte *)vn_xip(vn.get(), off, len)))
+		return std::errc::operation_not_supported;
+	if (PAGE_OFF(addr) != PAGE_OFF(off))
+		return std::errc::operation_not_supported;
+
+	const auto base = (std::byte *)PAGE_TRUNC(addr);
+	const auto pg_len{PAGE_ALIGN(PAGE_OFF(off) + len)};
+	if (as_overlaps(a, base, pg_len))
+		return std::errc::operation_not_supported;
+
+	/* if insertion fails page_free refuses storage which isn't ours */
+	page_ptr pages{virt_to_phys(base), pg_len, a};
+
+	if (auto r = as_insert(a, std::move(pages), len, prot, flags,
+			       std::move(vn), off, attr);
+	    !r.ok())
+		return r.err();
+
+#if defined(CONFIG_MPU)
+	mpu_map(a, base, pg_len, prot);
+#endif
+
+	return addr;
+}
+
+/*
+ * as_map_shared - map file data shared with other address spaces
+ *
+ * Read only private mappings of files on read only file systems can share
+ * pages with identical mappings in other address spaces, e.g. the text of
+ * programs which are running more than once. Pages are owned by the shared
+ * index and are freed when the last mapping of each page goes away.
+ */
+static expect<void *>
+as_map_shared(as *a, size_t len, int prot, int flags,
+    std::unique_ptr<vnode> &vn, off_t off, long attr)
+{
+	const auto pg_off = PAGE_OFF(off);
+	const auto pg_len{PAGE_ALIGN(pg_off + len)};
+	std::unique_lock l{shared_lock};
+
+	shared_region *r;
+	if ((r = shared_idx.find(vn.get(), off, len))) {
+		if (as_overlaps(a, r->base, pg_len) || !shared_idx.ref(r))
+			return std::errc::operation_not_supported;
+	} else {
+		l.unlock();
+
+		page_ptr pages{page_alloc(pg_len, attr, &shared_idx)};
+		if (!pages)
+			return std::errc::not_enough_memory;
+		std::byte *addr = (std::byte*)phys_to_virt(pages);
+		if (as_overlaps(a, addr, pg_len))
+			return std::errc::operation_not_supported;
+
+		memset(addr, 0, pg_off);
+		if (ssize_t rd = vn_pread(vn.get(), addr + pg_off, len, off);
+		    rd != (ssize_t)len)
+			return to_errc(rd, DERR(std::errc::no_such_device_or_address));
+		memset(addr + pg_off + len, 0, pg_len - pg_off - len);
+		/* later mappings may be executable */
+		cache_coherent_exec(addr, pg_len);
+
+		if (!(r = (shared_region *)kmem_alloc(
+		    shared_pages::size(pg_len / PAGE_SIZE), MA_FAST)))
+			return std::errc::not_enough_memory;
+
+		l.lock();
+		shared_idx.insert(r, vn.get(), off, len,
+		    phys_to_virt(pages.release()), pg_len / PAGE_SIZE);
+	}
+
+	/* if insertion fails page_free refuses pages which aren't ours */
+	page_ptr pages{virt_to_phys(r->base), pg_len, a};
+	std::byte *base = r->base;
+
+	if (auto err = as_insert(a, std::move(pages), len, prot, flags,
+				 std::move(vn), off, attr);
+	    !err.ok()) {
+		if (shared_idx.unref(r, base, pg_len, [](void *p, size_t len) {
+			page_free(virt_to_phys(p), len, &shared_idx);
+		    }))
+			kmem_free(r);
+		return err.err();
+	}
+
+#if defined(CONFIG_MPU)
+	mpu_map(a, base, pg_len, prot);
+#endif
+
+	return base + pg_off;
+}
+
 /*
  * as_map - map memory into address space
  */
@@ -91,6 +221,19 @@ as_map(as *a, void *req_addr, size_t len, int prot, int flags,
 	const auto fixed = flags & MAP_FIXED;
 	const auto pg_off = PAGE_OFF(req_addr);
 
+	/* execute in place if possible */
+	if (vn && !fixed && (flags & MAP_PRIVATE) && !(prot & PROT_WRITE))
+		if (auto r = as_map_xip(a, len, prot, flags, vn, off, attr);
+		    r.ok() || r.err() != std::errc::operation_not_supported)
+			return r;
+
+	/* share with other address spaces if possible */
+	if (vn && !fixed && (flags & MAP_PRIVATE) && !(prot & PROT_WRITE) &&
+	    vn_readonly(vn.get()))
+		if (auto r = as_map_shared(a, len, prot, flags, vn, off, attr);
+		    r.ok() || r.err() != std::errc::operation_not_supported)
+			return r;
+
 	page_ptr pages{fixed
 			? page_reserve(virt_to_phys(req_addr), len, attr, a)
 			: page_alloc(pg_off + len, attr, a)};
@@ -120,8 +263,7 @@ as_map(as *a, void *req_addr, size_t len, int prot, int flags,
 		return r.err();
 
 #if defined(CONFIG_MPU)
-	if (a == task_cur()->as)
-		mpu_map(addr, pg_len, prot);
+	mpu_map(a, addr, pg_len, prot);
 #endif
 
 	return addr + pg_off;
@@ -136,14 +278,26 @@ expect_ok
 as_unmap(as *a, void *addr, size_t len, vnode *vn, off_t off)
 {
 #if defined(DEBUG)
-	memset(addr, 0, len);
+	if (!not_owned(a, addr, len, vn))
+		memset(addr, 0, len);
 #endif
 
 #if defined(CONFIG_MPU)
-	if (a == task_cur()->as)
-		mpu_unmap(addr, len);
+	mpu_unmap(a, addr, len);
 #endif
 
+	/* storage mapped in place is not ours to free, shared pages are
+	   freed when their last mapping goes away */
+	if (not_owned(a, addr, len, vn)) {
+		std::lock_guard l{shared_lock};
+		if (auto r = shared_idx.find_addr(addr); r &&
+		    shared_idx.unref(r, addr, len, [](void *p, size_t len) {
+			page_free(virt_to_phys(p), len, &shared_idx);
+		    }))
+			kmem_free(r);
+		return {};
+	}
+
 	return page_free(virt_to_phys(addr), len, a);
 }
 
@@ -153,9 +307,12 @@ as_unmap(as *a, void *addr, size_t len, vnode *vn, off_t off)
 expect_ok
 as_mprotect(as *a, void *addr, size_t len, int prot)
 {
+	/* storage mapped in place can't be made writable */
+	if ((prot & PROT_WRITE) && !page_valid(virt_to_phys(addr), len, a))
+		return DERR(std::errc::permission_denied);
+
 #if defined(CONFIG_MPU)
-	if (a == task_cur()->as)
-		mpu_protect(addr, len, prot);
+	mpu_protect(a, addr, len, prot);
 #endif
 
 	return {};
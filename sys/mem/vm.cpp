@@ -11,6 +11,7 @@
 #include <fs.h>
 #include <kernel.h>
 #include <kmem.h>
+#include <lib/addr_index.h>
 #include <list.h>
 #include <sections.h>
 #include <sys/mman.h>
@@ -42,6 +43,7 @@ struct seg {
 
 struct as {
 	list segs;	/* list of segments */
+	addr_index<seg> index; /* segment lookup index */
 	void *base;	/* base address of address space */
 	size_t len;	/* size of address space */
 	void *brk;	/* current program break */
@@ -109,6 +111,57 @@ oflags(int prot, int flags)
 	return DERR(std::errc::invalid_argument);
 }
 
+/*
+ * seg_above - find first segment ending above addr
+ *
+ * Returns the list head entry if there is no such segment.
+ */
+static seg *
+seg_above(const as *a, const void *addr)
+{
+	if (a->index.valid()) {
+		if (seg *s = a->index.first_above(addr))
+			return s;
+		return list_entry(&a->segs, seg, link);
+	}
+
+	seg *s;
+	list_for_each_entry(s, &a->segs, link) {
+		if (seg_end(s) > addr)
+			break;
+	}
+	return s;
+}
+
+/*
+ * seg_reindex - rebuild segment index after modifying segment list
+ *
+ * Segments are found by walking the list if memory for the index can't be
+ * allocated.
+ */
+static void
+seg_reindex(as *a)
+{
+	using entry = addr_index<seg>::entry;
+
+	size_t n = 0;
+	seg *s;
+	list_for_each_entry(s, &a->segs, link)
+		++n;
+
+	a->index.invalidate();
+	if (n > a->index.capacity()) {
+		const size_t cap = std::max<size_t>(n * 2, 8);
+		entry *e;
+		if (!(e = (entry *)kmem_alloc(cap * sizeof *e, MA_FAST)))
+			return;
+		kmem_free(a->index.assign(e, cap));
+	}
+	list_for_each_entry(s, &a->segs, link)
+		a->index.push_back(s->base, seg_end(s), s);
+	a->index.validate();
+}
+
 /*
  * seg_insert - insert new segment
  */
@@ -132,6 +185,9 @@ seg_insert(seg *prev, page_ptr pages, size_t len, int prot,
 
 /*
  * seg_combine - combine contiguous segments
+ *
+ * File mappings may refer to storage which is mapped in place, so anonymous
+ * memory is never combined into a preceding file mapping.
  */
 static void
 seg_combine(as *a)
@@ -141,7 +197,7 @@ seg_combine(as *a)
 	seg *p = list_entry(list_first(&a->segs), seg, link), *s, *tmp;
 	list_for_each_entry_safe(s, tmp, list_next(&a->segs), link) {
 		if (p->prot != s->prot || seg_end(p) != s->base ||
-		    p->attr != s->attr ||
+		    p->attr != s->attr || (p->vn && !s->vn) ||
 		    (s->vn && (p->vn != s->vn ||
 			       (p->vn && (PAGE_OFF(p->off + p->mapped) ||
 					  p->off + p->mapped != s->off))))) {
@@ -160,7 +216,8 @@ seg_combine(as *a)
 /*
  * do_munmapfor - unmap memory from locked address space
  *
- * Must be called with address space write lock held.
+ * Must be called with address space write lock held. If remap is set the
+ * caller must rebuild the segment index.
  */
 static expect_ok
 do_munmapfor(as *a, void *const vaddr, const size_t ulen, bool remap)
@@ -175,11 +232,10 @@ do_munmapfor(as *a, void *const vaddr, const size_t ulen, bool remap)
 	const auto uaddr = (char*)vaddr;
 	const auto uend = uaddr + ulen;
 
-	seg *s, *tmp;
-	list_for_each_entry_safe(s, tmp, &a->segs, link) {
+	seg *s = seg_above(a, uaddr), *tmp;
+	a->index.invalidate();
+	list_for_each_entry_safe_from(s, tmp, &a->segs, link) {
 		const auto send = (char*)s->base + s->len;
-		if (send <= uaddr)
-			continue;
 		if (s->base >= uend)
 			break;
 		if (s->base >= uaddr && send <= uend) {
@@ -193,8 +249,10 @@ do_munmapfor(as *a, void *const vaddr, const size_t ulen, bool remap)
 		} else if (s->base < uaddr && send > uend) {
 			/* hole in segment */
 			seg *ns;
-			if (!(ns = (seg*)kmem_alloc(sizeof(seg), MA_FAST)))
-				return DERR(std::errc::not_enough_memory);
+			if (!(ns = (seg*)kmem_alloc(sizeof(seg), MA_FAST))) {
+				rc = DERR(std::errc::not_enough_memory);
+				break;
+			}
 			s->len = uaddr - (char*)s->base;
 			if (!remap)
 				rc = as_unmap(a, uaddr, ulen, s->vn,
@@ -231,6 +289,8 @@ do_munmapfor(as *a, void *const vaddr, const size_t ulen, bool remap)
 			break;
 	}
 
+	if (!remap)
+		seg_reindex(a);
 	return rc;
 }
 
@@ -319,30 +379,37 @@ mprotectfor(as *a, void *const vaddr, const size_t ulen, const int prot)
 	const auto uaddr = (char*)vaddr;
 	const auto uend = uaddr + ulen;
 
-	seg *s, *tmp;
-	list_for_each_entry_safe(s, tmp, &a->segs, link) {
+	seg *s = seg_above(a, uaddr), *tmp;
+	a->index.invalidate();
+	list_for_each_entry_safe_from(s, tmp, &a->segs, link) {
 		const auto send = (char*)s->base + s->len;
-		if (send <= uaddr)
-			continue;
 		if (s->base >= uend)
 			break;
 		if (s->prot == prot)
 			continue;
 		if (s->base >= uaddr && send <= uend) {
 			/* entire segment */
-			rc = as_mprotect(a, s->base, s->len, prot);
+			if (!(rc = as_mprotect(a, s->base, s->len, prot)).ok())
+				break;
 			s->prot = prot;
 		} else if (s->base < uaddr && send > uend) {
 			/* hole in segment */
 			seg *ns1, *ns2;
-			if (!(ns1 = (seg*)kmem_alloc(sizeof(seg), MA_FAST)))
-				return DERR(std::errc::not_enough_memory);
+			if (!(ns1 = (seg*)kmem_alloc(sizeof(seg), MA_FAST))) {
+				rc = DERR(std::errc::not_enough_memory);
+				break;
+			}
 			if (!(ns2 = (seg*)kmem_alloc(sizeof(seg), MA_FAST))) {
 				kmem_free(ns1);
-				return DERR(std::errc::not_enough_memory);
+				rc = DERR(std::errc::not_enough_memory);
+				break;
 			}
 
-			rc = as_mprotect(a, uaddr, ulen, prot);
+			if (!(rc = as_mprotect(a, uaddr, ulen, prot)).ok()) {
+				kmem_free(ns1);
+				kmem_free(ns2);
+				break;
+			}
 
 			s->len = uaddr - (char*)s->base;
 
@@ -369,11 +436,16 @@ mprotectfor(as *a, void *const vaddr, const size_t ulen, const int prot)
 		} else if (s->base < uaddr) {
 			/* end of segment */
 			seg *ns;
-			if (!(ns = (seg*)kmem_alloc(sizeof(seg), MA_FAST)))
-				return DERR(std::errc::not_enough_memory);
+			if (!(ns = (seg*)kmem_alloc(sizeof(seg), MA_FAST))) {
+				rc = DERR(std::errc::not_enough_memory);
+				break;
+			}
 
 			const auto l = uaddr - (char*)s->base;
-			rc = as_mprotect(a, uaddr, s->len - l, prot);
+			if (!(rc = as_mprotect(a, uaddr, s->len - l, prot)).ok()) {
+				kmem_free(ns);
+				break;
+			}
 
 			*ns = *s;
 			ns->prot = prot;
@@ -389,10 +461,15 @@ mprotectfor(as *a, void *const vaddr, const size_t ulen, const int prot)
 		} else if (s->base < uend) {
 			/* start of segment */
 			seg *ns;
-			if (!(ns = (seg*)kmem_alloc(sizeof(seg), MA_FAST)))
-				return DERR(std::errc::not_enough_memory);
+			if (!(ns = (seg*)kmem_alloc(sizeof(seg), MA_FAST))) {
+				rc = DERR(std::errc::not_enough_memory);
+				break;
+			}
 			const auto l = uend - (char*)s->base;
-			rc = as_mprotect(a, s->base, l, prot);
+			if (!(rc = as_mprotect(a, s->base, l, prot)).ok()) {
+				kmem_free(ns);
+				break;
+			}
 
 			*ns = *s;
 			ns->prot = prot;
@@ -407,11 +484,10 @@ mprotectfor(as *a, void *const vaddr, const size_t ulen, const int prot)
 			s->len -= l;
 		} else
 			panic("BUG");
-		if (!rc.ok())
-			break;
 	}
 
 	seg_combine(a);
+	seg_reindex(a);
 	return rc;
 }
 
@@ -525,11 +601,9 @@ sc_madvise(void *vaddr, size_t ulen, int advice)
 	const auto uaddr = (char*)vaddr;
 	const auto uend = uaddr + ulen;
 
-	seg *s;
-	list_for_each_entry(s, &a->segs, link) {
+	seg *s = seg_above(a, uaddr), *tmp;
+	list_for_each_entry_safe_from(s, tmp, &a->segs, link) {
 		const auto send = (char*)s->base + s->len;
-		if (send <= uaddr)
-			continue;
 		if (s->base >= uend)
 			break;
 		if (s->base >= uaddr && send <= uend) {
@@ -670,6 +744,7 @@ as_destroy(as *a)
 			vn_close(s->vn);
 		kmem_free(s);
 	}
+	kmem_free(a->index.assign(nullptr, 0));
 	a->lock.write().unlock();
 	kmem_free(a);
 }
@@ -764,12 +839,18 @@ as_dump(const as *a)
 /*
  * as_find_seg - find segment containing address
  *
- * REVISIT: This really needs to be as fast as possible. We should use some
- * kind of tree rather than a linear search in the future.
+ * Runs on every user pointer check and MPU fault so uses the segment index
+ * unless it is being rebuilt.
  */
 __fast_text expect<const seg *>
 as_find_seg(const as *a, const void *uaddr)
 {
+	if (a->index.valid()) {
+		if (const seg *s = a->index.find(uaddr))
+			return s;
+		return std::errc::bad_address;
+	}
+
 	seg *s;
 	list_for_each_entry(s, &a->segs, link) {
 		if (seg_begin(s) <= uaddr && seg_end(s) > uaddr)
@@ -778,6 +859,16 @@ as_find_seg(const as *a, const void *uaddr)
 	return std::errc::bad_address;
 }
 
+/*
+ * as_overlaps - check if address range overlaps any segment
+ */
+bool
+as_overlaps(const as *a, const void *addr, size_t len)
+{
+	const seg *s = seg_above(a, addr);
+	return &s->link != &a->segs && s->base < (const char *)addr + len;
+}
+
 /*
  * seg_begin - get start address of segment
  */
@@ -838,22 +929,20 @@ as_insert(as *a, page_ptr pages, size_t len, int prot,
 	/* remove any existing mappings */
 	if (fixed &&
 	    !(rc = do_munmapfor(a, phys_to_virt(pages),
-				PAGE_ALIGN(PAGE_OFF(off) + len), true)).ok())
+				PAGE_ALIGN(PAGE_OFF(off) + len), true)).ok()) {
+		seg_reindex(a);
 		return rc;
+	}
 
 	/* find insertion point */
-	seg *s;
-	list_for_each_entry(s, &a->segs, link) {
-		if (s->base > phys_to_virt(pages))
-			break;
-	}
+	seg *s = seg_above(a, phys_to_virt(pages));
 	s = list_entry(list_prev(&s->link), seg, link);
 
 	/* insert new segment */
-	if (!(rc = seg_insert(s, std::move(pages), len, prot, std::move(vn),
-			       off, attr)).ok())
-		return rc;
-
-	seg_combine(a);
-	return {};
+	a->index.invalidate();
+	if ((rc = seg_insert(s, std::move(pages), len, prot, std::move(vn),
+			      off, attr)).ok())
+		seg_combine(a);
+	seg_reindex(a);
+	return rc;
 }
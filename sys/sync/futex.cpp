@@ -1,121 +1,181 @@
 #include <futex.h>
 
 #include <access.h>
+#include <address.h>
 #include <arch/interrupt.h>
 #include <atomic>
 #include <climits>
 #include <cstdlib>
 #include <debug.h>
 #include <errno.h>
+#include <jhash3.h>
 #include <sch.h>
 #include <sys/mman.h>
 #include <syscalls.h>
 #include <task.h>
 #include <thread.h>
 #include <time32.h>
+#include <timer.h>
+#include <utility>
 #include <vm.h>
 
 #define trace(...)
 
 /*
- * TODO: optimise search using hash map?
- * TODO: free unused futexes?
+ * Futexes with waiters are kept in a global hash table. Private futexes are
+ * keyed by address space and virtual address. Shared futexes are keyed by
+ * physical address so that tasks mapping the same memory find the same
+ * futex.
+ *
+ * A k_futex only carries state while threads are waiting on it, so idle
+ * entries are freed whenever their hash bucket is searched. This bounds
+ * kernel memory by the number of waiting threads rather than the number of
+ * futexes ever used.
  */
+#define FUTEX_BUCKETS 64		/* size of futex hash table */
 
 /*
  * k_futex - kernel data for a userspace futex
  */
 struct k_futex {
-	void *addr;		/* futex address */
-	spinlock lock;		/* to synchronise operations on this futex */
-	struct event event;	/* event */
-	list link;		/* linkage on futexes list */
+	const struct as *as;		/* address space, nullptr if shared */
+	uintptr_t addr;		/* futex address, physical if shared */
+	pi_event event;		/* event, with priority inheritance for PI ops */
+	list link;		/* linkage on hash bucket */
 };
 
 /*
- * futexes_impl - internal details of struct futexes
+ * futex_key - identifies a futex
  */
-struct futexes_impl {
-	spinlock lock;
-	struct list list;
+struct futex_key {
+	const struct as *as;	/* address space, nullptr if shared */
+	uintptr_t addr;		/* futex address, physical if shared */
 };
-static_assert(sizeof(futexes_impl) == sizeof(futexes));
-static_assert(alignof(futexes_impl) == alignof(futexes));
 
 /*
- * futexes - retrieve futexes_impl from task
+ * futex_bucket - futex hash table bucket
  */
-static futexes_impl *
-futexes(task *t)
+struct futex_bucket {
+	spinlock lock;		/* to synchronise operations on bucket futexes */
+	list futexes;		/* futexes in bucket */
+};
+
+static futex_bucket futex_table[FUTEX_BUCKETS];
+
+/*
+ * futex_key_get - get key for futex at uaddr
+ */
+static futex_key
+futex_key_get(task *t, int *uaddr, int op)
 {
-	return (futexes_impl *)task_futexes(t);
+	if (op & FUTEX_PRIVATE)
+		return {t->as, (uintptr_t)uaddr};
+	return {nullptr, virt_to_phys(uaddr).phys()};
 }
 
 /*
- * futex_find - search for futex associated with uaddr
+ * futex_bucket_get - get hash bucket for key
  */
-static k_futex *
-futex_find_unlocked(futexes_impl *fi, int *uaddr)
+static futex_bucket *
+futex_bucket_get(const futex_key &k)
 {
-	k_futex *f;
-	list_for_each_entry(f, &fi->list, link) {
-		if (f->addr == uaddr)
-			return f;
-	}
-	return 0;
+	return &futex_table[jhash_2words((uint32_t)k.addr,
+	    (uint32_t)(uintptr_t)k.as) & (FUTEX_BUCKETS - 1)];
 }
 
-static k_futex *
-futex_find(futexes_impl *fi, int *uaddr)
+/*
+ * futex_idle - true if futex has no state
+ */
+static bool
+futex_idle(const k_futex *f)
 {
-	spinlock_lock(&fi->lock);
-	k_futex *f = futex_find_unlocked(fi, uaddr);
-	spinlock_unlock(&fi->lock);
-
-	return f;
+	return !event_waiting(&f->event.event) && !f->event.owner;
 }
 
 /*
- * futex_get - find or create futex for uaddr
+ * futex_find - search bucket for futex, optionally creating it
+ *
+ * Idle futexes other than the one found are freed. Must be called with
+ * bucket locked.
  */
 static k_futex *
-futex_get(futexes_impl *fi, int *uaddr)
+futex_find(futex_bucket *b, const futex_key &k, bool create)
 {
-	k_futex *f;
+	k_futex *f, *tmp, *found = nullptr;
 
-	spinlock_lock(&fi->lock);
+	spinlock_assert_locked(&b->lock);
 
-	if ((f = futex_find_unlocked(fi, uaddr)))
-		goto out;
+	list_for_each_entry_safe(f, tmp, &b->futexes, link) {
+		if (f->as == k.as && f->addr == k.addr)
+			found = f;
+		else if (futex_idle(f)) {
+			list_remove(&f->link);
+			free(f);
+		}
+	}
+	if (found || !create)
+		return found;
 
 	if (!(f = (k_futex *)malloc(sizeof(k_futex))))
-		goto out;
+		return nullptr;
 
-	f->addr = uaddr;
-	spinlock_init(&f->lock);
-	event_init(&f->event, "futex", event::ev_LOCK);
-	list_insert(&fi->list, &f->link);
-
-out:
-	spinlock_unlock(&fi->lock);
+	f->as = k.as;
+	f->addr = k.addr;
+	pi_event_init(&f->event, "futex");
+	list_insert(&b->futexes, &f->link);
 	return f;
 }
 
+/*
+ * futex_release - free futex if it is idle
+ *
+ * Must be called with bucket locked.
+ */
+static void
+futex_release(k_futex *f)
+{
+	if (!f || !futex_idle(f))
+		return;
+	list_remove(&f->link);
+	free(f);
+}
+
+/*
+ * futex_lock_pair - lock buckets for a two futex operation
+ */
+static void
+futex_lock_pair(futex_bucket *a, futex_bucket *b)
+{
+	if (a > b)
+		std::swap(a, b);
+	spinlock_lock(&a->lock);
+	if (a != b)
+		spinlock_lock(&b->lock);
+}
+
+/*
+ * futex_unlock_pair - unlock buckets for a two futex operation
+ */
+static void
+futex_unlock_pair(futex_bucket *a, futex_bucket *b)
+{
+	if (a != b)
+		spinlock_unlock(&b->lock);
+	spinlock_unlock(&a->lock);
+}
+
 /*
  * futex_wait - perform FUTEX_WAIT operation
  */
 static int
-futex_wait(task *t, int *uaddr, int val, const timespec32 *ts)
+futex_wait(task *t, int *uaddr, const futex_key &k, int val,
+    const timespec32 *ts)
 {
 	int err, uval;
 
 	if (ts && (ts->tv_sec < 0 || ts->tv_nsec > 1000000000))
 		return -EINVAL;
 
-	k_futex *f;
-	if (!(f = futex_get(futexes(t), uaddr)))
-		return DERR(-ENOMEM);
-
 	if ((err = u_access_begin_interruptible()) < 0)
 		return err;
 	if (!u_access_okfor(t->as, uaddr, 4, PROT_READ)) {
@@ -123,34 +183,44 @@ futex_wait(task *t, int *uaddr, int val, const timespec32 *ts)
 		return DERR(-EFAULT);
 	}
 
-	spinlock_lock(&f->lock);
+	futex_bucket *b = futex_bucket_get(k);
+	spinlock_lock(&b->lock);
 	uval = std::atomic_load((std::atomic_uint32_t *)uaddr);
 	u_access_end();
 
 	if (uval != val) {
-		spinlock_unlock(&f->lock);
+		spinlock_unlock(&b->lock);
 		return -EAGAIN;
 	}
 
+	k_futex *f;
+	if (!(f = futex_find(b, k, true))) {
+		spinlock_unlock(&b->lock);
+		return DERR(-ENOMEM);
+	}
+
 	trace("futex_wait th:%p uaddr:%p val:%x ns:%llu\n",
 	      thread_cur(), uaddr, val, ts ? ts32_to_ns(*ts) : 0);
 
-	err = sch_prepare_sleep(&f->event, ts ? ts32_to_ns(*ts) : 0);
-	spinlock_unlock(&f->lock);
+	if ((err = sch_prepare_sleep(&f->event.event,
+	    ts ? ts32_to_ns(*ts) : 0)))
+		futex_release(f);
+	spinlock_unlock(&b->lock);
 	if (err)
 		return err;
 	return sch_continue_sleep();
 	/* Be _very_ careful. Requeue can move us from one futex to another, so
-	 * we are not necessarily waiting on 'f' anymore. */
+	 * we are not necessarily waiting on 'f' anymore, and 'f' may have been
+	 * freed. */
 }
 
 /*
  * futex_wake - perform FUTEX_WAKE operation
  */
 static int
-futex_wake(task *t, int *uaddr, int val)
+futex_wake(const futex_key &k, int val)
 {
-	trace("futex_wake th:%p uaddr:%p val:%d\n", thread_cur(), uaddr, val);
+	trace("futex_wake th:%p addr:%p val:%d\n", thread_cur(), k.addr, val);
 
 	if (val < 0)
 		return DERR(-EINVAL);
@@ -158,24 +228,29 @@ futex_wake(task *t, int *uaddr, int val)
 		return 0;
 
 	int n;
+	futex_bucket *b = futex_bucket_get(k);
+	spinlock_lock(&b->lock);
+
 	k_futex *f;
-	if (!(f = futex_find(futexes(t), uaddr)))
+	if (!(f = futex_find(b, k, false))) {
+		spinlock_unlock(&b->lock);
 		return 0;
+	}
 
-	spinlock_lock(&f->lock);
 	switch (val) {
 	case 1:
-		val = sch_wakeone(&f->event) ? 1 : 0;
+		val = sch_wakeone(&f->event.event) ? 1 : 0;
 		break;
 	case INT_MAX:
-		val = sch_wakeup(&f->event, 0);
+		val = sch_wakeup(&f->event.event, 0);
 		break;
 	default:
 		n = val;
-		while (n && sch_wakeone(&f->event)) --n;
+		while (n && sch_wakeone(&f->event.event)) --n;
 		val -= n;
 	}
-	spinlock_unlock(&f->lock);
+	futex_release(f);
+	spinlock_unlock(&b->lock);
 
 	return val;
 }
@@ -184,34 +259,175 @@ futex_wake(task *t, int *uaddr, int val)
  * futex_requeue - perform FUTEX_REQUEUE operation
  */
 static int
-futex_requeue(task *t, int *uaddr, int val, int val2, int *uaddr2)
+futex_requeue(const futex_key &k, int val, int val2, const futex_key &k2)
 {
-	trace("futex_requeue th:%p uaddr:%p val:%d val2:%d uaddr2:%p\n",
-	    thread_cur(), uaddr, val, val2, uaddr2);
+	trace("futex_requeue th:%p addr:%p val:%d val2:%d addr2:%p\n",
+	    thread_cur(), k.addr, val, val2, k2.addr);
 
 	if (val < 0 || val2 < 0)
 		return DERR(-EINVAL);
 
+	int err = 0;
+	futex_bucket *lb = futex_bucket_get(k), *rb = futex_bucket_get(k2);
+	futex_lock_pair(lb, rb);
+
 	k_futex *l;
-	if (!(l = futex_find(futexes(t), uaddr)))
+	if (!(l = futex_find(lb, k, false))) {
+		futex_unlock_pair(lb, rb);
 		return 0;
-
-	spinlock_lock(&l->lock);
+	}
 
 	int n = val;
-	while (n && sch_wakeone(&l->event)) --n;
+	while (n && sch_wakeone(&l->event.event)) --n;
 
-	spinlock_unlock(&l->lock);
-
-	if (val2) {
+	/* l is not idle so creating r can't free it */
+	if (val2 && event_waiting(&l->event.event)) {
 		k_futex *r;
-		if (!(r = futex_get(futexes(t), uaddr2)))
-			return DERR(-ENOMEM);
+		if (!(r = futex_find(rb, k2, true)))
+			err = DERR(-ENOMEM);
+		else
+			while (val2-- &&
+			    sch_requeue(&l->event.event, &r->event.event));
+	}
+
+	futex_release(l);
+	futex_unlock_pair(lb, rb);
+
+	return err ? err : val - n;
+}
+
+/*
+ * futex_lock_pi - perform FUTEX_LOCK_PI operation
+ *
+ * The futex word holds the thread id of the owner. While we wait the owner
+ * inherits our priority. On success ownership has been transferred to us by
+ * futex_unlock_pi.
+ *
+ * The timeout is an absolute CLOCK_REALTIME time.
+ */
+static int
+futex_lock_pi(task *t, int *uaddr, const futex_key &k, const timespec32 *ts)
+{
+	int err;
+	uint_fast64_t nsec = 0;
+
+	if (ts) {
+		if (ts->tv_sec < 0 || ts->tv_nsec >= 1000000000)
+			return DERR(-EINVAL);
+		const uint_fast64_t abs = ts32_to_ns(*ts);
+		const uint_fast64_t now = timer_realtime();
+		if (abs <= now)
+			return -ETIMEDOUT;
+		nsec = abs - now;
+	}
 
-		while (val2-- && sch_requeue(&l->event, &r->event));
+	if ((err = u_access_begin_interruptible()) < 0)
+		return err;
+	if (!u_access_okfor(t->as, uaddr, 4, PROT_READ | PROT_WRITE)) {
+		u_access_end();
+		return DERR(-EFAULT);
+	}
+
+	futex_bucket *b = futex_bucket_get(k);
+	spinlock_lock(&b->lock);
+
+	k_futex *f;
+	if (!(f = futex_find(b, k, true))) {
+		spinlock_unlock(&b->lock);
+		u_access_end();
+		return DERR(-ENOMEM);
+	}
+
+	const uint32_t tid = thread_id(thread_cur());
+	auto word = (std::atomic_uint32_t *)uaddr;
+	uint32_t uval = std::atomic_load(word);
+	for (;;) {
+		if (!(uval & FUTEX_TID_MASK)) {
+			/* futex is free, take it */
+			const uint32_t nval = tid |
+			    (event_waiting(&f->event.event) ? FUTEX_WAITERS : 0);
+			if (!std::atomic_compare_exchange_weak(word, &uval, nval))
+				continue;
+			err = 0;
+			break;
+		}
+		if ((uval & FUTEX_TID_MASK) == tid) {
+			err = -EDEADLK;
+			break;
+		}
+		/* force owner to unlock via futex_unlock_pi */
+		if (std::atomic_compare_exchange_weak(word, &uval,
+		    uval | FUTEX_WAITERS)) {
+			err = 1;
+			break;
+		}
 	}
+	u_access_end();
 
-	return val - n;
+	thread *owner = nullptr;
+	if (err > 0 && !(owner = thread_find(uval & FUTEX_TID_MASK)))
+		err = DERR(-ESRCH);
+	if (err <= 0) {
+		futex_release(f);
+		spinlock_unlock(&b->lock);
+		return err;
+	}
+
+	trace("futex_lock_pi th:%p uaddr:%p owner:%p ns:%llu\n",
+	      thread_cur(), uaddr, owner, nsec);
+
+	if ((err = sch_prepare_sleep_pi(&f->event, owner, nsec)))
+		futex_release(f);
+	spinlock_unlock(&b->lock);
+	if (err)
+		return err;
+	return sch_continue_sleep();
+}
+
+/*
+ * futex_unlock_pi - perform FUTEX_UNLOCK_PI operation
+ *
+ * Ownership is handed to the highest priority waiter, if any.
+ */
+static int
+futex_unlock_pi(task *t, int *uaddr, const futex_key &k)
+{
+	int err;
+
+	trace("futex_unlock_pi th:%p uaddr:%p\n", thread_cur(), uaddr);
+
+	if ((err = u_access_begin_interruptible()) < 0)
+		return err;
+	if (!u_access_okfor(t->as, uaddr, 4, PROT_READ | PROT_WRITE)) {
+		u_access_end();
+		return DERR(-EFAULT);
+	}
+
+	futex_bucket *b = futex_bucket_get(k);
+	spinlock_lock(&b->lock);
+
+	auto word = (std::atomic_uint32_t *)uaddr;
+	const uint32_t uval = std::atomic_load(word);
+	if ((uval & FUTEX_TID_MASK) != (uint32_t)thread_id(thread_cur())) {
+		spinlock_unlock(&b->lock);
+		u_access_end();
+		return DERR(-EPERM);
+	}
+
+	/* waiters can only change the word while holding the bucket lock */
+	uint32_t nval = 0;
+	if (k_futex *f = futex_find(b, k, false); f) {
+		if (thread *waiter = sch_wakeone_pi(&f->event); waiter)
+			nval = thread_id(waiter) |
+			    (event_waiting(&f->event.event) ? FUTEX_WAITERS : 0);
+		futex_release(f);
+	}
+	std::atomic_store(word, nval);
+
+	spinlock_unlock(&b->lock);
+	u_access_end();
+
+	return 0;
 }
 
 /*
@@ -229,21 +445,22 @@ futex(task *t, int *uaddr, int op, int val, void *val2, int *uaddr2)
 	if ((op & FUTEX_CLOCK_REALTIME))
 		return DERR(-ENOSYS);
 
-	if (!(op & FUTEX_PRIVATE))
-		dbg("WARNING: shared futexes not yet supported\n");
+	const futex_key k = futex_key_get(t, uaddr, op);
 
 	switch (op & FUTEX_OP_MASK) {
 	case FUTEX_WAIT:
 		assert(!sch_locks());
-		return futex_wait(t, uaddr, val, (const timespec32 *)val2);
+		return futex_wait(t, uaddr, k, val, (const timespec32 *)val2);
 	case FUTEX_WAKE:
-		return futex_wake(t, uaddr, val);
+		return futex_wake(k, val);
 	case FUTEX_REQUEUE:
-		return futex_requeue(t, uaddr, val, (int)val2, uaddr2);
-	/*
-	 * TODO(FUTEX_LOCK_PI)
-	 * TODO(FUTEX_UNOCK_PI)
-	 */
+		return futex_requeue(k, val, (int)val2,
+		    futex_key_get(t, uaddr2, op));
+	case FUTEX_LOCK_PI:
+		assert(!sch_locks());
+		return futex_lock_pi(t, uaddr, k, (const timespec32 *)val2);
+	case FUTEX_UNLOCK_PI:
+		return futex_unlock_pi(t, uaddr, k);
 	default:
 		return DERR(-ENOTSUP);
 	}
@@ -260,6 +477,7 @@ sc_futex(int *uaddr, int op, int val, void *val2, int *uaddr2)
 	/* copy in userspace timespec */
 	switch (op & FUTEX_OP_MASK) {
 	case FUTEX_WAIT:
+	case FUTEX_LOCK_PI:
 		if (!val2)
 			break;
 		if (auto r = vm_read(task_cur()->as, &ts, val2, sizeof(ts));
@@ -272,30 +490,13 @@ sc_futex(int *uaddr, int op, int val, void *val2, int *uaddr2)
 }
 
 /*
- * futexes_init - initialise futexes structure
+ * futex_init - initialise futex hash table
  */
 void
-futexes_init(struct futexes *fs)
+futex_init()
 {
-	futexes_impl *fi = (futexes_impl *)fs;
-
-	spinlock_init(&fi->lock);
-	list_init(&fi->list);
-}
-
-/*
- * futexes_destroy - destroy futexes structure
- */
-void
-futexes_destroy(struct futexes *fs)
-{
-	futexes_impl *fi = (futexes_impl *)fs;
-
-	spinlock_lock(&fi->lock);
-	list *n;
-	for (n = list_first(&fi->list); n != &fi->list; n = list_next(n)) {
-		k_futex *fk = list_entry(n, k_futex, link);
-		free(fk);
+	for (auto &b : futex_table) {
+		spinlock_init(&b.lock);
+		list_init(&b.futexes);
 	}
-	spinlock_unlock(&fi->lock);
 }
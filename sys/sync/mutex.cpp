@@ -56,7 +56,7 @@ struct mutex_private {
 	std::atomic_intptr_t owner; /* owner thread locking this mutex */
 	spinlock lock;		    /* lock to protect struct mutex contents */
 	unsigned count;		    /* counter for recursive lock */
-	struct event event;	    /* event */
+	pi_event event;		    /* event with priority inheritance */
 };
 
 static_assert(sizeof(mutex_private) == sizeof(mutex));
@@ -73,7 +73,7 @@ mutex_init(mutex *m)
 	atomic_store_explicit(&mp->owner, 0, std::memory_order_relaxed);
 	spinlock_init(&mp->lock);
 	mp->count = 0;
-	event_init(&mp->event, "mutex", event::ev_LOCK);
+	pi_event_init(&mp->event, "mutex");
 }
 
 /*
@@ -82,6 +82,9 @@ mutex_init(mutex *m)
  * The current thread is blocked if the mutex has already been
  * locked. If current thread receives any exception while
  * waiting mutex, this routine returns EINTR.
+ *
+ * While the current thread is blocked the owner of the mutex inherits its
+ * priority.
  */
 static int __attribute__((noinline))
 mutex_lock_slowpath(mutex *m)
@@ -122,8 +125,8 @@ mutex_lock_slowpath(mutex *m)
 	    std::memory_order_relaxed
 	);
 
-	/* wait for unlock */
-	r = sch_prepare_sleep(&mp->event, 0);
+	/* wait for unlock, owner inherits our priority */
+	r = sch_prepare_sleep_pi(&mp->event, mutex_owner(m), 0);
 	spinlock_unlock(&mp->lock);
 	if (r == 0)
 		r = sch_continue_sleep();
@@ -210,11 +213,12 @@ mutex_unlock_slowpath(mutex *m)
 		return 0;
 	}
 
-	/* wake up one waiter and set new owner */
-	thread *waiter = sch_wakeone(&mp->event);
+	/* wake up one waiter, set new owner and drop inherited priority */
+	thread *waiter = sch_wakeone_pi(&mp->event);
 	atomic_store_explicit(
 	    &mp->owner,
-	    (intptr_t)waiter | (event_waiting(&mp->event) ? MUTEX_WAITERS : 0),
+	    (intptr_t)waiter |
+	    (event_waiting(&mp->event.event) ? MUTEX_WAITERS : 0),
 	    std::memory_order_relaxed
 	);
 
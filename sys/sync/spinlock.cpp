@@ -46,7 +46,11 @@ spinlock_unlock(spinlock *s)
 int
 spinlock_lock_irq_disable(spinlock *s)
 {
+#if defined(CONFIG_IRQ_TRACE)
+	const int i = irq_trace_disable(__builtin_return_address(0));
+#else
 	const int i = irq_disable();
+#endif
 #if defined(CONFIG_DEBUG)
 	assert(!s->owner);
 	s->owner = thread_cur();
@@ -62,7 +66,11 @@ spinlock_unlock_irq_restore(spinlock *s, int v)
 	s->owner = 0;
 	--thread_cur()->spinlock_locks;
 #endif
+#if defined(CONFIG_IRQ_TRACE)
+	irq_trace_restore(v, __builtin_return_address(0));
+#else
 	irq_restore(v);
+#endif
 }
 
 void
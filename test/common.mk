@@ -23,7 +23,21 @@ INCLUDE := \
 	$(CONFIG_APEXDIR)/sys \
 
 SOURCES := \
+	src/addr_index.cpp \
+	src/bin_printf.cpp \
+	src/block_queue.cpp \
+	src/buffer_cache.cpp \
 	src/circular_buffer.cpp \
 	src/expect.cpp \
 	src/init_rand.cpp \
+	src/latency_hist.cpp \
+	src/log_ring.cpp \
 	src/page.cpp \
+	src/ready_queue.cpp \
+	src/region_cache.cpp \
+	src/sch.cpp \
+	src/shared_pages.cpp \
+	src/slab.cpp \
+	src/time_page.cpp \
+	src/timer_wheel.cpp \
+	src/tty_output.cpp \
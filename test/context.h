@@ -0,0 +1,7 @@
+#pragma once
+
+/*
+ * Architecture neutral thread context for test harness.
+ */
+
+struct context {};
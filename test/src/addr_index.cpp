@@ -0,0 +1,129 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/addr_index.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <list.h>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct seg {
+	list link;
+	char *base;
+	size_t len;
+	int prot;
+};
+
+/*
+ * segs - segment list and index
+ */
+struct segs {
+	std::vector<seg> s;
+	std::vector<addr_index<seg>::entry> storage;
+	addr_index<seg> index;
+	list head;
+
+	/* n segments of len bytes, with a gap of len bytes between each */
+	segs(char *base, size_t n, size_t len)
+	: s(n), storage(n)
+	{
+		list_init(&head);
+		index.assign(storage.data(), n);
+		for (size_t i = 0; i < n; ++i) {
+			s[i] = {{}, base + i * len * 2, len, 1};
+			list_insert(list_last(&head), &s[i].link);
+			index.push_back(s[i].base, s[i].base + len, &s[i]);
+		}
+		index.validate();
+	}
+
+	/* linear search as used before the index */
+	const seg *find_linear(const void *addr) const
+	{
+		seg *p;
+		list_for_each_entry(p, &head, link)
+			if (p->base <= addr && p->base + p->len > addr)
+				return p;
+		return nullptr;
+	}
+};
+
+char space[1 << 20];
+
+}
+
+TEST(addr_index, find)
+{
+	segs t(space, 4, 16);
+
+	for (size_t i = 0; i < 4; ++i) {
+		EXPECT_EQ(t.index.find(space + i * 32), &t.s[i]);
+		EXPECT_EQ(t.index.find(space + i * 32 + 15), &t.s[i]);
+		EXPECT_EQ(t.index.find(space + i * 32 + 16), nullptr);
+	}
+	EXPECT_EQ(t.index.find(space + 200), nullptr);
+
+	/* last hit is remembered but misses still work */
+	EXPECT_EQ(t.index.find(space + 70), &t.s[2]);
+	EXPECT_EQ(t.index.find(space + 71), &t.s[2]);
+	EXPECT_EQ(t.index.find(space + 80), nullptr);
+	EXPECT_EQ(t.index.find(space + 5), &t.s[0]);
+}
+
+TEST(addr_index, first_above)
+{
+	segs t(space, 3, 16);
+
+	EXPECT_EQ(t.index.first_above(space), &t.s[0]);
+	EXPECT_EQ(t.index.first_above(space + 15), &t.s[0]);
+	EXPECT_EQ(t.index.first_above(space + 16), &t.s[1]);
+	EXPECT_EQ(t.index.first_above(space + 40), &t.s[1]);
+	EXPECT_EQ(t.index.first_above(space + 79), &t.s[2]);
+	EXPECT_EQ(t.index.first_above(space + 80), nullptr);
+}
+
+TEST(addr_index, rebuild)
+{
+	segs t(space, 3, 16);
+	EXPECT_EQ(t.index.find(space + 32), &t.s[1]);
+
+	/* remove middle segment and rebuild */
+	t.index.invalidate();
+	EXPECT_FALSE(t.index.valid());
+	EXPECT_EQ(t.index.size(), 0);
+	t.index.push_back(t.s[0].base, t.s[0].base + 16, &t.s[0]);
+	t.index.push_back(t.s[2].base, t.s[2].base + 16, &t.s[2]);
+	t.index.validate();
+	EXPECT_EQ(t.index.size(), 2);
+	EXPECT_EQ(t.index.find(space + 32), nullptr);
+	EXPECT_EQ(t.index.find(space + 64), &t.s[2]);
+
+	/* new storage */
+	std::vector<addr_index<seg>::entry> more(8);
+	EXPECT_EQ(t.index.assign(more.data(), more.size()),
+	    t.storage.data());
+	EXPECT_FALSE(t.index.valid());
+	EXPECT_EQ(t.index.capacity(), 8);
+	t.index.validate();
+	EXPECT_EQ(t.index.find(space), nullptr);
+	EXPECT_EQ(t.index.first_above(space), nullptr);
+}
+
+TEST(addr_index, random)
+{
+	std::mt19937 rng(1);
+	for (size_t n : {1, 2, 3, 7, 64, 100}) {
+		segs t(space, n, 64);
+		for (size_t i = 0; i < 10000; ++i) {
+			const char *a = space + rng() % (n * 128 + 64);
+			ASSERT_EQ(t.index.find(a), t.find_linear(a));
+		}
+	}
+}
@@ -0,0 +1,136 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/bin_printf.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+/*
+ * encode - save arguments for fmt
+ */
+std::vector<char>
+encode(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	va_list ap2;
+	va_copy(ap2, ap);
+	std::vector<char> args(bin_vencode(nullptr, 0, fmt, ap));
+	va_end(ap);
+	EXPECT_EQ(bin_vencode(args.data(), args.size(), fmt, ap2),
+	    args.size());
+	va_end(ap2);
+	return args;
+}
+
+/*
+ * format - format saved arguments
+ */
+std::string
+format(const char *fmt, const std::vector<char> &args)
+{
+	char buf[256];
+	const int n = bin_format(buf, sizeof buf, fmt, args.data(),
+	    args.size());
+	EXPECT_EQ(n, strlen(buf));
+	return buf;
+}
+
+/*
+ * expect - check that saving then formatting matches snprintf
+ */
+#define EXPECT_FORMAT(fmt, ...) \
+	do { \
+		char buf[256]; \
+		snprintf(buf, sizeof buf, fmt, __VA_ARGS__); \
+		EXPECT_EQ(format(fmt, encode(fmt, __VA_ARGS__)), buf); \
+	} while (0)
+
+}
+
+TEST(bin_printf, integers)
+{
+	EXPECT_FORMAT("%d %i %u %x %X %o", -1, 2, 3u, 0xabu, 0xcdu, 8u);
+	EXPECT_FORMAT("%ld %lu %lld %llx", -1L, 2UL, -3LL, 0x1234567890ULL);
+	EXPECT_FORMAT("%zu %zd %td %jd", (size_t)1, (ssize_t)-2,
+	    (ptrdiff_t)3, (intmax_t)-4);
+	EXPECT_FORMAT("%hd %hhu %c", 70000, 300, 'x');
+	EXPECT_FORMAT("%08x|%-6d|%+d|% d", 0x1f, 42, 3, 4);
+}
+
+TEST(bin_printf, strings)
+{
+	EXPECT_FORMAT("[%s] [%10s] [%-4s] [%.2s]", "a", "right", "l", "trunc");
+	EXPECT_FORMAT("%s%s", "", "empty");
+	EXPECT_EQ(format("%s", encode("%s", (const char *)nullptr)), "(null)");
+}
+
+TEST(bin_printf, strings_copied)
+{
+	char str[] = "before";
+	const auto args = encode("%s", str);
+	strcpy(str, "after");
+	EXPECT_EQ(format("%s", args), "before");
+}
+
+TEST(bin_printf, stars)
+{
+	EXPECT_FORMAT("[%*d] [%-*d] [%.*s] [%*.*s]", 5, 1, 3, 2, 2, "abc",
+	    6, 1, "xyz");
+}
+
+TEST(bin_printf, other)
+{
+	int x;
+	EXPECT_FORMAT("%p %% %f %.3e %Lg", (void *)&x, 1.5, 2.25, 3.0L);
+	EXPECT_FORMAT("no conversions%s", "");
+	EXPECT_EQ(format("100%%", encode("100%%")), "100%");
+}
+
+TEST(bin_printf, truncated)
+{
+	/* output truncated like snprintf */
+	const char *fmt = "%s %d";
+	const auto args = encode(fmt, "hello", 12345);
+	char buf[8];
+	EXPECT_EQ(bin_format(buf, sizeof buf, fmt, args.data(), args.size()),
+	    11);
+	EXPECT_STREQ(buf, "hello 1");
+	EXPECT_EQ(bin_format(buf, 1, fmt, args.data(), args.size()), 11);
+	EXPECT_STREQ(buf, "");
+	EXPECT_EQ(bin_format(nullptr, 0, fmt, args.data(), args.size()), 11);
+
+	/* encoding stops at buffer length but returns required length */
+	char small[4];
+	va_list ap;
+	auto enc = [&](const char *fmt, ...) {
+		va_start(ap, fmt);
+		const size_t n = bin_vencode(small, sizeof small, fmt, ap);
+		va_end(ap);
+		return n;
+	};
+	EXPECT_EQ(enc("%d %d", 1, 2), 2 * sizeof(int));
+}
+
+TEST(bin_printf, corrupt)
+{
+	/* formatting stops at the end of the argument data */
+	auto args = encode("%d %s %ld", 7, "string", 8L);
+	for (size_t i = 0; i < args.size(); ++i) {
+		std::vector<char> a(args.begin(), args.begin() + i);
+		const std::string s = format("%d %s %ld", a);
+		EXPECT_EQ(s, std::string("7 string 8").substr(0, s.size()));
+	}
+
+	/* unterminated string */
+	std::vector<char> a{'a', 'b', 'c'};
+	EXPECT_EQ(format("x%sy", a), "x");
+}
@@ -0,0 +1,217 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/block_queue.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace {
+
+constexpr size_t sector = 512;
+
+/*
+ * queue_test - test fixture for block request queue
+ *
+ * Requests complete into a result vector indexed by request.
+ */
+class queue_test : public ::testing::Test {
+protected:
+	queue_test()
+	: rqs_(64)
+	, results_(64, 1)
+	{
+		q_.init(4, 16 * sector);
+		buf_.iov_base = data_;
+		buf_.iov_len = sizeof(data_);
+	}
+
+	block_request *submit(size_t i, bool write, off_t off, size_t len)
+	{
+		block_request *rq = &rqs_[i];
+		*rq = block_request{
+			.write = write,
+			.off = off,
+			.len = len,
+			.iov = &buf_,
+			.iov_off = 0,
+			.done = [](block_request *rq, ssize_t r) {
+				*static_cast<ssize_t *>(rq->arg) = r;
+			},
+			.arg = &results_[i],
+		};
+		q_.insert(rq);
+		return rq;
+	}
+
+	std::vector<const block_request *> reqs(const block_queue::batch &b)
+	{
+		std::vector<const block_request *> v;
+		const block_request *rq;
+		list_for_each_entry(rq, &b.reqs, link)
+			v.push_back(rq);
+		return v;
+	}
+
+	block_queue q_;
+	std::vector<block_request> rqs_;
+	std::vector<ssize_t> results_;
+	char data_[16 * sector];
+	iovec buf_;
+};
+
+}
+
+/*
+ * merge - adjacent requests in the same direction are merged
+ */
+TEST_F(queue_test, merge)
+{
+	submit(0, false, 2 * sector, sector);
+	submit(1, false, 0, sector);
+	submit(2, false, sector, sector);
+	submit(3, true, 3 * sector, sector);
+	submit(4, false, 8 * sector, sector);
+
+	block_queue::batch b;
+	q_.dispatch(b);
+	EXPECT_FALSE(b.write);
+	EXPECT_EQ(b.off, 0);
+	EXPECT_EQ(b.len, 3 * sector);
+	EXPECT_EQ(reqs(b), (std::vector<const block_request *>{
+	    &rqs_[1], &rqs_[2], &rqs_[0]}));
+
+	iovec v[3];
+	block_queue::gather(b, v);
+	for (auto &i : v)
+		EXPECT_EQ(i.iov_len, sector);
+	block_queue::complete(b, b.len);
+	EXPECT_EQ(results_[0], sector);
+	EXPECT_EQ(results_[1], sector);
+	EXPECT_EQ(results_[2], sector);
+
+	/* write is not merged with reads */
+	q_.dispatch(b);
+	EXPECT_TRUE(b.write);
+	EXPECT_EQ(b.nreqs, 1);
+	block_queue::complete(b, b.len);
+	q_.dispatch(b);
+	EXPECT_EQ(b.off, 8 * sector);
+	block_queue::complete(b, b.len);
+	EXPECT_TRUE(q_.empty());
+	EXPECT_EQ(q_.requests(), 5);
+	EXPECT_EQ(q_.batches(), 3);
+}
+
+/*
+ * limits - batches respect buffer and length limits
+ */
+TEST_F(queue_test, limits)
+{
+	for (size_t i = 0; i < 6; ++i)
+		submit(i, false, i * sector, sector);
+	block_queue::batch b;
+	q_.dispatch(b);
+	EXPECT_EQ(b.nreqs, 4);
+	EXPECT_EQ(b.niov, 4);
+	block_queue::complete(b, b.len);
+	q_.dispatch(b);
+	EXPECT_EQ(b.nreqs, 2);
+	block_queue::complete(b, b.len);
+
+	/* oversized request is dispatched alone */
+	submit(0, false, 0, 16 * sector);
+	submit(1, false, 16 * sector, sector);
+	for (size_t i = 0; i < 2; ++i) {
+		q_.dispatch(b);
+		EXPECT_EQ(b.nreqs, 1);
+		block_queue::complete(b, b.len);
+	}
+	EXPECT_EQ(results_[0], 16 * sector);
+}
+
+/*
+ * elevator - requests are dispatched in ascending order from head
+ */
+TEST_F(queue_test, elevator)
+{
+	block_queue::batch b;
+	submit(0, false, 10 * sector, sector);
+	q_.dispatch(b);
+	block_queue::complete(b, b.len);
+
+	submit(1, false, 2 * sector, sector);
+	submit(2, false, 20 * sector, sector);
+	submit(3, false, 12 * sector, sector);
+	std::vector<off_t> order;
+	while (!q_.empty()) {
+		q_.dispatch(b);
+		order.push_back(b.off);
+		block_queue::complete(b, b.len);
+	}
+	EXPECT_EQ(order, (std::vector<off_t>{
+	    12 * sector, 20 * sector, 2 * sector}));
+}
+
+/*
+ * hazard - overlapping requests are not reordered
+ */
+TEST_F(queue_test, hazard)
+{
+	block_queue::batch b;
+	submit(0, false, 10 * sector, sector);
+	q_.dispatch(b);
+	block_queue::complete(b, b.len);
+
+	/* write at 0, then read of same sector, then read beyond head */
+	submit(1, true, 0, 2 * sector);
+	submit(2, false, sector, sector);
+	submit(3, false, 12 * sector, sector);
+
+	/* read at 12 is first, then write must precede overlapping read */
+	q_.dispatch(b);
+	EXPECT_EQ(reqs(b).front(), &rqs_[3]);
+	block_queue::complete(b, b.len);
+	q_.dispatch(b);
+	EXPECT_EQ(reqs(b).front(), &rqs_[1]);
+	EXPECT_EQ(b.nreqs, 1);
+	block_queue::complete(b, b.len);
+	q_.dispatch(b);
+	EXPECT_EQ(reqs(b).front(), &rqs_[2]);
+	block_queue::complete(b, b.len);
+
+	/* later read overlapping earlier write is never picked first */
+	submit(4, true, 4 * sector, sector);
+	submit(5, false, 4 * sector, sector);
+	q_.dispatch(b);
+	EXPECT_EQ(reqs(b).front(), &rqs_[4]);
+	block_queue::complete(b, b.len);
+	q_.dispatch(b);
+	block_queue::complete(b, b.len);
+}
+
+/*
+ * error - partial transfer fails requests which were not transferred
+ */
+TEST_F(queue_test, error)
+{
+	for (size_t i = 0; i < 3; ++i)
+		submit(i, false, i * sector, sector);
+	block_queue::batch b;
+	q_.dispatch(b);
+	block_queue::complete(b, sector);
+	EXPECT_EQ(results_[0], sector);
+	EXPECT_EQ(results_[1], -EIO);
+	EXPECT_EQ(results_[2], -EIO);
+
+	for (size_t i = 0; i < 2; ++i)
+		submit(i, false, i * sector, sector);
+	q_.dispatch(b);
+	block_queue::complete(b, -ETIMEDOUT);
+	EXPECT_EQ(results_[0], -ETIMEDOUT);
+	EXPECT_EQ(results_[1], -ETIMEDOUT);
+}
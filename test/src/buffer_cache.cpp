@@ -0,0 +1,163 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/buffer_cache.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t nbufs = 8;
+
+/*
+ * cache_test - test fixture for buffer cache index
+ *
+ * Each buffer's data pointer stores the offset it was assigned so that
+ * lookups can be checked against the buffer contents.
+ */
+class cache_test : public ::testing::Test {
+protected:
+	cache_test()
+	: bufs_(nbufs)
+	{
+		cache_.init(bufs_.data(), bufs_.size(), block_size);
+	}
+
+	/*
+	 * get - find or assign buffer for block at off, writing back if
+	 *	 the victim is dirty
+	 */
+	buffer *get(off_t off)
+	{
+		if (buffer *b = cache_.lookup(off); b) {
+			cache_.touch(b);
+			++hits_;
+			return b;
+		}
+		buffer *b = cache_.victim();
+		if (b->dirty) {
+			++writebacks_;
+			cache_.set_dirty(b, false);
+		}
+		cache_.assign(b, off);
+		return b;
+	}
+
+	std::vector<buffer> bufs_;
+	buffer_cache<2> cache_;
+	size_t hits_ = 0;
+	size_t writebacks_ = 0;
+};
+
+}
+
+/*
+ * lru - least recently used buffer is reused first
+ */
+TEST_F(cache_test, lru)
+{
+	for (size_t i = 0; i < nbufs; ++i)
+		get(i * block_size);
+	EXPECT_EQ(hits_, 0);
+
+	/* touch block 0, block 1 becomes least recently used */
+	get(0);
+	EXPECT_EQ(hits_, 1);
+	buffer *b1 = cache_.lookup(block_size);
+	EXPECT_EQ(cache_.victim(), b1);
+	get(nbufs * block_size);
+	EXPECT_EQ(cache_.lookup(block_size), nullptr);
+	EXPECT_EQ(cache_.lookup(nbufs * block_size), b1);
+	EXPECT_NE(cache_.lookup(0), nullptr);
+}
+
+/*
+ * victim - clean buffers are reused before dirty buffers
+ */
+TEST_F(cache_test, victim)
+{
+	for (size_t i = 0; i < nbufs; ++i)
+		get(i * block_size);
+	for (size_t i = 0; i < nbufs - 1; ++i)
+		cache_.set_dirty(cache_.lookup(i * block_size), true);
+	EXPECT_EQ(cache_.dirty(), nbufs - 1);
+
+	/* only clean buffer is most recently used, but is still reused */
+	buffer *clean = cache_.lookup((nbufs - 1) * block_size);
+	EXPECT_EQ(cache_.victim(), clean);
+
+	/* all dirty, least recently used is reused */
+	cache_.set_dirty(clean, true);
+	EXPECT_EQ(cache_.victim(), cache_.lookup(0));
+	get(nbufs * block_size);
+	EXPECT_EQ(writebacks_, 1);
+	EXPECT_EQ(cache_.dirty(), nbufs - 1);
+}
+
+/*
+ * invalidate - invalid buffers are reused before valid buffers
+ */
+TEST_F(cache_test, invalidate)
+{
+	for (size_t i = 0; i < nbufs; ++i)
+		get(i * block_size);
+	buffer *b = cache_.lookup(5 * block_size);
+	cache_.set_dirty(b, true);
+	cache_.invalidate(b);
+	EXPECT_EQ(cache_.dirty(), 0);
+	EXPECT_EQ(cache_.lookup(5 * block_size), nullptr);
+	EXPECT_EQ(cache_.victim(), b);
+
+	size_t valid = 0;
+	cache_.for_each([&](buffer *) { ++valid; });
+	EXPECT_EQ(valid, nbufs - 1);
+}
+
+/*
+ * model - random access agrees with reference model
+ */
+TEST_F(cache_test, model)
+{
+	std::mt19937 rand;
+	std::map<off_t, bool> model;	/* cached offsets and dirty state */
+
+	for (size_t i = 0; i < 100000; ++i) {
+		const off_t off = (rand() % (nbufs * 3)) * block_size;
+		switch (rand() % 4) {
+		case 0:
+		case 1: {
+			buffer *b = get(off);
+			ASSERT_EQ(b->off, off);
+			break;
+		}
+		case 2:
+			if (buffer *b = cache_.lookup(off); b)
+				cache_.set_dirty(b, true);
+			break;
+		case 3:
+			if (buffer *b = cache_.lookup(off); b)
+				cache_.invalidate(b);
+			break;
+		}
+
+		model.clear();
+		cache_.for_each([&](buffer *b) {
+			ASSERT_EQ(b->off % block_size, 0);
+			ASSERT_EQ(model.count(b->off), 0) << "duplicate block";
+			ASSERT_EQ(cache_.lookup(b->off), b);
+			model[b->off] = b->dirty;
+		});
+		size_t dirty = 0;
+		for (auto [o, d] : model)
+			dirty += d;
+		ASSERT_EQ(cache_.dirty(), dirty);
+	}
+}
@@ -0,0 +1,131 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/latency_hist.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+namespace {
+
+using hist = latency_hist<8, 3>;
+
+/* code path addresses */
+const char path[4]{};
+const void *const a = &path[0];
+const void *const b = &path[1];
+const void *const c = &path[2];
+const void *const d = &path[3];
+
+}
+
+TEST(latency_hist, buckets)
+{
+	EXPECT_EQ(hist::bucket_of(0), 0);
+	EXPECT_EQ(hist::bucket_of(1), 1);
+	EXPECT_EQ(hist::bucket_of(2), 2);
+	EXPECT_EQ(hist::bucket_of(3), 2);
+	EXPECT_EQ(hist::bucket_of(4), 3);
+	EXPECT_EQ(hist::bucket_of(63), 6);
+	EXPECT_EQ(hist::bucket_of(64), 7);
+	EXPECT_EQ(hist::bucket_of(UINT32_MAX), 7);
+
+	hist h;
+	h.add(0, 0, a, b);
+	h.add(3, 0, a, b);
+	h.add(2, 0, a, b);
+	h.add(1000, 0, a, b);
+	EXPECT_EQ(h.count(), 4);
+	EXPECT_EQ(h.total(), 1005);
+	EXPECT_EQ(h.bucket(0), 1);
+	EXPECT_EQ(h.bucket(1), 0);
+	EXPECT_EQ(h.bucket(2), 2);
+	EXPECT_EQ(h.bucket(7), 1);
+}
+
+TEST(latency_hist, worst_per_path)
+{
+	hist h;
+	hist::record w[3];
+
+	/* nothing recorded */
+	h.worst(w);
+	for (const auto &e : w) {
+		EXPECT_EQ(e.from, nullptr);
+		EXPECT_EQ(e.to, nullptr);
+	}
+
+	/* same path keeps worst */
+	h.add(10, 1, a, b);
+	h.add(30, 2, a, b);
+	h.add(20, 3, a, b);
+	h.worst(w);
+	EXPECT_EQ(w[0].ns, 30);
+	EXPECT_EQ(w[0].id, 2);
+	EXPECT_EQ(w[1].from, nullptr);
+
+	/* paths are distinguished by both ends */
+	h.add(5, 4, a, c);
+	h.add(15, 5, c, b);
+	h.worst(w);
+	EXPECT_EQ(w[0].ns, 30);
+	EXPECT_EQ(w[1].ns, 15);
+	EXPECT_EQ(w[1].from, c);
+	EXPECT_EQ(w[2].ns, 5);
+	EXPECT_EQ(w[2].to, c);
+}
+
+TEST(latency_hist, replace)
+{
+	hist h;
+	hist::record w[3];
+
+	h.add(10, 0, a, b);
+	h.add(20, 0, b, c);
+	h.add(30, 0, c, d);
+
+	/* shorter than all worst cases is only counted */
+	h.add(5, 0, d, a);
+	h.worst(w);
+	EXPECT_EQ(w[2].ns, 10);
+	EXPECT_EQ(w[2].from, a);
+	EXPECT_EQ(h.count(), 4);
+
+	/* longer replaces least bad */
+	h.add(25, 0, d, a);
+	h.worst(w);
+	EXPECT_EQ(w[0].ns, 30);
+	EXPECT_EQ(w[1].ns, 25);
+	EXPECT_EQ(w[1].from, d);
+	EXPECT_EQ(w[2].ns, 20);
+
+	/* existing path is updated in place */
+	h.add(40, 0, b, c);
+	h.worst(w);
+	EXPECT_EQ(w[0].ns, 40);
+	EXPECT_EQ(w[0].from, b);
+	EXPECT_EQ(w[1].ns, 30);
+	EXPECT_EQ(w[2].ns, 25);
+}
+
+TEST(latency_hist, reset)
+{
+	hist h;
+	h.add(100, 0, a, b);
+	h.reset();
+	EXPECT_EQ(h.count(), 0);
+	EXPECT_EQ(h.total(), 0);
+	for (size_t i = 0; i < 8; ++i)
+		EXPECT_EQ(h.bucket(i), 0);
+	hist::record w[3];
+	h.worst(w);
+	EXPECT_EQ(w[0].from, nullptr);
+
+	/* zero latency is still recorded as a worst case */
+	h.add(0, 7, a, b);
+	h.worst(w);
+	EXPECT_EQ(w[0].from, a);
+	EXPECT_EQ(w[0].id, 7);
+}
@@ -0,0 +1,268 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/log_ring.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/*
+ * storage - aligned ring buffer
+ */
+struct storage {
+	storage(size_t size)
+	: buf{static_cast<char *>(
+	    operator new[](size, std::align_val_t{log_ring::align}))}
+	{ }
+
+	~storage()
+	{
+		operator delete[](buf, std::align_val_t{log_ring::align});
+	}
+
+	char *const buf;
+};
+
+/*
+ * ring - log ring with its own buffer
+ */
+class ring : private storage, public log_ring {
+public:
+	ring(size_t size)
+	: storage{size}
+	, log_ring{buf, size}
+	{ }
+
+	/*
+	 * put - write committed string record
+	 */
+	bool put(const std::string &s)
+	{
+		unsigned long pos;
+		void *p = reserve(s.size(), &pos);
+		if (!p)
+			return false;
+		memcpy(p, s.data(), s.size());
+		commit(pos);
+		return true;
+	}
+
+	/*
+	 * get - read string record at pos and advance pos
+	 *
+	 * Returns false if there is no record or it was dropped.
+	 */
+	bool get(unsigned long *pos, std::string *s) const
+	{
+		size_t len;
+		const void *p = read(pos, &len);
+		if (!p)
+			return false;
+		*s = std::string(static_cast<const char *>(p), len);
+		if (!valid(*pos))
+			return false;
+		*pos = next(*pos, len);
+		return true;
+	}
+};
+
+}
+
+TEST(log_ring, basic)
+{
+	ring r{256};
+	unsigned long pos = r.tail();
+	std::string s;
+
+	EXPECT_FALSE(r.get(&pos, &s));
+	EXPECT_TRUE(r.put("one"));
+	EXPECT_TRUE(r.put(""));
+	EXPECT_TRUE(r.put("three"));
+	EXPECT_TRUE(r.get(&pos, &s));
+	EXPECT_EQ(s, "one");
+	EXPECT_TRUE(r.get(&pos, &s));
+	EXPECT_EQ(s, "");
+	EXPECT_TRUE(r.get(&pos, &s));
+	EXPECT_EQ(s, "three");
+	EXPECT_FALSE(r.get(&pos, &s));
+	EXPECT_EQ(pos, r.head());
+
+	/* reset drops everything */
+	r.reset();
+	EXPECT_EQ(r.tail(), r.head());
+}
+
+TEST(log_ring, too_large)
+{
+	ring r{256};
+	unsigned long pos;
+	EXPECT_EQ(r.reserve(200, &pos), nullptr);
+	EXPECT_NE(r.reserve(128 - log_ring::align, &pos), nullptr);
+}
+
+TEST(log_ring, uncommitted)
+{
+	ring r{256};
+	unsigned long pos = r.tail(), p1, p2;
+	std::string s;
+
+	/* reader stops at record which is not yet committed */
+	char *a = static_cast<char *>(r.reserve(1, &p1));
+	char *b = static_cast<char *>(r.reserve(1, &p2));
+	ASSERT_TRUE(a && b);
+	*a = 'a';
+	*b = 'b';
+	r.commit(p2);
+	EXPECT_FALSE(r.get(&pos, &s));
+	r.commit(p1);
+	EXPECT_TRUE(r.get(&pos, &s));
+	EXPECT_EQ(s, "a");
+	EXPECT_TRUE(r.get(&pos, &s));
+	EXPECT_EQ(s, "b");
+}
+
+TEST(log_ring, wrap)
+{
+	ring r{1024};
+	unsigned long pos = r.tail();
+	std::string s;
+
+	/* records of varying length wrap around the ring many times */
+	for (size_t i = 0; i < 1000; ++i) {
+		const std::string m(i % 97, 'a' + i % 26);
+		ASSERT_TRUE(r.put(m));
+		ASSERT_TRUE(r.get(&pos, &s));
+		ASSERT_EQ(s, m);
+	}
+	EXPECT_FALSE(r.get(&pos, &s));
+	EXPECT_EQ(pos, r.head());
+}
+
+TEST(log_ring, overrun)
+{
+	ring r{512};
+	unsigned long pos = r.tail();
+	std::string s;
+	size_t i;
+
+	/* oldest records are dropped to make space */
+	for (i = 0; i < 100; ++i)
+		ASSERT_TRUE(r.put(std::to_string(i)));
+	EXPECT_NE(r.tail(), pos);
+	EXPECT_FALSE(r.valid(pos));
+
+	/* reader which restarts at tail sees the newest records */
+	pos = r.tail();
+	ASSERT_TRUE(r.get(&pos, &s));
+	for (i = std::stoul(s) + 1; r.get(&pos, &s); ++i)
+		EXPECT_EQ(s, std::to_string(i));
+	EXPECT_EQ(i, 100);
+}
+
+TEST(log_ring, blocked)
+{
+	ring r{256};
+	unsigned long p, q;
+
+	/* record which is still being written at the tail can't be dropped */
+	ASSERT_NE(r.reserve(16, &p), nullptr);
+	for (size_t i = 0; i < 16; ++i) {
+		if (!r.reserve(16, &q))
+			break;
+		r.commit(q);
+	}
+	EXPECT_EQ(r.reserve(16, &q), nullptr);
+	r.commit(p);
+	EXPECT_NE(r.reserve(16, &q), nullptr);
+}
+
+/*
+ * threads - concurrent producers with a concurrent reader
+ *
+ * Each record holds the producer number, a per producer sequence number and
+ * a payload derived from both. The reader checks that every valid record is
+ * intact and that records from each producer are in order.
+ */
+TEST(log_ring, threads)
+{
+	constexpr size_t producers = 4;
+	constexpr size_t records = 100000;
+
+	struct rec {
+		size_t thread;
+		size_t seq;
+		char payload[40];
+	};
+
+	auto fill = [](rec &m) {
+		memset(m.payload, (char)(m.thread * 31 + m.seq),
+		    m.seq % sizeof m.payload);
+	};
+
+	ring r{4096};
+	std::atomic_size_t done{0};
+	std::vector<std::thread> th;
+	for (size_t t = 0; t < producers; ++t) {
+		th.emplace_back([&, t] {
+			for (size_t i = 0; i < records; ++i) {
+				rec m{.thread = t, .seq = i, .payload{}};
+				fill(m);
+				const size_t len = offsetof(rec, payload) +
+				    i % sizeof m.payload;
+				unsigned long pos;
+				void *p;
+				while (!(p = r.reserve(len, &pos)))
+					std::this_thread::yield();
+				memcpy(p, &m, len);
+				r.commit(pos);
+			}
+			++done;
+		});
+	}
+
+	size_t last[producers] = {}, seen = 0;
+	unsigned long pos = r.tail();
+	for (;;) {
+		const bool finished = done == producers;
+		size_t len;
+		const void *p = r.read(&pos, &len);
+		if (!p) {
+			if (finished && pos == r.head())
+				break;
+			if (!r.valid(pos))
+				pos = r.tail();
+			continue;
+		}
+		rec m{}, e{};
+		memcpy(&m, p, std::min(len, sizeof m));
+		if (!r.valid(pos)) {
+			pos = r.tail();
+			continue;
+		}
+		ASSERT_LT(m.thread, producers);
+		ASSERT_EQ(len, offsetof(rec, payload) +
+		    m.seq % sizeof m.payload);
+		e.thread = m.thread;
+		e.seq = m.seq;
+		fill(e);
+		ASSERT_EQ(memcmp(&m, &e, sizeof m), 0);
+		ASSERT_GE(m.seq, last[m.thread]);
+		last[m.thread] = m.seq;
+		++seen;
+		pos = r.next(pos, len);
+	}
+	for (auto &t : th)
+		t.join();
+
+	EXPECT_GT(seen, 0);
+}
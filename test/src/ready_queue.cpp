@@ -0,0 +1,134 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/ready_queue.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+constexpr unsigned ev_in = 1;
+constexpr unsigned ev_out = 4;
+
+/*
+ * harvest - take all queued items and report those in ready
+ *
+ * Returns reported items in order.
+ */
+std::vector<ready_item *>
+harvest(ready_queue &q, const std::vector<ready_item *> &ready,
+    size_t max = SIZE_MAX)
+{
+	std::vector<ready_item *> v;
+	list tx;
+	q.take(&tx, max);
+	while (!list_empty(&tx)) {
+		ready_item *it = list_entry(list_first(&tx), ready_item, link);
+		bool r = false;
+		for (auto i : ready)
+			r |= i == it;
+		if (r)
+			v.push_back(it);
+		q.finish(it, r);
+	}
+	return v;
+}
+
+}
+
+/*
+ * level - level triggered items are reported until no longer ready
+ */
+TEST(ready_queue, level)
+{
+	ready_queue q;
+	ready_item a, b;
+	ready_queue::init(&a, ev_in, false, false);
+	ready_queue::init(&b, ev_in, false, false);
+
+	/* events outside interest are ignored */
+	EXPECT_FALSE(q.notify(&a, ev_out));
+	EXPECT_TRUE(q.empty());
+
+	/* items are queued once */
+	EXPECT_TRUE(q.notify(&a, ev_in));
+	EXPECT_FALSE(q.notify(&a, ev_in));
+	EXPECT_TRUE(q.notify(&b, ev_in));
+
+	EXPECT_EQ(harvest(q, {&a, &b}), (std::vector<ready_item *>{&a, &b}));
+	EXPECT_EQ(harvest(q, {&b}), (std::vector<ready_item *>{&b}));
+	EXPECT_EQ(harvest(q, {}), (std::vector<ready_item *>{}));
+	EXPECT_TRUE(q.empty());
+}
+
+/*
+ * edge - edge triggered items are reported once per notification
+ */
+TEST(ready_queue, edge)
+{
+	ready_queue q;
+	ready_item a;
+	ready_queue::init(&a, ev_in, true, false);
+
+	EXPECT_TRUE(q.notify(&a, ev_in));
+	EXPECT_EQ(harvest(q, {&a}), (std::vector<ready_item *>{&a}));
+	EXPECT_TRUE(q.empty());
+
+	/* notification while being harvested requeues item */
+	EXPECT_TRUE(q.notify(&a, ev_in));
+	list tx;
+	EXPECT_EQ(q.take(&tx, 8), 1);
+	EXPECT_FALSE(q.notify(&a, ev_in));
+	q.finish(&a, true);
+	EXPECT_FALSE(q.empty());
+	EXPECT_EQ(harvest(q, {&a}), (std::vector<ready_item *>{&a}));
+	EXPECT_TRUE(q.empty());
+}
+
+/*
+ * oneshot - oneshot items are disabled once reported
+ */
+TEST(ready_queue, oneshot)
+{
+	ready_queue q;
+	ready_item a;
+	ready_queue::init(&a, ev_in, false, true);
+
+	/* not reported, so still enabled */
+	EXPECT_TRUE(q.notify(&a, ev_in));
+	EXPECT_EQ(harvest(q, {}), (std::vector<ready_item *>{}));
+	EXPECT_TRUE(q.notify(&a, ev_in));
+	EXPECT_EQ(harvest(q, {&a}), (std::vector<ready_item *>{&a}));
+	EXPECT_EQ(a.events, 0);
+	EXPECT_FALSE(q.notify(&a, ev_in));
+	EXPECT_TRUE(q.empty());
+}
+
+/*
+ * fair - busy level triggered items don't starve others
+ */
+TEST(ready_queue, fair)
+{
+	ready_queue q;
+	ready_item it[4];
+	for (auto &i : it) {
+		ready_queue::init(&i, ev_in, false, false);
+		q.notify(&i, ev_in);
+	}
+	const std::vector<ready_item *> all{&it[0], &it[1], &it[2], &it[3]};
+	EXPECT_EQ(harvest(q, all, 3), (std::vector<ready_item *>{
+	    &it[0], &it[1], &it[2]}));
+	EXPECT_EQ(harvest(q, all, 3), (std::vector<ready_item *>{
+	    &it[3], &it[0], &it[1]}));
+
+	q.remove(&it[2]);
+	EXPECT_FALSE(it[2].queued);
+	EXPECT_EQ(harvest(q, all), (std::vector<ready_item *>{&it[3], &it[0],
+	    &it[1]}));
+}
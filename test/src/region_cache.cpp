@@ -0,0 +1,302 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/region_cache.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+namespace {
+
+struct region {
+	unsigned base;
+	unsigned len;
+
+	bool overlaps(unsigned addr, unsigned l) const
+	{
+		return base < addr + l && addr < base + len;
+	}
+};
+
+constexpr size_t regions = 8;
+using cache = region_cache<region, regions, 2>;
+
+/*
+ * hardware - model of protection unit region registers
+ */
+struct hardware {
+	region r[regions]{};
+	bool enabled[regions]{};
+
+	void program(size_t i, const region &reg)
+	{
+		r[i] = reg;
+		enabled[i] = true;
+	}
+
+	void disable(size_t i)
+	{
+		enabled[i] = false;
+	}
+
+	/* bases of enabled regions in [first, regions) */
+	std::vector<unsigned> bases(size_t first) const
+	{
+		std::vector<unsigned> v;
+		for (size_t i = first; i < regions; ++i)
+			if (enabled[i])
+				v.push_back(r[i].base);
+		return v;
+	}
+};
+
+int as_a, as_b, as_c;	/* address space keys */
+
+}
+
+TEST(region_cache, victim)
+{
+	cache c{};
+	c.init(regions);
+
+	/* free regions are used first */
+	for (size_t i = 2; i < regions; ++i) {
+		EXPECT_EQ(c.victim(2), i);
+		c.load(i, {unsigned(i), 1});
+	}
+
+	/* then least recently loaded */
+	EXPECT_EQ(c.victim(2), 2);
+	c.load(2, {100, 1});
+	EXPECT_EQ(c.victim(2), 3);
+	c.load(3, {101, 1});
+	EXPECT_EQ(c.victim(2), 4);
+
+	/* unloaded regions are free */
+	c.unload(6);
+	EXPECT_EQ(c.victim(2), 6);
+
+	/* regions before first are never selected */
+	EXPECT_EQ(c.victim(5), 6);
+	c.load(6, {102, 1});
+	EXPECT_EQ(c.victim(5), 5);
+
+	/* regions not implemented by hardware are never selected */
+	cache d{};
+	d.init(4);
+	for (size_t i = 0; i < 4; ++i)
+		d.load(d.victim(0), {unsigned(i), 1});
+	EXPECT_EQ(d.victim(0), 0);
+}
+
+TEST(region_cache, save_restore)
+{
+	cache c{};
+	c.init(regions);
+	hardware hw;
+
+	/* a has regions loaded out of index order */
+	c.load(5, {50, 1});
+	c.load(3, {30, 1});
+	c.load(7, {70, 1});
+	c.save(&as_a, 2);
+	EXPECT_EQ(c.saved(&as_a), 3);
+
+	/* switching to b without saved regions restores nothing */
+	c.unload_all();
+	EXPECT_EQ(c.restore(&as_b, 2, [&](size_t i, const region &r) {
+		hw.program(i, r);
+	}), 0);
+	EXPECT_EQ(c.victim(2), 2);
+
+	/* b uses all regions */
+	for (size_t i = 2; i < regions; ++i)
+		c.load(i, {unsigned(200 + i), 1});
+	c.save(&as_b, 2);
+
+	/* restore a in load order */
+	c.unload_all();
+	EXPECT_EQ(c.restore(&as_a, 2, [&](size_t i, const region &r) {
+		hw.program(i, r);
+	}), 3);
+	EXPECT_EQ(hw.bases(2), (std::vector<unsigned>{50, 30, 70}));
+
+	/* restored regions keep their order for replacement */
+	EXPECT_EQ(c.victim(2), 5);
+	c.load(5, {80, 1});
+	c.load(6, {90, 1});
+	c.load(7, {91, 1});
+	EXPECT_EQ(c.victim(2), 2);
+}
+
+TEST(region_cache, restore_limited)
+{
+	cache c{};
+	c.init(regions);
+	hardware hw;
+
+	for (size_t i = 2; i < regions; ++i)
+		c.load(i, {unsigned(i), 1});
+	c.save(&as_a, 2);
+	c.unload_all();
+
+	/* less space on restore, e.g. larger stack, keeps most recent */
+	EXPECT_EQ(c.restore(&as_a, 5, [&](size_t i, const region &r) {
+		hw.program(i, r);
+	}), 3);
+	EXPECT_EQ(hw.bases(0), (std::vector<unsigned>{5, 6, 7}));
+
+	/* no space at all */
+	c.unload_all();
+	EXPECT_EQ(c.restore(&as_a, regions, [&](size_t, const region &) {
+		ADD_FAILURE();
+	}), 0);
+}
+
+TEST(region_cache, replace_space)
+{
+	cache c{};
+	c.init(regions);
+
+	c.load(2, {1, 1});
+	c.save(&as_a, 2);
+	c.load(2, {2, 1});
+	c.save(&as_b, 2);
+
+	/* saving a again keeps its slot */
+	c.load(2, {3, 1});
+	c.load(3, {4, 1});
+	c.save(&as_a, 2);
+	EXPECT_EQ(c.saved(&as_a), 2);
+	EXPECT_EQ(c.saved(&as_b), 1);
+
+	/* c replaces least recently saved space */
+	c.unload(3);
+	c.save(&as_c, 2);
+	EXPECT_EQ(c.saved(&as_a), 2);
+	EXPECT_EQ(c.saved(&as_b), 0);
+	EXPECT_EQ(c.saved(&as_c), 1);
+
+	/* nothing to save doesn't take a slot */
+	c.unload_all();
+	c.save(&as_b, 2);
+	EXPECT_EQ(c.saved(&as_a), 2);
+	EXPECT_EQ(c.saved(&as_c), 1);
+
+	/* but empties an existing one */
+	c.save(&as_a, 2);
+	EXPECT_EQ(c.saved(&as_a), 0);
+}
+
+TEST(region_cache, invalidate)
+{
+	cache c{};
+	c.init(regions);
+	hardware hw;
+
+	for (size_t i = 2; i < 6; ++i) {
+		c.load(i, {unsigned(i * 10), 10});
+		hw.program(i, {unsigned(i * 10), 10});
+	}
+	c.save(&as_a, 2);
+
+	/* loaded regions overlapping [32, 45) are disabled */
+	auto overlaps = [](const region &r) { return r.overlaps(32, 13); };
+	c.unload_if(2, overlaps, [&](size_t i) { hw.disable(i); });
+	EXPECT_EQ(hw.bases(2), (std::vector<unsigned>{20, 50}));
+	EXPECT_EQ(c.victim(2), 3);
+
+	/* as are saved regions */
+	c.forget_if(&as_a, overlaps);
+	EXPECT_EQ(c.saved(&as_a), 2);
+	c.unload_all();
+	hardware hw2;
+	c.restore(&as_a, 2, [&](size_t i, const region &r) {
+		hw2.program(i, r);
+	});
+	EXPECT_EQ(hw2.bases(2), (std::vector<unsigned>{20, 50}));
+
+	/* unknown address space */
+	c.forget_if(&as_b, overlaps);
+	EXPECT_EQ(c.saved(&as_b), 0);
+}
+
+/*
+ * working_set - protection faults per context switch
+ *
+ * Models processes round-robining on an MPU with 16 regions, 6 of which are
+ * fixed or used by the stack. Each time slice a process makes accesses to
+ * a working set of regions. The old policy cleared all dynamic regions on
+ * every switch and replaced regions round-robin.
+ */
+TEST(region_cache, working_set)
+{
+	constexpr size_t hw_regions = 16;
+	constexpr size_t first = 6;
+	constexpr size_t slices = 2000;
+	constexpr size_t accesses = 200;
+
+	auto run = [&](size_t procs, size_t ws, bool cached) {
+		region_cache<region, hw_regions, 8> c{};
+		c.init(hw_regions);
+		unsigned hw[hw_regions];
+		size_t rr = first;
+		std::mt19937 rng(1);
+		std::vector<int> as(procs);
+		size_t faults = 0;
+
+		for (size_t s = 0; s < slices; ++s) {
+			const size_t p = s % procs;
+
+			/* switch in */
+			std::fill(std::begin(hw), std::end(hw), ~0u);
+			if (cached) {
+				c.unload_all();
+				c.restore(&as[p], first,
+				    [&](size_t i, const region &r) {
+					hw[i] = r.base;
+				});
+			} else
+				rr = first;
+
+			for (size_t a = 0; a < accesses; ++a) {
+				const unsigned base = p * 100 + rng() % ws;
+				if (std::find(hw + first, hw + hw_regions,
+				    base) != hw + hw_regions)
+					continue;
+				++faults;
+				size_t v;
+				if (cached) {
+					v = c.victim(first);
+					c.load(v, {base, 1});
+				} else {
+					v = rr;
+					if (++rr == hw_regions)
+						rr = first;
+				}
+				hw[v] = base;
+			}
+
+			/* switch out */
+			if (cached)
+				c.save(&as[p], first);
+		}
+		return (double)faults / slices;
+	};
+
+	for (size_t procs : {2, 4, 8, 12}) {
+		for (size_t ws : {4, 8, 10, 14}) {
+			const double o = run(procs, ws, false);
+			const double n = run(procs, ws, true);
+			EXPECT_LE(n, o);
+			if (ws <= hw_regions - first && procs <= 8) {
+				EXPECT_LT(n, 0.1);
+			}
+		}
+	}
+}
@@ -0,0 +1,433 @@
+/*
+ * Configuration for this test
+ */
+#define KERNEL
+#define CONFIG_TIME_SLICE_MS 50
+#define CONFIG_MA_NORMAL_ATTR MA_SPEED_0
+#define CONFIG_MA_FAST_ATTR MA_SPEED_1
+// #define CONFIG_DEBUG
+
+/*
+ * Test victim
+ *
+ * types.h must come before host <csignal> to avoid _NSIG redefinition.
+ */
+#include <types.h>
+#include <sys/kern/sch.cpp>
+#include <sys/lib/queue.cpp>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+/*
+ * Kernel environment required by scheduler
+ */
+thread idle_thread;
+
+bool interrupt_enabled() { return false; }
+bool interrupt_running() { return false; }
+void interrupt_enable() { }
+void interrupt_disable() { }
+int irq_disable() { return 0; }
+void irq_restore(int) { }
+void arch_schedule() { }
+void context_switch(thread *, thread *) { }
+void timer_callout(timer *, uint_fast64_t, uint_fast64_t, void (*)(void *), void *) { }
+void timer_redirect(timer *, void (*)(void *), void *) { }
+void timer_stop(timer *) { }
+bool sig_unblocked_pending(thread *) { return false; }
+thread *kthread_create(void (*)(void *), void *, int, const char *, long) { return nullptr; }
+void thread_zombie(thread *) { }
+void thread_check() { }
+
+namespace {
+
+int
+rand_in_range(int min, int max)
+{
+	const int range = max - min + 1;
+	return rand() % range + min;
+}
+
+/*
+ * runq_test - test fixture for run queue
+ *
+ * The run queue is checked against a reference model which keeps a FIFO of
+ * threads per priority level.
+ */
+class runq_test : public ::testing::Test {
+protected:
+	runq_test()
+	{
+		for (auto &q : runq.q)
+			queue_init(&q);
+		memset(runq.map, 0, sizeof runq.map);
+		runq.summary = 0;
+		idle_thread.prio = PRI_IDLE;
+		active_thread = &idle_thread;
+		resched = 0;
+	}
+
+	void create(size_t n)
+	{
+		threads_.resize(n);
+		for (auto &th : threads_) {
+			th.state = 0;
+			th.prio = rand_in_range(0, PRI_MIN);
+		}
+	}
+
+	void enqueue(thread *th)
+	{
+		runq_enqueue(th);
+		model_[th->prio].push_back(th);
+	}
+
+	void insert(thread *th)
+	{
+		runq_insert(th);
+		model_[th->prio].push_front(th);
+	}
+
+	void remove(thread *th)
+	{
+		runq_remove(th);
+		auto &q = model_[th->prio];
+		q.erase(std::find(q.begin(), q.end(), th));
+		if (q.empty())
+			model_.erase(th->prio);
+	}
+
+	thread *dequeue()
+	{
+		thread *th = runq_dequeue();
+		auto &q = model_.begin()->second;
+		EXPECT_EQ(th, q.front());
+		q.pop_front();
+		if (q.empty())
+			model_.erase(model_.begin());
+		return th;
+	}
+
+	void verify()
+	{
+		if (model_.empty())
+			EXPECT_EQ(runq_top(), PRI_MIN + 1);
+		else
+			EXPECT_EQ(runq_top(), model_.begin()->first);
+		for (int i = 0; i <= PRI_MIN; ++i) {
+			const bool bit = runq.map[i / RUNQ_WORD_BITS] &
+			    (0x80000000u >> (i % RUNQ_WORD_BITS));
+			EXPECT_EQ(bit, model_.count(i) != 0) << "priority " << i;
+		}
+		for (int i = 0; i < RUNQ_WORDS; ++i)
+			EXPECT_EQ(!!(runq.summary & (0x80000000u >> i)),
+			    !!runq.map[i]) << "word " << i;
+	}
+
+	std::vector<thread> threads_;
+	std::map<int, std::deque<thread *>> model_;
+};
+
+}
+
+/*
+ * order - threads are dequeued by priority then in FIFO order
+ */
+TEST_F(runq_test, order)
+{
+	create(4096);
+	for (auto &th : threads_)
+		enqueue(&th);
+	verify();
+	while (!model_.empty())
+		dequeue();
+	verify();
+}
+
+/*
+ * insert - preempted threads run before other threads of equal priority
+ */
+TEST_F(runq_test, insert)
+{
+	create(3);
+	for (auto &th : threads_)
+		th.prio = 100;
+	enqueue(&threads_[0]);
+	enqueue(&threads_[1]);
+	insert(&threads_[2]);
+	verify();
+	EXPECT_EQ(dequeue(), &threads_[2]);
+	EXPECT_EQ(dequeue(), &threads_[0]);
+	EXPECT_EQ(dequeue(), &threads_[1]);
+	verify();
+}
+
+/*
+ * preempt - enqueuing a higher priority thread requests preemption
+ */
+TEST_F(runq_test, preempt)
+{
+	create(2);
+	threads_[0].prio = PRI_IDLE;
+	enqueue(&threads_[0]);
+	EXPECT_EQ(resched, 0);
+	threads_[1].prio = PRI_DEFAULT;
+	enqueue(&threads_[1]);
+	EXPECT_EQ(resched, RESCHED_PREEMPT);
+}
+
+/*
+ * fuzz - random operations on thousands of threads
+ */
+TEST_F(runq_test, fuzz)
+{
+	create(4096);
+	std::vector<thread *> idle, queued;
+	for (auto &th : threads_)
+		idle.push_back(&th);
+
+	for (size_t i = 0; i < 200000; ++i) {
+		switch (rand_in_range(0, 3)) {
+		case 0:
+		case 1:
+			if (idle.empty())
+				break;
+			std::swap(idle[rand() % idle.size()], idle.back());
+			if (rand() & 1)
+				enqueue(idle.back());
+			else
+				insert(idle.back());
+			queued.push_back(idle.back());
+			idle.pop_back();
+			break;
+		case 2:
+			if (queued.empty())
+				break;
+			std::swap(queued[rand() % queued.size()], queued.back());
+			remove(queued.back());
+			idle.push_back(queued.back());
+			queued.pop_back();
+			break;
+		case 3: {
+			if (queued.empty())
+				break;
+			thread *th = dequeue();
+			queued.erase(std::find(queued.begin(), queued.end(), th));
+			idle.push_back(th);
+			break;
+		}
+		}
+		if (!(i % 1000))
+			verify();
+	}
+	verify();
+}
+
+namespace {
+
+/*
+ * pi_test - test fixture for priority inheritance
+ */
+class pi_test : public ::testing::Test {
+protected:
+	pi_test()
+	{
+		for (auto &q : runq.q)
+			queue_init(&q);
+		memset(runq.map, 0, sizeof runq.map);
+		runq.summary = 0;
+		idle_thread.prio = PRI_IDLE;
+		list_init(&idle_thread.pi_events);
+		active_thread = &idle_thread;
+		resched = 0;
+		locks = 0;
+	}
+
+	thread *create(int prio)
+	{
+		thread &th = threads_.emplace_back();
+		th.state = 0;
+		th.prio = prio;
+		th.baseprio = prio;
+		th.pi_blocked = nullptr;
+		list_init(&th.pi_events);
+		runq_enqueue(&th);
+		return &th;
+	}
+
+	/* th blocks on pi owned by owner */
+	void block(thread *th, pi_event *pi, thread *owner)
+	{
+		runq_remove(th);
+		active_thread = th;
+		EXPECT_EQ(sch_prepare_sleep_pi(pi, owner, 0), 0);
+		locks = 0;
+		active_thread = &idle_thread;
+	}
+
+	/* owner releases pi */
+	thread *release(thread *owner, pi_event *pi)
+	{
+		active_thread = owner;
+		thread *th = sch_wakeone_pi(pi);
+		active_thread = &idle_thread;
+		return th;
+	}
+
+	std::deque<thread> threads_;
+};
+
+}
+
+/*
+ * inherit - owner runs at priority of highest waiter until release
+ */
+TEST_F(pi_test, inherit)
+{
+	pi_event pi;
+	pi_event_init(&pi, "test");
+	thread *l = create(200);
+	thread *m = create(170);
+	thread *h = create(150);
+
+	block(m, &pi, l);
+	EXPECT_EQ(l->prio, 170);
+	block(h, &pi, l);
+	EXPECT_EQ(l->prio, 150);
+	EXPECT_EQ(l->baseprio, 200);
+
+	/* highest priority waiter becomes owner and inherits from the rest */
+	EXPECT_EQ(release(l, &pi), h);
+	EXPECT_EQ(l->prio, 200);
+	EXPECT_EQ(pi.owner, h);
+	EXPECT_EQ(h->pi_blocked, nullptr);
+
+	/* priority change of a waiter is passed to the owner */
+	sch_setprio(m, 120, 120);
+	EXPECT_EQ(h->prio, 120);
+	sch_setprio(m, 170, 170);
+	EXPECT_EQ(h->prio, 150);
+
+	EXPECT_EQ(release(h, &pi), m);
+	EXPECT_EQ(pi.owner, nullptr);
+	EXPECT_TRUE(list_empty(&h->pi_events));
+}
+
+/*
+ * transitive - priority is inherited along a chain of owners
+ */
+TEST_F(pi_test, transitive)
+{
+	pi_event p1, p2;
+	pi_event_init(&p1, "p1");
+	pi_event_init(&p2, "p2");
+	thread *a = create(200);
+	thread *b = create(180);
+	thread *c = create(100);
+
+	block(b, &p1, a);
+	EXPECT_EQ(a->prio, 180);
+	block(c, &p2, b);
+	EXPECT_EQ(b->prio, 100);
+	EXPECT_EQ(a->prio, 100);
+
+	/* waiter timing out drops priority along the chain */
+	sch_unsleep(c, -ETIMEDOUT);
+	EXPECT_EQ(c->slpret, -ETIMEDOUT);
+	EXPECT_EQ(b->prio, 180);
+	EXPECT_EQ(a->prio, 180);
+	EXPECT_EQ(p2.owner, nullptr);
+
+	sch_unsleep(b, -EINTR);
+	EXPECT_EQ(a->prio, 200);
+	EXPECT_TRUE(list_empty(&a->pi_events));
+}
+
+/*
+ * setprio - base priority changes do not drop inherited priority
+ */
+TEST_F(pi_test, setprio)
+{
+	pi_event pi;
+	pi_event_init(&pi, "test");
+	thread *l = create(200);
+	thread *h = create(150);
+
+	block(h, &pi, l);
+	sch_setprio(l, 220, 220);
+	EXPECT_EQ(l->prio, 150);
+	EXPECT_EQ(l->baseprio, 220);
+	sch_setprio(l, 100, 100);
+	EXPECT_EQ(l->prio, 100);
+	sch_setprio(l, 220, 220);
+	EXPECT_EQ(release(l, &pi), h);
+	EXPECT_EQ(l->prio, 220);
+}
+
+/*
+ * latency - priority inversion is bounded by the critical section
+ *
+ * A low priority thread holds a lock which a high priority thread needs
+ * while a medium priority thread is CPU bound. Ticks are simulated by
+ * running the highest priority runnable thread. Without priority inheritance
+ * the high priority thread waits for the medium priority thread to finish.
+ */
+TEST_F(pi_test, latency)
+{
+	constexpr int critical = 5;
+	constexpr int busy = 1000;
+
+	auto simulate = [&](bool inherit) {
+		pi_event pi;
+		pi_event_init(&pi, "test");
+		thread *l = create(200);
+		thread *m = create(175);
+		thread *h = create(150);
+		int l_work = critical;
+		int m_work = busy;
+
+		if (inherit)
+			block(h, &pi, l);
+		else {
+			runq_remove(h);
+			active_thread = h;
+			EXPECT_EQ(sch_prepare_sleep(&pi.event, 0), 0);
+			locks = 0;
+			active_thread = &idle_thread;
+		}
+
+		for (int tick = 0; runq_top() <= PRI_MIN; ++tick) {
+			thread *th = runq_dequeue();
+			if (th == h) {
+				while (runq_top() <= PRI_MIN)
+					runq_dequeue();
+				return tick;
+			}
+			if (th == l && !--l_work) {
+				active_thread = l;
+				if (inherit)
+					sch_wakeone_pi(&pi);
+				else
+					sch_wakeone(&pi.event);
+				active_thread = &idle_thread;
+				continue;
+			}
+			if (th == m && !--m_work)
+				continue;
+			runq_enqueue(th);
+		}
+		return -1;
+	};
+
+	const int with = simulate(true);
+	const int without = simulate(false);
+	EXPECT_EQ(with, critical);
+	EXPECT_GE(without, busy);
+}
@@ -0,0 +1,160 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/shared_pages.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr size_t page_size = 4096;
+
+/*
+ * shared_test - test fixture for shared page index
+ *
+ * Regions are placed at fake page aligned addresses and released runs are
+ * recorded as (page, count) pairs.
+ */
+class shared_test : public ::testing::Test {
+protected:
+	shared_test()
+	: idx_{page_size}
+	{ }
+
+	~shared_test()
+	{
+		for (auto r : regions_)
+			std::free(r);
+	}
+
+	shared_region *insert(const void *key, off_t off, size_t len,
+	    size_t page, size_t npages)
+	{
+		auto r = static_cast<shared_region *>(
+		    std::malloc(shared_pages::size(npages)));
+		regions_.push_back(r);
+		idx_.insert(r, key, off, len, addr(page), npages);
+		return r;
+	}
+
+	bool unref(shared_region *r, size_t page, size_t npages)
+	{
+		return idx_.unref(r, addr(page), npages * page_size,
+		    [&](void *a, size_t len) {
+			released_.emplace_back(
+			    (reinterpret_cast<uintptr_t>(a) - base) / page_size,
+			    len / page_size);
+		});
+	}
+
+	static std::byte *addr(size_t page)
+	{
+		return reinterpret_cast<std::byte *>(base + page * page_size);
+	}
+
+	static constexpr uintptr_t base = 0x10000000;
+
+	shared_pages idx_;
+	std::vector<shared_region *> regions_;
+	std::vector<std::pair<size_t, size_t>> released_;
+};
+
+}
+
+/*
+ * find - regions are found by key or by address
+ */
+TEST_F(shared_test, find)
+{
+	const int a = 0, b = 0;
+	shared_region *r1 = insert(&a, 0, 3 * page_size, 0, 3);
+	shared_region *r2 = insert(&b, page_size, 100, 8, 1);
+
+	EXPECT_EQ(idx_.find(&a, 0, 3 * page_size), r1);
+	EXPECT_EQ(idx_.find(&b, page_size, 100), r2);
+	EXPECT_EQ(idx_.find(&a, 0, page_size), nullptr);
+	EXPECT_EQ(idx_.find(&b, 0, 100), nullptr);
+
+	EXPECT_EQ(idx_.find_addr(addr(0)), r1);
+	EXPECT_EQ(idx_.find_addr(addr(2) + 10), r1);
+	EXPECT_EQ(idx_.find_addr(addr(3)), nullptr);
+	EXPECT_EQ(idx_.find_addr(addr(8)), r2);
+}
+
+/*
+ * release - pages are released when the last mapping goes away
+ */
+TEST_F(shared_test, release)
+{
+	const int a = 0;
+	shared_region *r = insert(&a, 0, 4 * page_size, 0, 4);
+	ASSERT_TRUE(idx_.ref(r));
+
+	EXPECT_FALSE(unref(r, 0, 4));
+	EXPECT_TRUE(released_.empty());
+	EXPECT_EQ(idx_.find(&a, 0, 4 * page_size), r);
+
+	EXPECT_TRUE(unref(r, 0, 4));
+	EXPECT_EQ(released_, (std::vector<std::pair<size_t, size_t>>{{0, 4}}));
+	EXPECT_TRUE(idx_.empty());
+}
+
+/*
+ * partial - partially unmapped regions release pages in runs
+ */
+TEST_F(shared_test, partial)
+{
+	const int a = 0;
+	shared_region *r = insert(&a, 0, 6 * page_size, 0, 6);
+	ASSERT_TRUE(idx_.ref(r));
+
+	/* first mapping unmaps middle, then remainder */
+	EXPECT_FALSE(unref(r, 2, 2));
+	EXPECT_FALSE(unref(r, 0, 2));
+	EXPECT_FALSE(unref(r, 4, 2));
+	EXPECT_TRUE(released_.empty());
+
+	/* second mapping unmaps page 1 only, region is now incomplete */
+	EXPECT_FALSE(unref(r, 1, 1));
+	EXPECT_EQ(released_, (std::vector<std::pair<size_t, size_t>>{{1, 1}}));
+	EXPECT_EQ(idx_.find(&a, 0, 6 * page_size), nullptr);
+	EXPECT_EQ(idx_.find_addr(addr(5)), r);
+
+	/* rest of second mapping is released as it is unmapped */
+	released_.clear();
+	EXPECT_FALSE(unref(r, 2, 4));
+	EXPECT_TRUE(unref(r, 0, 1));
+	EXPECT_EQ(released_, (std::vector<std::pair<size_t, size_t>>{
+	    {2, 4}, {0, 1}}));
+	EXPECT_TRUE(idx_.empty());
+}
+
+/*
+ * runs - pages with remaining references split released runs
+ */
+TEST_F(shared_test, runs)
+{
+	const int a = 0;
+	shared_region *r = insert(&a, 0, 5 * page_size, 0, 5);
+	ASSERT_TRUE(idx_.ref(r));
+	ASSERT_TRUE(idx_.ref(r));
+
+	/* second mapping goes away, third keeps only page 2 */
+	EXPECT_FALSE(unref(r, 0, 5));
+	EXPECT_FALSE(unref(r, 0, 2));
+	EXPECT_FALSE(unref(r, 3, 2));
+	EXPECT_TRUE(released_.empty());
+
+	/* first mapping goes away, page 2 is still referenced */
+	EXPECT_FALSE(unref(r, 0, 5));
+	EXPECT_EQ(released_, (std::vector<std::pair<size_t, size_t>>{
+	    {0, 2}, {3, 2}}));
+	EXPECT_TRUE(unref(r, 2, 1));
+}
@@ -0,0 +1,192 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/slab.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr size_t page_size = 4096;
+constexpr uint32_t magic = 0x51ab0000;
+constexpr size_t sizes[] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+
+/*
+ * slab_test - test fixture for slab cache
+ *
+ * Pages are supplied from the host heap and counted so that tests can check
+ * that empty slabs are returned.
+ */
+class slab_test : public ::testing::Test {
+protected:
+	~slab_test()
+	{
+		EXPECT_EQ(pages_, 0);
+	}
+
+	void *alloc(slab_cache &c)
+	{
+		if (void *p = c.alloc(); p)
+			return p;
+		++pages_;
+		c.grow(std::aligned_alloc(page_size, page_size));
+		return c.alloc();
+	}
+
+	void free(slab_cache &c, void *p)
+	{
+		if (void *m = c.free(p); m) {
+			--pages_;
+			std::free(m);
+		}
+	}
+
+	void shrink(slab_cache &c)
+	{
+		if (void *m = c.shrink(); m) {
+			--pages_;
+			std::free(m);
+		}
+	}
+
+	size_t pages_ = 0;
+};
+
+}
+
+/*
+ * alloc_free - objects are aligned, distinct and slabs are returned
+ */
+TEST_F(slab_test, alloc_free)
+{
+	for (auto size : sizes) {
+		slab_cache c;
+		c.init(size, page_size, magic);
+		ASSERT_GT(c.objects_per_slab(), 0);
+
+		const size_t n = c.objects_per_slab() * 3 + 1;
+		std::vector<void *> objs;
+		for (size_t i = 0; i < n; ++i) {
+			void *p = alloc(c);
+			ASSERT_NE(p, nullptr);
+			EXPECT_EQ(reinterpret_cast<uintptr_t>(p) % 16, 0);
+			slab *s = slab_cache::slab_of(p, page_size);
+			EXPECT_GE((char *)p, (char *)s + sizeof(slab));
+			EXPECT_LE((char *)p + size, (char *)s + page_size);
+			memset(p, (int)i, size);
+			objs.push_back(p);
+		}
+		EXPECT_EQ(c.slabs(), 4);
+		EXPECT_EQ(c.allocated(), n);
+
+		std::sort(objs.begin(), objs.end());
+		for (size_t i = 1; i < objs.size(); ++i)
+			EXPECT_GE((char *)objs[i], (char *)objs[i - 1] + size);
+
+		for (auto p : objs)
+			free(c, p);
+		EXPECT_EQ(c.allocated(), 0);
+		/* one empty slab is retained */
+		EXPECT_EQ(c.slabs(), 1);
+		EXPECT_EQ(pages_, 1);
+		shrink(c);
+		EXPECT_EQ(c.slabs(), 0);
+	}
+}
+
+/*
+ * release_empty - empty slab is only retained if no other slab has space
+ */
+TEST_F(slab_test, release_empty)
+{
+	slab_cache c;
+	c.init(64, page_size, magic);
+	const size_t n = c.objects_per_slab();
+
+	std::vector<void *> a, b;
+	for (size_t i = 0; i < n; ++i)
+		a.push_back(alloc(c));
+	for (size_t i = 0; i < n; ++i)
+		b.push_back(alloc(c));
+	EXPECT_EQ(c.slabs(), 2);
+
+	/* slab a becomes empty while slab b has space */
+	free(c, b.back());
+	b.pop_back();
+	for (auto p : a)
+		free(c, p);
+	a.clear();
+	EXPECT_EQ(c.slabs(), 1);
+	EXPECT_EQ(pages_, 1);
+
+	/* slab b becomes empty and is retained */
+	for (auto p : b)
+		free(c, p);
+	b.clear();
+	EXPECT_EQ(c.slabs(), 1);
+	EXPECT_EQ(pages_, 1);
+
+	/* retained slab is released once another slab has space */
+	for (size_t i = 0; i < n * 2; ++i)
+		a.push_back(alloc(c));
+	EXPECT_EQ(c.slabs(), 2);
+	for (size_t i = 0; i < n; ++i)
+		free(c, a[i]);
+	EXPECT_EQ(c.slabs(), 2);
+	free(c, a[n]);
+	EXPECT_EQ(c.slabs(), 1);
+	EXPECT_EQ(pages_, 1);
+
+	for (size_t i = n + 1; i < n * 2; ++i)
+		free(c, a[i]);
+	shrink(c);
+	EXPECT_EQ(c.slabs(), 0);
+}
+
+/*
+ * fuzz - random allocation and free does not corrupt objects
+ */
+TEST_F(slab_test, fuzz)
+{
+	std::mt19937 rand;
+	slab_cache caches[std::size(sizes)];
+	for (size_t i = 0; i < std::size(sizes); ++i)
+		caches[i].init(sizes[i], page_size, magic);
+
+	std::map<void *, std::pair<size_t, uint8_t>> live;
+	for (size_t i = 0; i < 200000; ++i) {
+		if (live.empty() || rand() % 100 < 55) {
+			const size_t cls = rand() % std::size(sizes);
+			void *p = alloc(caches[cls]);
+			ASSERT_NE(p, nullptr);
+			ASSERT_EQ(live.count(p), 0);
+			const uint8_t fill = rand();
+			memset(p, fill, sizes[cls]);
+			live[p] = {cls, fill};
+		} else {
+			auto it = live.begin();
+			std::advance(it, rand() % std::min<size_t>(live.size(), 64));
+			auto [cls, fill] = it->second;
+			const uint8_t *b = static_cast<uint8_t *>(it->first);
+			for (size_t j = 0; j < sizes[cls]; ++j)
+				ASSERT_EQ(b[j], fill);
+			free(caches[cls], it->first);
+			live.erase(it);
+		}
+	}
+	for (auto [p, v] : live)
+		free(caches[v.first], p);
+	for (auto &c : caches) {
+		EXPECT_EQ(c.allocated(), 0);
+		shrink(c);
+	}
+}
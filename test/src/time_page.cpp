@@ -0,0 +1,111 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/time_page.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+namespace {
+
+/*
+ * gettime - read clock from time page in nanoseconds, -1 if not supported
+ */
+int64_t
+gettime(const time_page &tp, clockid_t clk)
+{
+	timespec ts{};
+	if (time_page_gettime(&tp, clk, &ts))
+		return -1;
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+}
+
+TEST(time_page, unsupported)
+{
+	time_page tp{};
+	tp.flags = TIME_PAGE_TICK;
+	EXPECT_EQ(gettime(tp, CLOCK_PROCESS_CPUTIME_ID), -1);
+	EXPECT_EQ(gettime(tp, CLOCK_THREAD_CPUTIME_ID), -1);
+	EXPECT_EQ(gettime(tp, CLOCK_BOOTTIME), -1);
+}
+
+TEST(time_page, tick)
+{
+	time_page tp{};
+	tp.flags = TIME_PAGE_TICK;
+	tp.coarse = 5000000123;
+	tp.realtime_offset = 1000000000000;
+
+	/* only coarse clocks can be read without a counter */
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC_COARSE), 5000000123);
+	EXPECT_EQ(gettime(tp, CLOCK_REALTIME_COARSE), 1005000000123);
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC), -1);
+	EXPECT_EQ(gettime(tp, CLOCK_REALTIME), -1);
+
+	/* nothing can be read in tickless mode without a counter */
+	tp.flags = 0;
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC_COARSE), -1);
+}
+
+TEST(time_page, counter)
+{
+	volatile uint32_t counter[2] = {0x10, 0x1};
+	time_page tp{};
+	tp.flags = TIME_PAGE_TICK | TIME_PAGE_COUNTER;
+	tp.coarse = 1000;
+	tp.realtime_offset = 7;
+	tp.counter = counter;
+	tp.counter_ns = 100;
+
+	const int64_t ns = 0x100000010LL * 100;
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC), ns);
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC_RAW), ns);
+	EXPECT_EQ(gettime(tp, CLOCK_REALTIME), ns + 7);
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC_COARSE), 1000);
+	EXPECT_EQ(gettime(tp, CLOCK_REALTIME_COARSE), 1007);
+
+	/* without periodic tick coarse clocks are exact */
+	tp.flags = TIME_PAGE_COUNTER;
+	EXPECT_EQ(gettime(tp, CLOCK_MONOTONIC_COARSE), ns);
+	EXPECT_EQ(gettime(tp, CLOCK_REALTIME_COARSE), ns + 7);
+}
+
+/*
+ * seqlock - readers never see a partially updated page
+ *
+ * The writer keeps realtime a multiple of a large odd number, which a torn
+ * read of coarse and realtime_offset would break.
+ */
+TEST(time_page, seqlock)
+{
+	constexpr uint64_t k = 1000003;
+	time_page tp{};
+	tp.flags = TIME_PAGE_TICK;
+	std::atomic_bool done{false};
+
+	std::thread writer([&] {
+		for (uint64_t i = 1; !done; ++i) {
+			time_page_write_begin(&tp);
+			tp.coarse = i;
+			tp.realtime_offset = i * (k - 1);
+			time_page_write_end(&tp);
+		}
+	});
+
+	for (size_t i = 0; i < 1000000; ++i) {
+		timespec ts{};
+		ASSERT_EQ(time_page_gettime(&tp, CLOCK_REALTIME_COARSE, &ts),
+		    0);
+		const uint64_t ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		ASSERT_EQ(ns % k, 0);
+	}
+	done = true;
+	writer.join();
+}
@@ -0,0 +1,180 @@
+/*
+ * Test victim
+ */
+#include <sys/lib/timer_wheel.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr uint_fast64_t tick_ns = 1000000;
+using wheel_type = timer_wheel<6, 4>;
+
+/*
+ * wheel_test - test fixture for timer wheel
+ *
+ * The wheel is checked against a reference model which maps each armed
+ * timer to its expiry time.
+ */
+class wheel_test : public ::testing::Test {
+protected:
+	wheel_test()
+	: wheel_{tick_ns}
+	, timers_(1024)
+	{ }
+
+	void arm(timer *tmr, uint_fast64_t expire)
+	{
+		if (model_.count(tmr))
+			cancel(tmr);
+		tmr->expire = expire;
+		wheel_.insert(tmr);
+		model_[tmr] = expire;
+	}
+
+	void cancel(timer *tmr)
+	{
+		wheel_.remove(tmr);
+		model_.erase(tmr);
+	}
+
+	void advance(uint_fast64_t monotonic)
+	{
+		ASSERT_GE(monotonic, now_);
+		now_ = monotonic;
+		std::vector<timer *> fired;
+		wheel_.advance(monotonic, [&](timer *tmr) {
+			fired.push_back(tmr);
+		});
+		for (auto tmr : fired) {
+			ASSERT_TRUE(model_.count(tmr)) << "spurious expiry";
+			EXPECT_LE(model_[tmr], monotonic) << "early expiry";
+			model_.erase(tmr);
+		}
+		for (auto [tmr, expire] : model_)
+			EXPECT_GT(expire, monotonic) << "missed expiry";
+	}
+
+	uint_fast64_t earliest() const
+	{
+		uint_fast64_t e = UINT_FAST64_MAX;
+		for (auto [tmr, expire] : model_)
+			e = std::min(e, expire);
+		return e;
+	}
+
+	wheel_type wheel_;
+	std::vector<timer> timers_;
+	std::map<timer *, uint_fast64_t> model_;
+	uint_fast64_t now_ = 0;
+	std::mt19937_64 rand_;
+};
+
+}
+
+/*
+ * expire - timers expire no earlier than and no later than their deadline
+ */
+TEST_F(wheel_test, expire)
+{
+	for (size_t i = 0; i < 100000; ++i) {
+		timer *tmr = &timers_[rand_() % timers_.size()];
+		switch (rand_() % 4) {
+		case 0:
+			arm(tmr, now_ + rand_() % (100 * tick_ns));
+			break;
+		case 1:
+			arm(tmr, now_ + rand_() % (100000 * tick_ns));
+			break;
+		case 2:
+			if (model_.count(tmr))
+				cancel(tmr);
+			break;
+		case 3:
+			advance(now_ + rand_() % (1000 * tick_ns));
+			break;
+		}
+	}
+	advance(UINT_FAST64_MAX / 2);
+	EXPECT_TRUE(model_.empty());
+	EXPECT_TRUE(wheel_.empty());
+}
+
+/*
+ * next_expiry - next expiry is never late and exact for near timers
+ */
+TEST_F(wheel_test, next_expiry)
+{
+	EXPECT_EQ(wheel_.next_expiry(), UINT_FAST64_MAX);
+
+	for (size_t i = 0; i < 10000; ++i) {
+		/* near timers only, next expiry must be exact */
+		for (size_t j = 0; j < 8; ++j)
+			arm(&timers_[rand_() % timers_.size()],
+			    now_ + rand_() % (60 * tick_ns));
+		EXPECT_EQ(wheel_.next_expiry(), earliest());
+		advance(wheel_.next_expiry());
+	}
+
+	for (size_t i = 0; i < 10000; ++i) {
+		/* far timers, next expiry must never be late */
+		arm(&timers_[rand_() % timers_.size()],
+		    now_ + rand_() % (10000000 * tick_ns));
+		const auto next = wheel_.next_expiry();
+		EXPECT_LE(next, earliest());
+		advance(next);
+	}
+
+	/* running wheel by next expiry drains all timers */
+	while (!model_.empty()) {
+		const auto next = wheel_.next_expiry();
+		EXPECT_LE(next, earliest());
+		advance(next);
+	}
+	EXPECT_EQ(wheel_.next_expiry(), UINT_FAST64_MAX);
+}
+
+/*
+ * long_idle - timers expire correctly after advancing across many ticks
+ */
+TEST_F(wheel_test, long_idle)
+{
+	constexpr uint_fast64_t hour = 3600000000000;
+
+	arm(&timers_[0], 10 * hour);
+	arm(&timers_[1], 10 * hour + 1);
+	arm(&timers_[2], 100 * hour);
+	arm(&timers_[3], 5);
+	advance(4);
+	EXPECT_EQ(model_.size(), 4);
+	advance(10 * hour);
+	EXPECT_EQ(model_.size(), 2);
+	advance(10 * hour + 1);
+	EXPECT_EQ(model_.size(), 1);
+	advance(99 * hour);
+	EXPECT_EQ(model_.size(), 1);
+	advance(1000 * hour);
+	EXPECT_TRUE(model_.empty());
+}
+
+/*
+ * past - timers which are already due expire on next advance
+ */
+TEST_F(wheel_test, past)
+{
+	advance(1000 * tick_ns + 10);
+	arm(&timers_[0], 0);
+	arm(&timers_[1], 1000 * tick_ns + 10);
+	arm(&timers_[2], 1000 * tick_ns + 11);
+	EXPECT_EQ(wheel_.next_expiry(), 0);
+	advance(1000 * tick_ns + 10);
+	EXPECT_EQ(model_.size(), 1);
+	EXPECT_EQ(wheel_.next_expiry(), 1000 * tick_ns + 11);
+}
@@ -0,0 +1,87 @@
+/*
+ * Test victim
+ */
+#include <sys/dev/tty/output.h>
+
+/*
+ * Test suite
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+#include <sys/lib/circular_buffer.h>
+
+namespace {
+
+using queue = circular_buffer<char>;
+
+/*
+ * output - run tty_output on s and return queued characters
+ */
+std::string
+output(const std::string &s, tcflag_t oflag, size_t &column,
+    size_t capacity = 1024, size_t *consumed = nullptr)
+{
+	queue q{capacity};
+	const size_t n = tty_output(q, s.data(), s.size(), oflag, column);
+	if (consumed)
+		*consumed = n;
+	return {q.begin(), q.end()};
+}
+
+}
+
+TEST(tty_output, ordinary)
+{
+	size_t column = 0;
+	EXPECT_EQ(output("hello", OPOST | ONLCR, column), "hello");
+	EXPECT_EQ(column, 5);
+}
+
+TEST(tty_output, onlcr)
+{
+	size_t column = 0;
+	EXPECT_EQ(output("ab\ncd\n", OPOST | ONLCR, column), "ab\r\ncd\r\n");
+	EXPECT_EQ(column, 0);
+	EXPECT_EQ(output("ab\ncd", OPOST, column), "ab\ncd");
+	EXPECT_EQ(column, 2);
+}
+
+TEST(tty_output, tabs)
+{
+	size_t column = 0;
+	EXPECT_EQ(output("ab\tc", OPOST | XTABS, column), "ab      c");
+	EXPECT_EQ(column, 9);
+	EXPECT_EQ(output("\t", OPOST | XTABS, column), "       ");
+	EXPECT_EQ(column, 16);
+	EXPECT_EQ(output("a\tb", OPOST, column), "a\tb");
+	EXPECT_EQ(column, 25);
+}
+
+TEST(tty_output, no_opost)
+{
+	size_t column = 3;
+	EXPECT_EQ(output("a\tb\nc", ONLCR | XTABS, column), "a\tb\nc");
+	EXPECT_EQ(column, 1);
+}
+
+TEST(tty_output, full)
+{
+	size_t column = 0, n;
+
+	/* ordinary characters are queued up to capacity */
+	EXPECT_EQ(output("abcdef", OPOST | ONLCR, column, 4, &n), "abcd");
+	EXPECT_EQ(n, 4);
+	EXPECT_EQ(column, 4);
+
+	/* processed characters are not split */
+	column = 0;
+	EXPECT_EQ(output("abc\n", OPOST | ONLCR, column, 4, &n), "abc");
+	EXPECT_EQ(n, 3);
+	EXPECT_EQ(column, 3);
+
+	column = 0;
+	EXPECT_EQ(output("ab\t", OPOST | XTABS, column, 4, &n), "ab");
+	EXPECT_EQ(n, 2);
+	EXPECT_EQ(column, 2);
+}